@@ -7,8 +7,16 @@ set -e
 
 sqlite3_name="sqlite3"
 sqlite3_prefix="${INSTALL_DIR}/${sqlite3_name}"
+sqlite3_build="${BUILD_DIR}/sqlite-autoconf-3270200"
+sqlite3_cflags="-USQLITE_TEMP_STORE -DSQLITE_TEMP_STORE=3 -USQLITE_THREADSAFE -DSQLITE_THREADSAFE=0 -USQLITE_MAX_EXPR_DEPTH -DSQLITE_MAX_EXPR_DEPTH=0 -USQLITE_DEFAULT_MEMSTATUS -DSQLITE_DEFAULT_MEMSTATUS=0 -DSQLITE_OMIT_DECLTYPE -USQLITE_ENABLE_DBSTAT_VTAB -USQLITE_ENABLE_RTREE -USQLITE_ENABLE_FTS4 -USQLITE_ENABLE_JSON1 -USQLITE_OMIT_PROGRESS_CALLBACK -USQLITE_MAX_ATTACHED -DSQLITE_MAX_ATTACHED=125 -DSQLITE_ENABLE_DESERIALIZE -O3"
+
+# rebuild installations that were configured with different flags
+sqlite3_stamp="${sqlite3_prefix}/cflags"
+if [[ -d "${sqlite3_prefix}" ]] && [[ "$(cat "${sqlite3_stamp}" 2>/dev/null)" != "${sqlite3_cflags}" ]]; then
+    rm -rf "${sqlite3_prefix}" "${sqlite3_build}/build"
+fi
+
 if [[ ! -d "${sqlite3_prefix}" ]]; then
-    sqlite3_build="${BUILD_DIR}/sqlite-autoconf-3270200"
     if [[ ! -d "${sqlite3_build}" ]]; then
         sqlite3_tarball="${DOWNLOAD_DIR}/sqlite-autoconf-3270200.tar.gz"
         if [[ ! -f "${sqlite3_tarball}" ]]; then
@@ -23,8 +31,9 @@ if [[ ! -d "${sqlite3_prefix}" ]]; then
     mkdir -p build
     cd build
     if [[ ! -f Makefile ]]; then
-        CFLAGS="-USQLITE_TEMP_STORE -DSQLITE_TEMP_STORE=3 -USQLITE_THREADSAFE -DSQLITE_THREADSAFE=0 -USQLITE_MAX_EXPR_DEPTH -DSQLITE_MAX_EXPR_DEPTH=0 -USQLITE_DEFAULT_MEMSTATUS -DSQLITE_DEFAULT_MEMSTATUS=0 -DSQLITE_OMIT_DECLTYPE -USQLITE_ENABLE_DBSTAT_VTAB -USQLITE_ENABLE_RTREE -USQLITE_ENABLE_FTS4 -USQLITE_ENABLE_JSON1 -USQLITE_OMIT_PROGRESS_CALLBACK -USQLITE_MAX_ATTACHED -DSQLITE_MAX_ATTACHED=125 -O3" ../configure --prefix="${sqlite3_prefix}"
+        CFLAGS="${sqlite3_cflags}" ../configure --prefix="${sqlite3_prefix}"
     fi
     make -j "${THREADS}"
     make install
+    echo "${sqlite3_cflags}" > "${sqlite3_stamp}"
 fi
@@ -73,6 +73,7 @@ OF SUCH DAMAGE.
 #define GUFI_BOTTOM_UP_H
 
 #include <pthread.h>
+#include <string.h>
 
 #include "SinglyLinkedList.h"
 #include "bf.h"
@@ -98,17 +99,17 @@ OF SUCH DAMAGE.
   the user, so the imeplementation is not opaque.
 */
 struct BottomUp {
-    char name[MAXPATH];
+    char *name;            /* stored right after the user struct */
     size_t name_len;
-    struct stat st;
-    struct {
-        pthread_mutex_t mutex;
-        size_t remaining;
-    } refs;
+    size_t refs;           /* subdirectories that have not been processed yet */
     size_t subdir_count;
     size_t subnondir_count;
     struct sll subdirs;
-    struct sll subnondirs;
+    struct {
+        char *names;       /* NULL separated basenames, only filled in when tracking non-directories */
+        size_t len;
+        size_t capacity;
+    } subnondirs;
     struct BottomUp *parent;
 
     /* extra arguments available at all times */
@@ -121,6 +122,12 @@ struct BottomUp {
     } tid;
 };
 
+/* loop through the basenames of the non-directories of a struct BottomUp */
+#define BottomUp_nondir_loop(bu, name)                                      \
+    for(const char *(name) = (bu)->subnondirs.names;                        \
+        (name) && ((name) < ((bu)->subnondirs.names + (bu)->subnondirs.len)); \
+        (name) += strlen(name) + 1)
+
 /* Signature of function for processing */
 /* directories while traversing a tree */
 typedef void (*BU_f)(void *user_struct
@@ -131,12 +138,19 @@ typedef void (*BU_f)(void *user_struct
  *
  * Similar to descent, returning from the bottom upwards does
  * not happen until all subdirectories have been processed.
+ *
+ * If max_memory is not 0, once the directories that have been
+ * found but not finished take up more than max_memory bytes,
+ * threads stop handing new subdirectories to the thread pool and
+ * walk them depth first instead, until enough directories have
+ * gone back up and been freed.
  */
 int parallel_bottomup(char **root_names, size_t root_count,
                       const size_t thread_count,
                       const size_t user_struct_size,
                       BU_f descend, BU_f ascend,
                       const int track_non_dirs,
+                      const size_t max_memory,
                       void *extra_args
                       #if defined(DEBUG) && defined(PER_THREAD_STATS)
                       , struct OutputBuffers *debug_buffers
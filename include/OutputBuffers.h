@@ -95,10 +95,12 @@ size_t OutputBuffer_write(struct OutputBuffer *obuf, const void *buf, const size
 size_t OutputBuffer_flush(struct OutputBuffer *obuf, FILE *out);
 
 /* Buffers for all threads */
+struct OutputWriter;
 struct OutputBuffers {
     pthread_mutex_t *mutex;
     size_t count;
     struct OutputBuffer *buffers;
+    struct OutputWriter *writer;    /* if not NULL, full buffers are handed to this instead of being flushed */
 };
 
 struct OutputBuffers *OutputBuffers_init(struct OutputBuffers *obufs, const size_t count, const size_t capacity, pthread_mutex_t *global_mutex);
@@ -106,6 +108,44 @@ size_t OutputBuffers_flush_to_single(struct OutputBuffers *obufs, FILE *out);
 size_t OutputBuffers_flush_to_multiple(struct OutputBuffers *obufs, FILE **out);
 void OutputBuffers_destroy(struct OutputBuffers *obufs);
 
+/*
+  Dedicated writer thread
+
+  Each buffer gets a second buffer of the same size. When a
+  thread's buffer is full, OutputWriter_handoff swaps it with the
+  second buffer and queues the full one, so the thread continues
+  filling memory while the writer thread writes. The writer thread
+  gathers every queued buffer that goes to the same file into a
+  single writev. A thread only waits if its previous buffer has
+  not been written yet.
+
+  Only the writer thread writes to the files between
+  OutputWriter_start and OutputWriter_stop.
+*/
+struct OutputWriter {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t ready;          /* buffers were queued or the writer should stop */
+    pthread_cond_t done;           /* queued buffers were written */
+    struct OutputBuffers *obufs;
+    struct OutputBuffer *back;     /* second buffer of each thread */
+    int *fds;
+    int *pending;                  /* back[i] is queued or being written */
+    size_t *queue;                 /* ids of the queued buffers, in handoff order */
+    size_t queued;
+    int stop;
+    int error;                     /* errno of the first failed write */
+};
+
+/* flushes out, which must not be written to through the FILEs until OutputWriter_stop */
+struct OutputWriter *OutputWriter_start(struct OutputWriter *writer, struct OutputBuffers *obufs, FILE **out);
+
+/* called by the thread that owns buffer id */
+void OutputWriter_handoff(struct OutputWriter *writer, const size_t id);
+
+/* writes out every buffer and joins the writer thread - returns errno of the first failed write */
+int OutputWriter_stop(struct OutputWriter *writer);
+
 #ifdef __cplusplus
 }
 #endif
@@ -198,6 +198,16 @@ struct input {
    /* only used by rollup */
    int dry_run;
    size_t max_in_dir;
+
+   /* used by gufi_dir2index and gufi_trace2index */
+   int build_in_memory;
+   int write_threads;             // threads writing in-memory databases out (gufi_dir2index only)
+   size_t split_threshold;        // directories with more entries than this are processed by multiple threads
+   int incremental;               // only process directories that changed since the last run
+   size_t memory_limit;           // soft limit on memory used by tree walks and aggregation databases (0 for no limit)
+   size_t rollup_budget;          // most rows rollup may copy into pentries (0 for no planner)
+   int vacuum;                    // VACUUM databases while copying them
+   size_t index_threshold;        // index entries of databases with more rows than this (0 for no indexes)
 };
 extern struct input in;
 
@@ -290,6 +300,7 @@ struct work {
    char          osstext2[MAXXATTR];
    char          pinodec[128];
    int           suspect;  // added for bfwreaddirplus2db for suspect
+   size_t        catalog;  // added for gufi_query for the directory's catalog record
 };
 
 extern char xattrdelim[];
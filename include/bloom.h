@@ -0,0 +1,126 @@
+/*
+This file is part of GUFI, which is part of MarFS, which is released
+under the BSD license.
+
+
+Copyright (c) 2017, Los Alamos National Security (LANS), LLC
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+From Los Alamos National Security, LLC:
+LA-CC-15-039
+
+Copyright (c) 2017, Los Alamos National Security, LLC All rights reserved.
+Copyright 2017. Los Alamos National Security, LLC. This software was produced
+under U.S. Government contract DE-AC52-06NA25396 for Los Alamos National
+Laboratory (LANL), which is operated by Los Alamos National Security, LLC for
+the U.S. Department of Energy. The U.S. Government has rights to use,
+reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR LOS
+ALAMOS NATIONAL SECURITY, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR
+ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is
+modified to produce derivative works, such modified software should be
+clearly marked, so as not to confuse it with the version available from
+LANL.
+
+THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+
+
+
+#ifndef GUFI_BLOOM_H
+#define GUFI_BLOOM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * bloom filters over the names in a directory
+ *
+ * every filter has the same number of bits, so filters of different
+ * directories can be merged into the filter of a rolled up directory or
+ * of a subtree without rehashing the names
+ *
+ * filters with few bits set are stored as the sorted positions of the
+ * set bits (delta encoded varints), so a directory with a handful of
+ * names costs a few dozen bytes instead of BLOOM_BITS / 8
+ */
+#define BLOOM_BITS   ((uint32_t) 1 << 20)
+#define BLOOM_HASHES 3
+
+/* keys for extensions are the extension with this prefix, e.g. "*.h5" */
+#define BLOOM_EXT_PREFIX     "*."
+#define BLOOM_EXT_PREFIX_LEN 2
+
+struct bloom {
+    uint32_t *positions;  /* set bits while sparse - unsorted, may repeat */
+    size_t count;
+    size_t size;
+    unsigned char *bits;  /* bitmap once there are too many positions */
+};
+
+void bloom_init(struct bloom *bloom);
+
+/* add one key */
+void bloom_add(struct bloom *bloom, const char *key, const size_t len);
+
+/* add a name and, if it has one, its extension */
+void bloom_add_name(struct bloom *bloom, const char *name, const size_t len);
+
+/* add every key of a serialized filter - returns 0 on success */
+int bloom_merge(struct bloom *bloom, const void *blob, const size_t len);
+
+/* add every key of another filter */
+void bloom_union(struct bloom *bloom, const struct bloom *other);
+
+/* returns a malloc-ed buffer */
+void *bloom_serialize(struct bloom *bloom, size_t *len);
+
+/* 0 if the key was definitely not added, 1 if it might have been (or the filter is bad) */
+int bloom_may_contain(const void *blob, const size_t len, const char *key, const size_t key_len);
+
+void bloom_destroy(struct bloom *bloom);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
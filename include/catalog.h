@@ -0,0 +1,206 @@
+/*
+This file is part of GUFI, which is part of MarFS, which is released
+under the BSD license.
+
+
+Copyright (c) 2017, Los Alamos National Security (LANS), LLC
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+From Los Alamos National Security, LLC:
+LA-CC-15-039
+
+Copyright (c) 2017, Los Alamos National Security, LLC All rights reserved.
+Copyright 2017. Los Alamos National Security, LLC. This software was produced
+under U.S. Government contract DE-AC52-06NA25396 for Los Alamos National
+Laboratory (LANL), which is operated by Los Alamos National Security, LLC for
+the U.S. Department of Energy. The U.S. Government has rights to use,
+reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR LOS
+ALAMOS NATIONAL SECURITY, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR
+ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is
+modified to produce derivative works, such modified software should be
+clearly marked, so as not to confuse it with the version available from
+LANL.
+
+THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+
+
+
+#ifndef GUFI_CATALOG_H
+#define GUFI_CATALOG_H
+
+#include <pthread.h>
+#include <sqlite3.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bf.h"
+#include "dbutils.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * catalog of the directories under an index root
+ *
+ * a single file in the index root holding one fixed size record per
+ * directory with its rollupscore and the treesummary columns that are
+ * most often used to prune, so that the shape of the tree and whether
+ * or not a subtree can match a -T query can be found with one mmap
+ * instead of an opendir and an sqlite3_open_v2 per directory
+ *
+ * records are in depth first order, so the subtree of record i is
+ * records i + 1 up to (but not including) records[i].end
+ *
+ * the catalog is written by bfti -s, rollupscores are updated by
+ * rollup, and treesummary changes are applied by gufi_events2index;
+ * anything that adds or removes directories removes the catalog
+ */
+#define CATALOG       DBNAME ".catalog"
+#define CATALOG_MAGIC "GUFICAT1"
+
+struct catalog_header {
+    char     magic[8];
+    uint64_t count;        /* number of records */
+    uint64_t record_size;  /* sizeof(struct catalog_record) of the writer */
+    uint64_t names_size;   /* bytes of names after the records */
+};
+
+/* the treesummary columns kept in the catalog */
+struct catalog_tsum {
+    int64_t totsubdirs;
+    int64_t totfiles;
+    int64_t totlinks;
+    int64_t totsize;
+    int64_t minuid;
+    int64_t maxuid;
+    int64_t mingid;
+    int64_t maxgid;
+    int64_t minsize;
+    int64_t maxsize;
+    int64_t minblocks;
+    int64_t maxblocks;
+    int64_t minctime;
+    int64_t maxctime;
+    int64_t minmtime;
+    int64_t maxmtime;
+    int64_t minatime;
+    int64_t maxatime;
+    int64_t depth;
+};
+
+struct catalog_record {
+    uint64_t parent;       /* record of the parent directory - the root is its own parent */
+    uint64_t end;          /* one past the last record of this subtree */
+    uint64_t name;         /* offset of the NULL terminated directory name in the names */
+    uint32_t name_len;
+    int32_t  rollupscore;
+    int64_t  has_tsum;     /* the directory had a treesummary table */
+    struct catalog_tsum tsum;
+};
+
+/* a mapped catalog */
+struct catalog {
+    char root[MAXPATH];
+    size_t root_len;
+    int fd;
+    void *map;
+    size_t size;
+    uint64_t count;
+    struct catalog_record *records;
+    const char *names;
+};
+
+/* map <index>/CATALOG - returns 0 on success */
+int catalog_open(struct catalog *catalog, const char *index, const int writable);
+void catalog_close(struct catalog *catalog);
+
+/* remove <index>/CATALOG after the shape of the tree changed */
+int catalog_remove(const char *index);
+
+/* also remove the catalogs of every index directory above path */
+void catalog_remove_all(const char *path);
+
+/* record of a directory given relative to the index root - returns catalog->count if not found */
+uint64_t catalog_find(struct catalog *catalog, const char *path);
+
+/* record of a directory given with the index root prefix */
+uint64_t catalog_find_path(struct catalog *catalog, const char *path);
+
+/* add the change of a subtree (see gufi_events2index) to a record */
+void catalog_apply_delta(struct catalog_record *record, const struct sum *delta);
+
+/* collects records in any order during a walk and writes them sorted */
+struct catalog_entry;
+struct catalog_builder {
+    pthread_mutex_t mutex;
+    char root[MAXPATH];
+    size_t root_len;
+    struct catalog_entry *entries;
+    size_t count;
+    size_t capacity;
+};
+
+void catalog_builder_init(struct catalog_builder *builder, const char *root);
+
+/* tsum is NULL if the directory does not have a treesummary table - safe to call from multiple threads */
+int catalog_builder_add(struct catalog_builder *builder, const char *path, const int rollupscore, const struct sum *tsum);
+
+/* atomically replace <root>/CATALOG - returns 0 on success */
+int catalog_builder_write(struct catalog_builder *builder);
+void catalog_builder_destroy(struct catalog_builder *builder);
+
+/*
+ * evaluating queries against records
+ *
+ * catalog_db_init creates a treesummary table with the catalog
+ * columns and catalog_db_load replaces its single row
+ */
+int catalog_db_init(sqlite3 *db, sqlite3_stmt **load);
+int catalog_db_load(sqlite3_stmt *load, const struct catalog_record *record);
+
+/* returns 1 if every statement in sql only reads and can be answered by the catalog */
+int catalog_db_can_run(sqlite3 *db, const char *sql);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,169 @@
+/*
+This file is part of GUFI, which is part of MarFS, which is released
+under the BSD license.
+
+
+Copyright (c) 2017, Los Alamos National Security (LANS), LLC
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+From Los Alamos National Security, LLC:
+LA-CC-15-039
+
+Copyright (c) 2017, Los Alamos National Security, LLC All rights reserved.
+Copyright 2017. Los Alamos National Security, LLC. This software was produced
+under U.S. Government contract DE-AC52-06NA25396 for Los Alamos National
+Laboratory (LANL), which is operated by Los Alamos National Security, LLC for
+the U.S. Department of Energy. The U.S. Government has rights to use,
+reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR LOS
+ALAMOS NATIONAL SECURITY, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR
+ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is
+modified to produce derivative works, such modified software should be
+clearly marked, so as not to confuse it with the version available from
+LANL.
+
+THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+
+
+
+#ifndef GUFI_COLUMNS_H
+#define GUFI_COLUMNS_H
+
+#include <sqlite3.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bf.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * column sidecars
+ *
+ * a file next to db.db holding the size, uid, gid, mtime, atime, and
+ * blocks of every row of pentries as fixed width arrays, so that
+ * aggregates over those columns are tight loops over memory instead
+ * of stepping through the rows of pentries one at a time
+ *
+ * sidecars are written by gufi_dir2index and gufi_trace2index and
+ * kept up to date by rollup, unrollup, and gufi_events2index when
+ * built with -DCOLUMN_SIDECARS=On - builds without it remove them
+ * whenever pentries changes, so a sidecar is never stale
+ */
+#define COLUMNS       DBNAME ".columns"
+#define COLUMNS_MAGIC "GUFICOL1"
+
+/* the order of the arrays in the file */
+enum column {
+    COLUMN_SIZE = 0,
+    COLUMN_UID,
+    COLUMN_GID,
+    COLUMN_MTIME,
+    COLUMN_ATIME,
+    COLUMN_BLOCKS,
+    COLUMN_COUNT,
+};
+
+struct columns_header {
+    char     magic[8];
+    uint64_t rows;
+    uint64_t columns;      /* COLUMN_COUNT of the writer */
+    int64_t  rollupscore;  /* of the database when the sidecar was written */
+};
+
+/* a mapped sidecar */
+struct columns {
+    void *map;
+    size_t size;
+    uint64_t rows;
+    int rollupscore;
+    const int64_t *values[COLUMN_COUNT];
+};
+
+/* map <dir>/COLUMNS - returns 0 on success */
+int columns_open(struct columns *columns, const char *dir);
+void columns_close(struct columns *columns);
+
+/* replace <dir>/COLUMNS with the contents of <schema>.pentries - returns 0 on success */
+int columns_write(const char *dir, sqlite3 *db, const char *schema);
+
+/* remove <dir>/COLUMNS */
+int columns_remove(const char *dir);
+
+/* write the sidecar from main if built with COLUMN_SIDECARS, otherwise remove it */
+int update_columns(const char *dir, sqlite3 *db);
+
+/* returns -1 if name is not a column in the sidecar */
+int column_id(const char *name);
+
+/*
+ * aggregates over one column, optionally only of the rows whose
+ * value of filter is in [lo, hi) (filter is NULL for every row)
+ *
+ * min and max return the number of rows that were looked at, and
+ * only set *value if that is not 0
+ */
+uint64_t columns_count(const int64_t *filter, const uint64_t rows, const int64_t lo, const int64_t hi);
+int64_t  columns_sum(const int64_t *values, const int64_t *filter, const uint64_t rows, const int64_t lo, const int64_t hi);
+uint64_t columns_min(const int64_t *values, const int64_t *filter, const uint64_t rows, const int64_t lo, const int64_t hi, int64_t *value);
+uint64_t columns_max(const int64_t *values, const int64_t *filter, const uint64_t rows, const int64_t lo, const int64_t hi, int64_t *value);
+
+/*
+ * the sidecar used by the column_* SQL functions of thread id
+ *
+ * without a selected sidecar, the functions compute the same
+ * values from pentries of the database they are called from
+ */
+int columns_select(const size_t id, const char *dir);
+struct columns *columns_selected(const size_t id);
+void columns_deselect(const size_t id);
+
+/* column_count, column_sum, column_min, and column_max */
+int addcolumnfuncs(sqlite3 *db, const size_t id);
+
+/* returns 1 if every statement in sql prepares without any of the index tables */
+int columns_can_run(sqlite3 *db, const char *sql);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
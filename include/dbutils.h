@@ -94,11 +94,44 @@ sqlite3 *attachdb(const char *name, sqlite3 *db, const char *dbn, const int flag
 
 sqlite3 *detachdb(const char *name, sqlite3 *db, const char *dbn);
 
-int create_table_wrapper(const char *name, sqlite3 *db, const char *sql_name, const char *sql);
+/* name that shards are attached as while they are being merged */
+#define SHARD_ATTACH "shard"
+
+int mergeshard(const char *name, sqlite3 *db);
+
+/* table holding the rows of entries (entries is a view with COMPACT_SCHEMA) */
+#ifndef COMPACT_SCHEMA
+#define ENTRIES_TABLE "entries"
+#else
+#define ENTRIES_TABLE "entriesc"
+#endif
+
+int create_entries_indexes(const char *name, sqlite3 *db, const char *table);
 
-int set_db_pragmas(sqlite3 *db);
+/*
+ * create the secondary indexes of a directory with more than
+ * in.index_threshold entries, the name filter, and the columns
+ * sidecar of a database once all of its entries were inserted
+ */
+void index_entries(const char *dbname, sqlite3 *db, struct sum *summary);
+
+int create_table_wrapper(const char *name, sqlite3 *db, const char *sql_name, const char *sql);
 
-sqlite3 *opendb(const char *name, int flags, const int setpragmas, const int load_extensions,
+/*
+ * sets of PRAGMAs applied by opendb, chosen by
+ * what the caller is going to do with the database
+ */
+enum pragma_profile {
+    PRAGMA_NONE = 0,       /* leave the connection as it was opened */
+    PRAGMA_BUILD,          /* new index databases filled by the builders */
+    PRAGMA_QUERY_READONLY, /* index databases opened read-only */
+    PRAGMA_ROLLUP,         /* existing index databases modified in place */
+    PRAGMA_AGGREGATE,      /* output, intermediate, and aggregate databases */
+};
+
+int set_db_pragmas(sqlite3 *db, const enum pragma_profile profile);
+
+sqlite3 *opendb(const char *name, int flags, const enum pragma_profile pragmas, const int load_extensions,
                  int (*modifydb_func)(const char *name, sqlite3 *db, void *args), void *modifydb_args
                  #if defined(DEBUG) && defined(PER_THREAD_STATS)
                  , struct start_end *sqlite3_open,   struct start_end *set_pragmas
@@ -127,6 +160,8 @@ int insertdbgor(struct work *pwork, sqlite3 *db, sqlite3_stmt *res);
 
 int insertsumdb(sqlite3 *sdb, struct work *pwork,struct sum *su);
 
+int updatesumdb(sqlite3 *sdb, struct sum *su);
+
 int inserttreesumdb(const char *name, sqlite3 *sdb, struct sum *su,int rectype,int uid,int gid);
 
 int addqueryfuncs(sqlite3 *db, size_t id, size_t lvl, char *starting_dir);
@@ -135,4 +170,57 @@ size_t print_results(sqlite3_stmt *res, FILE *out, const int printpath, const in
 
 int get_rollupscore(const char *name, sqlite3 *db, int *rollupscore);
 
+/* replace the pentries table with the view and remove rolled up summaries */
+int unrollupdb(const char *name, sqlite3 *db);
+
+/*
+ * a packed directory is a rolled up directory whose subdirectories
+ * were removed from the index, leaving its database as the only copy
+ * of the subtree: pentries holds the entries of every directory keyed
+ * by pinode, and summary holds a row for every directory, named by
+ * its path relative to the packed directory
+ */
+#define PACKED_MARKER DBNAME ".packed"
+
+/* whether or not the directory in the index has the marker and is still rolled up */
+int is_packed(const char *dir);
+
+/* add the summaries of every directory under a packed directory */
+int querypackedtsdb(const char *name, struct sum *sumout, sqlite3 *db);
+
+/* recreate the directories and databases under a packed directory */
+int unpackdb(const char *name, sqlite3 *db, const int template_fd, const off_t template_size);
+
+/*
+ * bloom filters over the names (and extensions) in a directory's pentries
+ * and in its whole subtree, used by the may_contain and tree_may_contain
+ * query functions
+ *
+ * a missing filter means "might contain anything", so anything that
+ * changes names without rebuilding a filter deletes it instead
+ */
+#define NAMEFILTERS     "namefilters"
+#define NAMEFILTER_DIR  0
+#define NAMEFILTER_TREE 1
+
+struct bloom;
+
+/* add a stored filter to bloom - returns 0 if it was found */
+int namefilter_read(sqlite3 *db, const char *schema, const int which, struct bloom *bloom);
+int namefilter_write(const char *name, sqlite3 *db, const int which, struct bloom *bloom);
+void namefilter_delete(sqlite3 *db, const int which);
+
+/* build the directory's filter from pentries */
+int create_namefilter(const char *name, sqlite3 *db);
+
+/* call after changing pentries: rebuilds the filter with NAME_FILTERS, otherwise deletes it */
+int update_namefilter(const char *name, sqlite3 *db);
+
+/*
+ * remove the treesummary table (and its views) and the tree name filter
+ * of a directory whose subtree changed without them being recomputed
+ * (a missing treesummary is never used to prune)
+ */
+int drop_treesummary(const char *name, sqlite3 *db);
+
 #endif
@@ -65,9 +65,20 @@ OF SUCH DAMAGE.
 #ifndef TEMPLATE_DB_H
 #define TEMPLATE_DB_H
 
+#include <sqlite3.h>
 #include <sys/types.h>
 
+/* copy size bytes from the start of src_fd into dst_fd using the cheapest method available */
+ssize_t gufi_copyfd(int src_fd, int dst_fd, size_t size);
+
 off_t create_template(int *fd);
 int copy_template(const int src_fd, const char *dst, off_t size, uid_t uid, gid_t gid);
 
+/* build databases in memory instead of on the filesystem */
+/* (requires sqlite3 to be compiled with SQLITE_ENABLE_DESERIALIZE) */
+void *load_template_image(const int fd, const off_t size);
+sqlite3 *template_to_memdb(const void *image, const off_t size);
+int memdb_to_file(sqlite3 *db, const char *dst, uid_t uid, gid_t gid);
+int write_image(const void *image, const size_t size, const char *dst, uid_t uid, gid_t gid);
+
 #endif
@@ -67,6 +67,7 @@ OF SUCH DAMAGE.
 
 #include <dirent.h>
 #include <stdio.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 
 #include <sqlite3.h>
@@ -121,6 +122,8 @@ int sumit (struct sum *summary,struct work *pwork);
 
 int tsumit (struct sum *sumin,struct sum *smout);
 
+int summerge (struct sum *sumin,struct sum *smout);
+
 // given a possibly-multi-level path of directories (final component is
 // also a dir), create the parent dirs all the way down.
 //
@@ -128,6 +131,8 @@ int mkpath(char* path, mode_t mode, uid_t uid, gid_t gid);
 
 int dupdir(char* path, struct stat * stat);
 
+int remove_tree(const char *path);
+
 int shortpath(const char *name, char *nameout, char *endname);
 
 int printit(const char *name, const struct stat *status, char *type, char *linkname, int xattrs, char * xattr,int printing, long long pinode);
@@ -144,6 +149,25 @@ size_t descend(struct QPTPool * ctx, const size_t id,
                QPTPoolFunc_t func,
                const size_t max_level);
 
+/* lstat an entry of an open directory without re-resolving the */
+/* directory's path, requesting only the fields that GUFI stores */
+int lstat_at(const int dir_fd, const char *name, struct stat *st);
+
+#ifdef __linux__
+/* only the fields that end up in the index */
+/* (only defined when <linux/stat.h> has already been included) */
+#ifdef STATX_TYPE
+#define GUFI_STATX_MASK (STATX_TYPE  | STATX_MODE  | STATX_NLINK | \
+                         STATX_UID   | STATX_GID   | STATX_INO   | \
+                         STATX_SIZE  | STATX_BLOCKS |              \
+                         STATX_ATIME | STATX_MTIME | STATX_CTIME)
+#endif
+
+/* copy the fields of a struct statx that GUFI uses into a struct stat */
+struct statx;
+void statx_to_stat(const struct statx *stx, struct stat *st);
+#endif
+
 /* convert a mode to a human readable string */
 char * modetostr(char * str, const size_t size, const mode_t mode);
 
@@ -70,6 +70,7 @@ processed before processing the current one
 
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -98,6 +99,9 @@ struct UserArgs {
     BU_f ascend;
     int track_non_dirs;
 
+    size_t max_memory;      /* 0 for no limit */
+    size_t memory;          /* bytes held by directories that have not gone back up */
+
     #if defined(DEBUG) && defined(PER_THREAD_STATS)
     struct OutputBuffers *timestamp_buffers;
     #else
@@ -105,37 +109,18 @@ struct UserArgs {
     #endif
 };
 
-int ascend_to_top(struct QPTPool *ctx, const size_t id, void *data, void *args) {
+/* release one reference to a directory and process it if it was the last one */
+/* returns 1 if the directory went up, and its parent needs to be released */
+static int release(struct UserArgs *ua, const size_t id, struct BottomUp *bu) {
     timestamp_create_buffer(4096);
-    timestamp_start(ascend);
-
-    struct UserArgs *ua = (struct UserArgs *) args;
-
-    /* reached root */
-    if (!data) {
-        timestamp_end(ua->timestamp_buffers, id, "ascend_to_top", ascend);
-        return 0;
-    }
-
-    struct BottomUp *bu = (struct BottomUp *) data;
-
-    timestamp_start(lock_refs);
-    pthread_mutex_lock(&bu->refs.mutex);
-    timestamp_end(ua->timestamp_buffers, id, "lock_refs", lock_refs);
 
-    timestamp_start(get_remaining_refs);
-    size_t remaining = 0;
-    if (bu->refs.remaining) {
-        remaining = --bu->refs.remaining;
-    }
-    timestamp_end(ua->timestamp_buffers, id, "get_remaining_refs", get_remaining_refs);
-
-    timestamp_start(unlock_refs);
-    pthread_mutex_unlock(&bu->refs.mutex);
-    timestamp_end(ua->timestamp_buffers, id, "unlock_refs", unlock_refs);
+    /* only the last reference to be released continues upwards */
+    /* acquire-release makes the children's results visible here */
+    timestamp_start(release_ref);
+    const size_t remaining = __atomic_sub_fetch(&bu->refs, 1, __ATOMIC_ACQ_REL);
+    timestamp_end(ua->timestamp_buffers, id, "release_ref", release_ref);
 
     if (remaining) {
-        timestamp_end(ua->timestamp_buffers, id, "ascend_to_top", ascend);
         return 0;
     }
 
@@ -158,44 +143,125 @@ int ascend_to_top(struct QPTPool *ctx, const size_t id, void *data, void *args)
     /* clean up 'struct BottomUp's here, when they are */
     /* children instead of when they are the parent  */
     timestamp_start(cleanup);
+    size_t freed = bu->subnondirs.capacity;
+    sll_loop(&bu->subdirs, node) {
+        struct BottomUp *child = (struct BottomUp *) sll_node_data(node);
+        freed += ua->user_struct_size + child->name_len + 1 + sizeof(struct node);
+    }
     sll_destroy(&bu->subdirs, free);
-    sll_destroy(&bu->subnondirs, free);
-
-    /* mutex is not needed any more */
-    pthread_mutex_destroy(&bu->refs.mutex);
+    free(bu->subnondirs.names);
+    bu->subnondirs.names = NULL;
+    __atomic_sub_fetch(&ua->memory, freed, __ATOMIC_RELAXED);
     timestamp_end(ua->timestamp_buffers, id, "cleanup", cleanup);
 
-    /* always push parent to decrement their reference counters */
-    timestamp_start(enqueue_ascend);
-    QPTPool_enqueue(ctx, id, ascend_to_top, bu->parent);
-    timestamp_end(ua->timestamp_buffers, id, "enqueue_ascend", enqueue_ascend);
+    return 1;
+}
+
+int ascend_to_top(struct QPTPool *ctx, const size_t id, void *data, void *args) {
+    timestamp_create_buffer(4096);
+    timestamp_start(ascend);
+
+    struct UserArgs *ua = (struct UserArgs *) args;
+    struct BottomUp *bu = (struct BottomUp *) data;
+
+    /* reached root */
+    if (!bu) {
+        timestamp_end(ua->timestamp_buffers, id, "ascend_to_top", ascend);
+        return 0;
+    }
+
+    if (release(ua, id, bu)) {
+        /* always push parent to decrement their reference counters */
+        timestamp_start(enqueue_ascend);
+        QPTPool_enqueue(ctx, id, ascend_to_top, bu->parent);
+        timestamp_end(ua->timestamp_buffers, id, "enqueue_ascend", enqueue_ascend);
+    }
 
     timestamp_end(ua->timestamp_buffers, id, "ascend_to_top", ascend);
     return 0;
 }
 
-static struct BottomUp *track(const char *name, const size_t name_len,
-                              const size_t user_struct_size, struct sll *sll,
-                              const size_t level) {
-    struct BottomUp *copy = malloc(user_struct_size);
+/* go up from a directory in this thread, for as long as directories are complete */
+static void ascend_now(struct UserArgs *ua, const size_t id, struct BottomUp *bu) {
+    while (bu && release(ua, id, bu)) {
+        bu = bu->parent;
+    }
+}
+
+/* the name is stored right after the user struct so that it only takes as much space as it needs */
+static struct BottomUp *new_node(const char *name, const size_t name_len,
+                                 const size_t user_struct_size, const size_t level) {
+    /* zeroed so that directories that could not be opened look empty */
+    struct BottomUp *copy = calloc(1, user_struct_size + name_len + 1);
 
+    copy->name = ((char *) copy) + user_struct_size;
     memcpy(copy->name, name, name_len + 1); /* NULL terminate */
     copy->name_len = name_len;
 
     copy->level = level;
 
+    return copy;
+}
+
+static void track(const char *name, const size_t name_len,
+                  struct UserArgs *ua, struct sll *sll,
+                  const size_t level) {
+    struct BottomUp *copy = new_node(name, name_len, ua->user_struct_size, level);
+
+    __atomic_add_fetch(&ua->memory, ua->user_struct_size + name_len + 1 + sizeof(struct node), __ATOMIC_RELAXED);
+
     /* store the subdirectories without enqueuing them */
     sll_push(sll, copy);
+}
 
-    return copy;
+/* only the basename is kept since the path of the directory is known */
+static void track_nondir(struct BottomUp *bu, struct UserArgs *ua,
+                         const char *name, const size_t name_len) {
+    const size_t needed = bu->subnondirs.len + name_len + 1;
+    if (needed > bu->subnondirs.capacity) {
+        size_t capacity = bu->subnondirs.capacity?bu->subnondirs.capacity:256;
+        while (capacity < needed) {
+            capacity *= 2;
+        }
+
+        bu->subnondirs.names = realloc(bu->subnondirs.names, capacity);
+        __atomic_add_fetch(&ua->memory, capacity - bu->subnondirs.capacity, __ATOMIC_RELAXED);
+        bu->subnondirs.capacity = capacity;
+    }
+
+    memcpy(bu->subnondirs.names + bu->subnondirs.len, name, name_len + 1);
+    bu->subnondirs.len = needed;
 }
 
-int descend_to_bottom(struct QPTPool *ctx, const size_t id, void *data, void *args) {
-    timestamp_create_buffer(4096);
-    timestamp_start(descend);
+int descend_to_bottom(struct QPTPool *ctx, const size_t id, void *data, void *args);
 
-    struct UserArgs *ua = (struct UserArgs *) args;
-    struct BottomUp *bu = (struct BottomUp *) data;
+/* directories that are walked in this thread instead of being enqueued */
+struct worklist {
+    struct BottomUp **dirs;
+    size_t count;
+    size_t capacity;
+};
+
+static void worklist_push(struct worklist *walk, struct BottomUp *bu) {
+    if (walk->count == walk->capacity) {
+        walk->capacity = walk->capacity?(walk->capacity * 2):64;
+        walk->dirs = realloc(walk->dirs, walk->capacity * sizeof(struct BottomUp *));
+    }
+
+    walk->dirs[walk->count++] = bu;
+}
+
+/*
+ * read one directory and hand off its subdirectories
+ *
+ * walking is set when bu was taken from the worklist, in which case
+ * the thread goes back up directly instead of enqueuing the ascent
+ * so that directories are freed while the walk continues
+ */
+static void descend_dir(struct QPTPool *ctx, const size_t id,
+                        struct UserArgs *ua, struct BottomUp *bu,
+                        struct worklist *walk, const int walking) {
+    timestamp_create_buffer(4096);
 
     /* keep track of which thread was used to walk downwards */
     bu->tid.down = id;
@@ -204,21 +270,28 @@ int descend_to_bottom(struct QPTPool *ctx, const size_t id, void *data, void *ar
     DIR *dir = opendir(bu->name);
     timestamp_end(ua->timestamp_buffers, id, "opendir", open_dir);
 
-    if (!dir) {
-        fprintf(stderr, "Error: Could not open directory \"%s\": %s\n", bu->name, strerror(errno));
-        free(data);
-        timestamp_end(ua->timestamp_buffers, id, "descend_to_bottom", descend);
-        return 0;
-    }
-
     timestamp_start(init);
-    pthread_mutex_init(&bu->refs.mutex, NULL);
     bu->subdir_count = 0;
     bu->subnondir_count = 0;
     sll_init(&bu->subdirs);
-    sll_init(&bu->subnondirs);
+    bu->subnondirs.names = NULL;
+    bu->subnondirs.len = 0;
+    bu->subnondirs.capacity = 0;
     timestamp_end(ua->timestamp_buffers, id, "init", init);
 
+    if (!dir) {
+        fprintf(stderr, "Error: Could not open directory \"%s\": %s\n", bu->name, strerror(errno));
+
+        /* skip this directory, but let the parent continue upwards */
+        if (walking) {
+            ascend_now(ua, id, bu->parent);
+        }
+        else {
+            QPTPool_enqueue(ctx, id, ascend_to_top, bu->parent);
+        }
+        return;
+    }
+
     timestamp_start(read_dir_loop);
     const size_t next_level = bu->level + 1;
     while (1) {
@@ -238,35 +311,45 @@ int descend_to_bottom(struct QPTPool *ctx, const size_t id, void *data, void *ar
             }
         }
 
-        struct BottomUp new_work;
-        new_work.name_len = SNFORMAT_S(new_work.name, MAXPATH, 3,
-                                       bu->name, bu->name_len,
-                                       "/", (size_t) 1,
-                                       entry->d_name, name_len);
-
-        timestamp_start(lstat_entry);
-        const int rc = lstat(new_work.name, &new_work.st);
-        timestamp_end(ua->timestamp_buffers, id, "lstat", lstat_entry);
+        /* traversal only needs to know whether or not the entry is a */
+        /* directory, so only stat if the filesystem did not say */
+        int is_dir = 0;
+        #ifdef _DIRENT_HAVE_D_TYPE
+        if (entry->d_type != DT_UNKNOWN) {
+            is_dir = (entry->d_type == DT_DIR);
+        }
+        else
+        #endif
+        {
+            struct stat st;
+            timestamp_start(lstat_entry);
+            const int rc = fstatat(dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW);
+            timestamp_end(ua->timestamp_buffers, id, "lstat", lstat_entry);
+
+            if (rc != 0) {
+                fprintf(stderr, "Error: Could not stat \"%s/%s\": %s\n", bu->name, entry->d_name, strerror(errno));
+                continue;
+            }
 
-        if (rc != 0) {
-            fprintf(stderr, "Error: Could not stat \"%s\": %s\n", new_work.name, strerror(errno));
-            continue;
+            is_dir = S_ISDIR(st.st_mode);
         }
 
         timestamp_start(track_entry);
-        if (S_ISDIR(new_work.st.st_mode)) {
-            track(new_work.name, new_work.name_len,
-                  ua->user_struct_size, &bu->subdirs,
-                  next_level);
+        if (is_dir) {
+            char name[MAXPATH];
+            const size_t len = SNFORMAT_S(name, MAXPATH, 3,
+                                          bu->name, bu->name_len,
+                                          "/", (size_t) 1,
+                                          entry->d_name, name_len);
+
+            track(name, len, ua, &bu->subdirs, next_level);
 
             /* count how many subdirectories this directory has */
             bu->subdir_count++;
         }
         else {
             if (ua->track_non_dirs) {
-                track(new_work.name, new_work.name_len,
-                      ua->user_struct_size, &bu->subnondirs,
-                      next_level);
+                track_nondir(bu, ua, entry->d_name, name_len);
             }
             bu->subnondir_count++;
         }
@@ -294,31 +377,74 @@ int descend_to_bottom(struct QPTPool *ctx, const size_t id, void *data, void *ar
     timestamp_end(ua->timestamp_buffers, id, "run_user_descend_function", run_user_desc_func);
 
     /* if there are subdirectories, this directory cannot go back up just yet */
-    bu->refs.remaining = bu->subdir_count;
     if (bu->subdir_count) {
+        bu->refs = bu->subdir_count;
+
         timestamp_start(enqueue_subdirs);
-        /* have to lock to prevent subdirs from getting popped */
-        /* off before all of them have been enqueued */
-        pthread_mutex_lock(&bu->refs.mutex);
-        sll_loop(&bu->subdirs, node)  {
+        /*
+         * once the last child has been enqueued, this directory can
+         * be processed and freed at any time, so get the next node
+         * before enqueuing and do not touch bu after the last one
+         */
+        struct node *node = sll_head_node(&bu->subdirs);
+        while (node) {
+            struct node *next = sll_next_node(node);
+
             struct BottomUp *child = (struct BottomUp *) sll_node_data(node);
             child->parent = bu;
             child->extra_args = bu->extra_args;
 
             /* keep going down */
             timestamp_start(enqueue_subdir);
-            QPTPool_enqueue(ctx, id, descend_to_bottom, child);
+            if (ua->max_memory &&
+                (__atomic_load_n(&ua->memory, __ATOMIC_RELAXED) > ua->max_memory)) {
+                /* too much memory is being used - stop adding work */
+                /* and walk depth first until directories get freed */
+                worklist_push(walk, child);
+            }
+            else {
+                QPTPool_enqueue(ctx, id, descend_to_bottom, child);
+            }
             timestamp_end(ua->timestamp_buffers, id, "enqueue_subdir", enqueue_subdir);
+
+            node = next;
         }
-        pthread_mutex_unlock(&bu->refs.mutex);
         timestamp_end(ua->timestamp_buffers, id, "enqueue_subdirs", enqueue_subdirs);
     }
     else {
+        /* the only reference is the one released by ascend_to_top */
+        bu->refs = 1;
+
         /* start working upwards */
-        timestamp_start(enqueue_bottom);
-        QPTPool_enqueue(ctx, id, ascend_to_top, bu);
-        timestamp_end(ua->timestamp_buffers, id, "enqueue_bottom", enqueue_bottom);
+        if (walking) {
+            ascend_now(ua, id, bu);
+        }
+        else {
+            timestamp_start(enqueue_bottom);
+            QPTPool_enqueue(ctx, id, ascend_to_top, bu);
+            timestamp_end(ua->timestamp_buffers, id, "enqueue_bottom", enqueue_bottom);
+        }
     }
+}
+
+int descend_to_bottom(struct QPTPool *ctx, const size_t id, void *data, void *args) {
+    timestamp_create_buffer(4096);
+    timestamp_start(descend);
+
+    struct UserArgs *ua = (struct UserArgs *) args;
+
+    /* the worklist lives on the heap, so deep trees do not use up the stack */
+    struct worklist walk;
+    walk.dirs = NULL;
+    walk.count = 0;
+    walk.capacity = 0;
+
+    descend_dir(ctx, id, ua, (struct BottomUp *) data, &walk, 0);
+    while (walk.count) {
+        descend_dir(ctx, id, ua, walk.dirs[--walk.count], &walk, 1);
+    }
+
+    free(walk.dirs);
 
     timestamp_end(ua->timestamp_buffers, id, "descend_to_bottom", descend);
     return 0;
@@ -329,6 +455,7 @@ int parallel_bottomup(char **root_names, size_t root_count,
                       const size_t user_struct_size,
                       BU_f descend, BU_f ascend,
                       const int track_non_dirs,
+                      const size_t max_memory,
                       void *extra_args
                       #if defined(DEBUG) && defined(PER_THREAD_STATS)
                       , struct OutputBuffers *timestamp_buffers
@@ -347,6 +474,8 @@ int parallel_bottomup(char **root_names, size_t root_count,
     ua.descend = descend?descend:noop;
     ua.ascend = ascend?ascend:noop;
     ua.track_non_dirs = track_non_dirs;
+    ua.max_memory = max_memory;
+    ua.memory = 0;
 
     #if defined(DEBUG) && defined(PER_THREAD_STATS)
     ua.timestamp_buffers = timestamp_buffers;
@@ -371,24 +500,24 @@ int parallel_bottomup(char **root_names, size_t root_count,
 
     /* enqueue all root directories */
     timestamp_start(enqueue_roots);
-    struct BottomUp *roots = malloc(root_count * user_struct_size);
+    struct BottomUp **roots = calloc(root_count, sizeof(struct BottomUp *));
     for(size_t i = 0; i < root_count; i++) {
-        struct BottomUp *root = &roots[i];
-        root->name_len = SNPRINTF(root->name, MAXPATH, "%s", root_names[i]);
-
-        if (lstat(root->name, &root->st) != 0) {
-            fprintf(stderr, "Could not stat %s\n", root->name);
+        struct stat st;
+        if (lstat(root_names[i], &st) != 0) {
+            fprintf(stderr, "Could not stat %s\n", root_names[i]);
             continue;
         }
 
-        if (!S_ISDIR(root->st.st_mode)) {
-            fprintf(stderr, "%s is not a directory\n", root->name);
+        if (!S_ISDIR(st.st_mode)) {
+            fprintf(stderr, "%s is not a directory\n", root_names[i]);
             continue;
         }
 
+        struct BottomUp *root = new_node(root_names[i], strlen(root_names[i]), user_struct_size, 0);
+        roots[i] = root;
+
         root->parent = NULL;
         root->extra_args = extra_args;
-        root->level = 0;
 
         timestamp_start(enqueue_root);
         QPTPool_enqueue(pool, i % in.maxthreads, descend_to_bottom, root);
@@ -401,6 +530,9 @@ int parallel_bottomup(char **root_names, size_t root_count,
     timestamp_end(ua.timestamp_buffers, thread_count, "wait_for_threads", qptpool_wait);
 
     /* clean up root directories since they don't get freed during processing */
+    for(size_t i = 0; i < root_count; i++) {
+        free(roots[i]);
+    }
     free(roots);
 
     #ifdef DEBUG
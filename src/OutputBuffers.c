@@ -64,8 +64,11 @@ OF SUCH DAMAGE.
 
 #include "OutputBuffers.h"
 
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 struct OutputBuffer *OutputBuffer_init(struct OutputBuffer *obuf, const size_t capacity) {
     if (obuf) {
@@ -117,6 +120,7 @@ struct OutputBuffers *OutputBuffers_init(struct OutputBuffers *obufs, const size
 
     obufs->mutex = global_mutex;
     obufs->count = 0;
+    obufs->writer = NULL;
     if (!(obufs->buffers = malloc(count * sizeof(struct OutputBuffer)))) {
         return NULL;
     }
@@ -184,3 +188,197 @@ void OutputBuffers_destroy(struct OutputBuffers *obufs) {
         obufs->count = 0;
     }
 }
+
+/* write every iovec, continuing after partial writes - returns 0 or errno */
+static int writev_all(const int fd, struct iovec *iov, size_t iovcnt, const size_t iov_max) {
+    while (iovcnt) {
+        const ssize_t rc = writev(fd, iov, (iovcnt < iov_max)?iovcnt:iov_max);
+        if (rc < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno;
+        }
+
+        /* skip over what was written */
+        size_t written = rc;
+        while (iovcnt && (written >= iov->iov_len)) {
+            written -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+
+        if (iovcnt) {
+            iov->iov_base = (char *) iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+
+    return 0;
+}
+
+static void *OutputWriter_run(void *args) {
+    struct OutputWriter *writer = (struct OutputWriter *) args;
+    const size_t count = writer->obufs->count;
+
+    /* POSIX only guarantees 16 */
+    const long sc_iov_max = sysconf(_SC_IOV_MAX);
+    const size_t iov_max = (sc_iov_max > 0)?(size_t) sc_iov_max:16;
+
+    size_t *batch = malloc(count * sizeof(size_t));
+    char *grouped = malloc(count);
+    struct iovec *iov = malloc(count * sizeof(struct iovec));
+
+    pthread_mutex_lock(&writer->mutex);
+    while (1) {
+        while (!writer->queued && !writer->stop) {
+            pthread_cond_wait(&writer->ready, &writer->mutex);
+        }
+
+        if (!writer->queued) {
+            break;
+        }
+
+        /* take everything that has been queued so far */
+        const size_t n = writer->queued;
+        memcpy(batch, writer->queue, n * sizeof(size_t));
+        writer->queued = 0;
+        pthread_mutex_unlock(&writer->mutex);
+
+        /* one writev per file, keeping the order the buffers were handed off in */
+        memset(grouped, 0, n);
+        for(size_t i = 0; i < n; i++) {
+            if (grouped[i]) {
+                continue;
+            }
+
+            const int fd = writer->fds[batch[i]];
+            size_t iovcnt = 0;
+            for(size_t j = i; j < n; j++) {
+                if (!grouped[j] && (writer->fds[batch[j]] == fd)) {
+                    grouped[j] = 1;
+                    iov[iovcnt].iov_base = writer->back[batch[j]].buf;
+                    iov[iovcnt].iov_len  = writer->back[batch[j]].filled;
+                    iovcnt++;
+                }
+            }
+
+            const int err = writev_all(fd, iov, iovcnt, iov_max);
+            if (err && !writer->error) {
+                writer->error = err;
+            }
+        }
+
+        pthread_mutex_lock(&writer->mutex);
+        for(size_t i = 0; i < n; i++) {
+            writer->back[batch[i]].filled = 0;
+            writer->pending[batch[i]] = 0;
+        }
+        pthread_cond_broadcast(&writer->done);
+    }
+    pthread_mutex_unlock(&writer->mutex);
+
+    free(iov);
+    free(grouped);
+    free(batch);
+
+    return NULL;
+}
+
+static void OutputWriter_free(struct OutputWriter *writer) {
+    for(size_t i = 0; writer->back && (i < writer->obufs->count); i++) {
+        OutputBuffer_destroy(&writer->back[i]);
+    }
+    free(writer->back);
+    free(writer->queue);
+    free(writer->pending);
+    free(writer->fds);
+    pthread_cond_destroy(&writer->done);
+    pthread_cond_destroy(&writer->ready);
+    pthread_mutex_destroy(&writer->mutex);
+}
+
+struct OutputWriter *OutputWriter_start(struct OutputWriter *writer, struct OutputBuffers *obufs, FILE **out) {
+    if (!writer || !obufs || !out) {
+        return NULL;
+    }
+
+    memset(writer, 0, sizeof(*writer));
+    pthread_mutex_init(&writer->mutex, NULL);
+    pthread_cond_init(&writer->ready, NULL);
+    pthread_cond_init(&writer->done, NULL);
+    writer->obufs   = obufs;
+    writer->fds     = malloc(obufs->count * sizeof(int));
+    writer->pending = calloc(obufs->count, sizeof(int));
+    writer->queue   = malloc(obufs->count * sizeof(size_t));
+    writer->back    = calloc(obufs->count, sizeof(struct OutputBuffer));
+
+    for(size_t i = 0; i < obufs->count; i++) {
+        /* anything already buffered by the FILE has to come first */
+        if ((fflush(out[i]) != 0)                                                   ||
+            ((writer->fds[i] = fileno(out[i])) < 0)                                 ||
+            !OutputBuffer_init(&writer->back[i], obufs->buffers[i].capacity)) {
+            OutputWriter_free(writer);
+            return NULL;
+        }
+    }
+
+    if (pthread_create(&writer->thread, NULL, OutputWriter_run, writer) != 0) {
+        OutputWriter_free(writer);
+        return NULL;
+    }
+
+    obufs->writer = writer;
+
+    return writer;
+}
+
+void OutputWriter_handoff(struct OutputWriter *writer, const size_t id) {
+    struct OutputBuffer *front = &writer->obufs->buffers[id];
+    if (!front->filled) {
+        return;
+    }
+
+    pthread_mutex_lock(&writer->mutex);
+
+    /* the previous buffer has to be written before it can be reused */
+    while (writer->pending[id]) {
+        pthread_cond_wait(&writer->done, &writer->mutex);
+    }
+
+    /* swap the buffers instead of copying the rows */
+    struct OutputBuffer *back = &writer->back[id];
+    void *buf = back->buf;
+    const size_t capacity = back->capacity;
+    back->buf = front->buf;
+    back->capacity = front->capacity;
+    back->filled = front->filled;
+    front->buf = buf;
+    front->capacity = capacity;
+    front->filled = 0;
+
+    writer->pending[id] = 1;
+    writer->queue[writer->queued++] = id;
+    pthread_cond_signal(&writer->ready);
+
+    pthread_mutex_unlock(&writer->mutex);
+}
+
+int OutputWriter_stop(struct OutputWriter *writer) {
+    for(size_t i = 0; i < writer->obufs->count; i++) {
+        OutputWriter_handoff(writer, i);
+    }
+
+    pthread_mutex_lock(&writer->mutex);
+    writer->stop = 1;
+    pthread_cond_signal(&writer->ready);
+    pthread_mutex_unlock(&writer->mutex);
+
+    pthread_join(writer->thread, NULL);
+
+    const int error = writer->error;
+    writer->obufs->writer = NULL;
+    OutputWriter_free(writer);
+
+    return error;
+}
@@ -206,8 +206,11 @@ static void *worker_function(void *args) {
     }
 
     timestamp_start(wf_broadcast);
+    /* hold each mutex so that a thread between checking for work and waiting can't miss the broadcast */
     for(size_t i = 0; i < ctx->size; i++) {
+        pthread_mutex_lock(&ctx->data[i].mutex);
         pthread_cond_broadcast(&ctx->data[i].cv);
+        pthread_mutex_unlock(&ctx->data[i].mutex);
     }
     timestamp_end(ctx->buffers, wf_args->id, "wf_broadcast", wf_broadcast);
 
@@ -0,0 +1,323 @@
+/*
+This file is part of GUFI, which is part of MarFS, which is released
+under the BSD license.
+
+
+Copyright (c) 2017, Los Alamos National Security (LANS), LLC
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+From Los Alamos National Security, LLC:
+LA-CC-15-039
+
+Copyright (c) 2017, Los Alamos National Security, LLC All rights reserved.
+Copyright 2017. Los Alamos National Security, LLC. This software was produced
+under U.S. Government contract DE-AC52-06NA25396 for Los Alamos National
+Laboratory (LANL), which is operated by Los Alamos National Security, LLC for
+the U.S. Department of Energy. The U.S. Government has rights to use,
+reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR LOS
+ALAMOS NATIONAL SECURITY, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR
+ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is
+modified to produce derivative works, such modified software should be
+clearly marked, so as not to confuse it with the version available from
+LANL.
+
+THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef IO_URING
+#include <linux/io_uring.h>
+#include <linux/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include "batch_stat.h"
+#include "utils.h"
+
+extern int errno;
+
+size_t batch_stat_add(struct BatchStat *batch, const char *name, const size_t name_len) {
+    memcpy(batch->names[batch->count], name, name_len + 1);
+    batch->name_lens[batch->count] = name_len;
+    batch->count++;
+    return BATCH_STAT_SIZE - batch->count;
+}
+
+static void batch_stat_sync(const int dir_fd, struct BatchStat *batch) {
+    for(size_t i = 0; i < batch->count; i++) {
+        batch->rc[i] = lstat_at(dir_fd, batch->names[i], &batch->st[i])?-errno:0;
+    }
+}
+
+#ifdef IO_URING
+
+/* mapped io_uring submission and completion queues */
+struct BatchStatRing {
+    int fd;
+
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    struct io_uring_sqe *sqes;
+
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ptr;
+    size_t sq_len;
+    void *cq_ptr;
+    size_t cq_len;
+    size_t sqes_len;
+
+    /* set when the kernel rejects IORING_OP_STATX */
+    int unsupported;
+
+    struct statx stx[BATCH_STAT_SIZE];
+};
+
+struct BatchStatRing *batch_stat_ring_init(void) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    const int fd = syscall(__NR_io_uring_setup, BATCH_STAT_SIZE, &params);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct BatchStatRing *ring = calloc(1, sizeof(struct BatchStatRing));
+    if (!ring) {
+        close(fd);
+        return NULL;
+    }
+
+    ring->fd = fd;
+    ring->sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    ring->cq_len = params.cq_off.cqes  + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_len > ring->sq_len) {
+            ring->sq_len = ring->cq_len;
+        }
+        ring->cq_len = ring->sq_len;
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) {
+        close(fd);
+        free(ring);
+        return NULL;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ptr = ring->sq_ptr;
+    }
+    else {
+        ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED) {
+            munmap(ring->sq_ptr, ring->sq_len);
+            close(fd);
+            free(ring);
+            return NULL;
+        }
+    }
+
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        if (ring->cq_ptr != ring->sq_ptr) {
+            munmap(ring->cq_ptr, ring->cq_len);
+        }
+        munmap(ring->sq_ptr, ring->sq_len);
+        close(fd);
+        free(ring);
+        return NULL;
+    }
+
+    char *sq = ring->sq_ptr;
+    ring->sq_head  = (unsigned int *) (sq + params.sq_off.head);
+    ring->sq_tail  = (unsigned int *) (sq + params.sq_off.tail);
+    ring->sq_mask  = (unsigned int *) (sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned int *) (sq + params.sq_off.array);
+
+    char *cq = ring->cq_ptr;
+    ring->cq_head  = (unsigned int *) (cq + params.cq_off.head);
+    ring->cq_tail  = (unsigned int *) (cq + params.cq_off.tail);
+    ring->cq_mask  = (unsigned int *) (cq + params.cq_off.ring_mask);
+    ring->cqes     = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+    return ring;
+}
+
+void batch_stat_ring_destroy(struct BatchStatRing *ring) {
+    if (ring) {
+        munmap(ring->sqes, ring->sqes_len);
+        if (ring->cq_ptr != ring->sq_ptr) {
+            munmap(ring->cq_ptr, ring->cq_len);
+        }
+        munmap(ring->sq_ptr, ring->sq_len);
+        close(ring->fd);
+        free(ring);
+    }
+}
+
+/* process every completion that is available, returning how many there were */
+static size_t batch_stat_reap(struct BatchStatRing *ring, struct BatchStat *batch) {
+    size_t reaped = 0;
+
+    unsigned int head = __atomic_load_n(ring->cq_head, __ATOMIC_ACQUIRE);
+    const unsigned int cq_mask = *ring->cq_mask;
+    while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        const struct io_uring_cqe *cqe = &ring->cqes[head & cq_mask];
+        const size_t i = cqe->user_data;
+        batch->rc[i] = cqe->res;
+        if (cqe->res == 0) {
+            statx_to_stat(&ring->stx[i], &batch->st[i]);
+        }
+        else if (cqe->res == -EINVAL) {
+            /* the kernel has io_uring, but not IORING_OP_STATX */
+            ring->unsupported = 1;
+        }
+        head++;
+        reaped++;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+    return reaped;
+}
+
+void batch_stat(struct BatchStatRing *ring, const int dir_fd, struct BatchStat *batch) {
+    if (!ring || ring->unsupported) {
+        batch_stat_sync(dir_fd, batch);
+        return;
+    }
+
+    /* queue up all of the stats */
+    unsigned int tail = __atomic_load_n(ring->sq_tail, __ATOMIC_ACQUIRE);
+    const unsigned int sq_mask = *ring->sq_mask;
+    for(size_t i = 0; i < batch->count; i++) {
+        const unsigned int idx = tail & sq_mask;
+        struct io_uring_sqe *sqe = &ring->sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode      = IORING_OP_STATX;
+        sqe->fd          = dir_fd;
+        sqe->addr        = (unsigned long) batch->names[i];
+        sqe->len         = GUFI_STATX_MASK;
+        sqe->off         = (unsigned long) &ring->stx[i];
+        sqe->statx_flags = AT_SYMLINK_NOFOLLOW;
+        sqe->user_data   = i;
+        ring->sq_array[idx] = idx;
+        tail++;
+    }
+    __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+    /* submit everything and wait for all of the results */
+    size_t submitted = 0;
+    size_t completed = 0;
+    while (completed < batch->count) {
+        const unsigned int to_submit = batch->count - submitted;
+        const int rc = syscall(__NR_io_uring_enter, ring->fd, to_submit,
+                               batch->count - completed, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (rc < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            /* something is wrong with the ring, so stop using it */
+            ring->unsupported = 1;
+
+            /* take back the stats that the kernel did not pick up */
+            __atomic_store_n(ring->sq_tail, __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+
+            /*
+             * the stats that were submitted still point into the
+             * batch and the ring, so wait for them before returning
+             */
+            completed += batch_stat_reap(ring, batch);
+            while (completed < submitted) {
+                if ((syscall(__NR_io_uring_enter, ring->fd, 0,
+                             submitted - completed, IORING_ENTER_GETEVENTS, NULL, 0) < 0) &&
+                    (errno != EINTR) && (errno != EAGAIN) && (errno != EBUSY)) {
+                    break;
+                }
+                completed += batch_stat_reap(ring, batch);
+            }
+
+            break;
+        }
+        submitted += rc;
+
+        completed += batch_stat_reap(ring, batch);
+    }
+
+    if (ring->unsupported) {
+        /* redo the batch synchronously */
+        batch_stat_sync(dir_fd, batch);
+    }
+}
+
+#else
+
+struct BatchStatRing *batch_stat_ring_init(void) {
+    return NULL;
+}
+
+void batch_stat_ring_destroy(struct BatchStatRing *ring) {
+    (void) ring;
+}
+
+void batch_stat(struct BatchStatRing *ring, const int dir_fd, struct BatchStat *batch) {
+    (void) ring;
+    batch_stat_sync(dir_fd, batch);
+}
+
+#endif
@@ -109,7 +109,7 @@ void print_help(const char* prog_name,
       case 'P': printf("  -P                     print directories as they are encountered\n"); break;
       case 'N': printf("  -N                     print column-names (header) for DB results\n"); break;
       case 'V': printf("  -V                     print column-values (rows) for DB results\n"); break;
-      case 's': printf("  -s                     generate tree-summary table (in top-level DB)\n"); break;
+      case 's': printf("  -s                     generate tree-summary table (in every DB)\n"); break;
       case 'b': printf("  -b                     build GUFI index tree\n"); break;
       case 'a': printf("  -a                     AND/OR (SQL query combination)\n"); break;
       case 'n': printf("  -n <threads>           number of threads\n"); break;
@@ -146,6 +146,14 @@ void print_help(const char* prog_name,
       case 'j': printf("  -j                     print the information in terse form\n"); break;
       case 'X': printf("  -X                     Dry run\n"); break;
       case 'L': printf("  -L                     Highest number of files/links in a directory allowed to be rolled up\n"); break;
+      case 'M': printf("  -M                     build each database in memory and write it out with a single write\n"); break;
+      case 'q': printf("  -q <threads>           number of threads writing databases to the index, separate from -n (implies -M)\n"); break;
+      case 'k': printf("  -k <entries>           split directories with more than this many entries across threads\n"); break;
+      case 'U': printf("  -U                     incremental: only process directories that changed since the previous run\n"); break;
+      case 'l': printf("  -l <bytes>             soft limit on the memory used to track directories while walking the tree, or by each aggregation database before it is moved to disk\n"); break;
+      case 'C': printf("  -C <rows>              storage budget: most rows roll up may copy into pentries tables (enables the planner)\n"); break;
+      case 'v': printf("  -v                     VACUUM each database while copying it\n"); break;
+      case 'Q': printf("  -Q <rows>              index name, uid, size, and mtime of entries in databases with more than this many rows\n"); break;
 
       default: printf("print_help(): unrecognized option '%c'\n", (char)ch);
       }
@@ -203,6 +211,14 @@ void show_input(struct input* in, int retval) {
    printf("in.terse              = %d\n",    in->terse);
    printf("in.dry_run            = %d\n",    in->dry_run);
    printf("in.max_in_dir         = %zu\n",   in->max_in_dir);
+   printf("in.build_in_memory    = %d\n",    in->build_in_memory);
+   printf("in.write_threads      = %d\n",    in->write_threads);
+   printf("in.split_threshold    = %zu\n",   in->split_threshold);
+   printf("in.incremental        = %d\n",    in->incremental);
+   printf("in.memory_limit       = %zu\n",   in->memory_limit);
+   printf("in.rollup_budget      = %zu\n",   in->rollup_budget);
+   printf("in.vacuum             = %d\n",    in->vacuum);
+   printf("in.index_threshold    = %zu\n",   in->index_threshold);
    printf("\n");
    printf("retval                = %d\n",    retval);
    printf("\n");
@@ -260,6 +276,14 @@ int parse_cmd_line(int         argc,
    in->terse              = 0;
    in->dry_run            = 0;
    in->max_in_dir         = (size_t) -1;
+   in->build_in_memory    = 0;                      // default to building databases on the filesystem
+   in->write_threads      = 0;                      // default to writing databases from the scanning threads
+   in->split_threshold    = 0;                      // default to processing each directory with one thread
+   in->incremental        = 0;                      // default to processing every directory
+   in->memory_limit       = 0;                      // default to no limit
+   in->rollup_budget      = 0;                      // default to rolling up everything allowed
+   in->vacuum             = 0;                      // default to copying databases as they are
+   in->index_threshold    = 0;                      // default to not indexing entries
 
    int show   = 0;
    int retval = 0;
@@ -478,6 +502,38 @@ int parse_cmd_line(int         argc,
           INSTALL_UINT(in->max_in_dir, optarg, (size_t) 0, (size_t) -1, "-L");
           break;
 
+      case 'M':
+          in->build_in_memory = 1;
+          break;
+
+      case 'q':
+          INSTALL_INT(in->write_threads, optarg, 1, MAXPTHREAD, "-q");
+          break;
+
+      case 'k':
+          INSTALL_UINT(in->split_threshold, optarg, (size_t) 1, (size_t) -1, "-k");
+          break;
+
+      case 'U':
+          in->incremental = 1;
+          break;
+
+      case 'l':
+          INSTALL_UINT(in->memory_limit, optarg, (size_t) 1, (size_t) -1, "-l");
+          break;
+
+      case 'C':
+          INSTALL_UINT(in->rollup_budget, optarg, (size_t) 1, (size_t) -1, "-C");
+          break;
+
+      case 'v':
+          in->vacuum = 1;
+          break;
+
+      case 'Q':
+          INSTALL_UINT(in->index_threshold, optarg, (size_t) 1, (size_t) -1, "-Q");
+          break;
+
       case '?':
          // getopt returns '?' when there is a problem.  In this case it
          // also prints, e.g. "getopt_test: illegal option -- z"
@@ -505,6 +561,11 @@ int parse_cmd_line(int         argc,
        }
    }
 
+   // -q implies -M
+   if (in->write_threads) {
+       in->build_in_memory = 1;
+   }
+
    // only one output type is allowed
    if (in->outfile && in->outdb) {
        fprintf(stderr, "Cannot specify -o and -O at the same time\n");
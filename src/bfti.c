@@ -82,14 +82,18 @@ OF SUCH DAMAGE.
 #include <grp.h>
 
 #include "bf.h"
+#include "BottomUp.h"
+#include "bloom.h"
+#include "catalog.h"
 #include "utils.h"
 #include "dbutils.h"
-#include "QueuePerThreadPool.h"
 
 extern int errno;
 
+/* records of every directory, written to the index root with -s */
+static struct catalog_builder catalog;
+
 static int create_tables(const char *name, sqlite3 *db, void * args) {
-     printf("writetsum %d\n", in.writetsum);
     if ((create_table_wrapper(name, db, "tsql",        tsql)        != SQLITE_OK) ||
         (create_table_wrapper(name, db, "vtssqldir",   vtssqldir)   != SQLITE_OK) ||
         (create_table_wrapper(name, db, "vtssqluser",  vtssqluser)  != SQLITE_OK) ||
@@ -100,115 +104,159 @@ static int create_tables(const char *name, sqlite3 *db, void * args) {
     return 0;
 }
 
-static int processdir(struct QPTPool * ctx, const size_t id, void * data, void * args)
-{
-    struct work *passmywork = data;
-    char dbname[MAXPATH];
-    DIR *dir;
-    sqlite3 *db;
-    struct sum sumin;
-    int recs;
-    int trecs;
+/* data passed around during the walk */
+struct TreeSummary {
+    struct BottomUp data;
+    struct sum sum;         /* summary of this directory and everything below it */
 
-    (void) args;
+    #ifdef NAME_FILTERS
+    struct bloom filter;    /* names in this directory and everything below it */
+    int filter_complete;    /* every directory in the subtree had a name filter */
+    #endif
+};
 
-    if (!(dir = opendir(passmywork->name)))
-       goto out_free;
+static void print_dir(void * args timestamp_sig) {
+    struct TreeSummary * dir = (struct TreeSummary *) args;
 
-    SNPRINTF(passmywork->type,2,"%s","d");
     if (in.printing || in.printdir) {
-      passmywork->xattrs_len = 0;
-      printits(passmywork,id);
+        struct work work;
+        memset(&work, 0, sizeof(work));
+        SNFORMAT_S(work.name, MAXPATH, 1, dir->data.name, dir->data.name_len);
+        SNPRINTF(work.type, 2, "%s", "d");
+        printits(&work, dir->data.tid.down);
     }
+}
 
-    // push subdirectories into the queue
-    //descend(passmywork, dir, in.max_level);
-
-    SNPRINTF(dbname, MAXPATH, "%s/%s", passmywork->name, DBNAME);
-    if ((db=opendb(dbname, SQLITE_OPEN_READONLY, 1, 1
-                   , NULL, NULL
-                   #if defined(DEBUG) && defined(PER_THREAD_STATS)
-                   , NULL, NULL
-                   , NULL, NULL
-                   #endif
-                   ))) {
-       zeroit(&sumin);
-
-       trecs=rawquerydb(passmywork->name, 0, db, "select name from sqlite_master where type=\'table\' and name=\'treesummary\';", 0, 0, 0, id);
-       if (trecs<1) {
-         // push subdirectories into the queue
-         descend(ctx, id, passmywork, dir, processdir, in.max_level);
-         querytsdb(passmywork->name,&sumin,db,&recs,0);
-       } else {
-         querytsdb(passmywork->name,&sumin,db,&recs,1);
-       }
-
-       tsumit(&sumin,&sumout);
+/* write the treesummary table without changing the timestamps of the database file */
+static int writetsum(struct TreeSummary *dir, const char *dbpath) {
+    struct stat smt;
+    const int rc = lstat(dbpath, &smt);
+
+    sqlite3 *tdb = opendb(dbpath, SQLITE_OPEN_READWRITE, PRAGMA_ROLLUP, 1
+                          , create_tables, NULL
+                          #if defined(DEBUG) && defined(PER_THREAD_STATS)
+                          , NULL, NULL
+                          , NULL, NULL
+                          #endif
+                          );
+    if (!tdb) {
+        return -1;
     }
 
-    closedb(db);
-    closedir(dir);
+    inserttreesumdb(dir->data.name, tdb, &dir->sum, 0, 0, 0);
 
- out_free:
-    free(passmywork);
+    /* a stale subtree filter could be missing names, so remove it if it can't be replaced */
+    #ifdef NAME_FILTERS
+    if (dir->filter_complete) {
+        namefilter_write(dir->data.name, tdb, NAMEFILTER_TREE, &dir->filter);
+    }
+    else
+    #endif
+    {
+        namefilter_delete(tdb, NAMEFILTER_TREE);
+    }
+
+    closedb(tdb);
+
+    if (rc == 0) {
+        struct utimbuf utimeStruct;
+        utimeStruct.actime  = smt.st_atime;
+        utimeStruct.modtime = smt.st_mtime;
+        if (utime(dbpath, &utimeStruct) != 0) {
+            fprintf(stderr, "ERROR: utime failed with error number: %d on %s\n", errno, dbpath);
+            return -1;
+        }
+    }
 
     return 0;
 }
 
-int processinit(struct QPTPool * ctx) {
+/*
+ * the subdirectories have already been summarized, so the tree
+ * summary of this directory is its own summary plus the tree
+ * summaries of its children
+ */
+static void processdir(void * args timestamp_sig) {
+    struct TreeSummary * dir = (struct TreeSummary *) args;
 
-     struct work * mywork = malloc(sizeof(struct work));
+    zeroit(&dir->sum);
 
-     // process input directory and put it on the queue
-     SNPRINTF(mywork->name,MAXPATH,"%s",in.name);
-     lstat(in.name,&mywork->statuso);
-     if (access(in.name, R_OK | X_OK)) {
-        fprintf(stderr, "couldn't access input dir '%s': %s\n",
-                in.name, strerror(errno));
-        return 1;
-     }
-     if (!S_ISDIR(mywork->statuso.st_mode) ) {
-        fprintf(stderr,"input-dir '%s' is not a directory\n", in.name);
-        return 1;
-     }
+    #ifdef NAME_FILTERS
+    bloom_init(&dir->filter);
+    dir->filter_complete = 0;
+    #endif
 
-     /* push the path onto the queue */
-     QPTPool_enqueue(ctx, 0, processdir, mywork);
+    char dbname[MAXPATH];
+    SNPRINTF(dbname, MAXPATH, "%s/%s", dir->data.name, DBNAME);
+
+    sqlite3 *db = opendb(dbname, SQLITE_OPEN_READONLY, PRAGMA_QUERY_READONLY, 1
+                         , NULL, NULL
+                         #if defined(DEBUG) && defined(PER_THREAD_STATS)
+                         , NULL, NULL
+                         , NULL, NULL
+                         #endif
+                         );
+    const int opened = (db != NULL);
+    int rollupscore = 0;
+    if (db) {
+        struct sum sumin;
+        int recs;
+        zeroit(&sumin);
+        querytsdb(dir->data.name, &sumin, db, &recs, 0);
+        tsumit(&sumin, &dir->sum);
+
+        /* the rest of the subtree is only in this database */
+        if (is_packed(dir->data.name)) {
+            querypackedtsdb(dir->data.name, &dir->sum, db);
+        }
 
-     return 0;
-}
+        if (in.writetsum) {
+            get_rollupscore(dir->data.name, db, &rollupscore);
+        }
 
-int processfin() {
+        #ifdef NAME_FILTERS
+        if (in.writetsum) {
+            dir->filter_complete = (namefilter_read(db, "main", NAMEFILTER_DIR, &dir->filter) == 0);
+        }
+        #endif
+    }
+    closedb(db);
 
-     sqlite3 *tdb;
-     struct stat smt;
-     int rc;
-     char dbpath[MAXPATH];
-     struct utimbuf utimeStruct;
+    sll_loop(&dir->data.subdirs, node) {
+        struct TreeSummary * child = (struct TreeSummary *) sll_node_data(node);
+        if (child->sum.totsubdirs) {
+            tsumit(&child->sum, &dir->sum);
+        }
 
-     SNPRINTF(dbpath,MAXPATH,"%s/%s",in.name,DBNAME);
-     rc=1;
-     rc=lstat(dbpath,&smt);
-     if (in.writetsum) {
-        if (! (tdb = opendb(dbpath, SQLITE_OPEN_READWRITE, 1, 1
-                            , create_tables, NULL
-                            #if defined(DEBUG) && defined(PER_THREAD_STATS)
-                            , NULL, NULL
-                            , NULL, NULL
-                            #endif
-                            )))
-           return -1;
-        inserttreesumdb(in.name,tdb,&sumout,0,0,0);
-        closedb(tdb);
-     }
-     if (rc==0) {
-        utimeStruct.actime  = smt.st_atime;
-        utimeStruct.modtime = smt.st_mtime;
-        if(utime(dbpath, &utimeStruct) != 0) {
-           fprintf(stderr,"ERROR: utime failed with error number: %d on %s\n", errno,dbpath);
-           exit(1);
+        #ifdef NAME_FILTERS
+        if (dir->filter_complete) {
+            if (child->filter_complete) {
+                bloom_union(&dir->filter, &child->filter);
+            }
+            else {
+                dir->filter_complete = 0;
+            }
         }
-     }
+        bloom_destroy(&child->filter);
+        #endif
+    }
+
+    if (in.writetsum) {
+        const int written = opened && (writetsum(dir, dbname) == 0);
+        catalog_builder_add(&catalog, dir->data.name, rollupscore, written?&dir->sum:NULL);
+    }
+
+    /* the root is freed by parallel_bottomup, so keep a copy */
+    if (!dir->data.parent) {
+        sumout = dir->sum;
+
+        #ifdef NAME_FILTERS
+        bloom_destroy(&dir->filter);
+        #endif
+    }
+}
+
+int processfin() {
 
      printf("totals: \n");
      printf("totfiles %lld totlinks %lld\n",sumout.totfiles,sumout.totlinks);
@@ -254,7 +302,7 @@ int main(int argc, char *argv[])
      // but allow different fields to be filled at the command-line.
      // Callers provide the options-string for get_opt(), which will
      // control which options are parsed for each program.
-     int idx = parse_cmd_line(argc, argv, "hHPn:s", 1, "GUFI_index", &in);
+     int idx = parse_cmd_line(argc, argv, "hHPn:sl:", 1, "GUFI_index", &in);
      if (in.helped)
         sub_help();
      if (idx < 0)
@@ -273,26 +321,34 @@ int main(int argc, char *argv[])
      if (validate_inputs())
         return -1;
 
-     struct QPTPool * pool = QPTPool_init(in.maxthreads
-                                         #if defined(DEBUG) && defined(PER_THREAD_STATS)
-                                         , NULL
-                                         #endif
-         );
-     if (!pool) {
-         fprintf(stderr, "Failed to initialize thread pool\n");
-         return -1;
+     zeroit(&sumout);
+
+     if (in.writetsum) {
+         catalog_builder_init(&catalog, in.name);
      }
 
-     if (QPTPool_start(pool, NULL) != (size_t) in.maxthreads) {
-         fprintf(stderr, "Failed to start threads\n");
+     char *roots[] = {in.name};
+     if (parallel_bottomup(roots, 1,
+                           in.maxthreads,
+                           sizeof(struct TreeSummary),
+                           print_dir, processdir,
+                           0,
+                           in.memory_limit,
+                           NULL
+                           #if defined(DEBUG) && defined(PER_THREAD_STATS)
+                           , NULL
+                           #endif
+             ) != 0) {
+         if (in.writetsum) {
+             catalog_builder_destroy(&catalog);
+         }
          return -1;
      }
 
-     processinit(pool);
-
-     QPTPool_wait(pool);
-
-     QPTPool_destroy(pool);
+     if (in.writetsum) {
+         catalog_builder_write(&catalog);
+         catalog_builder_destroy(&catalog);
+     }
 
      processfin();
 
@@ -196,7 +196,7 @@ int reprocessdir(void * passv, DIR *dir)
           truncate(dbpath,0);
         }
     }
-    if (!(db = opendb(dbpath, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, 1, 1
+    if (!(db = opendb(dbpath, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, PRAGMA_BUILD, 1
                       , create_tables, NULL
                       #if defined(DEBUG) && defined(PER_THREAD_STATS)
                       , NULL, NULL
@@ -609,7 +609,7 @@ int processinit(struct QPTPool * ctx) {
        i=0;
        while (i < in.maxthreads) {
            SNPRINTF(outdbn,MAXPATH,"%s.%d",in.outdbn,i);
-           gts.outdbd[i]=opendb(outdbn, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, 1, 1
+           gts.outdbd[i]=opendb(outdbn, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, PRAGMA_BUILD, 1
                                 , create_readdirplus_tables, NULL
                                 #if defined(DEBUG) && defined(PER_THREAD_STATS)
                                 , NULL, NULL
@@ -0,0 +1,344 @@
+/*
+This file is part of GUFI, which is part of MarFS, which is released
+under the BSD license.
+
+
+Copyright (c) 2017, Los Alamos National Security (LANS), LLC
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+From Los Alamos National Security, LLC:
+LA-CC-15-039
+
+Copyright (c) 2017, Los Alamos National Security, LLC All rights reserved.
+Copyright 2017. Los Alamos National Security, LLC. This software was produced
+under U.S. Government contract DE-AC52-06NA25396 for Los Alamos National
+Laboratory (LANL), which is operated by Los Alamos National Security, LLC for
+the U.S. Department of Energy. The U.S. Government has rights to use,
+reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR LOS
+ALAMOS NATIONAL SECURITY, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR
+ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is
+modified to produce derivative works, such modified software should be
+clearly marked, so as not to confuse it with the version available from
+LANL.
+
+THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bloom.h"
+
+#define BLOOM_BYTES (BLOOM_BITS / 8)
+
+/* serialized filter types (first byte) */
+#define BLOOM_SPARSE 's'
+#define BLOOM_DENSE  'd'
+
+/*
+ * switch to the bitmap once the positions would take about as
+ * much space as the bitmap (varint deltas are ~2 bytes each here)
+ */
+#define BLOOM_DENSE_AT (BLOOM_BYTES / 2)
+
+/* FNV-1a */
+static uint64_t hash(const char *key, const size_t len) {
+    uint64_t h = 14695981039346656037ULL;
+    for(size_t i = 0; i < len; i++) {
+        h ^= (unsigned char) key[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/* double hashing: position i = h1 + i * h2 */
+static void positions_of(const char *key, const size_t len, uint32_t *pos) {
+    const uint64_t h = hash(key, len);
+    const uint32_t h1 = (uint32_t) h;
+    const uint32_t h2 = (uint32_t) (h >> 32) | 1;
+    for(uint32_t i = 0; i < BLOOM_HASHES; i++) {
+        pos[i] = (h1 + i * h2) & (BLOOM_BITS - 1);
+    }
+}
+
+void bloom_init(struct bloom *bloom) {
+    memset(bloom, 0, sizeof(*bloom));
+}
+
+static void to_dense(struct bloom *bloom) {
+    bloom->bits = calloc(BLOOM_BYTES, 1);
+    for(size_t i = 0; i < bloom->count; i++) {
+        bloom->bits[bloom->positions[i] >> 3] |= 1 << (bloom->positions[i] & 7);
+    }
+    free(bloom->positions);
+    bloom->positions = NULL;
+    bloom->count = 0;
+    bloom->size = 0;
+}
+
+static void set_bit(struct bloom *bloom, const uint32_t pos) {
+    if (bloom->bits) {
+        bloom->bits[pos >> 3] |= 1 << (pos & 7);
+        return;
+    }
+
+    if (bloom->count == bloom->size) {
+        bloom->size = bloom->size?(bloom->size * 2):64;
+        bloom->positions = realloc(bloom->positions, bloom->size * sizeof(uint32_t));
+    }
+
+    bloom->positions[bloom->count++] = pos;
+
+    if (bloom->count >= BLOOM_DENSE_AT) {
+        to_dense(bloom);
+    }
+}
+
+void bloom_add(struct bloom *bloom, const char *key, const size_t len) {
+    uint32_t pos[BLOOM_HASHES];
+    positions_of(key, len, pos);
+    for(size_t i = 0; i < BLOOM_HASHES; i++) {
+        set_bit(bloom, pos[i]);
+    }
+}
+
+void bloom_add_name(struct bloom *bloom, const char *name, const size_t len) {
+    bloom_add(bloom, name, len);
+
+    /* names that start with a dot and have no other dot do not have an extension */
+    const char *dot = NULL;
+    for(size_t i = len; i > 1; i--) {
+        if (name[i - 1] == '.') {
+            dot = name + i - 1;
+            break;
+        }
+    }
+
+    if (!dot || (dot == name + len - 1)) {
+        return;
+    }
+
+    const size_t ext_len = name + len - (dot + 1);
+    char *key = malloc(BLOOM_EXT_PREFIX_LEN + ext_len);
+    memcpy(key, BLOOM_EXT_PREFIX, BLOOM_EXT_PREFIX_LEN);
+    memcpy(key + BLOOM_EXT_PREFIX_LEN, dot + 1, ext_len);
+    bloom_add(bloom, key, BLOOM_EXT_PREFIX_LEN + ext_len);
+    free(key);
+}
+
+/* read one varint - returns the number of bytes used, or 0 if it is bad */
+static size_t read_varint(const unsigned char *buf, const size_t len, uint32_t *value) {
+    uint32_t v = 0;
+    for(size_t i = 0; (i < len) && (i < 5); i++) {
+        v |= (uint32_t) (buf[i] & 0x7f) << (7 * i);
+        if (!(buf[i] & 0x80)) {
+            *value = v;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+int bloom_merge(struct bloom *bloom, const void *blob, const size_t len) {
+    const unsigned char *buf = (const unsigned char *) blob;
+    if (!buf || !len) {
+        return -1;
+    }
+
+    if (buf[0] == BLOOM_DENSE) {
+        if (len != BLOOM_BYTES + 1) {
+            return -1;
+        }
+
+        if (!bloom->bits) {
+            to_dense(bloom);
+        }
+
+        for(size_t i = 0; i < BLOOM_BYTES; i++) {
+            bloom->bits[i] |= buf[i + 1];
+        }
+
+        return 0;
+    }
+
+    if (buf[0] != BLOOM_SPARSE) {
+        return -1;
+    }
+
+    uint32_t pos = 0;
+    size_t i = 1;
+    while (i < len) {
+        uint32_t delta = 0;
+        const size_t used = read_varint(buf + i, len - i, &delta);
+        if (!used) {
+            return -1;
+        }
+        i += used;
+        pos += delta;
+        if (pos >= BLOOM_BITS) {
+            return -1;
+        }
+        set_bit(bloom, pos);
+    }
+
+    return 0;
+}
+
+void bloom_union(struct bloom *bloom, const struct bloom *other) {
+    if (other->bits) {
+        if (!bloom->bits) {
+            to_dense(bloom);
+        }
+
+        for(size_t i = 0; i < BLOOM_BYTES; i++) {
+            bloom->bits[i] |= other->bits[i];
+        }
+
+        return;
+    }
+
+    for(size_t i = 0; i < other->count; i++) {
+        set_bit(bloom, other->positions[i]);
+    }
+}
+
+static int compare_positions(const void *lhs, const void *rhs) {
+    const uint32_t l = * (const uint32_t *) lhs;
+    const uint32_t r = * (const uint32_t *) rhs;
+    return (l > r) - (l < r);
+}
+
+void *bloom_serialize(struct bloom *bloom, size_t *len) {
+    if (bloom->bits) {
+        unsigned char *buf = malloc(BLOOM_BYTES + 1);
+        buf[0] = BLOOM_DENSE;
+        memcpy(buf + 1, bloom->bits, BLOOM_BYTES);
+        *len = BLOOM_BYTES + 1;
+        return buf;
+    }
+
+    qsort(bloom->positions, bloom->count, sizeof(uint32_t), compare_positions);
+
+    /* at most 3 bytes per position since positions are < 2^21 */
+    unsigned char *buf = malloc(1 + 3 * bloom->count);
+    size_t used = 0;
+    buf[used++] = BLOOM_SPARSE;
+
+    uint32_t prev = 0;
+    for(size_t i = 0; i < bloom->count; i++) {
+        const uint32_t pos = bloom->positions[i];
+        if (i && (pos == prev)) {
+            continue;
+        }
+
+        uint32_t delta = pos - prev;
+        while (delta >= 0x80) {
+            buf[used++] = (delta & 0x7f) | 0x80;
+            delta >>= 7;
+        }
+        buf[used++] = delta;
+
+        prev = pos;
+    }
+
+    *len = used;
+    return buf;
+}
+
+int bloom_may_contain(const void *blob, const size_t len, const char *key, const size_t key_len) {
+    const unsigned char *buf = (const unsigned char *) blob;
+    if (!buf || !len) {
+        return 1;
+    }
+
+    uint32_t pos[BLOOM_HASHES];
+    positions_of(key, key_len, pos);
+
+    if (buf[0] == BLOOM_DENSE) {
+        if (len != BLOOM_BYTES + 1) {
+            return 1;
+        }
+
+        for(size_t i = 0; i < BLOOM_HASHES; i++) {
+            if (!(buf[1 + (pos[i] >> 3)] & (1 << (pos[i] & 7)))) {
+                return 0;
+            }
+        }
+
+        return 1;
+    }
+
+    if (buf[0] != BLOOM_SPARSE) {
+        return 1;
+    }
+
+    /* look for the positions in ascending order in a single pass */
+    qsort(pos, BLOOM_HASHES, sizeof(uint32_t), compare_positions);
+
+    size_t found = 0;
+    uint32_t curr = 0;
+    size_t i = 1;
+    while ((i < len) && (found < BLOOM_HASHES)) {
+        uint32_t delta = 0;
+        const size_t used = read_varint(buf + i, len - i, &delta);
+        if (!used) {
+            return 1;
+        }
+        i += used;
+        curr += delta;
+
+        while ((found < BLOOM_HASHES) && (pos[found] == curr)) {
+            found++;
+        }
+
+        if ((found < BLOOM_HASHES) && (pos[found] < curr)) {
+            return 0;
+        }
+    }
+
+    return (found == BLOOM_HASHES);
+}
+
+void bloom_destroy(struct bloom *bloom) {
+    free(bloom->positions);
+    free(bloom->bits);
+    bloom_init(bloom);
+}
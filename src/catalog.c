@@ -0,0 +1,489 @@
+/*
+This file is part of GUFI, which is part of MarFS, which is released
+under the BSD license.
+
+
+Copyright (c) 2017, Los Alamos National Security (LANS), LLC
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+From Los Alamos National Security, LLC:
+LA-CC-15-039
+
+Copyright (c) 2017, Los Alamos National Security, LLC All rights reserved.
+Copyright 2017. Los Alamos National Security, LLC. This software was produced
+under U.S. Government contract DE-AC52-06NA25396 for Los Alamos National
+Laboratory (LANL), which is operated by Los Alamos National Security, LLC for
+the U.S. Department of Energy. The U.S. Government has rights to use,
+reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR LOS
+ALAMOS NATIONAL SECURITY, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR
+ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is
+modified to produce derivative works, such modified software should be
+clearly marked, so as not to confuse it with the version available from
+LANL.
+
+THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "catalog.h"
+
+int catalog_open(struct catalog *catalog, const char *index, const int writable) {
+    memset(catalog, 0, sizeof(*catalog));
+    catalog->fd = -1;
+
+    catalog->root_len = SNPRINTF(catalog->root, MAXPATH, "%s", index);
+    remove_trailing(catalog->root, &catalog->root_len, "/", 1);
+
+    char path[MAXPATH];
+    SNPRINTF(path, MAXPATH, "%s/" CATALOG, catalog->root);
+
+    catalog->fd = open(path, writable?O_RDWR:O_RDONLY);
+    if (catalog->fd < 0) {
+        return -1;
+    }
+
+    struct stat st;
+    if ((fstat(catalog->fd, &st) != 0) || ((size_t) st.st_size < sizeof(struct catalog_header))) {
+        catalog_close(catalog);
+        return -1;
+    }
+
+    catalog->size = st.st_size;
+    catalog->map = mmap(NULL, catalog->size, PROT_READ | (writable?PROT_WRITE:0), MAP_SHARED, catalog->fd, 0);
+    if (catalog->map == MAP_FAILED) {
+        catalog->map = NULL;
+        catalog_close(catalog);
+        return -1;
+    }
+
+    /* make sure the file was written by this version and is not truncated */
+    const struct catalog_header *header = (struct catalog_header *) catalog->map;
+    if ((memcmp(header->magic, CATALOG_MAGIC, sizeof(header->magic)) != 0) ||
+        (header->record_size != sizeof(struct catalog_record))             ||
+        (header->count == 0)                                                ||
+        (catalog->size != sizeof(*header) + header->count * sizeof(struct catalog_record) + header->names_size)) {
+        fprintf(stderr, "Ignoring bad catalog %s\n", path);
+        catalog_close(catalog);
+        return -1;
+    }
+
+    catalog->count   = header->count;
+    catalog->records = (struct catalog_record *) (header + 1);
+    catalog->names   = (const char *) (catalog->records + catalog->count);
+
+    return 0;
+}
+
+void catalog_close(struct catalog *catalog) {
+    if (catalog->map) {
+        munmap(catalog->map, catalog->size);
+    }
+    if (catalog->fd > -1) {
+        close(catalog->fd);
+    }
+    catalog->fd = -1;
+    catalog->map = NULL;
+    catalog->records = NULL;
+    catalog->count = 0;
+}
+
+int catalog_remove(const char *index) {
+    char path[MAXPATH];
+    SNPRINTF(path, MAXPATH, "%s/" CATALOG, index);
+    if ((unlink(path) != 0) && (errno != ENOENT)) {
+        fprintf(stderr, "Could not remove catalog %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+void catalog_remove_all(const char *path) {
+    char dir[MAXPATH];
+    if (!realpath(path, dir)) {
+        return;
+    }
+
+    while (1) {
+        /* stop once out of the index */
+        char dbname[MAXPATH];
+        SNPRINTF(dbname, MAXPATH, "%s/" DBNAME, dir);
+
+        struct stat st;
+        if (lstat(dbname, &st) != 0) {
+            break;
+        }
+
+        catalog_remove(dir);
+
+        char *slash = strrchr(dir, '/');
+        if (!slash || (slash == dir)) {
+            break;
+        }
+        *slash = '\0';
+    }
+}
+
+uint64_t catalog_find(struct catalog *catalog, const char *path) {
+    uint64_t curr = 0;
+    while (*path) {
+        while (*path == '/') {
+            path++;
+        }
+
+        const size_t len = strcspn(path, "/");
+        if (!len) {
+            break;
+        }
+
+        /* search the children of the current record */
+        const uint64_t end = catalog->records[curr].end;
+        uint64_t child = curr + 1;
+        while (child < end) {
+            const struct catalog_record *record = &catalog->records[child];
+            if ((record->name_len == len) && (memcmp(catalog->names + record->name, path, len) == 0)) {
+                break;
+            }
+            child = record->end;
+        }
+
+        if (child >= end) {
+            return catalog->count;
+        }
+
+        curr = child;
+        path += len;
+    }
+
+    return curr;
+}
+
+uint64_t catalog_find_path(struct catalog *catalog, const char *path) {
+    if ((strncmp(path, catalog->root, catalog->root_len) != 0) ||
+        ((path[catalog->root_len] != '/') && (path[catalog->root_len] != '\0'))) {
+        return catalog->count;
+    }
+
+    return catalog_find(catalog, path + catalog->root_len);
+}
+
+#define add(field)  dst->field += delta->field
+#define lower(field) if (delta->field < dst->field) { dst->field = delta->field; }
+#define upper(field) if (delta->field > dst->field) { dst->field = delta->field; }
+
+void catalog_apply_delta(struct catalog_record *record, const struct sum *delta) {
+    struct catalog_tsum *dst = &record->tsum;
+    add(totsubdirs);
+    add(totfiles);
+    add(totlinks);
+    add(totsize);
+    lower(minuid);    upper(maxuid);
+    lower(mingid);    upper(maxgid);
+    lower(minsize);   upper(maxsize);
+    lower(minblocks); upper(maxblocks);
+    lower(minctime);  upper(maxctime);
+    lower(minmtime);  upper(maxmtime);
+    lower(minatime);  upper(maxatime);
+}
+
+#undef add
+#undef lower
+#undef upper
+
+/* a directory found during the walk */
+struct catalog_entry {
+    char *path;           /* relative to the root */
+    int rollupscore;
+    int has_tsum;
+    struct catalog_tsum tsum;
+};
+
+void catalog_builder_init(struct catalog_builder *builder, const char *root) {
+    memset(builder, 0, sizeof(*builder));
+    pthread_mutex_init(&builder->mutex, NULL);
+    builder->root_len = SNPRINTF(builder->root, MAXPATH, "%s", root);
+    remove_trailing(builder->root, &builder->root_len, "/", 1);
+}
+
+int catalog_builder_add(struct catalog_builder *builder, const char *path, const int rollupscore, const struct sum *tsum) {
+    if (strncmp(path, builder->root, builder->root_len) != 0) {
+        return -1;
+    }
+
+    const char *rel = path + builder->root_len;
+    while (*rel == '/') {
+        rel++;
+    }
+
+    struct catalog_entry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.path = strdup(rel);
+    entry.rollupscore = rollupscore;
+    entry.has_tsum = !!tsum;
+    if (tsum) {
+        struct catalog_tsum *dst = &entry.tsum;
+        dst->totsubdirs = tsum->totsubdirs;
+        dst->totfiles   = tsum->totfiles;
+        dst->totlinks   = tsum->totlinks;
+        dst->totsize    = tsum->totsize;
+        dst->minuid     = tsum->minuid;
+        dst->maxuid     = tsum->maxuid;
+        dst->mingid     = tsum->mingid;
+        dst->maxgid     = tsum->maxgid;
+        dst->minsize    = tsum->minsize;
+        dst->maxsize    = tsum->maxsize;
+        dst->minblocks  = tsum->minblocks;
+        dst->maxblocks  = tsum->maxblocks;
+        dst->minctime   = tsum->minctime;
+        dst->maxctime   = tsum->maxctime;
+        dst->minmtime   = tsum->minmtime;
+        dst->maxmtime   = tsum->maxmtime;
+        dst->minatime   = tsum->minatime;
+        dst->maxatime   = tsum->maxatime;
+
+        /* same as inserttreesumdb */
+        for(const char *c = path; *c; c++) {
+            dst->depth += (*c == '/');
+        }
+    }
+
+    pthread_mutex_lock(&builder->mutex);
+    if (builder->count == builder->capacity) {
+        builder->capacity = builder->capacity?(builder->capacity * 2):1024;
+        builder->entries = realloc(builder->entries, builder->capacity * sizeof(struct catalog_entry));
+    }
+    builder->entries[builder->count++] = entry;
+    pthread_mutex_unlock(&builder->mutex);
+
+    return 0;
+}
+
+/*
+ * depth first order: compare paths with '/' sorting before every
+ * other character so that a subtree is never split by a sibling
+ * such as "a-b" sorting between "a" and "a/b"
+ */
+static int compare_entries(const void *lhs, const void *rhs) {
+    const unsigned char *l = (const unsigned char *) ((const struct catalog_entry *) lhs)->path;
+    const unsigned char *r = (const unsigned char *) ((const struct catalog_entry *) rhs)->path;
+    while (*l && (*l == *r)) {
+        l++;
+        r++;
+    }
+    const int lc = (*l == '/')?1:(*l?(*l + 1):0);
+    const int rc = (*r == '/')?1:(*r?(*r + 1):0);
+    return lc - rc;
+}
+
+int catalog_builder_write(struct catalog_builder *builder) {
+    if (!builder->count) {
+        return -1;
+    }
+
+    qsort(builder->entries, builder->count, sizeof(struct catalog_entry), compare_entries);
+
+    /* the root has to be first */
+    if (builder->entries[0].path[0]) {
+        fprintf(stderr, "Catalog of %s is missing the root\n", builder->root);
+        return -1;
+    }
+
+    struct catalog_record *records = calloc(builder->count, sizeof(struct catalog_record));
+    uint64_t *stack = malloc(builder->count * sizeof(uint64_t));
+    size_t depth = 0;
+
+    uint64_t names_size = 0;
+    for(size_t i = 0; i < builder->count; i++) {
+        const struct catalog_entry *entry = &builder->entries[i];
+        struct catalog_record *record = &records[i];
+
+        /* close every subtree this entry is not in */
+        while (depth) {
+            const char *top = builder->entries[stack[depth - 1]].path;
+            const size_t top_len = strlen(top);
+            if (!top_len || ((strncmp(entry->path, top, top_len) == 0) && (entry->path[top_len] == '/'))) {
+                break;
+            }
+            records[stack[--depth]].end = i;
+        }
+
+        const char *name = strrchr(entry->path, '/');
+        name = name?(name + 1):entry->path;
+
+        record->parent      = depth?stack[depth - 1]:i;
+        record->name        = names_size;
+        record->name_len    = strlen(name);
+        record->rollupscore = entry->rollupscore;
+        record->has_tsum    = entry->has_tsum;
+        record->tsum        = entry->tsum;
+
+        names_size += record->name_len + 1;
+        stack[depth++] = i;
+    }
+    while (depth) {
+        records[stack[--depth]].end = builder->count;
+    }
+    free(stack);
+
+    struct catalog_header header;
+    memcpy(header.magic, CATALOG_MAGIC, sizeof(header.magic));
+    header.count       = builder->count;
+    header.record_size = sizeof(struct catalog_record);
+    header.names_size  = names_size;
+
+    char path[MAXPATH];
+    char tmp[MAXPATH];
+    SNPRINTF(path, MAXPATH, "%s/" CATALOG, builder->root);
+    SNPRINTF(tmp,  MAXPATH, "%s.tmp", path);
+
+    int rc = -1;
+    FILE *out = fopen(tmp, "wb");
+    if (out) {
+        int good = ((fwrite(&header, sizeof(header), 1, out) == 1) &&
+                    (fwrite(records, sizeof(struct catalog_record), builder->count, out) == builder->count));
+        for(size_t i = 0; good && (i < builder->count); i++) {
+            const char *name = builder->entries[i].path + strlen(builder->entries[i].path) - records[i].name_len;
+            good = (fwrite(name, 1, records[i].name_len + 1, out) == records[i].name_len + 1);
+        }
+        good &= (fclose(out) == 0);
+
+        /* readers only ever see a complete catalog */
+        if (good && (rename(tmp, path) == 0)) {
+            rc = 0;
+        }
+        else {
+            fprintf(stderr, "Could not write catalog %s: %s\n", path, strerror(errno));
+            unlink(tmp);
+        }
+    }
+    else {
+        fprintf(stderr, "Could not create catalog %s: %s\n", tmp, strerror(errno));
+    }
+
+    free(records);
+
+    return rc;
+}
+
+void catalog_builder_destroy(struct catalog_builder *builder) {
+    for(size_t i = 0; i < builder->count; i++) {
+        free(builder->entries[i].path);
+    }
+    free(builder->entries);
+    builder->entries = NULL;
+    builder->count = 0;
+    builder->capacity = 0;
+    pthread_mutex_destroy(&builder->mutex);
+}
+
+/* rectype, uid, and gid are always 0 in the treesummary tables written by bfti */
+static const char CATALOG_DB_CREATE[] =
+    "CREATE TABLE treesummary(totsubdirs INT64, totfiles INT64, totlinks INT64, totsize INT64, "
+    "minuid INT64, maxuid INT64, mingid INT64, maxgid INT64, minsize INT64, maxsize INT64, "
+    "minblocks INT64, maxblocks INT64, minctime INT64, maxctime INT64, minmtime INT64, maxmtime INT64, "
+    "minatime INT64, maxatime INT64, depth INT64, rectype INT64, uid INT64, gid INT64);";
+
+static const char CATALOG_DB_LOAD[] =
+    "INSERT OR REPLACE INTO treesummary(rowid, totsubdirs, totfiles, totlinks, totsize, "
+    "minuid, maxuid, mingid, maxgid, minsize, maxsize, minblocks, maxblocks, "
+    "minctime, maxctime, minmtime, maxmtime, minatime, maxatime, depth, rectype, uid, gid) "
+    "VALUES (1, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, 0, 0, 0);";
+
+int catalog_db_init(sqlite3 *db, sqlite3_stmt **load) {
+    char *err = NULL;
+    if (sqlite3_exec(db, CATALOG_DB_CREATE, NULL, NULL, &err) != SQLITE_OK) {
+        fprintf(stderr, "Could not create catalog table: %s\n", err);
+        sqlite3_free(err);
+        return -1;
+    }
+
+    if (sqlite3_prepare_v2(db, CATALOG_DB_LOAD, sizeof(CATALOG_DB_LOAD), load, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Could not prepare catalog load: %s\n", sqlite3_errmsg(db));
+        return -1;
+    }
+
+    return 0;
+}
+
+int catalog_db_load(sqlite3_stmt *load, const struct catalog_record *record) {
+    const struct catalog_tsum *tsum = &record->tsum;
+    const int64_t values[] = {
+        tsum->totsubdirs, tsum->totfiles, tsum->totlinks, tsum->totsize,
+        tsum->minuid, tsum->maxuid, tsum->mingid, tsum->maxgid,
+        tsum->minsize, tsum->maxsize, tsum->minblocks, tsum->maxblocks,
+        tsum->minctime, tsum->maxctime, tsum->minmtime, tsum->maxmtime,
+        tsum->minatime, tsum->maxatime, tsum->depth,
+    };
+
+    for(size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        sqlite3_bind_int64(load, i + 1, values[i]);
+    }
+
+    const int rc = sqlite3_step(load);
+    sqlite3_reset(load);
+    return (rc == SQLITE_DONE)?0:-1;
+}
+
+int catalog_db_can_run(sqlite3 *db, const char *sql) {
+    const char *tail = sql;
+    while (tail && *tail) {
+        sqlite3_stmt *stmt = NULL;
+        if (sqlite3_prepare_v2(db, tail, -1, &stmt, &tail) != SQLITE_OK) {
+            return 0;
+        }
+
+        /* stmt is NULL for whitespace and comments */
+        const int readonly = !stmt || sqlite3_stmt_readonly(stmt);
+        sqlite3_finalize(stmt);
+        if (!readonly) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
@@ -0,0 +1,588 @@
+/*
+This file is part of GUFI, which is part of MarFS, which is released
+under the BSD license.
+
+
+Copyright (c) 2017, Los Alamos National Security (LANS), LLC
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+From Los Alamos National Security, LLC:
+LA-CC-15-039
+
+Copyright (c) 2017, Los Alamos National Security, LLC All rights reserved.
+Copyright 2017. Los Alamos National Security, LLC. This software was produced
+under U.S. Government contract DE-AC52-06NA25396 for Los Alamos National
+Laboratory (LANL), which is operated by Los Alamos National Security, LLC for
+the U.S. Department of Energy. The U.S. Government has rights to use,
+reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR LOS
+ALAMOS NATIONAL SECURITY, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR
+ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is
+modified to produce derivative works, such modified software should be
+clearly marked, so as not to confuse it with the version available from
+LANL.
+
+THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "columns.h"
+#include "utils.h"
+
+/* in the order of enum column */
+static const char *column_names[COLUMN_COUNT] = {
+    "size", "uid", "gid", "mtime", "atime", "blocks",
+};
+
+#define COLUMNS_SELECT "SELECT size, uid, gid, mtime, atime, blocks FROM %s.pentries;"
+
+int columns_open(struct columns *columns, const char *dir) {
+    memset(columns, 0, sizeof(*columns));
+
+    char path[MAXPATH];
+    SNPRINTF(path, MAXPATH, "%s/" COLUMNS, dir);
+
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || ((size_t) st.st_size < sizeof(struct columns_header))) {
+        close(fd);
+        return -1;
+    }
+
+    columns->size = st.st_size;
+    columns->map = mmap(NULL, columns->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (columns->map == MAP_FAILED) {
+        columns->map = NULL;
+        return -1;
+    }
+
+    /* make sure the file was written by this version and is not truncated */
+    const struct columns_header *header = (struct columns_header *) columns->map;
+    if ((memcmp(header->magic, COLUMNS_MAGIC, sizeof(header->magic)) != 0) ||
+        (header->columns != COLUMN_COUNT)                                   ||
+        (columns->size != sizeof(*header) + header->rows * COLUMN_COUNT * sizeof(int64_t))) {
+        fprintf(stderr, "Ignoring bad column sidecar %s\n", path);
+        columns_close(columns);
+        return -1;
+    }
+
+    columns->rows = header->rows;
+    columns->rollupscore = header->rollupscore;
+    const int64_t *values = (const int64_t *) (header + 1);
+    for(size_t i = 0; i < COLUMN_COUNT; i++) {
+        columns->values[i] = values + i * columns->rows;
+    }
+
+    return 0;
+}
+
+void columns_close(struct columns *columns) {
+    if (columns->map) {
+        munmap(columns->map, columns->size);
+    }
+    memset(columns, 0, sizeof(*columns));
+}
+
+int columns_write(const char *dir, sqlite3 *db, const char *schema) {
+    char sql[MAXSQL];
+    SNPRINTF(sql, MAXSQL, COLUMNS_SELECT, schema);
+
+    sqlite3_stmt *stmt = NULL;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Could not read columns of %s: %s\n", dir, sqlite3_errmsg(db));
+        columns_remove(dir);
+        return -1;
+    }
+
+    /* transpose the rows into one array per column */
+    int64_t *values[COLUMN_COUNT] = {NULL};
+    uint64_t rows = 0;
+    uint64_t capacity = 0;
+    int rc = SQLITE_ROW;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        if (rows == capacity) {
+            capacity = capacity?(capacity * 2):64;
+            for(size_t i = 0; i < COLUMN_COUNT; i++) {
+                values[i] = realloc(values[i], capacity * sizeof(int64_t));
+            }
+        }
+
+        for(size_t i = 0; i < COLUMN_COUNT; i++) {
+            values[i][rows] = sqlite3_column_int64(stmt, i);
+        }
+        rows++;
+    }
+    sqlite3_finalize(stmt);
+
+    if (rc != SQLITE_DONE) {
+        fprintf(stderr, "Could not read columns of %s: %s\n", dir, sqlite3_errmsg(db));
+        for(size_t i = 0; i < COLUMN_COUNT; i++) {
+            free(values[i]);
+        }
+        columns_remove(dir);
+        return -1;
+    }
+
+    /* ignore errors - the sidecar has to be rewritten if the score changes */
+    int64_t rollupscore = 0;
+    SNPRINTF(sql, MAXSQL, "SELECT rollupscore FROM %s.summary WHERE isroot == 1;", schema);
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            rollupscore = sqlite3_column_int64(stmt, 0);
+        }
+    }
+    sqlite3_finalize(stmt);
+
+    struct columns_header header;
+    memcpy(header.magic, COLUMNS_MAGIC, sizeof(header.magic));
+    header.rows        = rows;
+    header.columns     = COLUMN_COUNT;
+    header.rollupscore = rollupscore;
+
+    char path[MAXPATH];
+    char tmp[MAXPATH];
+    SNPRINTF(path, MAXPATH, "%s/" COLUMNS, dir);
+    SNPRINTF(tmp,  MAXPATH, "%s.tmp", path);
+
+    int good = 0;
+    FILE *out = fopen(tmp, "wb");
+    if (out) {
+        good = (fwrite(&header, sizeof(header), 1, out) == 1);
+        for(size_t i = 0; good && (i < COLUMN_COUNT); i++) {
+            good = (fwrite(values[i], sizeof(int64_t), rows, out) == rows);
+        }
+        good &= (fclose(out) == 0);
+
+        /* readers only ever see a complete sidecar */
+        good = good && (rename(tmp, path) == 0);
+        if (!good) {
+            fprintf(stderr, "Could not write column sidecar %s: %s\n", path, strerror(errno));
+            unlink(tmp);
+        }
+    }
+    else {
+        fprintf(stderr, "Could not create column sidecar %s: %s\n", tmp, strerror(errno));
+    }
+
+    for(size_t i = 0; i < COLUMN_COUNT; i++) {
+        free(values[i]);
+    }
+
+    if (!good) {
+        columns_remove(dir);
+        return -1;
+    }
+
+    return 0;
+}
+
+int columns_remove(const char *dir) {
+    char path[MAXPATH];
+    SNPRINTF(path, MAXPATH, "%s/" COLUMNS, dir);
+    if ((unlink(path) != 0) && (errno != ENOENT)) {
+        fprintf(stderr, "Could not remove column sidecar %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+int update_columns(const char *dir, sqlite3 *db) {
+    #ifdef COLUMN_SIDECARS
+    return columns_write(dir, db, "main");
+    #else
+    (void) db;
+    return columns_remove(dir);
+    #endif
+}
+
+int column_id(const char *name) {
+    for(int i = 0; name && (i < COLUMN_COUNT); i++) {
+        if (strcmp(name, column_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * the loops below keep LANES independent accumulators and do not
+ * branch on the values, so that the compiler can turn each of them
+ * into SIMD instructions
+ *
+ * filtering uses a single unsigned comparison: lo <= v < hi is the
+ * same as (v - lo) < (hi - lo) when both are done modulo 2^64
+ */
+#define LANES 8
+
+#define in_range(v) ((uint64_t) ((uint64_t) (v) - (uint64_t) lo) < span)
+
+uint64_t columns_count(const int64_t *filter, const uint64_t rows, const int64_t lo, const int64_t hi) {
+    if (!filter) {
+        return rows;
+    }
+
+    if (hi <= lo) {
+        return 0;
+    }
+
+    const uint64_t span = (uint64_t) hi - (uint64_t) lo;
+    uint64_t acc[LANES] = {0};
+    uint64_t i = 0;
+    for(; i + LANES <= rows; i += LANES) {
+        for(size_t j = 0; j < LANES; j++) {
+            acc[j] += in_range(filter[i + j]);
+        }
+    }
+    for(; i < rows; i++) {
+        acc[0] += in_range(filter[i]);
+    }
+
+    uint64_t count = 0;
+    for(size_t j = 0; j < LANES; j++) {
+        count += acc[j];
+    }
+    return count;
+}
+
+/* unsigned so that overflow wraps instead of being undefined */
+int64_t columns_sum(const int64_t *values, const int64_t *filter, const uint64_t rows, const int64_t lo, const int64_t hi) {
+    uint64_t acc[LANES] = {0};
+    uint64_t i = 0;
+
+    if (!filter) {
+        for(; i + LANES <= rows; i += LANES) {
+            for(size_t j = 0; j < LANES; j++) {
+                acc[j] += (uint64_t) values[i + j];
+            }
+        }
+        for(; i < rows; i++) {
+            acc[0] += (uint64_t) values[i];
+        }
+    }
+    else if (lo < hi) {
+        const uint64_t span = (uint64_t) hi - (uint64_t) lo;
+        for(; i + LANES <= rows; i += LANES) {
+            for(size_t j = 0; j < LANES; j++) {
+                acc[j] += (uint64_t) values[i + j] & -(uint64_t) in_range(filter[i + j]);
+            }
+        }
+        for(; i < rows; i++) {
+            acc[0] += (uint64_t) values[i] & -(uint64_t) in_range(filter[i]);
+        }
+    }
+
+    uint64_t sum = 0;
+    for(size_t j = 0; j < LANES; j++) {
+        sum += acc[j];
+    }
+    return (int64_t) sum;
+}
+
+/* rows that do not pass the filter are replaced with the identity of the reduction */
+#define columns_reduce(name, identity, better)                                          \
+uint64_t name(const int64_t *values, const int64_t *filter, const uint64_t rows,        \
+              const int64_t lo, const int64_t hi, int64_t *value) {                     \
+    const uint64_t count = columns_count(filter, rows, lo, hi);                         \
+    if (!count) {                                                                       \
+        return 0;                                                                       \
+    }                                                                                   \
+                                                                                        \
+    int64_t acc[LANES];                                                                 \
+    for(size_t j = 0; j < LANES; j++) {                                                 \
+        acc[j] = identity;                                                              \
+    }                                                                                   \
+                                                                                        \
+    uint64_t i = 0;                                                                     \
+    if (!filter) {                                                                      \
+        for(; i + LANES <= rows; i += LANES) {                                          \
+            for(size_t j = 0; j < LANES; j++) {                                         \
+                const int64_t v = values[i + j];                                        \
+                acc[j] = (v better acc[j])?v:acc[j];                                    \
+            }                                                                           \
+        }                                                                               \
+        for(; i < rows; i++) {                                                          \
+            acc[0] = (values[i] better acc[0])?values[i]:acc[0];                        \
+        }                                                                               \
+    }                                                                                   \
+    else {                                                                              \
+        const uint64_t span = (uint64_t) hi - (uint64_t) lo;                            \
+        for(; i + LANES <= rows; i += LANES) {                                          \
+            for(size_t j = 0; j < LANES; j++) {                                         \
+                const int64_t v = in_range(filter[i + j])?values[i + j]:(identity);     \
+                acc[j] = (v better acc[j])?v:acc[j];                                    \
+            }                                                                           \
+        }                                                                               \
+        for(; i < rows; i++) {                                                          \
+            const int64_t v = in_range(filter[i])?values[i]:(identity);                 \
+            acc[0] = (v better acc[0])?v:acc[0];                                        \
+        }                                                                               \
+    }                                                                                   \
+                                                                                        \
+    *value = acc[0];                                                                    \
+    for(size_t j = 1; j < LANES; j++) {                                                 \
+        *value = (acc[j] better *value)?acc[j]:*value;                                  \
+    }                                                                                   \
+                                                                                        \
+    return count;                                                                       \
+}
+
+columns_reduce(columns_min, INT64_MAX, <)
+columns_reduce(columns_max, INT64_MIN, >)
+
+#undef columns_reduce
+#undef in_range
+
+static struct columns selected[MAXPTHREAD];
+
+int columns_select(const size_t id, const char *dir) {
+    columns_deselect(id);
+    return columns_open(&selected[id], dir);
+}
+
+struct columns *columns_selected(const size_t id) {
+    return selected[id].map?&selected[id]:NULL;
+}
+
+void columns_deselect(const size_t id) {
+    columns_close(&selected[id]);
+}
+
+/* what the SQL functions compute */
+enum column_func {
+    FUNC_COUNT,
+    FUNC_SUM,
+    FUNC_MIN,
+    FUNC_MAX,
+};
+
+static const char *func_sql[] = {
+    "COUNT(*)", "COALESCE(SUM(%s), 0)", "MIN(%s)", "MAX(%s)",
+};
+
+/*
+ * column_count([filter, lo, hi])
+ * column_sum(column[, filter, lo, hi])
+ * column_min(column[, filter, lo, hi])
+ * column_max(column[, filter, lo, hi])
+ *
+ * rows are only used if lo <= filter < hi - a NULL lo or hi is unbounded
+ */
+static void column_aggregate(sqlite3_context *context, const enum column_func func,
+                             int argc, sqlite3_value **argv) {
+    const size_t id = (size_t) (uintptr_t) sqlite3_user_data(context);
+
+    /* every function except column_count starts with the column to aggregate */
+    int arg = 0;
+    int col = -1;
+    if (func != FUNC_COUNT) {
+        if (argc < 1) {
+            sqlite3_result_error(context, "missing column", -1);
+            return;
+        }
+
+        if ((col = column_id((const char *) sqlite3_value_text(argv[0]))) < 0) {
+            sqlite3_result_error(context, "not a column in the sidecar", -1);
+            return;
+        }
+
+        arg++;
+    }
+
+    const int filtered = ((argc - arg) == 3);
+    if (!filtered && (argc != arg)) {
+        sqlite3_result_error(context, "wrong number of arguments", -1);
+        return;
+    }
+
+    int filter = -1;
+    int64_t lo = INT64_MIN;
+    int64_t hi = INT64_MAX;
+    if (filtered) {
+        if ((filter = column_id((const char *) sqlite3_value_text(argv[arg]))) < 0) {
+            sqlite3_result_error(context, "not a column in the sidecar", -1);
+            return;
+        }
+
+        if (sqlite3_value_type(argv[arg + 1]) != SQLITE_NULL) {
+            lo = sqlite3_value_int64(argv[arg + 1]);
+        }
+
+        if (sqlite3_value_type(argv[arg + 2]) != SQLITE_NULL) {
+            hi = sqlite3_value_int64(argv[arg + 2]);
+        }
+    }
+
+    struct columns *columns = columns_selected(id);
+    if (columns) {
+        const int64_t *values = (col > -1)?columns->values[col]:NULL;
+        const int64_t *f = filtered?columns->values[filter]:NULL;
+        int64_t value = 0;
+        switch (func) {
+            case FUNC_COUNT:
+                sqlite3_result_int64(context, columns_count(f, columns->rows, lo, hi));
+                break;
+            case FUNC_SUM:
+                sqlite3_result_int64(context, columns_sum(values, f, columns->rows, lo, hi));
+                break;
+            case FUNC_MIN:
+                if (columns_min(values, f, columns->rows, lo, hi, &value)) {
+                    sqlite3_result_int64(context, value);
+                }
+                else {
+                    sqlite3_result_null(context);
+                }
+                break;
+            case FUNC_MAX:
+                if (columns_max(values, f, columns->rows, lo, hi, &value)) {
+                    sqlite3_result_int64(context, value);
+                }
+                else {
+                    sqlite3_result_null(context);
+                }
+                break;
+        }
+        return;
+    }
+
+    /* no sidecar, so compute the same value from pentries */
+    char agg[MAXSQL];
+    SNPRINTF(agg, MAXSQL, func_sql[func], (col > -1)?column_names[col]:"");
+
+    char sql[MAXSQL];
+    if (filtered) {
+        SNPRINTF(sql, MAXSQL, "SELECT %s FROM pentries WHERE (%s >= ?) AND (%s < ?);",
+                 agg, column_names[filter], column_names[filter]);
+    }
+    else {
+        SNPRINTF(sql, MAXSQL, "SELECT %s FROM pentries;", agg);
+    }
+
+    sqlite3 *db = sqlite3_context_db_handle(context);
+    sqlite3_stmt *stmt = NULL;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+        sqlite3_result_error(context, sqlite3_errmsg(db), -1);
+        return;
+    }
+
+    if (filtered) {
+        sqlite3_bind_int64(stmt, 1, lo);
+        sqlite3_bind_int64(stmt, 2, hi);
+    }
+
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        sqlite3_result_value(context, sqlite3_column_value(stmt, 0));
+    }
+    else {
+        sqlite3_result_error(context, sqlite3_errmsg(db), -1);
+    }
+    sqlite3_finalize(stmt);
+}
+
+static void column_count(sqlite3_context *context, int argc, sqlite3_value **argv) {
+    column_aggregate(context, FUNC_COUNT, argc, argv);
+}
+
+static void column_sum(sqlite3_context *context, int argc, sqlite3_value **argv) {
+    column_aggregate(context, FUNC_SUM, argc, argv);
+}
+
+static void column_min(sqlite3_context *context, int argc, sqlite3_value **argv) {
+    column_aggregate(context, FUNC_MIN, argc, argv);
+}
+
+static void column_max(sqlite3_context *context, int argc, sqlite3_value **argv) {
+    column_aggregate(context, FUNC_MAX, argc, argv);
+}
+
+int addcolumnfuncs(sqlite3 *db, const size_t id) {
+    return ((sqlite3_create_function(db, "column_count", -1, SQLITE_UTF8, (void *) (uintptr_t) id, &column_count, NULL, NULL) == SQLITE_OK) &&
+            (sqlite3_create_function(db, "column_sum",   -1, SQLITE_UTF8, (void *) (uintptr_t) id, &column_sum,   NULL, NULL) == SQLITE_OK) &&
+            (sqlite3_create_function(db, "column_min",   -1, SQLITE_UTF8, (void *) (uintptr_t) id, &column_min,   NULL, NULL) == SQLITE_OK) &&
+            (sqlite3_create_function(db, "column_max",   -1, SQLITE_UTF8, (void *) (uintptr_t) id, &column_max,   NULL, NULL) == SQLITE_OK))?0:1;
+}
+
+/* reading sqlite_master or running a pragma depends on the database, so they are not allowed */
+static int index_independent(void *args, int action, const char *arg1, const char *arg2,
+                             const char *schema, const char *trigger) {
+    (void) args; (void) arg2; (void) schema; (void) trigger;
+
+    if (action == SQLITE_PRAGMA) {
+        return SQLITE_DENY;
+    }
+
+    if ((action == SQLITE_READ) && arg1 && (strncmp(arg1, "sqlite_", 7) == 0)) {
+        return SQLITE_DENY;
+    }
+
+    return SQLITE_OK;
+}
+
+int columns_can_run(sqlite3 *db, const char *sql) {
+    sqlite3_set_authorizer(db, index_independent, NULL);
+
+    int can_run = 1;
+    const char *curr = sql;
+    while (can_run && curr && *curr) {
+        sqlite3_stmt *stmt = NULL;
+        const char *tail = NULL;
+        if (sqlite3_prepare_v2(db, curr, -1, &stmt, &tail) != SQLITE_OK) {
+            can_run = 0;
+        }
+        sqlite3_finalize(stmt);
+        curr = tail;
+    }
+
+    sqlite3_set_authorizer(db, NULL, NULL);
+
+    return can_run;
+}
@@ -66,25 +66,65 @@ OF SUCH DAMAGE.
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #include <pwd.h>
 #include <grp.h>
 #include "pcre.h"
 
+#include "bloom.h"
+#include "columns.h"
 #include "config.h"
 #include "dbutils.h"
+#include "gufi_vfs.h"
+#include "template_db.h"
+#include "utils.h"
 
 extern int errno;
 
-static const char GUFI_SQLITE_VFS[] = "unix-none";
+static const char GUFI_SQLITE_VFS[] = GUFI_SQLITE_BASE_VFS;
 
 char *rsql = // "DROP TABLE IF EXISTS readdirplus;"
             "CREATE TABLE readdirplus(path TEXT, type TEXT, inode INT64 PRIMARY KEY, pinode INT64, suspect INT64);";
 
 char *rsqli = "INSERT INTO readdirplus VALUES (@path,@type,@inode,@pinode,@suspect);";
 
+#ifndef COMPACT_SCHEMA
 char *esql = // "DROP TABLE IF EXISTS entries;"
             "CREATE TABLE entries(id INTEGER PRIMARY KEY, name TEXT, type TEXT, inode INT64, mode INT64, nlink INT64, uid INT64, gid INT64, size INT64, blksize INT64, blocks INT64, atime INT64, mtime INT64, ctime INT64, linkname TEXT, xattrs BLOB, crtime INT64, ossint1 INT64, ossint2 INT64, ossint3 INT64, ossint4 INT64, osstext1 TEXT, osstext2 TEXT);";
+#else
+/*
+ * entries is a view with the same columns as the entries table over:
+ *     entriesc   - one row per entry, with type stored as a small integer
+ *     entriesext - xattrs and OSS columns, only for entries that have them
+ *
+ * each table costs at least one page per database, so type is
+ * decoded in the view instead of through its own lookup table
+ *
+ * inserts into and deletes from entries go through triggers,
+ * so code that writes to entries does not need to change
+ */
+char *esql =
+            "CREATE TABLE entriesc(id INTEGER PRIMARY KEY, name TEXT, type INT64, inode INT64, mode INT64, nlink INT64, uid INT64, gid INT64, size INT64, blksize INT64, blocks INT64, atime INT64, mtime INT64, ctime INT64, linkname TEXT, crtime INT64);"
+            "CREATE TABLE entriesext(id INTEGER PRIMARY KEY, xattrs BLOB, ossint1 INT64, ossint2 INT64, ossint3 INT64, ossint4 INT64, osstext1 TEXT, osstext2 TEXT);"
+            "CREATE VIEW entries AS SELECT c.id AS id, c.name AS name, CASE c.type WHEN 0 THEN 'f' WHEN 1 THEN 'd' WHEN 2 THEN 'l' ELSE c.type END AS type, "
+                "c.inode AS inode, c.mode AS mode, c.nlink AS nlink, c.uid AS uid, c.gid AS gid, c.size AS size, c.blksize AS blksize, c.blocks AS blocks, c.atime AS atime, c.mtime AS mtime, c.ctime AS ctime, c.linkname AS linkname, "
+                "IFNULL(x.xattrs, X'') AS xattrs, c.crtime AS crtime, "
+                "IFNULL(x.ossint1, 0) AS ossint1, IFNULL(x.ossint2, 0) AS ossint2, IFNULL(x.ossint3, 0) AS ossint3, IFNULL(x.ossint4, 0) AS ossint4, IFNULL(x.osstext1, '') AS osstext1, IFNULL(x.osstext2, '') AS osstext2 "
+                "FROM entriesc AS c LEFT JOIN entriesext AS x ON x.id == c.id;"
+            "CREATE TRIGGER entriesinsert INSTEAD OF INSERT ON entries BEGIN "
+                "INSERT INTO entriesc VALUES (NEW.id, NEW.name, CASE NEW.type WHEN 'f' THEN 0 WHEN 'd' THEN 1 WHEN 'l' THEN 2 ELSE NEW.type END, "
+                    "NEW.inode, NEW.mode, NEW.nlink, NEW.uid, NEW.gid, NEW.size, NEW.blksize, NEW.blocks, NEW.atime, NEW.mtime, NEW.ctime, NEW.linkname, NEW.crtime);"
+                "INSERT INTO entriesext SELECT last_insert_rowid(), NEW.xattrs, NEW.ossint1, NEW.ossint2, NEW.ossint3, NEW.ossint4, NEW.osstext1, NEW.osstext2 "
+                    "WHERE LENGTH(NEW.xattrs) > 0 OR "
+                          "IFNULL(NEW.ossint1, 0) <> 0 OR IFNULL(NEW.ossint2, 0) <> 0 OR IFNULL(NEW.ossint3, 0) <> 0 OR IFNULL(NEW.ossint4, 0) <> 0 OR "
+                          "IFNULL(NEW.osstext1, '') <> '' OR IFNULL(NEW.osstext2, '') <> '';"
+            "END;"
+            "CREATE TRIGGER entriesdelete INSTEAD OF DELETE ON entries BEGIN "
+                "DELETE FROM entriesext WHERE id == OLD.id;"
+                "DELETE FROM entriesc WHERE id == OLD.id;"
+            "END;";
+#endif
 
 char *esqli = "INSERT INTO entries VALUES (NULL,@name,@type,@inode,@mode,@nlink,@uid,@gid,@size,@blksize,@blocks,@atime,@mtime,@ctime,@linkname,@xattrs,@crtime,@ossint1,@ossint2,@ossint3,@ossint4,@osstext1,@osstext2);";
 
@@ -119,7 +159,10 @@ sqlite3 *attachdb(const char *name, sqlite3 *db, const char *dbn, const int flag
 {
   char attach[MAXSQL];
   if (flags & SQLITE_OPEN_READONLY) {
-      if (!sqlite3_snprintf(MAXSQL, attach, "ATTACH 'file:%q?mode=ro' AS %Q", name, dbn)) {
+      const char *fmt = (gufi_vfs_init() == SQLITE_OK)?
+          "ATTACH 'file:%q?mode=ro&vfs=" GUFI_SQLITE_RO_VFS "' AS %Q":
+          "ATTACH 'file:%q?mode=ro' AS %Q";
+      if (!sqlite3_snprintf(MAXSQL, attach, fmt, name, dbn)) {
           fprintf(stderr, "Cannot create ATTACH command\n");
           return NULL;
       }
@@ -155,57 +198,130 @@ sqlite3 *detachdb(const char *name, sqlite3 *db, const char *dbn)
   return db;
 }
 
-int create_table_wrapper(const char *name, sqlite3 *db, const char *sql_name, const char *sql) {
+/* copy the entries of a separately built database into db */
+int mergeshard(const char *name, sqlite3 *db)
+{
+  if (!attachdb(name, db, SHARD_ATTACH, SQLITE_OPEN_READWRITE)) {
+      return 1;
+  }
+
+  char *err_msg = NULL;
+  /* let the ids be reassigned */
+  const int rc = sqlite3_exec(db, "INSERT INTO entries SELECT NULL, name, type, inode, mode, nlink, uid, gid, size, blksize, blocks, atime, mtime, ctime, linkname, xattrs, crtime, ossint1, ossint2, ossint3, ossint4, osstext1, osstext2 FROM " SHARD_ATTACH ".entries;", NULL, NULL, &err_msg);
+  if (rc != SQLITE_OK) {
+      fprintf(stderr, "Cannot copy entries from %s: %s\n", name, err_msg);
+      sqlite3_free(err_msg);
+  }
+
+  if (!detachdb(name, db, SHARD_ATTACH)) {
+      return 1;
+  }
+
+  return (rc != SQLITE_OK);
+}
+
+/*
+ * secondary indexes on the columns most queries filter on
+ *
+ * uid and mtime are paired with size so that sums of sizes by
+ * owner or by age are answered from the index alone
+ *
+ * name LIKE only uses the index with PRAGMA case_sensitive_like = ON,
+ * but name GLOB and name == always can
+ */
+static const char ENTRIES_INDEXES[] =
+    "CREATE INDEX IF NOT EXISTS %s_name  ON %s(name);"
+    "CREATE INDEX IF NOT EXISTS %s_uid   ON %s(uid, size);"
+    "CREATE INDEX IF NOT EXISTS %s_mtime ON %s(mtime, size);"
+    "CREATE INDEX IF NOT EXISTS %s_size  ON %s(size);";
+
+/* call after bulk inserts so that the inserts don't have to update the indexes */
+int create_entries_indexes(const char *name, sqlite3 *db, const char *table) {
+    char sql[MAXSQL];
+    SNPRINTF(sql, MAXSQL, ENTRIES_INDEXES,
+             table, table, table, table,
+             table, table, table, table);
+
     char *err_msg = NULL;
     const int rc = sqlite3_exec(db, sql, NULL, NULL, &err_msg);
     if (rc != SQLITE_OK) {
-        fprintf(stderr, "%s:%d SQL error while executing '%s' on %s: '%s' (%d)\n",
-                __FILE__, __LINE__, sql_name, name, err_msg, rc);
+        fprintf(stderr, "Could not index %s in %s: %s\n", table, name, err_msg);
         sqlite3_free(err_msg);
     }
-    return rc;
-}
 
-int set_db_pragmas(sqlite3 *db) {
-    int rc = 0;
+    return (rc != SQLITE_OK);
+}
 
-    // try to turn sychronization off
-    if (sqlite3_exec(db, "PRAGMA synchronous = OFF", NULL, NULL, NULL) != SQLITE_OK) {
-        fprintf(stderr, "Could not turn off synchronization\n");
-        rc = 1;
+/* index the entries of a directory once all of them have been inserted */
+void index_entries(const char *dbname, sqlite3 *db, struct sum *summary) {
+    /* only directories with many entries get secondary indexes */
+    if (in.index_threshold &&
+        ((size_t) (summary->totfiles + summary->totlinks) > in.index_threshold)) {
+        /* ignore errors */
+        create_entries_indexes(dbname, db, ENTRIES_TABLE);
     }
 
-    // try to turn journaling off
-    if (sqlite3_exec(db, "PRAGMA journal_mode = OFF", NULL, NULL, NULL) != SQLITE_OK) {
-        fprintf(stderr, "Could not turn off journaling\n");
-        rc = 1;
-    }
+    #ifdef NAME_FILTERS
+    /* ignore errors */
+    create_namefilter(dbname, db);
+    #endif
 
-    // try to store temp_store in memory
-    if (sqlite3_exec(db, "PRAGMA temp_store = 2", NULL, NULL, NULL) != SQLITE_OK) {
-        fprintf(stderr, "Could not set temporary storage to in-memory\n");
-        rc = 1;
-    }
+    /* the sidecar goes next to the database - ignore errors */
+    char topath[MAXPATH];
+    const char *slash = strrchr(dbname, '/');
+    SNFORMAT_S(topath, MAXPATH, 1, dbname, slash?(size_t) (slash - dbname):strlen(dbname));
+    update_columns(topath, db);
+}
 
-    // try to increase the page size
-    if (sqlite3_exec(db, "PRAGMA page_size = 16777216", NULL, NULL, NULL) != SQLITE_OK) {
-        fprintf(stderr, "Could not set page size\n");
-        rc = 1;
+int create_table_wrapper(const char *name, sqlite3 *db, const char *sql_name, const char *sql) {
+    char *err_msg = NULL;
+    const int rc = sqlite3_exec(db, sql, NULL, NULL, &err_msg);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "%s:%d SQL error while executing '%s' on %s: '%s' (%d)\n",
+                __FILE__, __LINE__, sql_name, name, err_msg, rc);
+        sqlite3_free(err_msg);
     }
+    return rc;
+}
 
-    // try to increase the cache size
-    if (sqlite3_exec(db, "PRAGMA cache_size = 16777216", NULL, NULL, NULL) != SQLITE_OK) {
-        fprintf(stderr, "Could not set cache size\n");
-        rc = 1;
+/*
+ * temp_store does not need to be set: sqlite3 is built with SQLITE_TEMP_STORE=3
+ * locking_mode does not need to be set: GUFI_SQLITE_VFS does not lock
+ *
+ * page_size only takes effect before the first table is created, so it
+ * only changes new databases (including the template copied by the builders).
+ * Most directories are small, so most databases are a handful of pages and
+ * 2048 byte pages waste less space than the default without slowing scans.
+ *
+ * cache_size is left at the default. Raising it did not speed up
+ * rollup's largest write, and read-only opens are served from an
+ * in-memory image by the read-only VFS. mmap_size is not set for the
+ * same reason.
+ *
+ * Read-only opens run no PRAGMAs at all.
+ */
+static const char *pragma_profiles[] = {
+    NULL,                                                                 /* PRAGMA_NONE */
+    "PRAGMA page_size = 2048; PRAGMA synchronous = OFF; PRAGMA journal_mode = OFF;", /* PRAGMA_BUILD */
+    NULL,                                                                 /* PRAGMA_QUERY_READONLY */
+    "PRAGMA synchronous = OFF; PRAGMA journal_mode = OFF;",               /* PRAGMA_ROLLUP */
+    "PRAGMA synchronous = OFF; PRAGMA journal_mode = OFF;",               /* PRAGMA_AGGREGATE */
+};
+
+int set_db_pragmas(sqlite3 *db, const enum pragma_profile profile) {
+    if (((size_t) profile >= sizeof(pragma_profiles) / sizeof(pragma_profiles[0])) ||
+        !pragma_profiles[profile]) {
+        return 0;
     }
 
-    // try to get an exclusive lock
-    if (sqlite3_exec(db, "PRAGMA locking_mode = EXCLUSIVE", NULL, NULL, NULL) != SQLITE_OK) {
-        fprintf(stderr, "Could not set locking mode\n");
-        rc = 1;
+    char *err_msg = NULL;
+    if (sqlite3_exec(db, pragma_profiles[profile], NULL, NULL, &err_msg) != SQLITE_OK) {
+        fprintf(stderr, "Could not set pragmas \"%s\": %s\n", pragma_profiles[profile], err_msg);
+        sqlite3_free(err_msg);
+        return 1;
     }
 
-    return rc;
+    return 0;
 }
 
 #if defined(DEBUG) && defined(PER_THREAD_STATS)
@@ -223,7 +339,7 @@ int set_db_pragmas(sqlite3 *db) {
 #define check_set_end(name)
 #endif
 
-sqlite3 *opendb(const char *name, int flags, const int setpragmas, const int load_extensions,
+sqlite3 *opendb(const char *name, int flags, const enum pragma_profile pragmas, const int load_extensions,
                  int (*modifydb_func)(const char *name, sqlite3 *db, void *args), void *modifydb_args
                  #if defined(DEBUG) && defined(PER_THREAD_STATS)
                  , struct start_end *sqlite3_open,   struct start_end *set_pragmas
@@ -232,8 +348,14 @@ sqlite3 *opendb(const char *name, int flags, const int setpragmas, const int loa
     ) {
     sqlite3 *db = NULL;
 
+    /* read-only databases are read into memory with one read */
+    const char *vfs = GUFI_SQLITE_VFS;
+    if ((flags & SQLITE_OPEN_READONLY) && (gufi_vfs_init() == SQLITE_OK)) {
+        vfs = GUFI_SQLITE_RO_VFS;
+    }
+
     check_set_start(sqlite3_open);
-    if (sqlite3_open_v2(name, &db, flags | SQLITE_OPEN_URI, GUFI_SQLITE_VFS) != SQLITE_OK) {
+    if (sqlite3_open_v2(name, &db, flags | SQLITE_OPEN_URI, vfs) != SQLITE_OK) {
         check_set_end(sqlite3_open);
         if (!(flags & SQLITE_OPEN_CREATE)) {
             fprintf(stderr, "Cannot open database: %s %s rc %d\n", name, sqlite3_errmsg(db), sqlite3_errcode(db));
@@ -244,10 +366,8 @@ sqlite3 *opendb(const char *name, int flags, const int setpragmas, const int loa
     check_set_end(sqlite3_open);
 
     check_set_start(set_pragmas);
-    if (setpragmas) {
-        /* ignore errors */
-        set_db_pragmas(db);
-    }
+    /* ignore errors */
+    set_db_pragmas(db, pragmas);
     check_set_end(set_pragmas);
 
     check_set_start(load_extension);
@@ -367,25 +487,7 @@ int rawquerydb(const char *name,
     return(rec_count);
 }
 
-int querytsdb(const char *name, struct sum *sumin, sqlite3 *db, int *recs, int ts)
-{
-     static const char *ts_str[] = {
-         "select totfiles,totlinks,minuid,maxuid,mingid,maxgid,minsize,maxsize,totltk,totmtk,totltm,totmtm,totmtg,totmtt,totsize,minctime,maxctime,minmtime,maxmtime,minatime,maxatime,minblocks,maxblocks,totxattr,mincrtime,maxcrtime,minossint1,maxossint1,totossint1,minossint2,maxossint2,totossint2,minossint3,maxossint3,totossint3,minossint4,maxossint4,totossint4 "
-         "from summary where rectype=0;",
-         "select totfiles,totlinks,minuid,maxuid,mingid,maxgid,minsize,maxsize,totltk,totmtk,totltm,totmtm,totmtg,totmtt,totsize,minctime,maxctime,minmtime,maxmtime,minatime,maxatime,minblocks,maxblocks,totxattr,mincrtime,maxcrtime,minossint1,maxossint1,totossint1,minossint2,maxossint2,totossint2,minossint3,maxossint3,totossint3,minossint4,maxossint4,totossint4,totsubdirs,maxsubdirfiles,maxsubdirlinks,maxsubdirsize "
-         "from treesummary where rectype=0;"
-     };
-
-     const char *sqlstmt = ts_str[ts];
-     sqlite3_stmt *res = NULL;
-     if (sqlite3_prepare_v2(db, sqlstmt, MAXSQL, &res, NULL) != SQLITE_OK) {
-          fprintf(stderr, "SQL error on query: %s, name: %s, err: %s\n",
-                  sqlstmt,name,sqlite3_errmsg(db));
-          return -1;
-     }
-
-     sqlite3_step(res);
-
+static void get_sum_columns(sqlite3_stmt *res, struct sum *sumin, const int ts) {
      //sumin->totfiles = atoll((const char *)sqlite3_column_text(res, 0));
      sumin->totfiles   = sqlite3_column_int64(res, 0);
      sumin->totlinks   = sqlite3_column_int64(res, 1);
@@ -439,6 +541,28 @@ int querytsdb(const char *name, struct sum *sumin, sqlite3 *db, int *recs, int t
        sumin->maxsubdirlinks = 0;
        sumin->maxsubdirsize  = 0;
      }
+}
+
+int querytsdb(const char *name, struct sum *sumin, sqlite3 *db, int *recs, int ts)
+{
+     static const char *ts_str[] = {
+         "select totfiles,totlinks,minuid,maxuid,mingid,maxgid,minsize,maxsize,totltk,totmtk,totltm,totmtm,totmtg,totmtt,totsize,minctime,maxctime,minmtime,maxmtime,minatime,maxatime,minblocks,maxblocks,totxattr,mincrtime,maxcrtime,minossint1,maxossint1,totossint1,minossint2,maxossint2,totossint2,minossint3,maxossint3,totossint3,minossint4,maxossint4,totossint4 "
+         "from summary where rectype=0;",
+         "select totfiles,totlinks,minuid,maxuid,mingid,maxgid,minsize,maxsize,totltk,totmtk,totltm,totmtm,totmtg,totmtt,totsize,minctime,maxctime,minmtime,maxmtime,minatime,maxatime,minblocks,maxblocks,totxattr,mincrtime,maxcrtime,minossint1,maxossint1,totossint1,minossint2,maxossint2,totossint2,minossint3,maxossint3,totossint3,minossint4,maxossint4,totossint4,totsubdirs,maxsubdirfiles,maxsubdirlinks,maxsubdirsize "
+         "from treesummary where rectype=0;"
+     };
+
+     const char *sqlstmt = ts_str[ts];
+     sqlite3_stmt *res = NULL;
+     if (sqlite3_prepare_v2(db, sqlstmt, MAXSQL, &res, NULL) != SQLITE_OK) {
+          fprintf(stderr, "SQL error on query: %s, name: %s, err: %s\n",
+                  sqlstmt,name,sqlite3_errmsg(db));
+          return -1;
+     }
+
+     sqlite3_step(res);
+
+     get_sum_columns(res, sumin, ts);
 
      //printf("tsdb: totfiles %d totlinks %d minuid %d\n",
      //       sumin->totfiles,sumin->totlinks,sumin->minuid);
@@ -712,6 +836,37 @@ int insertsumdb(sqlite3 *sdb, struct work *pwork,struct sum *su)
     return 0;
 }
 
+/* replace the values of an existing directory summary */
+int updatesumdb(sqlite3 *sdb, struct sum *su)
+{
+    char *err_msg = 0;
+    char sqlstmt[MAXSQL];
+
+    SNPRINTF(sqlstmt,MAXSQL,"UPDATE summary SET "
+            "totfiles = %lld, totlinks = %lld, minuid = %lld, maxuid = %lld, mingid = %lld, maxgid = %lld, "
+            "minsize = %lld, maxsize = %lld, totltk = %lld, totmtk = %lld, totltm = %lld, totmtm = %lld, totmtg = %lld, totmtt = %lld, totsize = %lld, "
+            "minctime = %lld, maxctime = %lld, minmtime = %lld, maxmtime = %lld, minatime = %lld, maxatime = %lld, "
+            "minblocks = %lld, maxblocks = %lld, totxattr = %lld, mincrtime = %lld, maxcrtime = %lld, "
+            "minossint1 = %lld, maxossint1 = %lld, totossint1 = %lld, minossint2 = %lld, maxossint2 = %lld, totossint2 = %lld, "
+            "minossint3 = %lld, maxossint3 = %lld, totossint3 = %lld, minossint4 = %lld, maxossint4 = %lld, totossint4 = %lld "
+            "WHERE isroot == 1;",
+            su->totfiles, su->totlinks, su->minuid, su->maxuid, su->mingid, su->maxgid,
+            su->minsize, su->maxsize, su->totltk, su->totmtk, su->totltm, su->totmtm, su->totmtg, su->totmtt, su->totsize,
+            su->minctime, su->maxctime, su->minmtime, su->maxmtime, su->minatime, su->maxatime,
+            su->minblocks, su->maxblocks, su->totxattr, su->mincrtime, su->maxcrtime,
+            su->minossint1, su->maxossint1, su->totossint1, su->minossint2, su->maxossint2, su->totossint2,
+            su->minossint3, su->maxossint3, su->totossint3, su->minossint4, su->maxossint4, su->totossint4);
+
+    const int rc = sqlite3_exec(sdb, sqlstmt, 0, 0, &err_msg);
+    if (rc != SQLITE_OK ) {
+        fprintf(stderr, "SQL error on update (summary): %s\n", err_msg);
+        sqlite3_free(err_msg);
+        return -1;
+    }
+
+    return 0;
+}
+
 int inserttreesumdb(const char *name, sqlite3 *sdb, struct sum *su,int rectype,int uid,int gid)
 {
     char *err_msg = 0;
@@ -980,6 +1135,90 @@ static void sqlite_basename(sqlite3_context *context, int argc, sqlite3_value **
     return;
 }
 
+/*
+ * the filter of one directory, read the first time may_contain or
+ * tree_may_contain is called after addqueryfuncs, so that a -E query
+ * does not read it again for every row
+ */
+struct namefilter_cache {
+    int which;
+    int loaded;
+    void *filter;        /* NULL if there is no filter */
+    int len;
+};
+
+static struct namefilter_cache *namefilter_cache_init(const int which) {
+    struct namefilter_cache *cache = calloc(1, sizeof(struct namefilter_cache));
+    if (cache) {
+        cache->which = which;
+    }
+    return cache;
+}
+
+static void namefilter_cache_free(void *ptr) {
+    struct namefilter_cache *cache = (struct namefilter_cache *) ptr;
+    free(cache->filter);
+    free(cache);
+}
+
+static void namefilter_cache_load(sqlite3 *db, struct namefilter_cache *cache) {
+    sqlite3_stmt *stmt = NULL;
+    if (sqlite3_prepare_v2(db, "SELECT filter FROM " NAMEFILTERS " WHERE tree == ?;",
+                           -1, &stmt, NULL) == SQLITE_OK) {
+        sqlite3_bind_int(stmt, 1, cache->which);
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            const int len = sqlite3_column_bytes(stmt, 0);
+            const void *filter = sqlite3_column_blob(stmt, 0);
+            if (filter && (len > 0)) {
+                cache->filter = malloc(len);
+                if (cache->filter) {
+                    memcpy(cache->filter, filter, len);
+                    cache->len = len;
+                }
+            }
+        }
+    }
+    sqlite3_finalize(stmt);
+
+    cache->loaded = 1;
+}
+
+/*
+ * may_contain(key) and tree_may_contain(key) return 0 if the name filter of
+ * this directory (or of this subtree) says that key is definitely not a name
+ * in it - keys starting with BLOOM_EXT_PREFIX are extensions
+ *
+ * databases without a filter always return 1
+ */
+static void namefilter_may_contain(sqlite3_context *context, int argc, sqlite3_value **argv) {
+    struct namefilter_cache *cache = (struct namefilter_cache *) sqlite3_user_data(context);
+    const char *key = (const char *) sqlite3_value_text(argv[0]);
+    const int key_len = sqlite3_value_bytes(argv[0]);
+
+    if (!cache->loaded) {
+        namefilter_cache_load(sqlite3_context_db_handle(context), cache);
+    }
+
+    int maybe = 1;
+    if (key && cache->filter) {
+        maybe = bloom_may_contain(cache->filter, cache->len, key, key_len);
+    }
+
+    sqlite3_result_int(context, maybe);
+}
+
+/* the previous cache is freed by sqlite when the function is replaced */
+static int add_namefilter_func(sqlite3 *db, const char *name, const int which) {
+    struct namefilter_cache *cache = namefilter_cache_init(which);
+    if (!cache) {
+        return SQLITE_NOMEM;
+    }
+
+    return sqlite3_create_function_v2(db, name, 1, SQLITE_UTF8, cache,
+                                      &namefilter_may_contain, NULL, NULL,
+                                      &namefilter_cache_free);
+}
+
 int addqueryfuncs(sqlite3 *db, size_t id, size_t lvl, char *starting_dir) {
     return ((sqlite3_create_function(db, "path",                1, SQLITE_UTF8, (void *) (uintptr_t) id,  &path,                NULL, NULL) == SQLITE_OK) &&
             (sqlite3_create_function(db, "fpath",               0, SQLITE_UTF8, (void *) (uintptr_t) id,  &fpath,               NULL, NULL) == SQLITE_OK) &&
@@ -992,7 +1231,10 @@ int addqueryfuncs(sqlite3 *db, size_t id, size_t lvl, char *starting_dir) {
             (sqlite3_create_function(db, "human_readable_size", 2, SQLITE_UTF8, NULL,                     &human_readable_size, NULL, NULL) == SQLITE_OK) &&
             (sqlite3_create_function(db, "level",               0, SQLITE_UTF8, (void *) (uintptr_t) lvl, &relative_level,      NULL, NULL) == SQLITE_OK) &&
             (sqlite3_create_function(db, "starting_point",      0, SQLITE_UTF8, starting_dir,             &starting_point,      NULL, NULL) == SQLITE_OK) &&
-            (sqlite3_create_function(db, "basename",            1, SQLITE_UTF8, NULL,                     &sqlite_basename,     NULL, NULL) == SQLITE_OK))?0:1;
+            (sqlite3_create_function(db, "basename",            1, SQLITE_UTF8, NULL,                     &sqlite_basename,     NULL, NULL) == SQLITE_OK) &&
+            (add_namefilter_func(db, "may_contain",      NAMEFILTER_DIR)  == SQLITE_OK) &&
+            (add_namefilter_func(db, "tree_may_contain", NAMEFILTER_TREE) == SQLITE_OK) &&
+            (addcolumnfuncs(db, id) == 0))?0:1;
 }
 
 size_t print_results(sqlite3_stmt *res, FILE *out, const int printpath, const int printheader, const int printrows, const char *delim) {
@@ -1077,3 +1319,305 @@ int get_rollupscore(const char *name, sqlite3 *db, int *rollupscore) {
 
     return 0;
 }
+
+int unrollupdb(const char *name, sqlite3 *db) {
+    char *err = NULL;
+    if (sqlite3_exec(db,
+                     "BEGIN TRANSACTION;"
+                     "DROP TABLE pentries;"
+                     "CREATE VIEW pentries AS SELECT entries.*, summary.inode AS pinode FROM entries, summary WHERE rectype = 0;"
+                     "DELETE FROM summary WHERE isroot <> 1;"
+                     "UPDATE summary SET rollupscore = 0 WHERE isroot == 1;"
+                     "END TRANSACTION;",
+                     NULL,
+                     NULL,
+                     &err) != SQLITE_OK) {
+        fprintf(stderr, "Could not remove roll up data from \"%s\": %s\n", name, err);
+        sqlite3_free(err);
+        return 1;
+    }
+
+    /* the filter and the sidecar covered the rolled up entries too */
+    update_namefilter(name, db);
+    update_columns(name, db);
+
+    return 0;
+}
+
+int is_packed(const char *dir) {
+    char marker[MAXPATH];
+    SNPRINTF(marker, MAXPATH, "%s/" PACKED_MARKER, dir);
+
+    struct stat st;
+    if (lstat(marker, &st) != 0) {
+        return 0;
+    }
+
+    /* a database that was rebuilt or unrolled after packing leaves the marker */
+    /* behind, so the directory is only packed while it is still rolled up */
+    char dbname[MAXPATH];
+    SNPRINTF(dbname, MAXPATH, "%s/" DBNAME, dir);
+
+    /* only one row is read, so skip opendb and the read-only VFS */
+    sqlite3 *db = NULL;
+    int rollupscore = 0;
+    if (sqlite3_open_v2(dbname, &db, SQLITE_OPEN_READONLY, NULL) == SQLITE_OK) {
+        get_rollupscore(dbname, db, &rollupscore);
+    }
+    sqlite3_close(db);
+
+    return (rollupscore > 0);
+}
+
+int querypackedtsdb(const char *name, struct sum *sumout, sqlite3 *db) {
+    static const char sqlstmt[] =
+        "select totfiles,totlinks,minuid,maxuid,mingid,maxgid,minsize,maxsize,totltk,totmtk,totltm,totmtm,totmtg,totmtt,totsize,minctime,maxctime,minmtime,maxmtime,minatime,maxatime,minblocks,maxblocks,totxattr,mincrtime,maxcrtime,minossint1,maxossint1,totossint1,minossint2,maxossint2,totossint2,minossint3,maxossint3,totossint3,minossint4,maxossint4,totossint4 "
+        "from summary where rectype=0 and isroot<>1;";
+
+    sqlite3_stmt *res = NULL;
+    if (sqlite3_prepare_v2(db, sqlstmt, sizeof(sqlstmt), &res, NULL) != SQLITE_OK) {
+        fprintf(stderr, "SQL error on query: %s, name: %s, err: %s\n",
+                sqlstmt, name, sqlite3_errmsg(db));
+        return -1;
+    }
+
+    while (sqlite3_step(res) == SQLITE_ROW) {
+        struct sum sumin;
+        zeroit(&sumin);
+        get_sum_columns(res, &sumin, 0);
+        tsumit(&sumin, sumout);
+    }
+
+    sqlite3_finalize(res);
+    return 0;
+}
+
+/* columns of entries, in order */
+#define ENTRIES_COLUMNS "id, name, type, inode, mode, nlink, uid, gid, size, blksize, blocks, atime, mtime, ctime, linkname, xattrs, crtime, ossint1, ossint2, ossint3, ossint4, osstext1, osstext2"
+
+/* every column of summary except id, name, depth, isroot, and rollupscore */
+#define SUMMARY_BEFORE_DEPTH "type, inode, mode, nlink, uid, gid, size, blksize, blocks, atime, mtime, ctime, linkname, xattrs, totfiles, totlinks, minuid, maxuid, mingid, maxgid, minsize, maxsize, totltk, totmtk, totltm, totmtm, totmtg, totmtt, totsize, minctime, maxctime, minmtime, maxmtime, minatime, maxatime, minblocks, maxblocks, totxattr"
+#define SUMMARY_AFTER_DEPTH  "mincrtime, maxcrtime, minossint1, maxossint1, totossint1, minossint2, maxossint2, totossint2, minossint3, maxossint3, totossint3, minossint4, maxossint4, totossint4, rectype, pinode"
+
+struct Unpack {
+    const char *name;           /* packed directory */
+    size_t name_len;
+    int template_fd;
+    off_t template_size;
+    int rc;
+};
+
+static int unpack_dir(void *args, int count, char **data, char **columns) {
+    struct Unpack *unpack = (struct Unpack *) args;
+
+    /* full name in summary, path relative to the packed directory, inode, mode, uid, gid */
+    const char *full = data[0];
+    const char *rel = data[1];
+
+    char path[MAXPATH];
+    SNFORMAT_S(path, MAXPATH, 3, unpack->name, unpack->name_len, "/", (size_t) 1, rel, strlen(rel));
+
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    st.st_mode = strtoull(data[3], NULL, 10);
+    st.st_uid  = strtoull(data[4], NULL, 10);
+    st.st_gid  = strtoull(data[5], NULL, 10);
+
+    if (dupdir(path, &st) != 0) {
+        fprintf(stderr, "Could not create \"%s\": %s\n", path, strerror(errno));
+        unpack->rc = 1;
+        return 0;
+    }
+
+    char dbname[MAXPATH];
+    SNPRINTF(dbname, MAXPATH, "%s/" DBNAME, path);
+    if (copy_template(unpack->template_fd, dbname, unpack->template_size, st.st_uid, st.st_gid) != 0) {
+        unpack->rc = 1;
+        return 0;
+    }
+
+    sqlite3 *db = opendb(dbname, SQLITE_OPEN_READWRITE, PRAGMA_BUILD, 0
+                         , NULL, NULL
+                         #if defined(DEBUG) && defined(PER_THREAD_STATS)
+                         , NULL, NULL
+                         , NULL, NULL
+                         #endif
+        );
+    if (!db) {
+        unpack->rc = 1;
+        return 0;
+    }
+
+    char packed[MAXPATH];
+    SNFORMAT_S(packed, MAXPATH, 3, unpack->name, unpack->name_len, "/", (size_t) 1, DBNAME, (size_t) DBNAME_LEN);
+    if (!attachdb(packed, db, "packed", SQLITE_OPEN_READONLY)) {
+        closedb(db);
+        unpack->rc = 1;
+        return 0;
+    }
+
+    /* rolling up added 1 to the depth for every level the summary was copied up */
+    size_t levels = 1;
+    for(const char *c = rel; *c; c++) {
+        levels += (*c == '/');
+    }
+
+    const char *basename = strrchr(rel, '/');
+    basename = basename?(basename + 1):rel;
+
+    char *sql = sqlite3_mprintf(
+        "BEGIN TRANSACTION;"
+        "INSERT INTO entries SELECT " ENTRIES_COLUMNS " FROM packed.pentries WHERE pinode == %s;"
+        "INSERT INTO summary SELECT NULL, %Q, " SUMMARY_BEFORE_DEPTH ", depth - %d, " SUMMARY_AFTER_DEPTH ", 1, 0 FROM packed.summary WHERE name == %Q;"
+        "END TRANSACTION;",
+        data[2], basename, (int) levels, full);
+
+    char *err = NULL;
+    if (sqlite3_exec(db, sql, NULL, NULL, &err) != SQLITE_OK) {
+        fprintf(stderr, "Could not unpack \"%s\": %s\n", path, err);
+        unpack->rc = 1;
+    }
+    sqlite3_free(err);
+    sqlite3_free(sql);
+
+    detachdb(packed, db, "packed");
+
+    #ifdef NAME_FILTERS
+    /* ignore errors */
+    create_namefilter(path, db);
+    #endif
+
+    #ifdef COLUMN_SIDECARS
+    /* ignore errors */
+    columns_write(path, db, "main");
+    #endif
+
+    closedb(db);
+
+    return 0;
+}
+
+int unpackdb(const char *name, sqlite3 *db, const int template_fd, const off_t template_size) {
+    struct Unpack unpack;
+    unpack.name = name;
+    unpack.name_len = strlen(name);
+    unpack.template_fd = template_fd;
+    unpack.template_size = template_size;
+    unpack.rc = 0;
+
+    /* parents are shallower than their children, so they are created first */
+    char *err = NULL;
+    if (sqlite3_exec(db,
+                     "SELECT name, substr(name, length((SELECT name FROM summary WHERE isroot == 1)) + 2), inode, mode, uid, gid "
+                     "FROM summary WHERE isroot <> 1 ORDER BY depth",
+                     unpack_dir, &unpack, &err) != SQLITE_OK) {
+        fprintf(stderr, "Could not get the directories packed into \"%s\": %s\n", name, err);
+        sqlite3_free(err);
+        return 1;
+    }
+
+    return unpack.rc;
+}
+
+int namefilter_read(sqlite3 *db, const char *schema, const int which, struct bloom *bloom) {
+    char sql[MAXSQL];
+    SNPRINTF(sql, MAXSQL, "SELECT filter FROM %s." NAMEFILTERS " WHERE tree == %d;", schema, which);
+
+    int rc = 1;
+    sqlite3_stmt *stmt = NULL;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            rc = (bloom_merge(bloom, sqlite3_column_blob(stmt, 0), sqlite3_column_bytes(stmt, 0)) != 0);
+        }
+    }
+    sqlite3_finalize(stmt);
+
+    return rc;
+}
+
+int namefilter_write(const char *name, sqlite3 *db, const int which, struct bloom *bloom) {
+    char *err = NULL;
+    if (sqlite3_exec(db, "CREATE TABLE IF NOT EXISTS " NAMEFILTERS "(tree INT64 PRIMARY KEY, filter BLOB);",
+                     NULL, NULL, &err) != SQLITE_OK) {
+        fprintf(stderr, "Could not create name filter table in %s: %s\n", name, err);
+        sqlite3_free(err);
+        return 1;
+    }
+
+    size_t len = 0;
+    void *blob = bloom_serialize(bloom, &len);
+
+    int rc = 1;
+    sqlite3_stmt *stmt = NULL;
+    if (sqlite3_prepare_v2(db, "INSERT OR REPLACE INTO " NAMEFILTERS " VALUES (?, ?);", -1, &stmt, NULL) == SQLITE_OK) {
+        sqlite3_bind_int(stmt, 1, which);
+        sqlite3_bind_blob64(stmt, 2, blob, len, SQLITE_STATIC);
+        rc = (sqlite3_step(stmt) != SQLITE_DONE);
+    }
+    if (rc) {
+        fprintf(stderr, "Could not write name filter of %s: %s\n", name, sqlite3_errmsg(db));
+    }
+    sqlite3_finalize(stmt);
+    free(blob);
+
+    return rc;
+}
+
+void namefilter_delete(sqlite3 *db, const int which) {
+    char sql[MAXSQL];
+    SNPRINTF(sql, MAXSQL, "DELETE FROM " NAMEFILTERS " WHERE tree == %d;", which);
+
+    /* ignore errors - databases without filters do not have the table */
+    sqlite3_exec(db, sql, NULL, NULL, NULL);
+}
+
+int create_namefilter(const char *name, sqlite3 *db) {
+    sqlite3_stmt *stmt = NULL;
+    if (sqlite3_prepare_v2(db, "SELECT name FROM pentries;", -1, &stmt, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Could not read names of %s: %s\n", name, sqlite3_errmsg(db));
+        namefilter_delete(db, NAMEFILTER_DIR);
+        return 1;
+    }
+
+    struct bloom bloom;
+    bloom_init(&bloom);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        const char *entry = (const char *) sqlite3_column_text(stmt, 0);
+        if (entry) {
+            bloom_add_name(&bloom, entry, sqlite3_column_bytes(stmt, 0));
+        }
+    }
+    sqlite3_finalize(stmt);
+
+    const int rc = namefilter_write(name, db, NAMEFILTER_DIR, &bloom);
+    bloom_destroy(&bloom);
+    return rc;
+}
+
+int update_namefilter(const char *name, sqlite3 *db) {
+    #ifdef NAME_FILTERS
+    return create_namefilter(name, db);
+    #else
+    (void) name;
+    namefilter_delete(db, NAMEFILTER_DIR);
+    return 0;
+    #endif
+}
+
+int drop_treesummary(const char *name, sqlite3 *db) {
+    namefilter_delete(db, NAMEFILTER_TREE);
+
+    char *err = NULL;
+    if (sqlite3_exec(db,
+                     "DROP VIEW IF EXISTS vtsummarydir;"
+                     "DROP VIEW IF EXISTS vtsummaryuser;"
+                     "DROP VIEW IF EXISTS vtsummarygroup;"
+                     "DROP TABLE IF EXISTS treesummary;",
+                     NULL, NULL, &err) != SQLITE_OK) {
+        fprintf(stderr, "Could not drop treesummary of %s: %s\n", name, err);
+        sqlite3_free(err);
+        return 1;
+    }
+
+    return 0;
+}
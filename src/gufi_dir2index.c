@@ -72,7 +72,11 @@ OF SUCH DAMAGE.
 #include <unistd.h>
 
 #include "QueuePerThreadPool.h"
+#include "SinglyLinkedList.h"
+#include "batch_stat.h"
 #include "bf.h"
+#include "catalog.h"
+#include "columns.h"
 #include "debug.h"
 #include "dbutils.h"
 #include "template_db.h"
@@ -83,6 +87,8 @@ extern int errno;
 /* constants set at runtime (probably cannot be constexpr) */
 int templatefd = -1;
 off_t templatesize = 0;
+void *templateimage = NULL; /* only used when building databases in memory */
+struct BatchStatRing **rings = NULL; /* one per thread - NULL entries mean synchronous stats */
 
 #if BENCHMARK
 #include <time.h>
@@ -92,104 +98,187 @@ size_t total_dirs = 0;
 size_t total_files = 0;
 #endif
 
-int processdir(struct QPTPool *ctx, const size_t id, void *data, void *args) {
-    #if BENCHMARK
-    pthread_mutex_lock(&global_mutex);
-    total_dirs++;
-    pthread_mutex_unlock(&global_mutex);
-    #endif
+/*
+ * serialized databases waiting to be written by the writer threads
+ *
+ * the scanning threads block once there are too many images
+ * in flight so that memory usage stays bounded when the index
+ * filesystem cannot keep up with the source filesystem
+ */
+struct PendingImages {
+    pthread_mutex_t mutex;
+    pthread_cond_t cv;
+    size_t count;
+    size_t max;
+};
+
+/* maximum number of images waiting for each writer thread */
+#define IMAGES_PER_WRITER 32
+
+struct PendingImages pending_images = {
+    PTHREAD_MUTEX_INITIALIZER,
+    PTHREAD_COND_INITIALIZER,
+    0,
+    0,
+};
+
+static void pending_images_acquire(struct PendingImages *pending) {
+    pthread_mutex_lock(&pending->mutex);
+    while (pending->count >= pending->max) {
+        pthread_cond_wait(&pending->cv, &pending->mutex);
+    }
+    pending->count++;
+    pthread_mutex_unlock(&pending->mutex);
+}
 
-    /* skip argument checking */
-    /* if (!data) { */
-    /*     return 1; */
-    /* } */
+static void pending_images_release(struct PendingImages *pending) {
+    pthread_mutex_lock(&pending->mutex);
+    pending->count--;
+    pthread_cond_signal(&pending->cv);
+    pthread_mutex_unlock(&pending->mutex);
+}
 
-    /* if (!ctx || (id >= ctx->size)) { */
-    /*     free(data); */
-    /*     return 1; */
-    /* } */
+/* number of databases that could not be written to the index */
+static size_t write_errors = 0;
 
-    struct work *work = (struct work *) data;
+/*
+ * more scanning threads than writer threads share the
+ * round robin counters QPTPool_enqueue uses to pick a
+ * writer, so handing off an image has to be serialized
+ */
+static pthread_mutex_t writers_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-    DIR *dir = opendir(work->name);
-    if (!dir) {
-        fprintf(stderr, "Could not open directory \"%s\"\n", work->name);
-        return 1;
+/*
+ * with -U, databases are built under a temporary name and
+ * renamed over the existing database once they are complete
+ * so that the index never contains a partially written database
+ */
+#define INCREMENTAL_SUFFIX ".new"
+
+static void replacedb(const char *topath, const char *dbname) {
+    if (!in.incremental) {
+        return;
     }
 
-    /* get source directory info */
-    struct stat dir_st;
-    if (lstat(work->name, &dir_st) < 0)  {
-        closedir(dir);
-        return 1;
+    char final[MAXPATH];
+    SNPRINTF(final, MAXPATH, "%s/" DBNAME, topath);
+    if (rename(dbname, final) != 0) {
+        const int err = errno;
+        fprintf(stderr, "Could not replace %s: %d %s\n", final, err, strerror(err));
+        return;
     }
 
-    /* create the directory */
+    /* rolled up databases, including packed ones, are always rebuilt, and */
+    /* the rebuilt subdirectories replace the ones that were in the packed */
+    /* database, so the directory is not packed anymore */
+    char marker[MAXPATH];
+    SNPRINTF(marker, MAXPATH, "%s/" PACKED_MARKER, topath);
+    remove(marker);
+}
+
+/* a directory's database that has been built but not written yet */
+struct write_work {
     char topath[MAXPATH];
-    SNPRINTF(topath, MAXPATH, "%s/%s", in.nameto, work->name + in.name_len); /* offset by in.name_len to remove prefix */
-    int rc = mkdir(topath, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);           /* don't need recursion because parent is guaranteed to exist */
-    if (rc < 0) {
-        const int err = errno;
-        if (err != EEXIST) {
-            fprintf(stderr, "mkdir %s failure: %d %s\n", topath, err, strerror(err));
-            closedir(dir);
-            return 1;
+    char dbname[MAXPATH];
+    mode_t mode;
+    uid_t uid;
+    gid_t gid;
+    unsigned char *image;
+    sqlite3_int64 size;
+};
+
+/* write a serialized database and set the permissions of its directory */
+int writedb(struct QPTPool *ctx, const size_t id, void *data, void *args) {
+    (void) ctx; (void) id; (void) args;
+
+    struct write_work *ww = (struct write_work *) data;
+
+    int rc = 1;
+    if (ww->image) {
+        rc = write_image(ww->image, ww->size, ww->dbname, ww->uid, ww->gid);
+        sqlite3_free(ww->image);
+
+        if (rc == 0) {
+            replacedb(ww->topath, ww->dbname);
         }
     }
-
-    /* create the database name */
-    char dbname[MAXPATH];
-    SNPRINTF(dbname, MAXPATH, "%s/" DBNAME, topath);
-
-    /* copy the template file */
-    if (copy_template(templatefd, dbname, templatesize, dir_st.st_uid, dir_st.st_gid)) {
-        closedir(dir);
-        return 1;
+    else {
+        fprintf(stderr, "Could not serialize database for %s\n", ww->dbname);
     }
 
-    sqlite3 *db = opendb(dbname, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, 1, 0
-                          , NULL, NULL
-                          #if defined(DEBUG) && defined(PER_THREAD_STATS)
-                          , NULL, NULL
-                          , NULL, NULL
-                          #endif
-                          );
-    if (!db) {
-        closedir(dir);
-        return 1;
+    if (rc != 0) {
+        __atomic_add_fetch(&write_errors, 1, __ATOMIC_RELAXED);
     }
 
-    /* prepare to insert into the database */
-    struct sum summary;
-    zeroit(&summary);
-
-    sqlite3_stmt *res = insertdbprep(db);
+    pending_images_release(&pending_images);
 
-    startdb(db);
+    /* ignore errors */
+    chmod(ww->topath, ww->mode);
+    chown(ww->topath, ww->uid, ww->gid);
 
-    struct dirent *entry = NULL;
-    size_t rows = 0;
-    while ((entry = readdir(dir))) {
-        const size_t len = strlen(entry->d_name);
+    free(ww);
 
-        /* skip . and .. */
-        if (entry->d_name[0] == '.') {
-            if ((len == 1) ||
-                ((len == 2) && (entry->d_name[1] == '.'))) {
-                continue;
-            }
-        }
+    return !!rc;
+}
 
+/*
+ * a directory with more than in.split_threshold entries
+ *
+ * the thread that reads the directory keeps the first
+ * in.split_threshold entries and hands the rest of the
+ * names to other threads in chunks. each chunk is inserted
+ * into its own shard database so that the inserts do not
+ * contend with each other. the last thread to finish
+ * merges the shards and the partial summaries into the
+ * directory's database.
+ */
+struct split_dir {
+    pthread_mutex_t mutex;
+    size_t remaining;           /* the reading thread + unfinished chunks */
+    size_t chunks;
+
+    struct work *work;
+    int dir_fd;
+    char topath[MAXPATH];
+    char dbname[MAXPATH];
+    sqlite3 *db;
+    struct sum summary;
+    int failed;                 /* a chunk could not be inserted or merged */
+};
+
+/* names of some of the entries of a split directory */
+struct chunk {
+    struct split_dir *split;
+    size_t index;
+    char *names;                /* NUL terminated names, one after another */
+    size_t size;
+    size_t capacity;
+    size_t count;
+};
+
+int processdir(struct QPTPool *ctx, const size_t id, void *data, void *args);
+
+/* stat and insert a batch of entries found in work */
+static void process_batch(struct QPTPool *ctx, const size_t id,
+                          struct work *work, const int dir_fd,
+                          struct BatchStat *batch,
+                          sqlite3 *db, sqlite3_stmt *res, struct sum *summary) {
+    batch_stat(rings[id], dir_fd, batch);
+
+    for(size_t i = 0; i < batch->count; i++) {
+        const char *d_name = batch->names[i];
+        const size_t len = batch->name_lens[i];
 
         /* get entry path */
         struct work e;
         memset(&e, 0, sizeof(struct work));
-        SNFORMAT_S(e.name, MAXPATH, 3, work->name, strlen(work->name), "/", 1, entry->d_name, len);
+        SNFORMAT_S(e.name, MAXPATH, 3, work->name, strlen(work->name), "/", 1, d_name, len);
 
-        /* get the entry's metadata */
-        if (lstat(e.name, &e.statuso) < 0) {
+        /* the entry's metadata */
+        if (batch->rc[i] != 0) {
             continue;
         }
+        e.statuso = batch->st[i];
 
         /* e.xattrs_len = 0; */
         if (in.doxattrs > 0) {
@@ -213,12 +302,10 @@ int processdir(struct QPTPool *ctx, const size_t id, void *data, void *args) {
             }
         }
 
-        rows++;
-
         /* non directories */
         if (S_ISLNK(e.statuso.st_mode)) {
             e.type[0] = 'l';
-            readlink(e.name, e.linkname, MAXPATH);
+            readlinkat(dir_fd, d_name, e.linkname, MAXPATH);
         }
         else if (S_ISREG(e.statuso.st_mode)) {
             e.type[0] = 'f';
@@ -242,21 +329,635 @@ int processdir(struct QPTPool *ctx, const size_t id, void *data, void *args) {
         SNFORMAT_S(e.name, MAXPATH, 1, e_name, strlen(e.name) - in.name_len);
 
         /* update summary table */
-        sumit(&summary, &e);
+        sumit(summary, &e);
 
         /* add entry into bulk insert */
         insertdbgo(&e, db, res);
     }
+}
+
+/*
+ * the summary table only has whole seconds, so the nanoseconds of
+ * the directory's ctime are kept in the database header for -U
+ * (ctime changes whenever mtime does)
+ */
+static void set_ctime_nsec(sqlite3 *db, const struct stat *st) {
+    char sql[MAXSQL];
+    SNPRINTF(sql, MAXSQL, "PRAGMA user_version = %ld;", (long) st->st_ctim.tv_nsec);
+
+    /* ignore errors - the directory is rebuilt the next time */
+    sqlite3_exec(db, sql, NULL, NULL, NULL);
+}
+
+/* write a filled database to the index and close it */
+static void finishdb(void *args, const size_t id, struct work *work,
+                     const char *topath, const char *dbname, sqlite3 *db) {
+    set_ctime_nsec(db, &work->statuso);
+
+    if (in.write_threads) {
+        /* hand the database off to the writer threads */
+        struct QPTPool *writers = (struct QPTPool *) args;
+        struct write_work *ww = (struct write_work *) malloc(sizeof(struct write_work));
+
+        SNFORMAT_S(ww->topath, MAXPATH, 1, topath, strlen(topath));
+        SNFORMAT_S(ww->dbname, MAXPATH, 1, dbname, strlen(dbname));
+        ww->mode = work->statuso.st_mode;
+        ww->uid = work->statuso.st_uid;
+        ww->gid = work->statuso.st_gid;
+
+        /* block here if the writers have fallen behind */
+        pending_images_acquire(&pending_images);
+        ww->image = sqlite3_serialize(db, "main", &ww->size, 0);
+
+        closedb(db);
+
+        pthread_mutex_lock(&writers_mutex);
+        QPTPool_enqueue(writers, id % writers->size, writedb, ww);
+        pthread_mutex_unlock(&writers_mutex);
+    }
+    else {
+        int rc = 0;
+        if (in.build_in_memory) {
+            rc = memdb_to_file(db, dbname, work->statuso.st_uid, work->statuso.st_gid);
+        }
+
+        closedb(db);
+
+        if (rc == 0) {
+            replacedb(topath, dbname);
+        }
+        else {
+            __atomic_add_fetch(&write_errors, 1, __ATOMIC_RELAXED);
+        }
+
+        /* ignore errors */
+        chmod(topath, work->statuso.st_mode);
+        chown(topath, work->statuso.st_uid, work->statuso.st_gid);
+    }
+}
+
+static void shardname(char *name, const char *dbname, const size_t index) {
+    SNPRINTF(name, MAXPATH, "%s.%zu", dbname, index);
+}
+
+static struct split_dir *split_init(struct work *work, const int dir_fd,
+                                    const char *topath, const char *dbname) {
+    struct split_dir *split = (struct split_dir *) calloc(1, sizeof(struct split_dir));
+    pthread_mutex_init(&split->mutex, NULL);
+    split->remaining = 1;
+    split->chunks = 0;
+    split->work = work;
+    split->dir_fd = dup(dir_fd); /* the reading thread closes its directory before the chunks finish */
+    SNFORMAT_S(split->topath, MAXPATH, 1, topath, strlen(topath));
+    SNFORMAT_S(split->dbname, MAXPATH, 1, dbname, strlen(dbname));
+    split->db = NULL;
+    zeroit(&split->summary);
+    split->failed = 0;
+    return split;
+}
+
+/*
+ * merge a partial summary - the last thread to finish writes the database
+ *
+ * if any chunk failed, the database is missing entries, so it is
+ * not written (with -U, the previous database is kept)
+ */
+static void split_release(void *args, const size_t id, struct split_dir *split,
+                          struct sum *summary, const int failed) {
+    pthread_mutex_lock(&split->mutex);
+    summerge(summary, &split->summary);
+    split->failed |= failed;
+    const int last = !--split->remaining;
+    pthread_mutex_unlock(&split->mutex);
+
+    if (!last) {
+        return;
+    }
+
+    for(size_t i = 0; i < split->chunks; i++) {
+        char name[MAXPATH];
+        shardname(name, split->dbname, i);
+        if (!split->failed && (mergeshard(name, split->db) != 0)) {
+            split->failed = 1;
+        }
+        unlink(name);
+    }
+
+    if (split->failed) {
+        fprintf(stderr, "Could not insert all entries of %s\n", split->work->name);
+        closedb(split->db);
+        if (!in.build_in_memory) {
+            unlink(split->dbname);
+        }
+        __atomic_add_fetch(&write_errors, 1, __ATOMIC_RELAXED);
+
+        /* ignore errors */
+        chmod(split->topath, split->work->statuso.st_mode);
+        chown(split->topath, split->work->statuso.st_uid, split->work->statuso.st_gid);
+    }
+    else {
+        insertsumdb(split->db, split->work, &split->summary);
+        index_entries(split->dbname, split->db, &split->summary);
+        finishdb(args, id, split->work, split->topath, split->dbname, split->db);
+    }
+
+    close(split->dir_fd);
+    pthread_mutex_destroy(&split->mutex);
+    free(split->work);
+    free(split);
+}
+
+static struct chunk *chunk_init(struct split_dir *split) {
+    struct chunk *chunk = (struct chunk *) malloc(sizeof(struct chunk));
+    chunk->split = split;
+    chunk->size = 0;
+    chunk->capacity = 4096;
+    chunk->names = (char *) malloc(chunk->capacity);
+    chunk->count = 0;
+
+    pthread_mutex_lock(&split->mutex);
+    chunk->index = split->chunks++;
+    split->remaining++;
+    pthread_mutex_unlock(&split->mutex);
+
+    return chunk;
+}
+
+static void chunk_add(struct chunk *chunk, const char *name, const size_t len) {
+    while (chunk->size + len + 1 > chunk->capacity) {
+        chunk->capacity *= 2;
+        chunk->names = (char *) realloc(chunk->names, chunk->capacity);
+    }
+
+    memcpy(chunk->names + chunk->size, name, len + 1);
+    chunk->size += len + 1;
+    chunk->count++;
+}
+
+/* insert a chunk of a split directory into a shard */
+int processchunk(struct QPTPool *ctx, const size_t id, void *data, void *args) {
+    struct chunk *chunk = (struct chunk *) data;
+    struct split_dir *split = chunk->split;
+    struct work *work = split->work;
+
+    char name[MAXPATH];
+    shardname(name, split->dbname, chunk->index);
+
+    struct sum summary;
+    zeroit(&summary);
+
+    int rc = 1;
+    if (copy_template(templatefd, name, templatesize, work->statuso.st_uid, work->statuso.st_gid) == 0) {
+        sqlite3 *db = opendb(name, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, PRAGMA_BUILD, 0
+                             , NULL, NULL
+                             #if defined(DEBUG) && defined(PER_THREAD_STATS)
+                             , NULL, NULL
+                             , NULL, NULL
+                             #endif
+                             );
+        if (db) {
+            sqlite3_stmt *res = insertdbprep(db);
+
+            startdb(db);
+
+            struct BatchStat batch;
+            batch.count = 0;
+
+            const char *d_name = chunk->names;
+            for(size_t i = 0; i < chunk->count; i++) {
+                const size_t len = strlen(d_name);
+                if (!batch_stat_add(&batch, d_name, len)) {
+                    process_batch(ctx, id, work, split->dir_fd, &batch, db, res, &summary);
+                    batch.count = 0;
+                }
+                d_name += len + 1;
+            }
+
+            process_batch(ctx, id, work, split->dir_fd, &batch, db, res, &summary);
+
+            stopdb(db);
+            insertdbfin(res);
+            closedb(db);
+
+            rc = 0;
+        }
+    }
+
+    free(chunk->names);
+    free(chunk);
+
+    split_release(args, id, split, &summary, rc);
+
+    return rc;
+}
+
+/*
+ * check whether the database built for a directory during
+ * a previous run still matches the directory
+ *
+ * only the directory's own metadata is compared, so changes
+ * to the contents of existing files are not detected
+ *
+ * databases that were not built with -U or -M by gufi_dir2index
+ * do not have the nanoseconds and are always rebuilt
+ */
+static int dir_unchanged(const char *dbname, const struct stat *st) {
+    if (access(dbname, F_OK) != 0) {
+        return 0;
+    }
+
+    sqlite3 *db = opendb(dbname, SQLITE_OPEN_READONLY, PRAGMA_QUERY_READONLY, 0
+                         , NULL, NULL
+                         #if defined(DEBUG) && defined(PER_THREAD_STATS)
+                         , NULL, NULL
+                         , NULL, NULL
+                         #endif
+                         );
+    if (!db) {
+        return 0;
+    }
+
+    /* rolled up databases contain their subdirectories' entries */
+    /* and are always rebuilt, which also removes the rollup */
+    int unchanged = 0;
+    sqlite3_stmt *res = NULL;
+    if (sqlite3_prepare_v2(db, "SELECT inode, mtime, ctime, rollupscore, "
+                               "(SELECT user_version FROM pragma_user_version()) "
+                               "FROM summary WHERE isroot == 1;", MAXSQL, &res, NULL) == SQLITE_OK) {
+        if (sqlite3_step(res) == SQLITE_ROW) {
+            unchanged = ((ino_t)  sqlite3_column_int64(res, 0) == st->st_ino)   &&
+                        ((time_t) sqlite3_column_int64(res, 1) == st->st_mtime) &&
+                        ((time_t) sqlite3_column_int64(res, 2) == st->st_ctime) &&
+                        (sqlite3_column_int64(res, 3) == 0)                     &&
+                        ((long)   sqlite3_column_int64(res, 4) == (long) st->st_ctim.tv_nsec);
+        }
+    }
+    sqlite3_finalize(res);
+
+    closedb(db);
+
+    return unchanged;
+}
+
+/*
+ * index directories rebuilt by -U
+ *
+ * the treesummary tables of their ancestors were computed from
+ * the old subtrees, so they are dropped after the walk
+ */
+static struct sll rebuilt;
+static pthread_mutex_t rebuilt_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void add_rebuilt(const char *topath) {
+    char *copy = strdup(topath);
+    pthread_mutex_lock(&rebuilt_mutex);
+    sll_push(&rebuilt, copy);
+    pthread_mutex_unlock(&rebuilt_mutex);
+}
+
+/* drop the treesummaries of every index directory above the rebuilt directories */
+static void drop_ancestor_treesummaries(void) {
+    /* ancestors that have already been handled, along with all of their ancestors */
+    sqlite3 *seen = NULL;
+    sqlite3_stmt *insert = NULL;
+    if ((sqlite3_open(":memory:", &seen) != SQLITE_OK) ||
+        (sqlite3_exec(seen, "CREATE TABLE seen(path TEXT PRIMARY KEY);", NULL, NULL, NULL) != SQLITE_OK) ||
+        (sqlite3_prepare_v2(seen, "INSERT OR IGNORE INTO seen VALUES (?);", -1, &insert, NULL) != SQLITE_OK)) {
+        fprintf(stderr, "Could not track rebuilt directories: %s\n", sqlite3_errmsg(seen));
+        sqlite3_close(seen);
+        return;
+    }
+
+    const size_t nameto_len = strlen(in.nameto);
+
+    sll_loop(&rebuilt, node) {
+        char dir[MAXPATH];
+        const char *topath = (const char *) sll_node_data(node);
+        SNFORMAT_S(dir, MAXPATH, 1, topath, strlen(topath));
+
+        while (1) {
+            /* go up one level, but not above the index */
+            char *slash = strrchr(dir, '/');
+            while (slash && (slash > dir) && (slash[-1] == '/')) {
+                slash--;
+            }
+            if (!slash || ((size_t) (slash - dir) < nameto_len)) {
+                break;
+            }
+            *slash = '\0';
+
+            sqlite3_bind_text(insert, 1, dir, -1, SQLITE_STATIC);
+            sqlite3_step(insert);
+            sqlite3_reset(insert);
+            if (!sqlite3_changes(seen)) {
+                break;
+            }
+
+            char dbname[MAXPATH];
+            SNPRINTF(dbname, MAXPATH, "%s/" DBNAME, dir);
+            if (access(dbname, F_OK) != 0) {
+                continue;
+            }
+
+            sqlite3 *db = opendb(dbname, SQLITE_OPEN_READWRITE, PRAGMA_ROLLUP, 0
+                                 , NULL, NULL
+                                 #if defined(DEBUG) && defined(PER_THREAD_STATS)
+                                 , NULL, NULL
+                                 , NULL, NULL
+                                 #endif
+                                 );
+            if (db) {
+                drop_treesummary(dbname, db);
+                closedb(db);
+            }
+        }
+    }
+
+    sqlite3_finalize(insert);
+    sqlite3_close(seen);
+}
+
+/* push the subdirectories of an unchanged directory onto the queue */
+static void descend_unchanged(struct QPTPool *ctx, const size_t id,
+                              struct work *work, DIR *dir, const int dir_fd) {
+    if (work->level >= in.max_level) {
+        return;
+    }
+
+    struct BatchStat batch;
+    int done = 0;
+    while (!done) {
+        batch.count = 0;
+        while (1) {
+            struct dirent *entry = readdir(dir);
+            if (!entry) {
+                done = 1;
+                break;
+            }
+
+            const size_t len = strlen(entry->d_name);
+
+            /* skip . and .. */
+            if (entry->d_name[0] == '.') {
+                if ((len == 1) ||
+                    ((len == 2) && (entry->d_name[1] == '.'))) {
+                    continue;
+                }
+            }
+
+            /* only directories need to be stat-ed */
+            #ifdef _DIRENT_HAVE_D_TYPE
+            if ((entry->d_type != DT_DIR) && (entry->d_type != DT_UNKNOWN)) {
+                continue;
+            }
+            #endif
+
+            if (!batch_stat_add(&batch, entry->d_name, len)) {
+                break;
+            }
+        }
+
+        batch_stat(rings[id], dir_fd, &batch);
+
+        for(size_t i = 0; i < batch.count; i++) {
+            if ((batch.rc[i] != 0) || !S_ISDIR(batch.st[i].st_mode)) {
+                continue;
+            }
+
+            struct work *copy = (struct work *) calloc(1, sizeof(struct work));
+            SNFORMAT_S(copy->name, MAXPATH, 3, work->name, strlen(work->name), "/", 1, batch.names[i], batch.name_lens[i]);
+            copy->statuso = batch.st[i];
+            if (in.doxattrs > 0) {
+                copy->xattrs_len = pullxattrs(copy->name, copy->xattrs, sizeof(copy->xattrs));
+            }
+            copy->type[0] = 'd';
+            copy->pinode = work->statuso.st_ino;
+            copy->level = work->level + 1;
+
+            QPTPool_enqueue(ctx, id, processdir, copy);
+        }
+    }
+}
+
+/* remove the index directories of subdirectories that no longer exist in the source */
+static void remove_deleted_subdirs(const char *topath, const int dir_fd) {
+    DIR *index = opendir(topath);
+    if (!index) {
+        return;
+    }
+
+    struct dirent *entry = NULL;
+    while ((entry = readdir(index))) {
+        const size_t len = strlen(entry->d_name);
+        if (entry->d_name[0] == '.') {
+            if ((len == 1) ||
+                ((len == 2) && (entry->d_name[1] == '.'))) {
+                continue;
+            }
+        }
+
+        #ifdef _DIRENT_HAVE_D_TYPE
+        if ((entry->d_type != DT_DIR) && (entry->d_type != DT_UNKNOWN)) {
+            continue;
+        }
+        #endif
+
+        char child[MAXPATH];
+        SNFORMAT_S(child, MAXPATH, 3, topath, strlen(topath), "/", 1, entry->d_name, len);
+
+        struct stat st;
+        if ((lstat(child, &st) != 0) || !S_ISDIR(st.st_mode)) {
+            continue;
+        }
+
+        /* the source still has a directory with this name */
+        if ((lstat_at(dir_fd, entry->d_name, &st) == 0) && S_ISDIR(st.st_mode)) {
+            continue;
+        }
+
+        if (remove_tree(child) != 0) {
+            const int err = errno;
+            fprintf(stderr, "Could not remove %s: %d %s\n", child, err, strerror(err));
+        }
+    }
+
+    closedir(index);
+}
+
+int processdir(struct QPTPool *ctx, const size_t id, void *data, void *args) {
+    #if BENCHMARK
+    pthread_mutex_lock(&global_mutex);
+    total_dirs++;
+    pthread_mutex_unlock(&global_mutex);
+    #endif
+
+    /* skip argument checking */
+    /* if (!data) { */
+    /*     return 1; */
+    /* } */
+
+    /* if (!ctx || (id >= ctx->size)) { */
+    /*     free(data); */
+    /*     return 1; */
+    /* } */
+
+    struct work *work = (struct work *) data;
+
+    DIR *dir = opendir(work->name);
+    if (!dir) {
+        fprintf(stderr, "Could not open directory \"%s\"\n", work->name);
+        return 1;
+    }
+
+    /* the source directory's metadata was collected by its parent */
+    /* (or validate_inputs for the root), so it is not stat-ed again */
+    const struct stat *dir_st = &work->statuso;
+    const int dir_fd = dirfd(dir);
+
+    /* create the directory */
+    char topath[MAXPATH];
+    SNPRINTF(topath, MAXPATH, "%s/%s", in.nameto, work->name + in.name_len); /* offset by in.name_len to remove prefix */
+    int rc = mkdir(topath, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);           /* don't need recursion because parent is guaranteed to exist */
+    if (rc < 0) {
+        const int err = errno;
+        if (err != EEXIST) {
+            fprintf(stderr, "mkdir %s failure: %d %s\n", topath, err, strerror(err));
+            closedir(dir);
+            return 1;
+        }
+    }
+
+    /* create the database name */
+    char dbname[MAXPATH];
+    SNPRINTF(dbname, MAXPATH, "%s/" DBNAME, topath);
+
+    if (in.incremental) {
+        /* keep the existing database and only look for subdirectories */
+        if (dir_unchanged(dbname, dir_st)) {
+            descend_unchanged(ctx, id, work, dir, dir_fd);
+            closedir(dir);
+            free(work);
+            return 0;
+        }
+
+        add_rebuilt(topath);
+
+        /* the directory's contents changed, so some subdirectories might have been removed */
+        remove_deleted_subdirs(topath, dir_fd);
+
+        /* build the new database next to the existing one */
+        SNPRINTF(dbname, MAXPATH, "%s/" DBNAME INCREMENTAL_SUFFIX, topath);
+    }
+
+    sqlite3 *db = NULL;
+    if (in.build_in_memory) {
+        /* the database is written to dbname after it has been filled */
+        db = template_to_memdb(templateimage, templatesize);
+    }
+    else {
+        /* copy the template file */
+        if (copy_template(templatefd, dbname, templatesize, dir_st->st_uid, dir_st->st_gid)) {
+            closedir(dir);
+            return 1;
+        }
+
+        db = opendb(dbname, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, PRAGMA_BUILD, 0
+                    , NULL, NULL
+                    #if defined(DEBUG) && defined(PER_THREAD_STATS)
+                    , NULL, NULL
+                    , NULL, NULL
+                    #endif
+                    );
+    }
+
+    if (!db) {
+        closedir(dir);
+        return 1;
+    }
+
+    /* prepare to insert into the database */
+    struct sum summary;
+    zeroit(&summary);
+
+    sqlite3_stmt *res = insertdbprep(db);
+
+    startdb(db);
+
+    /* only set up if this directory has too many entries */
+    struct split_dir *split = NULL;
+    struct chunk *chunk = NULL;
+
+    /* stat the entries in batches so that the stats can be in flight at the same time */
+    struct BatchStat batch;
+    int done = 0;
+    size_t kept = 0;
+    while (!done) {
+        batch.count = 0;
+        while (1) {
+            struct dirent *entry = readdir(dir);
+            if (!entry) {
+                done = 1;
+                break;
+            }
+
+            const size_t len = strlen(entry->d_name);
+
+            /* skip . and .. */
+            if (entry->d_name[0] == '.') {
+                if ((len == 1) ||
+                    ((len == 2) && (entry->d_name[1] == '.'))) {
+                    continue;
+                }
+            }
+
+            /* hand the entries past the threshold to other threads */
+            if (in.split_threshold && (kept >= in.split_threshold)) {
+                if (!split) {
+                    split = split_init(work, dir_fd, topath, dbname);
+                }
+
+                if (!chunk) {
+                    chunk = chunk_init(split);
+                }
+
+                chunk_add(chunk, entry->d_name, len);
+
+                if (chunk->count == in.split_threshold) {
+                    QPTPool_enqueue(ctx, id, processchunk, chunk);
+                    chunk = NULL;
+                }
+
+                continue;
+            }
+
+            kept++;
+
+            if (!batch_stat_add(&batch, entry->d_name, len)) {
+                break;
+            }
+        }
+
+        process_batch(ctx, id, work, dir_fd, &batch, db, res, &summary);
+    }
+
+    if (chunk) {
+        QPTPool_enqueue(ctx, id, processchunk, chunk);
+    }
 
     stopdb(db);
     insertdbfin(res);
-    insertsumdb(db, work, &summary);
-    closedb(db);
-    db = NULL;
 
-    /* ignore errors */
-    chmod(topath, work->statuso.st_mode);
-    chown(topath, work->statuso.st_uid, work->statuso.st_gid);
+    if (split) {
+        /* the last thread working on this directory writes the database */
+        split->db = db;
+        closedir(dir);
+        split_release(args, id, split, &summary, 0);
+        return 0;
+    }
+
+    insertsumdb(db, work, &summary);
+    index_entries(dbname, db, &summary);
+    finishdb(args, id, work, topath, dbname, db);
 
     closedir(dir);
 
@@ -396,6 +1097,9 @@ struct work *validate_inputs() {
         return NULL;
     }
 
+    /* a catalog from a previous index would be missing any new directories */
+    catalog_remove(dst_path);
+
     if (in.doxattrs > 0) {
         root->xattrs_len = pullxattrs(in.name, root->xattrs, sizeof(root->xattrs));
     }
@@ -412,7 +1116,7 @@ void sub_help() {
 }
 
 int main(int argc, char *argv[]) {
-    int idx = parse_cmd_line(argc, argv, "hHn:xz:", 2, "input_dir output_dir", &in);
+    int idx = parse_cmd_line(argc, argv, "hHn:xz:Mq:k:UQ:", 2, "input_dir output_dir", &in);
     if (in.helped)
         sub_help();
     if (idx < 0)
@@ -455,11 +1159,44 @@ int main(int argc, char *argv[]) {
         return -1;
     }
 
+    if (in.build_in_memory) {
+        if (!(templateimage = load_template_image(templatefd, templatesize))) {
+            close(templatefd);
+            return -1;
+        }
+    }
+
     #if BENCHMARK
     struct start_end benchmark;
     clock_gettime(CLOCK_MONOTONIC, &benchmark.start);
     #endif
 
+    /* optional pool of threads that only write to the index */
+    struct QPTPool *writers = NULL;
+    if (in.write_threads) {
+        pending_images.max = IMAGES_PER_WRITER * in.write_threads;
+
+        writers = QPTPool_init(in.write_threads
+                               #if defined(DEBUG) && defined(PER_THREAD_STATS)
+                               , NULL
+                               #endif
+            );
+        if (!writers) {
+            fprintf(stderr, "Failed to initialize writer thread pool\n");
+            return -1;
+        }
+
+        if (QPTPool_start(writers, NULL) != (size_t) in.write_threads) {
+            fprintf(stderr, "Failed to start writer threads\n");
+            return -1;
+        }
+    }
+
+    rings = (struct BatchStatRing **) calloc(in.maxthreads, sizeof(struct BatchStatRing *));
+    for(int i = 0; i < in.maxthreads; i++) {
+        rings[i] = batch_stat_ring_init();
+    }
+
     struct QPTPool *pool = QPTPool_init(in.maxthreads
                                         #if defined(DEBUG) && defined(PER_THREAD_STATS)
                                         , NULL
@@ -470,15 +1207,28 @@ int main(int argc, char *argv[]) {
         return -1;
     }
 
-    if (QPTPool_start(pool, NULL) != (size_t) in.maxthreads) {
+    if (QPTPool_start(pool, writers) != (size_t) in.maxthreads) {
         fprintf(stderr, "Failed to start threads\n");
         return -1;
     }
 
+    sll_init(&rebuilt);
+
     QPTPool_enqueue(pool, 0, processdir, root);
     QPTPool_wait(pool);
     QPTPool_destroy(pool);
 
+    /* the scanners are done, so no more databases will be queued */
+    if (writers) {
+        QPTPool_wait(writers);
+        QPTPool_destroy(writers);
+    }
+
+    if (in.incremental) {
+        drop_ancestor_treesummaries();
+        sll_destroy(&rebuilt, free);
+    }
+
     #if BENCHMARK
     clock_gettime(CLOCK_MONOTONIC, &benchmark.end);
     const long double processtime = sec(nsec(&benchmark));
@@ -490,7 +1240,18 @@ int main(int argc, char *argv[]) {
     fprintf(stderr, "Files/Sec:             %.2Lf\n",  total_files / processtime);
     #endif
 
+    for(int i = 0; i < in.maxthreads; i++) {
+        batch_stat_ring_destroy(rings[i]);
+    }
+    free(rings);
+
+    free(templateimage);
     close(templatefd);
 
+    if (write_errors) {
+        fprintf(stderr, "Could not write %zu databases\n", write_errors);
+        return -1;
+    }
+
     return 0;
 }
@@ -72,6 +72,7 @@ OF SUCH DAMAGE.
 #include <unistd.h>
 
 #include "QueuePerThreadPool.h"
+#include "batch_stat.h"
 #include "bf.h"
 #include "debug.h"
 #include "dbutils.h"
@@ -82,6 +83,8 @@ OF SUCH DAMAGE.
 
 extern int errno;
 
+struct BatchStatRing **rings = NULL; /* one per thread - NULL entries mean synchronous stats */
+
 #if BENCHMARK
 #include <time.h>
 
@@ -118,13 +121,9 @@ int processdir(struct QPTPool *ctx, const size_t id, void *data, void *args) {
         return 1;
     }
 
-    /* get source directory info */
-    struct stat dir_st;
-    if (lstat(work->name, &dir_st) < 0)  {
-        closedir(dir);
-        free(data);
-        return 1;
-    }
+    /* the source directory's metadata was collected by its parent */
+    /* (or validate_inputs for the root), so it is not stat-ed again */
+    const int dir_fd = dirfd(dir);
 
     /* get a copy of the full source path */
     char work_name[MAXPATH];
@@ -135,75 +134,97 @@ int processdir(struct QPTPool *ctx, const size_t id, void *data, void *args) {
     SNFORMAT_S(work->name, MAXPATH, 1, work_name + in.name_len, work_name_len - in.name_len);
     worktofile(gts.outfd[id], in.delim, work);
 
-    struct dirent *entry = NULL;
+    /* stat the entries in batches so that the stats can be in flight at the same time */
+    struct BatchStat batch;
+    int done = 0;
     size_t rows = 0;
-    while ((entry = readdir(dir))) {
-        /* skip . and .. */
-        if (entry->d_name[0] == '.') {
-            size_t len = strlen(entry->d_name);
-            if ((len == 1) ||
-                ((len == 2) && (entry->d_name[1] == '.'))) {
-                continue;
+    while (!done) {
+        batch.count = 0;
+        while (1) {
+            struct dirent *entry = readdir(dir);
+            if (!entry) {
+                done = 1;
+                break;
+            }
+
+            /* skip . and .. */
+            const size_t len = strlen(entry->d_name);
+            if (entry->d_name[0] == '.') {
+                if ((len == 1) ||
+                    ((len == 2) && (entry->d_name[1] == '.'))) {
+                    continue;
+                }
+            }
+
+            if (!batch_stat_add(&batch, entry->d_name, len)) {
+                break;
             }
         }
 
-        /* get entry path */
-        struct work e;
-        memset(&e, 0, sizeof(struct work));
+        batch_stat(rings[id], dir_fd, &batch);
 
-        char fullpath[MAXPATH];
-        const size_t fullpath_len = SNPRINTF(fullpath, MAXPATH, "%s/%s", work_name, entry->d_name);
+        for(size_t i = 0; i < batch.count; i++) {
+            const char *d_name = batch.names[i];
 
-        /* the name that is stored in trace does not have the prefix */
-        memcpy(e.name, fullpath + in.name_len, fullpath_len - in.name_len);
+            /* get entry path */
+            struct work e;
+            memset(&e, 0, sizeof(struct work));
 
-        /* get the entry's metadata */
-        if (lstat(fullpath, &e.statuso) < 0) {
-            continue;
-        }
+            char fullpath[MAXPATH];
+            const size_t fullpath_len = SNFORMAT_S(fullpath, MAXPATH, 3, work_name, work_name_len, "/", (size_t) 1, d_name, batch.name_lens[i]);
 
-        e.xattrs_len = 0;
-        if (in.doxattrs > 0) {
-            e.xattrs_len = pullxattrs(e.name, e.xattrs, sizeof(e.xattrs));
-        }
+            /* the name that is stored in trace does not have the prefix */
+            memcpy(e.name, fullpath + in.name_len, fullpath_len - in.name_len);
 
-        /* push subdirectories onto the queue */
-        if (S_ISDIR(e.statuso.st_mode)) {
-            e.type[0] = 'd';
-            e.pinode = work->statuso.st_ino;
+            /* the entry's metadata */
+            if (batch.rc[i] != 0) {
+                continue;
+            }
+            e.statuso = batch.st[i];
 
-            /* make a copy here so that the data can be pushed into the queue */
-            /* this is more efficient than malloc+free for every single entry */
-            struct work *copy = (struct work *) calloc(1, sizeof(struct work));
-            memcpy(copy, &e, sizeof(struct work));
-            memcpy(copy->name, fullpath, fullpath_len);
+            e.xattrs_len = 0;
+            if (in.doxattrs > 0) {
+                e.xattrs_len = pullxattrs(e.name, e.xattrs, sizeof(e.xattrs));
+            }
 
-            QPTPool_enqueue(ctx, id, processdir, copy);
-            continue;
-        }
+            /* push subdirectories onto the queue */
+            if (S_ISDIR(e.statuso.st_mode)) {
+                e.type[0] = 'd';
+                e.pinode = work->statuso.st_ino;
 
-        rows++;
+                /* make a copy here so that the data can be pushed into the queue */
+                /* this is more efficient than malloc+free for every single entry */
+                struct work *copy = (struct work *) calloc(1, sizeof(struct work));
+                memcpy(copy, &e, sizeof(struct work));
+                memcpy(copy->name, fullpath, fullpath_len);
 
-        /* non directories */
-        if (S_ISLNK(e.statuso.st_mode)) {
-            e.type[0] = 'l';
-            readlink(fullpath, e.linkname, MAXPATH);
-        }
-        else if (S_ISREG(e.statuso.st_mode)) {
-            e.type[0] = 'f';
-        }
-        else {
-            /* other types are not stored */
-            continue;
-        }
+                QPTPool_enqueue(ctx, id, processdir, copy);
+                continue;
+            }
+
+            rows++;
+
+            /* non directories */
+            if (S_ISLNK(e.statuso.st_mode)) {
+                e.type[0] = 'l';
+                readlinkat(dir_fd, d_name, e.linkname, MAXPATH);
+            }
+            else if (S_ISREG(e.statuso.st_mode)) {
+                e.type[0] = 'f';
+            }
+            else {
+                /* other types are not stored */
+                continue;
+            }
 
-        #if BENCHMARK
-        pthread_mutex_lock(&global_mutex);
-        total_files++;
-        pthread_mutex_unlock(&global_mutex);
-        #endif
+            #if BENCHMARK
+            pthread_mutex_lock(&global_mutex);
+            total_files++;
+            pthread_mutex_unlock(&global_mutex);
+            #endif
 
-        worktofile(gts.outfd[id], in.delim, &e);
+            worktofile(gts.outfd[id], in.delim, &e);
+        }
     }
 
     closedir(dir);
@@ -331,6 +352,11 @@ int main(int argc, char *argv[]) {
     clock_gettime(CLOCK_MONOTONIC, &benchmark.start);
     #endif
 
+    rings = (struct BatchStatRing **) calloc(in.maxthreads, sizeof(struct BatchStatRing *));
+    for(int i = 0; i < in.maxthreads; i++) {
+        rings[i] = batch_stat_ring_init();
+    }
+
     struct QPTPool *pool = QPTPool_init(in.maxthreads
                                         #if defined(DEBUG) && defined(PER_THREAD_STATS)
                                         , NULL
@@ -352,6 +378,11 @@ int main(int argc, char *argv[]) {
 
     outfiles_fin(gts.outfd, in.maxthreads);
 
+    for(int i = 0; i < in.maxthreads; i++) {
+        batch_stat_ring_destroy(rings[i]);
+    }
+    free(rings);
+
     #if BENCHMARK
     clock_gettime(CLOCK_MONOTONIC, &benchmark.end);
     const long double processtime = sec(nsec(&benchmark));
@@ -0,0 +1,1162 @@
+/*
+This file is part of GUFI, which is part of MarFS, which is released
+under the BSD license.
+
+
+Copyright (c) 2017, Los Alamos National Security (LANS), LLC
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+From Los Alamos National Security, LLC:
+LA-CC-15-039
+
+Copyright (c) 2017, Los Alamos National Security, LLC All rights reserved.
+Copyright 2017. Los Alamos National Security, LLC. This software was produced
+under U.S. Government contract DE-AC52-06NA25396 for Los Alamos National
+Laboratory (LANL), which is operated by Los Alamos National Security, LLC for
+the U.S. Department of Energy. The U.S. Government has rights to use,
+reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR LOS
+ALAMOS NATIONAL SECURITY, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR
+ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is
+modified to produce derivative works, such modified software should be
+clearly marked, so as not to confuse it with the version available from
+LANL.
+
+THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+
+
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <search.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "QueuePerThreadPool.h"
+#include "bf.h"
+#include "catalog.h"
+#include "columns.h"
+#include "dbutils.h"
+#include "template_db.h"
+#include "trace.h"
+#include "utils.h"
+
+extern int errno;
+
+int templatefd = -1;        /* this is really a constant that is set at runtime */
+off_t templatesize = 0;     /* this is really a constant that is set at runtime */
+
+/* first field of each line (see docs/gufi_events2index) */
+#define EVENT_CREATE  'c'
+#define EVENT_UNLINK  'u'
+#define EVENT_RENAME  'r'
+#define EVENT_SETATTR 's'
+
+/* maximum number of events held before they are applied */
+#define MAX_PENDING_EVENTS 65536
+
+/* maximum number of directories with treesummary changes held before they are applied */
+#define MAX_PENDING_DELTAS 65536
+
+/* a change to the database of one directory */
+struct event {
+    char op;              /* EVENT_CREATE, EVENT_UNLINK, or EVENT_SETATTR (renames are split) */
+    int self;             /* the event changes the metadata of dir itself instead of an entry */
+    char *dir;            /* directory whose database is changed, relative to the index root */
+    char *name;           /* name of the entry inside of dir */
+    char *record;         /* trace record of the entry (not used by EVENT_UNLINK) */
+    size_t record_len;
+};
+
+/* events that have been read but not applied */
+struct event pending[MAX_PENDING_EVENTS];
+size_t pending_count = 0;
+
+/* the events of one directory, in the order they were read */
+struct group {
+    struct event **events;
+    size_t count;
+    struct sum delta;     /* change in the directory's summary */
+    int changed;
+};
+
+/* changes to apply to the treesummary tables of ancestors */
+struct delta {
+    char *path;
+    struct sum sum;
+};
+
+/* one merged delta per directory, found by path through delta_tree */
+struct delta **deltas = NULL;
+size_t delta_count = 0;
+size_t delta_capacity = 0;
+void *delta_tree = NULL;
+
+/* the thread pool is kept for the whole run */
+struct QPTPool *pool = NULL;
+
+/* items given to the pool that have not been processed yet */
+struct batch {
+    size_t remaining;
+    size_t errors;        /* over the whole run */
+    pthread_mutex_t mutex;
+    pthread_cond_t cv;
+};
+
+struct batch batch = {0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+/* the deltas are also applied to the catalog of the index, if there is one */
+struct catalog catalog;
+
+/* the catalog can't describe a tree with different directories */
+static void drop_catalog(void) {
+    catalog_close(&catalog);
+    catalog_remove(in.nameto);
+}
+
+/* a delta that changes nothing */
+static void delta_init(struct sum *delta) {
+    zeroit(delta);
+    delta->totsubdirs = 0;
+}
+
+static void delta_merge(struct sum *dst, const struct sum *src) {
+    dst->totsubdirs += src->totsubdirs;
+    dst->totfiles   += src->totfiles;
+    dst->totlinks   += src->totlinks;
+    dst->totsize    += src->totsize;
+    dst->totltk     += src->totltk;
+    dst->totmtk     += src->totmtk;
+    dst->totltm     += src->totltm;
+    dst->totmtm     += src->totmtm;
+    dst->totmtg     += src->totmtg;
+    dst->totmtt     += src->totmtt;
+    dst->totxattr   += src->totxattr;
+    dst->totossint1 += src->totossint1;
+    dst->totossint2 += src->totossint2;
+    dst->totossint3 += src->totossint3;
+    dst->totossint4 += src->totossint4;
+
+    if (src->minuid     < dst->minuid)     dst->minuid     = src->minuid;
+    if (src->maxuid     > dst->maxuid)     dst->maxuid     = src->maxuid;
+    if (src->mingid     < dst->mingid)     dst->mingid     = src->mingid;
+    if (src->maxgid     > dst->maxgid)     dst->maxgid     = src->maxgid;
+    if (src->minsize    < dst->minsize)    dst->minsize    = src->minsize;
+    if (src->maxsize    > dst->maxsize)    dst->maxsize    = src->maxsize;
+    if (src->minblocks  < dst->minblocks)  dst->minblocks  = src->minblocks;
+    if (src->maxblocks  > dst->maxblocks)  dst->maxblocks  = src->maxblocks;
+    if (src->minctime   < dst->minctime)   dst->minctime   = src->minctime;
+    if (src->maxctime   > dst->maxctime)   dst->maxctime   = src->maxctime;
+    if (src->minmtime   < dst->minmtime)   dst->minmtime   = src->minmtime;
+    if (src->maxmtime   > dst->maxmtime)   dst->maxmtime   = src->maxmtime;
+    if (src->minatime   < dst->minatime)   dst->minatime   = src->minatime;
+    if (src->maxatime   > dst->maxatime)   dst->maxatime   = src->maxatime;
+    if (src->mincrtime  < dst->mincrtime)  dst->mincrtime  = src->mincrtime;
+    if (src->maxcrtime  > dst->maxcrtime)  dst->maxcrtime  = src->maxcrtime;
+    if (src->minossint1 < dst->minossint1) dst->minossint1 = src->minossint1;
+    if (src->maxossint1 > dst->maxossint1) dst->maxossint1 = src->maxossint1;
+    if (src->minossint2 < dst->minossint2) dst->minossint2 = src->minossint2;
+    if (src->maxossint2 > dst->maxossint2) dst->maxossint2 = src->maxossint2;
+    if (src->minossint3 < dst->minossint3) dst->minossint3 = src->minossint3;
+    if (src->maxossint3 > dst->maxossint3) dst->maxossint3 = src->maxossint3;
+    if (src->minossint4 < dst->minossint4) dst->minossint4 = src->minossint4;
+    if (src->maxossint4 > dst->maxossint4) dst->maxossint4 = src->maxossint4;
+}
+
+/* remove the totals of a summary (minimums and maximums are left alone) */
+static void delta_subtract(struct sum *dst, const struct sum *src) {
+    struct sum negative;
+    delta_init(&negative);
+    negative.totsubdirs = -src->totsubdirs;
+    negative.totfiles   = -src->totfiles;
+    negative.totlinks   = -src->totlinks;
+    negative.totsize    = -src->totsize;
+    negative.totltk     = -src->totltk;
+    negative.totmtk     = -src->totmtk;
+    negative.totltm     = -src->totltm;
+    negative.totmtm     = -src->totmtm;
+    negative.totmtg     = -src->totmtg;
+    negative.totmtt     = -src->totmtt;
+    negative.totxattr   = -src->totxattr;
+    negative.totossint1 = -src->totossint1;
+    negative.totossint2 = -src->totossint2;
+    negative.totossint3 = -src->totossint3;
+    negative.totossint4 = -src->totossint4;
+    delta_merge(dst, &negative);
+}
+
+static int compare_deltas(const void *lhs, const void *rhs) {
+    return strcmp(((struct delta *) lhs)->path, ((struct delta *) rhs)->path);
+}
+
+/* whether or not the treesummary of dir has changes that have not been applied */
+static int has_delta(const char *dir) {
+    struct delta key;
+    key.path = (char *) dir;
+    return (tfind(&key, &delta_tree, compare_deltas) != NULL);
+}
+
+/*
+ * queue a change for the treesummary of dir and all of its ancestors
+ *
+ * changes to the same directory are merged
+ *
+ * if strict is set, dir itself is skipped
+ */
+static void add_ancestor_deltas(const char *dir, const int strict, const struct sum *sum) {
+    char path[MAXPATH];
+    size_t len = SNPRINTF(path, MAXPATH, "%s", dir);
+
+    int skip = strict;
+    while (1) {
+        if (!skip) {
+            struct delta key;
+            key.path = path;
+
+            struct delta **found = tfind(&key, &delta_tree, compare_deltas);
+            if (found) {
+                delta_merge(&(*found)->sum, sum);
+            }
+            else {
+                if (delta_count == delta_capacity) {
+                    delta_capacity = delta_capacity?(delta_capacity * 2):1024;
+                    deltas = realloc(deltas, delta_capacity * sizeof(struct delta *));
+                }
+
+                struct delta *delta = malloc(sizeof(struct delta));
+                delta->path = strdup(path);
+                delta->sum = *sum;
+                deltas[delta_count++] = delta;
+                tsearch(delta, &delta_tree, compare_deltas);
+            }
+        }
+        skip = 0;
+
+        /* the index root has been reached */
+        if (!len) {
+            break;
+        }
+
+        /* remove the last path component */
+        while (len && (path[len - 1] != '/')) {
+            len--;
+        }
+        while (len && (path[len - 1] == '/')) {
+            len--;
+        }
+        path[len] = '\0';
+    }
+}
+
+/* path of a directory's database in the index */
+static void indexpath(char *dst, const char *dir, const char *name) {
+    if (dir[0]) {
+        SNFORMAT_S(dst, MAXPATH, 5, in.nameto, strlen(in.nameto), "/", (size_t) 1, dir, strlen(dir), "/", (size_t) 1, name, strlen(name));
+    }
+    else {
+        SNFORMAT_S(dst, MAXPATH, 3, in.nameto, strlen(in.nameto), "/", (size_t) 1, name, strlen(name));
+    }
+}
+
+/*
+ * the subdirectories of a packed directory only exist in its
+ * database (see gufi_pack), so nothing under it can be changed
+ */
+static int under_packed(const char *path, const size_t path_len) {
+    char dir[MAXPATH];
+    size_t len = SNPRINTF(dir, MAXPATH, "%.*s", (int) path_len, path);
+
+    while (len) {
+        /* remove the last path component */
+        while (len && (dir[len - 1] != '/')) {
+            len--;
+        }
+        while (len && (dir[len - 1] == '/')) {
+            len--;
+        }
+        dir[len] = '\0';
+
+        char indexdir[MAXPATH];
+        indexpath(indexdir, dir, "");
+        if (is_packed(indexdir)) {
+            fprintf(stderr, "%s is packed - unpack it with unrollup before applying events under it\n", indexdir);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static sqlite3 *openindexdb(const char *dbname) {
+    return opendb(dbname, SQLITE_OPEN_READWRITE, PRAGMA_ROLLUP, 0
+                  , NULL, NULL
+                  #if defined(DEBUG) && defined(PER_THREAD_STATS)
+                  , NULL, NULL
+                  , NULL, NULL
+                  #endif
+                  );
+}
+
+static int has_table(sqlite3 *db, const char *table) {
+    sqlite3_stmt *res = NULL;
+    if (sqlite3_prepare_v2(db, "SELECT COUNT(*) FROM sqlite_master WHERE type == 'table' AND name == ?;", MAXSQL, &res, NULL) != SQLITE_OK) {
+        return 0;
+    }
+
+    sqlite3_bind_text(res, 1, table, -1, SQLITE_STATIC);
+
+    int found = 0;
+    if (sqlite3_step(res) == SQLITE_ROW) {
+        found = sqlite3_column_int(res, 0);
+    }
+    sqlite3_finalize(res);
+
+    return found;
+}
+
+/* sum the entries table the same way the index builders do */
+static int resummarize(sqlite3 *db, struct sum *summary) {
+    zeroit(summary);
+
+    sqlite3_stmt *res = NULL;
+    if (sqlite3_prepare_v2(db, "SELECT type, uid, gid, size, blocks, atime, mtime, ctime, crtime, ossint1, ossint2, ossint3, ossint4, xattrs FROM entries;", MAXSQL, &res, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Could not read entries: %s\n", sqlite3_errmsg(db));
+        return 1;
+    }
+
+    while (sqlite3_step(res) == SQLITE_ROW) {
+        struct work row;
+        memset(&row, 0, sizeof(struct work));
+
+        SNPRINTF(row.type, 2, "%s", (const char *) sqlite3_column_text(res, 0));
+        row.statuso.st_uid    = sqlite3_column_int64(res, 1);
+        row.statuso.st_gid    = sqlite3_column_int64(res, 2);
+        row.statuso.st_size   = sqlite3_column_int64(res, 3);
+        row.statuso.st_blocks = sqlite3_column_int64(res, 4);
+        row.statuso.st_atime  = sqlite3_column_int64(res, 5);
+        row.statuso.st_mtime  = sqlite3_column_int64(res, 6);
+        row.statuso.st_ctime  = sqlite3_column_int64(res, 7);
+        row.crtime            = sqlite3_column_int64(res, 8);
+        row.ossint1           = sqlite3_column_int64(res, 9);
+        row.ossint2           = sqlite3_column_int64(res, 10);
+        row.ossint3           = sqlite3_column_int64(res, 11);
+        row.ossint4           = sqlite3_column_int64(res, 12);
+
+        const int xattrs_len = sqlite3_column_bytes(res, 13);
+        if ((xattrs_len > 0) && ((size_t) xattrs_len <= sizeof(row.xattrs))) {
+            memcpy(row.xattrs, sqlite3_column_blob(res, 13), xattrs_len);
+            row.xattrs_len = xattrs_len;
+        }
+
+        sumit(summary, &row);
+    }
+
+    sqlite3_finalize(res);
+
+    return 0;
+}
+
+/* replace the directory's own metadata in its summary */
+static int update_dir(sqlite3 *db, const char *dir, struct work *work) {
+    static const char UPDATE_DIR[] = "UPDATE summary SET name = ?, mode = ?, nlink = ?, uid = ?, gid = ?, size = ?, blksize = ?, blocks = ?, atime = ?, mtime = ?, ctime = ?, xattrs = ? WHERE isroot == 1;";
+
+    sqlite3_stmt *res = NULL;
+    if (sqlite3_prepare_v2(db, UPDATE_DIR, sizeof(UPDATE_DIR), &res, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Could not update directory %s: %s\n", dir, sqlite3_errmsg(db));
+        return 1;
+    }
+
+    char nameout[MAXPATH];
+    char shortname[MAXPATH];
+    shortpath(work->name, nameout, shortname);
+
+    sqlite3_bind_text (res, 1,  shortname, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(res, 2,  work->statuso.st_mode);
+    sqlite3_bind_int64(res, 3,  work->statuso.st_nlink);
+    sqlite3_bind_int64(res, 4,  work->statuso.st_uid);
+    sqlite3_bind_int64(res, 5,  work->statuso.st_gid);
+    sqlite3_bind_int64(res, 6,  work->statuso.st_size);
+    sqlite3_bind_int64(res, 7,  work->statuso.st_blksize);
+    sqlite3_bind_int64(res, 8,  work->statuso.st_blocks);
+    sqlite3_bind_int64(res, 9,  work->statuso.st_atime);
+    sqlite3_bind_int64(res, 10, work->statuso.st_mtime);
+    sqlite3_bind_int64(res, 11, work->statuso.st_ctime);
+    sqlite3_bind_blob64(res, 12, work->xattrs, work->xattrs_len, SQLITE_STATIC);
+
+    const int rc = sqlite3_step(res);
+    sqlite3_finalize(res);
+
+    return (rc != SQLITE_DONE);
+}
+
+/* mark one item of the current batch as processed */
+static void batch_done(const int rc) {
+    pthread_mutex_lock(&batch.mutex);
+    if (rc) {
+        batch.errors++;
+    }
+    if (--batch.remaining == 0) {
+        pthread_cond_broadcast(&batch.cv);
+    }
+    pthread_mutex_unlock(&batch.mutex);
+}
+
+/* wait for all items of the current batch to be processed */
+static void batch_wait(void) {
+    pthread_mutex_lock(&batch.mutex);
+    while (batch.remaining) {
+        pthread_cond_wait(&batch.cv, &batch.mutex);
+    }
+    pthread_mutex_unlock(&batch.mutex);
+}
+
+/* apply all of the events of one directory in a single transaction */
+static int update_group(struct group *group) {
+    const char *dir = group->events[0]->dir;
+
+    char dbname[MAXPATH];
+    indexpath(dbname, dir, DBNAME);
+
+    /* directories under packed directories are not in the index tree */
+    if ((access(dbname, F_OK) != 0) && under_packed(dir, strlen(dir))) {
+        return 1;
+    }
+
+    int rc = 0;
+
+    sqlite3 *db = openindexdb(dbname);
+    if (!db) {
+        return 1;
+    }
+
+    /* previous values for the ancestors' treesummaries */
+    struct sum old;
+    int recs = 0;
+    zeroit(&old);
+    querytsdb(dbname, &old, db, &recs, 0);
+
+    sqlite3_stmt *del = NULL;
+    if (sqlite3_prepare_v2(db, "DELETE FROM entries WHERE name == ?;", MAXSQL, &del, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Could not prepare delete for %s: %s\n", dbname, sqlite3_errmsg(db));
+        closedb(db);
+        return 1;
+    }
+
+    sqlite3_stmt *res = insertdbprep(db);
+
+    startdb(db);
+
+    for(size_t i = 0; i < group->count; i++) {
+        struct event *event = group->events[i];
+
+        struct work work;
+        memset(&work, 0, sizeof(struct work));
+        if (event->record) {
+            linetowork(event->record, event->record_len, in.delim, &work);
+        }
+
+        if (event->self) {
+            update_dir(db, dir, &work);
+
+            /* keep the index directory's permissions in sync like the builders do */
+            char topath[MAXPATH];
+            indexpath(topath, dir, "");
+            chmod(topath, work.statuso.st_mode);
+            chown(topath, work.statuso.st_uid, work.statuso.st_gid);
+            continue;
+        }
+
+        /* creates and setattrs replace the existing row */
+        /* insertdbgo stores names escaped, so match the escaped name */
+        char *zname = sqlite3_mprintf("%q", event->name);
+        sqlite3_bind_text(del, 1, zname, -1, SQLITE_STATIC);
+        sqlite3_step(del);
+        sqlite3_reset(del);
+        sqlite3_free(zname);
+
+        if (event->op != EVENT_UNLINK) {
+            if ((work.type[0] == 'f') || (work.type[0] == 'l')) {
+                insertdbgo(&work, db, res);
+            }
+        }
+
+        group->changed = 1;
+    }
+
+    insertdbfin(res);
+    sqlite3_finalize(del);
+
+    if (group->changed) {
+        struct sum summary;
+        if (resummarize(db, &summary) == 0) {
+            updatesumdb(db, &summary);
+
+            /* the totals change by the difference, and the minimums */
+            /* and maximums can only be widened by the new values */
+            delta_merge(&group->delta, &summary);
+            delta_subtract(&group->delta, &old);
+        }
+        else {
+            /* the change is unknown, so leave the ancestors alone */
+            group->changed = 0;
+            rc = 1;
+        }
+
+        /* rolled up databases keep a copy of their own entries in pentries */
+        int rollupscore = 0;
+        get_rollupscore(dbname, db, &rollupscore);
+        if (rollupscore) {
+            char *err = NULL;
+            if (sqlite3_exec(db,
+                             "DELETE FROM pentries WHERE pinode == (SELECT inode FROM summary WHERE isroot == 1);"
+                             "INSERT INTO pentries SELECT entries.*, summary.inode FROM summary, entries WHERE summary.isroot == 1;",
+                             NULL, NULL, &err) != SQLITE_OK) {
+                fprintf(stderr, "Could not update pentries of %s: %s\n", dbname, err);
+                sqlite3_free(err);
+            }
+        }
+
+        update_namefilter(dbname, db);
+
+        char topath[MAXPATH];
+        indexpath(topath, dir, "");
+        update_columns(topath, db);
+    }
+
+    stopdb(db);
+    closedb(db);
+
+    return rc;
+}
+
+int apply_group(struct QPTPool *ctx, const size_t id, void *data, void *args) {
+    (void) ctx; (void) id; (void) args;
+
+    const int rc = update_group((struct group *) data);
+    batch_done(rc);
+    return rc;
+}
+
+/* add the changes to the treesummary of one directory */
+static int update_treesummary(struct delta *delta) {
+    struct sum *su = &delta->sum;
+
+    char dbname[MAXPATH];
+    indexpath(dbname, delta->path, DBNAME);
+
+    /* the directory might have been removed */
+    if (access(dbname, F_OK) != 0) {
+        return 0;
+    }
+
+    sqlite3 *db = openindexdb(dbname);
+    if (!db) {
+        return 1;
+    }
+
+    int rc = 0;
+    if (has_table(db, "treesummary")) {
+        char sqlstmt[MAXSQL];
+        SNPRINTF(sqlstmt, MAXSQL, "UPDATE treesummary SET "
+                 "totsubdirs = totsubdirs + %lld, totfiles = totfiles + %lld, totlinks = totlinks + %lld, totsize = totsize + %lld, "
+                 "totltk = totltk + %lld, totmtk = totmtk + %lld, totltm = totltm + %lld, totmtm = totmtm + %lld, totmtg = totmtg + %lld, totmtt = totmtt + %lld, "
+                 "totxattr = totxattr + %lld, totossint1 = totossint1 + %lld, totossint2 = totossint2 + %lld, totossint3 = totossint3 + %lld, totossint4 = totossint4 + %lld, "
+                 "minuid = min(minuid, %lld), maxuid = max(maxuid, %lld), mingid = min(mingid, %lld), maxgid = max(maxgid, %lld), "
+                 "minsize = min(minsize, %lld), maxsize = max(maxsize, %lld), minblocks = min(minblocks, %lld), maxblocks = max(maxblocks, %lld), "
+                 "minctime = min(minctime, %lld), maxctime = max(maxctime, %lld), minmtime = min(minmtime, %lld), maxmtime = max(maxmtime, %lld), "
+                 "minatime = min(minatime, %lld), maxatime = max(maxatime, %lld), mincrtime = min(mincrtime, %lld), maxcrtime = max(maxcrtime, %lld) "
+                 "WHERE rectype == 0;",
+                 su->totsubdirs, su->totfiles, su->totlinks, su->totsize,
+                 su->totltk, su->totmtk, su->totltm, su->totmtm, su->totmtg, su->totmtt,
+                 su->totxattr, su->totossint1, su->totossint2, su->totossint3, su->totossint4,
+                 su->minuid, su->maxuid, su->mingid, su->maxgid,
+                 su->minsize, su->maxsize, su->minblocks, su->maxblocks,
+                 su->minctime, su->maxctime, su->minmtime, su->maxmtime,
+                 su->minatime, su->maxatime, su->mincrtime, su->maxcrtime);
+
+        char *err = NULL;
+        if (sqlite3_exec(db, sqlstmt, NULL, NULL, &err) != SQLITE_OK) {
+            fprintf(stderr, "Could not update treesummary of %s: %s\n", dbname, err);
+            sqlite3_free(err);
+            rc = 1;
+        }
+    }
+
+    /* new names are not in the subtree's name filter */
+    namefilter_delete(db, NAMEFILTER_TREE);
+
+    closedb(db);
+
+    if (catalog.records) {
+        const uint64_t record = catalog_find(&catalog, delta->path);
+        if (record < catalog.count) {
+            catalog_apply_delta(&catalog.records[record], su);
+        }
+    }
+
+    return rc;
+}
+
+int apply_delta(struct QPTPool *ctx, const size_t id, void *data, void *args) {
+    (void) ctx; (void) id; (void) args;
+
+    const int rc = update_treesummary((struct delta *) data);
+    batch_done(rc);
+    return rc;
+}
+
+static int compare_events(const void *lhs, const void *rhs) {
+    const struct event *l = * (struct event **) lhs;
+    const struct event *r = * (struct event **) rhs;
+    const int cmp = strcmp(l->dir, r->dir);
+    if (cmp) {
+        return cmp;
+    }
+
+    /* keep the order the events were read in */
+    return (l > r) - (l < r);
+}
+
+static struct QPTPool *start_pool() {
+    struct QPTPool *pool = QPTPool_init(in.maxthreads
+                                        #if defined(DEBUG) && defined(PER_THREAD_STATS)
+                                        , NULL
+                                        #endif
+        );
+    if (!pool) {
+        fprintf(stderr, "Failed to initialize thread pool\n");
+        return NULL;
+    }
+
+    if (QPTPool_start(pool, NULL) != (size_t) in.maxthreads) {
+        fprintf(stderr, "Failed to start threads\n");
+        QPTPool_destroy(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+/* apply the pending events grouped by directory */
+static void flush_events(void) {
+    if (!pending_count) {
+        return;
+    }
+
+    struct event **sorted = malloc(pending_count * sizeof(struct event *));
+    for(size_t i = 0; i < pending_count; i++) {
+        sorted[i] = &pending[i];
+    }
+    qsort(sorted, pending_count, sizeof(struct event *), compare_events);
+
+    struct group *groups = calloc(pending_count, sizeof(struct group));
+    size_t group_count = 0;
+    for(size_t i = 0; i < pending_count; i++) {
+        if (!group_count || strcmp(groups[group_count - 1].events[0]->dir, sorted[i]->dir)) {
+            groups[group_count].events = &sorted[i];
+            group_count++;
+        }
+        groups[group_count - 1].count++;
+    }
+
+    for(size_t i = 0; i < group_count; i++) {
+        delta_init(&groups[i].delta);
+    }
+
+    batch.remaining = group_count;
+    for(size_t i = 0; i < group_count; i++) {
+        QPTPool_enqueue(pool, i % in.maxthreads, apply_group, &groups[i]);
+    }
+    batch_wait();
+
+    for(size_t i = 0; i < group_count; i++) {
+        if (groups[i].changed) {
+            add_ancestor_deltas(groups[i].events[0]->dir, 0, &groups[i].delta);
+        }
+    }
+
+    free(groups);
+    free(sorted);
+
+    for(size_t i = 0; i < pending_count; i++) {
+        free(pending[i].dir);
+        free(pending[i].name);
+        free(pending[i].record);
+    }
+    pending_count = 0;
+}
+
+/* apply the merged treesummary changes */
+static void flush_deltas(void) {
+    if (!delta_count) {
+        return;
+    }
+
+    batch.remaining = delta_count;
+    for(size_t i = 0; i < delta_count; i++) {
+        QPTPool_enqueue(pool, i % in.maxthreads, apply_delta, deltas[i]);
+    }
+    batch_wait();
+
+    for(size_t i = 0; i < delta_count; i++) {
+        tdelete(deltas[i], &delta_tree, compare_deltas);
+        free(deltas[i]->path);
+        free(deltas[i]);
+    }
+    delta_count = 0;
+}
+
+/* apply the pending events, and then the treesummary changes */
+static void flush(void) {
+    flush_events();
+    flush_deltas();
+}
+
+/* whether or not path is dir or is under dir */
+static int in_subtree(const char *path, const char *dir, const size_t dir_len) {
+    return (strncmp(path, dir, dir_len) == 0) &&
+           ((path[dir_len] == '\0') || (path[dir_len] == '/') || !dir_len);
+}
+
+/*
+ * changes under a directory that is about to be moved or removed
+ * have to be applied first, so that its treesummary is up to date
+ * and no changes are left for the old paths
+ */
+static void flush_subtree(const char *dir, const size_t dir_len) {
+    for(size_t i = 0; i < pending_count; i++) {
+        if (in_subtree(pending[i].dir, dir, dir_len)) {
+            flush();
+            return;
+        }
+    }
+
+    /* every change under dir also changed dir */
+    char *path = strndup(dir, dir_len);
+    if (has_delta(path)) {
+        flush_deltas();
+    }
+    free(path);
+}
+
+/* split a path into the directory and name, removing extra slashes */
+static void split_path(const char *path, const size_t len, char **dir, char **name) {
+    size_t end = len;
+    while (end && (path[end - 1] == '/')) {
+        end--;
+    }
+
+    size_t start = end;
+    while (start && (path[start - 1] != '/')) {
+        start--;
+    }
+
+    size_t dir_end = start;
+    while (dir_end && (path[dir_end - 1] == '/')) {
+        dir_end--;
+    }
+
+    *dir = strndup(path, dir_end);
+    *name = strndup(path + start, end - start);
+}
+
+static void add_event(const char op, const int self, const char *path, const size_t path_len,
+                      const char *record, const size_t record_len) {
+    struct event *event = &pending[pending_count++];
+    event->op = op;
+    event->self = self;
+    if (self) {
+        char *parent = NULL;
+        split_path(path, path_len, &parent, &event->name);
+        free(parent);
+        event->dir = strndup(path, path_len);
+        while (event->dir[0] && (event->dir[strlen(event->dir) - 1] == '/')) {
+            event->dir[strlen(event->dir) - 1] = '\0';
+        }
+    }
+    else {
+        split_path(path, path_len, &event->dir, &event->name);
+    }
+    event->record = record?strndup(record, record_len):NULL;
+    event->record_len = record_len;
+}
+
+/* totals of a directory and everything under it */
+static void subtree_sum(const char *path, struct sum *sum) {
+    zeroit(sum);
+    sum->totsubdirs = 1;
+
+    char dbname[MAXPATH];
+    indexpath(dbname, path, DBNAME);
+
+    sqlite3 *db = openindexdb(dbname);
+    if (!db) {
+        return;
+    }
+
+    int recs = 0;
+    if (has_table(db, "treesummary")) {
+        querytsdb(dbname, sum, db, &recs, 1);
+    }
+    else {
+        querytsdb(dbname, sum, db, &recs, 0);
+        sum->totsubdirs = 1;
+    }
+
+    closedb(db);
+}
+
+static int create_dir(const char *path, struct work *work) {
+    char topath[MAXPATH];
+    indexpath(topath, path, "");
+
+    if (dupdir(topath, &work->statuso)) {
+        const int err = errno;
+        fprintf(stderr, "Dupdir failure %s: %d %s\n", topath, err, strerror(err));
+        return 1;
+    }
+
+    char dbname[MAXPATH];
+    indexpath(dbname, path, DBNAME);
+
+    if (copy_template(templatefd, dbname, templatesize, work->statuso.st_uid, work->statuso.st_gid)) {
+        return 1;
+    }
+
+    sqlite3 *db = openindexdb(dbname);
+    if (!db) {
+        return 1;
+    }
+
+    struct sum summary;
+    zeroit(&summary);
+    insertsumdb(db, work, &summary);
+    closedb(db);
+
+    struct sum delta;
+    delta_init(&delta);
+    delta.totsubdirs = 1;
+    add_ancestor_deltas(path, 1, &delta);
+
+    return 0;
+}
+
+/* directory creates, removes, and renames change the index tree, so they are applied in order */
+static int apply_dir_event(const char op, const char *path, const size_t path_len,
+                           char *record, const size_t record_len) {
+    if (under_packed(path, path_len) ||
+        ((op == EVENT_RENAME) && under_packed(record, strcspn(record, in.delim)))) {
+        return 1;
+    }
+
+    char *dir = strndup(path, path_len);
+
+    char indexdir[MAXPATH];
+    indexpath(indexdir, dir, "");
+
+    int rc = 0;
+    switch (op) {
+        case EVENT_CREATE:
+            {
+                struct stat st;
+                if ((lstat(indexdir, &st) == 0) && S_ISDIR(st.st_mode)) {
+                    /* already exists - only update the metadata */
+                    add_event(EVENT_SETATTR, 1, path, path_len, record, record_len);
+                }
+                else {
+                    struct work work;
+                    memset(&work, 0, sizeof(struct work));
+                    linetowork(record, record_len, in.delim, &work);
+                    drop_catalog();
+                    rc = create_dir(dir, &work);
+                }
+            }
+            break;
+        case EVENT_UNLINK:
+            {
+                struct sum sum;
+                subtree_sum(dir, &sum);
+
+                struct sum delta;
+                delta_init(&delta);
+                delta_subtract(&delta, &sum);
+                add_ancestor_deltas(dir, 1, &delta);
+
+                drop_catalog();
+                if (remove_tree(indexdir) != 0) {
+                    const int err = errno;
+                    fprintf(stderr, "Could not remove %s: %d %s\n", indexdir, err, strerror(err));
+                    rc = 1;
+                }
+            }
+            break;
+        case EVENT_RENAME:
+            {
+                /* the new path is the first field of the record */
+                const char *new_path = record;
+                const size_t new_path_len = strcspn(record, in.delim);
+
+                char *new_dir = strndup(new_path, new_path_len);
+                char new_indexdir[MAXPATH];
+                indexpath(new_indexdir, new_dir, "");
+
+                struct sum sum;
+                subtree_sum(dir, &sum);
+
+                drop_catalog();
+                if (rename(indexdir, new_indexdir) == 0) {
+                    struct sum delta;
+                    delta_init(&delta);
+                    delta_subtract(&delta, &sum);
+                    add_ancestor_deltas(dir, 1, &delta);
+
+                    delta_init(&delta);
+                    delta_merge(&delta, &sum);
+                    add_ancestor_deltas(new_dir, 1, &delta);
+
+                    /* the directory's name and metadata are updated with the other events */
+                    add_event(EVENT_SETATTR, 1, new_path, new_path_len, record, record_len);
+                }
+                else {
+                    const int err = errno;
+                    fprintf(stderr, "Could not rename %s to %s: %d %s\n", indexdir, new_indexdir, err, strerror(err));
+                    rc = 1;
+                }
+
+                free(new_dir);
+            }
+            break;
+        default:
+            break;
+    }
+
+    free(dir);
+
+    return rc;
+}
+
+/* type of the entry described by a trace record */
+static char record_type(const char *record) {
+    const char *type = strpbrk(record, in.delim);
+    return type?type[1]:'\0';
+}
+
+/* parse one event and either apply it or hold on to it */
+static int process_event(char *line, size_t len) {
+    /* remove the newline */
+    while (len && ((line[len - 1] == '\n') || (line[len - 1] == '\r'))) {
+        line[--len] = '\0';
+    }
+
+    if ((len < 3) || (line[1] != in.delim[0])) {
+        return 1;
+    }
+
+    const char op = line[0];
+    char *rest = line + 2;
+    const size_t rest_len = len - 2;
+
+    /* the first field is the path of the entry */
+    const size_t path_len = strcspn(rest, in.delim);
+    if (!path_len) {
+        return 1;
+    }
+
+    switch (op) {
+        case EVENT_CREATE:
+        case EVENT_SETATTR:
+            if (record_type(rest) == 'd') {
+                if (op == EVENT_CREATE) {
+                    /* new directories do not affect anything that is pending */
+                    return apply_dir_event(op, rest, path_len, rest, rest_len);
+                }
+                add_event(op, 1, rest, path_len, rest, rest_len);
+            }
+            else {
+                add_event(op, 0, rest, path_len, rest, rest_len);
+            }
+            break;
+        case EVENT_UNLINK:
+            {
+                char *dir = strndup(rest, path_len);
+                char indexdir[MAXPATH];
+                indexpath(indexdir, dir, "");
+                free(dir);
+
+                /* only directories exist in the index tree */
+                struct stat st;
+                if ((lstat(indexdir, &st) == 0) && S_ISDIR(st.st_mode)) {
+                    flush_subtree(rest, path_len);
+                    return apply_dir_event(op, rest, path_len, NULL, 0);
+                }
+                add_event(op, 0, rest, path_len, NULL, 0);
+            }
+            break;
+        case EVENT_RENAME:
+            {
+                /* the new record follows the old path */
+                if (path_len == rest_len) {
+                    return 1;
+                }
+
+                char *record = rest + path_len + 1;
+                const size_t record_len = rest_len - path_len - 1;
+                const size_t new_path_len = strcspn(record, in.delim);
+                if (!new_path_len) {
+                    return 1;
+                }
+
+                if (record_type(record) == 'd') {
+                    flush_subtree(rest, path_len);
+                    flush_subtree(record, new_path_len);
+                    return apply_dir_event(op, rest, path_len, record, record_len);
+                }
+
+                add_event(EVENT_UNLINK, 0, rest, path_len, NULL, 0);
+                if (pending_count == MAX_PENDING_EVENTS) {
+                    flush();
+                }
+                add_event(EVENT_CREATE, 0, record, new_path_len, record, record_len);
+            }
+            break;
+        default:
+            return 1;
+    }
+
+    if ((pending_count == MAX_PENDING_EVENTS) || (delta_count >= MAX_PENDING_DELTAS)) {
+        flush();
+    }
+
+    return 0;
+}
+
+void sub_help() {
+   printf("event_file        file containing events, one per line (- for stdin)\n");
+   printf("index_dir         root of the GUFI index to update\n");
+   printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+    int idx = parse_cmd_line(argc, argv, "hHn:d:", 2, "event_file index_dir", &in);
+    if (in.helped)
+        sub_help();
+    if (idx < 0)
+        return -1;
+    else {
+        /* parse positional args, following the options */
+        int retval = 0;
+        INSTALL_STR(in.name,   argv[idx++], MAXPATH, "event_file");
+        INSTALL_STR(in.nameto, argv[idx++], MAXPATH, "index_dir");
+
+        if (retval)
+            return retval;
+
+        size_t nameto_len = strlen(in.nameto);
+        remove_trailing(in.nameto, &nameto_len, "/", 1);
+    }
+
+    FILE *events = stdin;
+    if (strcmp(in.name, "-")) {
+        if (!(events = fopen(in.name, "rb"))) {
+            fprintf(stderr, "Could not open event file %s\n", in.name);
+            return -1;
+        }
+    }
+
+    if ((templatesize = create_template(&templatefd)) == (off_t) -1) {
+        fprintf(stderr, "Could not create template file\n");
+        if (events != stdin) {
+            fclose(events);
+        }
+        return -1;
+    }
+
+    if (!(pool = start_pool())) {
+        close(templatefd);
+        if (events != stdin) {
+            fclose(events);
+        }
+        return -1;
+    }
+
+    catalog_open(&catalog, in.nameto, 1);
+
+    size_t line_count = 0;
+    size_t bad = 0;
+
+    char *line = NULL;
+    size_t len = 0;
+    ssize_t nread;
+    while ((nread = getline(&line, &len, events)) != -1) {
+        line_count++;
+        if (process_event(line, nread) != 0) {
+            fprintf(stderr, "Could not apply event on line %zu\n", line_count);
+            bad++;
+        }
+    }
+    free(line);
+
+    /* apply whatever is left */
+    flush();
+
+    QPTPool_wait(pool);
+    QPTPool_destroy(pool);
+
+    free(deltas);
+
+    catalog_close(&catalog);
+
+    close(templatefd);
+
+    if (events != stdin) {
+        fclose(events);
+    }
+
+    fprintf(stdout, "Events: %zu (%zu not applied)\n", line_count, bad);
+
+    if (batch.errors) {
+        fprintf(stderr, "Could not update %zu databases\n", batch.errors);
+    }
+
+    return (batch.errors || bad)?-1:0;
+}
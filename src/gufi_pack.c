@@ -0,0 +1,294 @@
+/*
+This file is part of GUFI, which is part of MarFS, which is released
+under the BSD license.
+
+
+Copyright (c) 2017, Los Alamos National Security (LANS), LLC
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+From Los Alamos National Security, LLC:
+LA-CC-15-039
+
+Copyright (c) 2017, Los Alamos National Security, LLC All rights reserved.
+Copyright 2017. Los Alamos National Security, LLC. This software was produced
+under U.S. Government contract DE-AC52-06NA25396 for Los Alamos National
+Laboratory (LANL), which is operated by Los Alamos National Security, LLC for
+the U.S. Department of Energy. The U.S. Government has rights to use,
+reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR LOS
+ALAMOS NATIONAL SECURITY, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR
+ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is
+modified to produce derivative works, such modified software should be
+clearly marked, so as not to confuse it with the version available from
+LANL.
+
+THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+
+
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bf.h"
+#include "catalog.h"
+#include "dbutils.h"
+#include "debug.h"
+#include "QueuePerThreadPool.h"
+#include "utils.h"
+
+extern int errno;
+
+struct Pack {
+    char name[MAXPATH];
+};
+
+/* totals across all threads */
+static size_t packed = 0;
+static size_t removed = 0;
+
+static int get_count(void * args, int count, char ** data, char ** columns) {
+    *(size_t *) args = strtoull(data[0], NULL, 10);
+    return 0;
+}
+
+/* remove every subdirectory, leaving the database as the only copy of the subtree */
+static int pack(const char * name, const size_t dirs, const size_t rows) {
+    if (in.dry_run) {
+        printf("%s (%zu dirs, %zu rows)\n", name, dirs, rows);
+        __atomic_add_fetch(&packed, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&removed, dirs, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    /* mark first so that an interrupted pack can still be unpacked */
+    char marker[MAXPATH];
+    SNPRINTF(marker, MAXPATH, "%s/" PACKED_MARKER, name);
+    const int fd = open(marker, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Could not create \"%s\": %s\n", marker, strerror(errno));
+        return 1;
+    }
+    close(fd);
+
+    DIR * dir = opendir(name);
+    if (!dir) {
+        fprintf(stderr, "Error: Could not open directory \"%s\": %s\n", name, strerror(errno));
+        return 1;
+    }
+
+    int rc = 0;
+    struct dirent * entry = NULL;
+    while ((entry = readdir(dir))) {
+        if ((strncmp(entry->d_name, ".",  2) == 0) ||
+            (strncmp(entry->d_name, "..", 3) == 0)) {
+            continue;
+        }
+
+        char subdir[MAXPATH];
+        SNPRINTF(subdir, MAXPATH, "%s/%s", name, entry->d_name);
+
+        struct stat st;
+        if ((lstat(subdir, &st) != 0) || !S_ISDIR(st.st_mode)) {
+            continue;
+        }
+
+        if (remove_tree(subdir) != 0) {
+            fprintf(stderr, "Error: Could not remove \"%s\": %s\n", subdir, strerror(errno));
+            rc = 1;
+        }
+    }
+
+    closedir(dir);
+
+    __atomic_add_fetch(&packed, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&removed, dirs, __ATOMIC_RELAXED);
+
+    return rc;
+}
+
+int processdir(struct QPTPool * ctx, const size_t id, void * data, void * args) {
+    struct Pack * work = (struct Pack *) data;
+    int rc = 0;
+
+    /* already done */
+    if (is_packed(work->name)) {
+        goto free_work;
+    }
+
+    char dbname[MAXPATH];
+    SNPRINTF(dbname, MAXPATH, "%s/" DBNAME, work->name);
+    sqlite3 * db = opendb(dbname, SQLITE_OPEN_READONLY, PRAGMA_QUERY_READONLY, 0
+                          , NULL, NULL
+                          #if defined(DEBUG) && defined(PER_THREAD_STATS)
+                          , NULL, NULL
+                          , NULL, NULL
+                          #endif
+        );
+
+    int rollupscore = 0;
+    if (db) {
+        get_rollupscore(work->name, db, &rollupscore);
+    }
+
+    /*
+     * a rolled up directory already contains its entire subtree, so
+     * pack the highest rolled up directories that are small enough
+     */
+    if (rollupscore) {
+        size_t dirs = 0;
+        size_t rows = 0;
+        sqlite3_exec(db, "SELECT COUNT(*) FROM summary WHERE isroot <> 1", get_count, &dirs, NULL);
+        sqlite3_exec(db, "SELECT COUNT(*) FROM pentries", get_count, &rows, NULL);
+
+        if (!dirs) {
+            closedb(db);
+            goto free_work;
+        }
+
+        if (rows <= in.max_in_dir) {
+            closedb(db);
+            rc = pack(work->name, dirs, rows);
+            goto free_work;
+        }
+    }
+
+    closedb(db);
+
+    DIR * dir = opendir(work->name);
+    if (!dir) {
+        fprintf(stderr, "Error: Could not open directory \"%s\": %s\n", work->name, strerror(errno));
+        rc = 1;
+        goto free_work;
+    }
+
+    struct dirent * entry = NULL;
+    while ((entry = readdir(dir))) {
+        if ((strncmp(entry->d_name, ".",  2) == 0) ||
+            (strncmp(entry->d_name, "..", 3) == 0)) {
+            continue;
+        }
+
+        char name[MAXPATH];
+        const size_t len = SNPRINTF(name, MAXPATH, "%s/%s", work->name, entry->d_name);
+
+        struct stat st;
+        if ((lstat(name, &st) == 0) && S_ISDIR(st.st_mode)) {
+            struct Pack * subdir = malloc(sizeof(struct Pack));
+            memcpy(subdir->name, name, len + 1);
+            QPTPool_enqueue(ctx, id, processdir, subdir);
+        }
+    }
+
+    closedir(dir);
+
+  free_work:
+    free(work);
+
+    return rc;
+}
+
+void sub_help() {
+   printf("GUFI_index        rolled up GUFI index to pack\n");
+   printf("\n");
+}
+
+int main(int argc, char * argv[]) {
+    int idx = parse_cmd_line(argc, argv, "hHn:L:X", 1, "GUFI_index ...", &in);
+    if (in.helped)
+        sub_help();
+    if (idx < 0)
+        return -1;
+
+    #if defined(DEBUG) && defined(PER_THREAD_STATS)
+    epoch = since_epoch(NULL);
+
+    timestamp_init(timestamp_buffers, in.maxthreads + 1, 1024 * 1024, NULL);
+    #endif
+
+    struct QPTPool * pool = QPTPool_init(in.maxthreads
+                                         #if defined(DEBUG) && defined(PER_THREAD_STATS)
+                                         , timestamp_buffers
+                                         #endif
+        );
+
+    if (!pool) {
+        fprintf(stderr, "Failed to initialize thread pool\n");
+        return -1;
+    }
+
+    if (QPTPool_start(pool, NULL) != (size_t) in.maxthreads) {
+        fprintf(stderr, "Failed to start threads\n");
+        return -1;
+    }
+
+    for(int i = idx; i < argc; i++) {
+        struct stat st;
+        if ((lstat(argv[i], &st) != 0) || !S_ISDIR(st.st_mode)) {
+            fprintf(stderr, "input-dir '%s' is not a directory\n", argv[i]);
+            continue;
+        }
+
+        /* packing removes directories that are in the catalog */
+        if (!in.dry_run) {
+            catalog_remove_all(argv[i]);
+        }
+
+        struct Pack * mywork = malloc(sizeof(struct Pack));
+        SNPRINTF(mywork->name, MAXPATH, "%s", argv[i]);
+        QPTPool_enqueue(pool, i % in.maxthreads, processdir, mywork);
+    }
+
+    QPTPool_wait(pool);
+    QPTPool_destroy(pool);
+
+    #if defined(DEBUG) && defined(PER_THREAD_STATS)
+    timestamp_destroy(timestamp_buffers);
+    #endif
+
+    fprintf(stdout, "Packed:         %zu\n", packed);
+    fprintf(stdout, "Removed Dirs:   %zu\n", removed);
+
+    return 0;
+}
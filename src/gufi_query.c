@@ -76,6 +76,8 @@ OF SUCH DAMAGE.
 #include <utime.h>
 
 #include "bf.h"
+#include "catalog.h"
+#include "columns.h"
 #include "debug.h"
 #include "dbutils.h"
 #include "outdbs.h"
@@ -90,6 +92,39 @@ extern int errno;
 #define AGGREGATE_NAME         "file:aggregate%d?mode=memory&cache=shared"
 #define AGGREGATE_ATTACH_NAME  "aggregate"
 
+/*
+ * if the index root has a catalog and the -T query can be answered by
+ * it, directories are found and pruned using the catalog, and only the
+ * databases that -S and -E have to be run on are opened
+ */
+static struct catalog catalog;
+static sqlite3 **catalog_dbs = NULL;         /* per thread treesummary table for one record */
+static sqlite3_stmt **catalog_loads = NULL;
+
+/*
+ * if -E only uses the column_* functions (and -S is not set), -E is
+ * run against the column sidecar of each directory that has one
+ * instead of opening its database
+ */
+static int columns_only = 0;
+static sqlite3 **columns_dbs = NULL;         /* per thread database without any tables */
+
+/*
+ * with -l, intermediate and aggregate databases that grow past the
+ * limit are moved from memory into files in the scratch directory
+ * ($TMPDIR, or /tmp) and continue there
+ */
+#define SPILL_NAME             "%s/gufi_query.%d.aggregate%d.db"
+struct spill {
+    char name[MAXPATH];
+    enum {
+        SPILL_IN_MEMORY = 0,
+        SPILL_ON_DISK,
+        SPILL_FAILED,                        /* stay in memory */
+    } state;
+};
+static struct spill *spills = NULL;          /* aggregate database, then one per thread */
+
 #ifdef DEBUG
 struct start_end * buffer_create(struct sll * timers) {
     struct start_end * timer = malloc(sizeof(struct start_end));
@@ -354,6 +389,44 @@ static size_t descend2(struct QPTPool *ctx,
     return pushed;
 }
 
+/* Push the subdirectories listed in the catalog onto the queue */
+static size_t catalog_descend(struct QPTPool *ctx,
+                              const size_t id,
+                              struct work *passmywork,
+                              QPTPoolFunc_t func,
+                              const size_t max_level) {
+    const size_t next_level = passmywork->level + 1;
+    if (next_level > max_level) {
+        return 0;
+    }
+
+    const size_t name_len = strlen(passmywork->name);
+    const struct catalog_record *parent = &catalog.records[passmywork->catalog];
+
+    size_t pushed = 0;
+    for(uint64_t i = passmywork->catalog + 1; i < parent->end; i = catalog.records[i].end) {
+        const struct catalog_record *child = &catalog.records[i];
+        const char *name = catalog.names + child->name;
+
+        /* skip the same names as descend2 */
+        if ((child->name_len >= 3) && (strncmp(name + child->name_len - 3, ".db", 3) == 0)) {
+            continue;
+        }
+
+        struct work *clone = (struct work *) malloc(sizeof(struct work));
+        SNFORMAT_S(clone->name, MAXPATH, 3, passmywork->name, name_len, "/", (size_t) 1, name, (size_t) child->name_len);
+        clone->level = next_level;
+        clone->root = passmywork->root;
+        clone->catalog = i;
+
+        QPTPool_enqueue(ctx, id, func, clone);
+
+        pushed++;
+    }
+
+    return pushed;
+}
+
 /* sqlite3_exec callback argument data */
 struct CallbackArgs {
     struct OutputBuffers * output_buffers; /* buffers for printing into before writing to stdout */
@@ -377,7 +450,8 @@ static int print_callback(void *args, int count, char **data, char **columns) {
         size_t *lens = malloc(count * sizeof(size_t));
         size_t row_len = count + 1; /* one delimiter per column + newline */
         for(int i = 0; i < count; i++) {
-            lens[i] = strlen(data[i]);
+            /* NULL values are printed as empty columns */
+            lens[i] = data[i]?strlen(data[i]):0;
             row_len += lens[i];
         }
 
@@ -385,15 +459,27 @@ static int print_callback(void *args, int count, char **data, char **columns) {
 
         /* if a row cannot fit the buffer for whatever reason, flush the existing bufffer */
         if ((ob->capacity - ob->filled) < row_len) {
-            if (obs->mutex) {
-                pthread_mutex_lock(obs->mutex);
+            if (obs->writer) {
+                /* the writer thread writes it while this thread continues in the other buffer */
+                OutputWriter_handoff(obs->writer, id);
             }
-            OutputBuffer_flush(ob, gts.outfd[id]);
-            if (obs->mutex) {
-                pthread_mutex_unlock(obs->mutex);
+            else {
+                if (obs->mutex) {
+                    pthread_mutex_lock(obs->mutex);
+                }
+                OutputBuffer_flush(ob, gts.outfd[id]);
+                if (obs->mutex) {
+                    pthread_mutex_unlock(obs->mutex);
+                }
             }
         }
 
+        /* only the writer thread can write to the file, so make room for the row */
+        if (obs->writer && (ob->capacity < row_len)) {
+            ob->buf = realloc(ob->buf, row_len);
+            ob->capacity = row_len;
+        }
+
         /* if the row is larger than the entire buffer, flush this row */
         if (ob->capacity < row_len) {
             /* the existing buffer will have been flushed a few lines ago, maintaining output order */
@@ -401,7 +487,9 @@ static int print_callback(void *args, int count, char **data, char **columns) {
                 pthread_mutex_lock(obs->mutex);
             }
             for(int i = 0; i < count; i++) {
-                fwrite(data[i], sizeof(char), lens[i], gts.outfd[id]);
+                if (lens[i]) {
+                    fwrite(data[i], sizeof(char), lens[i], gts.outfd[id]);
+                }
                 fwrite(in.delim, sizeof(char), 1, gts.outfd[id]);
             }
             fwrite("\n", sizeof(char), 1, gts.outfd[id]);
@@ -417,8 +505,10 @@ static int print_callback(void *args, int count, char **data, char **columns) {
             char *buf = ob->buf;
             size_t filled = ob->filled;
             for(int i = 0; i < count; i++) {
-                memcpy(&buf[filled], data[i], lens[i]);
-                filled += lens[i];
+                if (lens[i]) {
+                    memcpy(&buf[filled], data[i], lens[i]);
+                    filled += lens[i];
+                }
 
                 buf[filled] = in.delim[0];
                 filled++;
@@ -471,6 +561,88 @@ do {                                                                    \
 #define querydb(dbname, db, query, callback, obufs, id, ts_name, rc)
 #endif
 
+static int spill_size_callback(void *args, int count, char **data, char **columns) {
+    (void) count; (void) columns;
+    *(size_t *) args = data[0]?strtoull(data[0], NULL, 10):0;
+    return 0;
+}
+
+/* number of bytes used by the main database of a connection */
+static size_t spill_size(sqlite3 *db) {
+    size_t size = 0;
+    sqlite3_exec(db, "SELECT page_count * page_size FROM pragma_page_count(), pragma_page_size();",
+                 spill_size_callback, &size, NULL);
+    return size;
+}
+
+/*
+ * copy an in-memory database into a new file in the scratch directory
+ * and close the in-memory copy
+ *
+ * the file is opened with its page cache limited to -l so that
+ * queries that sort or group its rows merge on disk
+ *
+ * returns the file, or NULL on error (the in-memory database is not closed)
+ */
+static sqlite3 *spill(sqlite3 *db, const int i) {
+    const char *scratch = getenv("TMPDIR");
+    if (!scratch || !*scratch) {
+        scratch = "/tmp";
+    }
+
+    struct spill *sp = &spills[i + 1];
+    SNPRINTF(sp->name, MAXPATH, SPILL_NAME, scratch, (int) getpid(), i);
+    unlink(sp->name);
+
+    sqlite3 *file = opendb(sp->name, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, PRAGMA_AGGREGATE, 1
+                           , NULL, NULL
+                           #if defined(DEBUG) && defined(PER_THREAD_STATS)
+                           , NULL, NULL
+                           , NULL, NULL
+                           #endif
+        );
+    if (!file) {
+        fprintf(stderr, "Could not create %s. Keeping database in memory.\n", sp->name);
+        sp->state = SPILL_FAILED;
+        return NULL;
+    }
+
+    char cache_size[MAXSQL];
+    SNPRINTF(cache_size, MAXSQL, "PRAGMA cache_size = -%zu;", (in.memory_limit + 1023) / 1024);
+
+    int rc = sqlite3_exec(file, cache_size, NULL, NULL, NULL);
+    if (rc == SQLITE_OK) {
+        sqlite3_backup *backup = sqlite3_backup_init(file, "main", db, "main");
+        rc = SQLITE_ERROR;
+        if (backup) {
+            sqlite3_backup_step(backup, -1);
+            rc = sqlite3_backup_finish(backup);
+        }
+    }
+
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "Could not move database to %s: %s. Keeping database in memory.\n", sp->name, sqlite3_errmsg(file));
+        closedb(file);
+        unlink(sp->name);
+        sp->state = SPILL_FAILED;
+        return NULL;
+    }
+
+    closedb(db);
+    sp->state = SPILL_ON_DISK;
+    return file;
+}
+
+/* move a database to disk if it is in memory and has grown past -l */
+static sqlite3 *spill_if_needed(sqlite3 *db, const int i) {
+    if (!spills || (spills[i + 1].state != SPILL_IN_MEMORY) || (spill_size(db) <= in.memory_limit)) {
+        return db;
+    }
+
+    sqlite3 *file = spill(db, i);
+    return file?file:db;
+}
+
 int processdir(struct QPTPool * ctx, const size_t id, void * data, void * args) {
     sqlite3 *db = NULL;
     int recs;
@@ -527,20 +699,53 @@ int processdir(struct QPTPool * ctx, const size_t id, void * data, void * args)
     timestamp_create_zero(utime_call,         ta->start_time);
     timestamp_create_zero(free_work,          ta->start_time);
 
-    /* keep opendir near opendb to help speed up sqlite3_open_v2 */
-    timestamp_set_start(opendir_call);
-    dir = opendir(work->name);
-    timestamp_set_end(opendir_call);
+    const struct catalog_record *record = catalog.records?&catalog.records[work->catalog]:NULL;
 
-    /* if the directory can't be opened, don't bother with anything else */
-    if (!dir) {
-        /* fprintf(stderr, "Could not open directory %s: %d %s\n", work->name, errno, strerror(errno)); */
-        goto out_free;
+    recs=1; /* set this to one record - if the sql succeeds it will set to 0 or 1 */
+            /* if it fails then this will be set to 1 and will go on */
+
+    if (record) {
+        /* run in.sqltsum on the catalog record instead of the database */
+        if (record->has_tsum) {
+            addqueryfuncs(catalog_dbs[id], id, work->level, work->root);
+            catalog_db_load(catalog_loads[id], record);
+            querydb(dbname, catalog_dbs[id], in.sqltsum,
+                    ta->print_callback_func, &ta->output_buffers,
+                    id, sqltsum, recs);
+        }
+
+        /* nothing below this directory can match, so don't touch the index at all */
+        if (recs < 1) {
+            goto out_free;
+        }
+    }
+    else {
+        /* keep opendir near opendb to help speed up sqlite3_open_v2 */
+        timestamp_set_start(opendir_call);
+        dir = opendir(work->name);
+        timestamp_set_end(opendir_call);
+
+        /* if the directory can't be opened, don't bother with anything else */
+        if (!dir) {
+            /* fprintf(stderr, "Could not open directory %s: %d %s\n", work->name, errno, strerror(errno)); */
+            goto out_free;
+        }
     }
 
+    /* -E only needs the sidecar if there is one */
+    const int sidecar = columns_only && (work->level >= in.min_level) &&
+                        (columns_select(id, work->name) == 0);
+
+    /* the database is only needed if -T, -S, or -E will be run on it */
+    const int use_db = (!record && (!sidecar || ((in.sqltsum_len > 1) && (in.andor == 0)))) ||
+                       (!sidecar && ((in.sqlsum_len > 1) || (in.sqlent_len > 1)) && (work->level >= in.min_level));
+
     #if OPENDB
     timestamp_set_start(open_call);
-    if (gts.outdbd[id]) {
+    if (!use_db) {
+        /* only the catalog is used for this directory */
+    }
+    else if (gts.outdbd[id]) {
       /* if we have an out db then only have to attach the gufi db */
       db = gts.outdbd[id];
       if (!attachdb(dbname, db, "tree", in.open_flags)) {
@@ -549,7 +754,8 @@ int processdir(struct QPTPool * ctx, const size_t id, void * data, void * args)
     }
     else {
       /* otherwise, open a standalone database to query from */
-      db = opendb(dbname, in.open_flags, 1, 1,
+      db = opendb(dbname, in.open_flags,
+                  (in.open_flags & SQLITE_OPEN_READONLY)?PRAGMA_QUERY_READONLY:PRAGMA_ROLLUP, 1,
                   NULL, NULL
                   #if defined(DEBUG) && defined(PER_THREAD_STATS)
                   , &timestamp_get_name(sqlite3_open_call), &timestamp_get_name(create_tables_call)
@@ -571,12 +777,10 @@ int processdir(struct QPTPool * ctx, const size_t id, void * data, void * args)
     timestamp_set_end(addqueryfuncs_call);
     #endif
 
-    recs=1; /* set this to one record - if the sql succeeds it will set to 0 or 1 */
-            /* if it fails then this will be set to 1 and will go on */
-
     /* if AND operation, and sqltsum is there, run a query to see if there is a match. */
     /* if this is OR, as well as no-sql-to-run, skip this query */
-    if (in.sqltsum_len > 1) {
+    /* (already done if the catalog is being used) */
+    if (!record && (in.sqltsum_len > 1)) {
         if (in.andor == 0) {      /* AND */
             /* make sure the treesummary table exists */
             querydb(dbname, db, "select name from sqlite_master where type=\'table\' and name='treesummary';",
@@ -606,13 +810,19 @@ int processdir(struct QPTPool * ctx, const size_t id, void * data, void * args)
          * ignore errors - if the db wasn't opened, or if
          * summary is missing the columns, keep descending
          */
-        int rollupscore = 0;
+        int rollupscore = record?record->rollupscore:0;
+        if (sidecar) {
+            rollupscore = columns_selected(id)->rollupscore;
+        }
         if (db) {
             get_rollupscore(work->name, db, &rollupscore);
         }
 
         /* push subdirectories into the queue */
-        if (rollupscore == 0) {
+        if ((rollupscore == 0) && record) {
+            catalog_descend(ctx, id, work, processdir, in.max_level);
+        }
+        else if (rollupscore == 0) {
             #ifdef DEBUG
             timestamp_set_start(descend_call);
             #ifdef SUBDIRECTORY_COUNTS
@@ -675,12 +885,29 @@ int processdir(struct QPTPool * ctx, const size_t id, void * data, void * args)
                 }
             }
         }
+        else if (sidecar) {
+            /* run -E against the sidecar, in the output database if there is one */
+            sqlite3 *cdb = gts.outdbd[id]?gts.outdbd[id]:columns_dbs[id];
+
+            shortpath(work->name,shortname,endname);
+            SNFORMAT_S(gps[id].gepath, MAXPATH, 1, endname, strlen(endname));
+            SNFORMAT_S(gps[id].gpath, MAXPATH, 1, work->name, work_name_len);
+            realpath(work->name,gps[id].gfpath);
+
+            addqueryfuncs(cdb, id, work->level, work->root);
+            querydb(dbname, cdb, in.sqlent,
+                    ta->print_callback_func, &ta->output_buffers,
+                    id, sqlent, recs); /* recs is not used */
+        }
     }
 
     #ifdef OPENDB
     timestamp_set_start(close_call);
     /* if we have an out db we just detach gufi db */
-    if (gts.outdbd[id]) {
+    if (!use_db) {
+        /* nothing was opened */
+    }
+    else if (gts.outdbd[id]) {
       detachdb(dbname, db, "tree");
     } else {
       closedb(db);
@@ -688,14 +915,21 @@ int processdir(struct QPTPool * ctx, const size_t id, void * data, void * args)
     timestamp_set_end(close_call);
     #endif
 
+    /* this thread's intermediate results might have to go to disk */
+    if (in.show_results == AGGREGATE) {
+        gts.outdbd[id] = spill_if_needed(gts.outdbd[id], id);
+    }
+
   close_dir:
     timestamp_set_start(closedir_call);
-    closedir(dir);
+    if (dir) {
+        closedir(dir);
+    }
     timestamp_set_end(closedir_call);
 
     timestamp_set_start(utime_call);
     /* restore mtime and atime */
-    if (in.keep_matime) {
+    if (in.keep_matime && use_db) {
         struct utimbuf dbtime = {};
         dbtime.actime  = work->statuso.st_atime;
         dbtime.modtime = work->statuso.st_mtime;
@@ -704,7 +938,7 @@ int processdir(struct QPTPool * ctx, const size_t id, void * data, void * args)
     timestamp_set_end(utime_call);
 
   out_free:
-    ;
+    columns_deselect(id);
 
     timestamp_set_start(free_work);
     free(work);
@@ -822,7 +1056,7 @@ static sqlite3 *aggregate_init(const char *AGGREGATE_NAME_TEMPLATE,
     for(int i = 0; i < in.maxthreads; i++) {
         char intermediate_name[MAXSQL];
         SNPRINTF(intermediate_name, MAXSQL, AGGREGATE_NAME, (int) i);
-        if (!(gts.outdbd[i] = opendb(intermediate_name, SQLITE_OPEN_READWRITE, 1, 1
+        if (!(gts.outdbd[i] = opendb(intermediate_name, SQLITE_OPEN_READWRITE, PRAGMA_AGGREGATE, 1
                                      , NULL, NULL
                                      #if defined(DEBUG) && defined(PER_THREAD_STATS)
                                      , NULL, NULL
@@ -846,7 +1080,7 @@ static sqlite3 *aggregate_init(const char *AGGREGATE_NAME_TEMPLATE,
 
     SNPRINTF(aggregate_name, MAXSQL, AGGREGATE_NAME, (int) -1);
     sqlite3 *aggregate = NULL;
-    if (!(aggregate = opendb(aggregate_name, SQLITE_OPEN_READWRITE, 1, 1
+    if (!(aggregate = opendb(aggregate_name, SQLITE_OPEN_READWRITE, PRAGMA_AGGREGATE, 1
                              , NULL, NULL
                              #if defined(DEBUG) && defined(PER_THREAD_STATS)
                              , NULL, NULL
@@ -876,6 +1110,92 @@ static void aggregate_fin(sqlite3 *aggregate) {
     closedb(aggregate);
 }
 
+/* use the catalog of the index root if the -T query can run on it */
+static int catalog_init(const char *index) {
+    if (catalog_open(&catalog, index, 0) != 0) {
+        return -1;
+    }
+
+    catalog_dbs = calloc(in.maxthreads, sizeof(sqlite3 *));
+    catalog_loads = calloc(in.maxthreads, sizeof(sqlite3_stmt *));
+
+    for(int i = 0; i < in.maxthreads; i++) {
+        if (!(catalog_dbs[i] = opendb(":memory:", SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, PRAGMA_NONE, 1
+                                      , NULL, NULL
+                                      #if defined(DEBUG) && defined(PER_THREAD_STATS)
+                                      , NULL, NULL
+                                      , NULL, NULL
+                                      #endif
+                  ))                                                                    ||
+            (addqueryfuncs(catalog_dbs[i], i, 0, (char *) index) != 0)                  ||
+            (catalog_db_init(catalog_dbs[i], &catalog_loads[i]) != 0)                   ||
+            ((i == 0) && !catalog_db_can_run(catalog_dbs[i], in.sqltsum))) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void catalog_fin(void) {
+    for(int i = 0; catalog_dbs && (i < in.maxthreads); i++) {
+        sqlite3_finalize(catalog_loads[i]);
+        closedb(catalog_dbs[i]);
+    }
+    free(catalog_loads);
+    free(catalog_dbs);
+    catalog_loads = NULL;
+    catalog_dbs = NULL;
+    catalog_close(&catalog);
+}
+
+/* run -E against column sidecars if it does not need the database */
+static int columns_init(const char *index) {
+    /* -S needs the database and nothing runs without -E */
+    if ((in.sqlsum_len > 1) || (in.sqlent_len < 2)) {
+        return -1;
+    }
+
+    /* -E is run in the output databases if there are any */
+    if (gts.outdbd[0]) {
+        if ((addqueryfuncs(gts.outdbd[0], 0, 0, (char *) index) != 0) ||
+            !columns_can_run(gts.outdbd[0], in.sqlent)) {
+            return -1;
+        }
+
+        columns_only = 1;
+        return 0;
+    }
+
+    columns_dbs = calloc(in.maxthreads, sizeof(sqlite3 *));
+
+    for(int i = 0; i < in.maxthreads; i++) {
+        if (!(columns_dbs[i] = opendb(":memory:", SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, PRAGMA_NONE, 1
+                                      , NULL, NULL
+                                      #if defined(DEBUG) && defined(PER_THREAD_STATS)
+                                      , NULL, NULL
+                                      , NULL, NULL
+                                      #endif
+                  ))                                                                    ||
+            (addqueryfuncs(columns_dbs[i], i, 0, (char *) index) != 0)                  ||
+            ((i == 0) && !columns_can_run(columns_dbs[i], in.sqlent))) {
+            return -1;
+        }
+    }
+
+    columns_only = 1;
+    return 0;
+}
+
+static void columns_fin(void) {
+    for(int i = 0; columns_dbs && (i < in.maxthreads); i++) {
+        closedb(columns_dbs[i]);
+    }
+    free(columns_dbs);
+    columns_dbs = NULL;
+    columns_only = 0;
+}
+
 void sub_help() {
    printf("GUFI_index        find GUFI index here\n");
    printf("\n");
@@ -893,7 +1213,7 @@ int main(int argc, char *argv[])
     /* but allow different fields to be filled at the command-line. */
     /* Callers provide the options-string for get_opt(), which will */
     /* control which options are parsed for each program. */
-    int idx = parse_cmd_line(argc, argv, "hHT:S:E:an:jo:d:O:I:F:y:z:J:K:G:e:m:B:w", 1, "GUFI_index ...", &in);
+    int idx = parse_cmd_line(argc, argv, "hHT:S:E:an:jo:d:O:I:F:y:z:J:K:G:e:m:B:wl:", 1, "GUFI_index ...", &in);
     if (in.helped)
         sub_help();
     if (idx < 0)
@@ -951,7 +1271,14 @@ int main(int argc, char *argv[])
     char aggregate_name[MAXSQL];
     sqlite3 *aggregate = NULL;
     if (in.show_results == AGGREGATE) {
+        if (in.memory_limit) {
+            if (!(spills = calloc(in.maxthreads + 1, sizeof(struct spill)))) {
+                fprintf(stderr, "Warning: Could not allocate space for scratch file names. Aggregating in memory.\n");
+            }
+        }
+
         if (!(aggregate = aggregate_init(AGGREGATE_NAME, aggregate_name, in.maxthreads))) {
+            free(spills);
             OutputBuffers_destroy(&args.output_buffers);
             outdbs_fin  (gts.outdbd, in.maxthreads, in.sqlfin, in.sqlfin_len);
             outfiles_fin(gts.outfd, output_count);
@@ -994,6 +1321,25 @@ int main(int argc, char *argv[])
         return -1;
     }
 
+    /* printed rows are written by a dedicated thread instead of by the thread that filled the buffer */
+    struct OutputWriter writer;
+    if (in.show_results == PRINT) {
+        if (!OutputWriter_start(&writer, &args.output_buffers, gts.outfd)) {
+            fprintf(stderr, "Warning: Could not start output writer. Threads will write their own output.\n");
+        }
+    }
+
+    /* the catalog can only replace -T when it is used to prune (AND) */
+    if ((argc - idx == 1) && (in.andor == 0) && (in.sqltsum_len > 1)) {
+        if (catalog_init(argv[idx]) != 0) {
+            catalog_fin();
+        }
+    }
+
+    if (columns_init(argv[idx]) != 0) {
+        columns_fin();
+    }
+
     /* enqueue all input paths */
     for(int i = idx; i < argc; i++) {
         /* remove trailing slashes */
@@ -1031,6 +1377,16 @@ int main(int argc, char *argv[])
 
     QPTPool_destroy(pool);
 
+    if (args.output_buffers.writer) {
+        const int err = OutputWriter_stop(&writer);
+        if (err) {
+            fprintf(stderr, "Error: Could not write results: %s\n", strerror(err));
+        }
+    }
+
+    catalog_fin();
+    columns_fin();
+
     #if (defined(DEBUG) && defined(CUMULATIVE_TIMES)) || BENCHMARK
     timestamp_set_end(work);
 
@@ -1052,9 +1408,25 @@ int main(int argc, char *argv[])
         /* aggregate the intermediate results */
         for(int i = 0; i < in.maxthreads; i++) {
             if (!attachdb(aggregate_name, gts.outdbd[i], AGGREGATE_ATTACH_NAME, SQLITE_OPEN_READWRITE) ||
+                (spills && (spills[0].state == SPILL_ON_DISK) &&
+                 (sqlite3_exec(gts.outdbd[i], "PRAGMA " AGGREGATE_ATTACH_NAME ".synchronous = OFF; "
+                                              "PRAGMA " AGGREGATE_ATTACH_NAME ".journal_mode = OFF;",
+                               NULL, NULL, NULL) != SQLITE_OK))                                     ||
                 (sqlite3_exec(gts.outdbd[i], in.intermediate, NULL, NULL, NULL) != SQLITE_OK))          {
                 fprintf(stderr, "Aggregation of intermediate databases error: %s\n", sqlite3_errmsg(gts.outdbd[i]));
             }
+
+            /* move the aggregate database to disk once it gets too big */
+            if (spills) {
+                detachdb(aggregate_name, gts.outdbd[i], AGGREGATE_ATTACH_NAME);
+                if (spills[0].state == SPILL_IN_MEMORY) {
+                    aggregate = spill_if_needed(aggregate, -1);
+                    if (spills[0].state == SPILL_ON_DISK) {
+                        addqueryfuncs(aggregate, in.maxthreads, -1, NULL);
+                        SNFORMAT_S(aggregate_name, MAXSQL, 1, spills[0].name, strlen(spills[0].name));
+                    }
+                }
+            }
         }
 
         #if (defined(DEBUG) && defined(CUMULATIVE_TIMES)) || BENCHMARK
@@ -1109,6 +1481,16 @@ int main(int argc, char *argv[])
     outdbs_fin  (gts.outdbd, in.maxthreads, in.sqlfin, in.sqlfin_len);
     outfiles_fin(gts.outfd, output_count);
 
+    /* remove databases that were moved to disk */
+    if (spills) {
+        for(int i = 0; i < in.maxthreads + 1; i++) {
+            if (spills[i].state == SPILL_ON_DISK) {
+                unlink(spills[i].name);
+            }
+        }
+        free(spills);
+    }
+
     #if defined(DEBUG) && defined(CUMULATIVE_TIMES) || BENCHMARK
     timestamp_set_end(cleanup_globals);
     const uint64_t cleanup_globals_time = timestamp_elapsed(cleanup_globals);
@@ -70,6 +70,8 @@ OF SUCH DAMAGE.
 
 #include "QueuePerThreadPool.h"
 #include "bf.h"
+#include "catalog.h"
+#include "columns.h"
 #include "debug.h"
 #include "dbutils.h"
 #include "template_db.h"
@@ -83,8 +85,9 @@ extern int errno;
 struct OutputBuffers debug_output_buffers;
 #endif
 
-int templatefd = -1;    /* this is really a constant that is set at runtime */
-off_t templatesize = 0; /* this is really a constant that is set at runtime */
+int templatefd = -1;        /* this is really a constant that is set at runtime */
+off_t templatesize = 0;     /* this is really a constant that is set at runtime */
+void *templateimage = NULL; /* only used when building databases in memory */
 
 /* Data stored during first pass of input file */
 struct row {
@@ -93,6 +96,11 @@ struct row {
     size_t len;
     long offset;
     size_t entries;
+
+    /* offsets of the entries that start each chunk after */
+    /* the first when entries is larger than in.split_threshold */
+    long *chunks;
+    size_t chunk_count;
 };
 
 struct row *row_init(const size_t first_delim, char *line, const size_t len, const long offset) {
@@ -103,17 +111,163 @@ struct row *row_init(const size_t first_delim, char *line, const size_t len, con
         row->len = len;
         row->offset = offset;
         row->entries = 0;
+        row->chunks = NULL;
+        row->chunk_count = 0;
     }
     return row;
 }
 
+void row_add_chunk(struct row *row, const long offset) {
+    row->chunks = realloc(row->chunks, (row->chunk_count + 1) * sizeof(long));
+    row->chunks[row->chunk_count++] = offset;
+}
+
 void row_destroy(struct row *row) {
     if (row) {
+        free(row->chunks);
         free(row->line);
         free(row);
     }
 }
 
+/*
+ * a directory with more than in.split_threshold entries
+ *
+ * the thread processing the directory's line inserts the first
+ * in.split_threshold entries and the remaining entries are
+ * inserted into shard databases by other threads. the last
+ * thread to finish merges the shards and the partial summaries
+ * into the directory's database.
+ */
+struct split_dir {
+    pthread_mutex_t mutex;
+    size_t remaining;           /* the directory's thread + unfinished chunks */
+    size_t chunks;
+
+    struct work dir;
+    char dbname[MAXPATH];
+    sqlite3 *db;
+    struct sum summary;
+};
+
+/* a range of entries of a split directory */
+struct chunk {
+    struct split_dir *split;
+    size_t index;
+    long offset;
+    size_t count;
+};
+
+/* number of databases that could not be written to the index */
+static size_t write_errors = 0;
+
+/* write an in-memory database to the index */
+static void write_memdb(sqlite3 *db, const char *dbname, struct stat *st) {
+    if (memdb_to_file(db, dbname, st->st_uid, st->st_gid) != 0) {
+        __atomic_add_fetch(&write_errors, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static void shardname(char *name, const char *dbname, const size_t index) {
+    SNPRINTF(name, MAXPATH, "%s.%zu", dbname, index);
+}
+
+/* merge a partial summary - the last thread to finish writes the database */
+static void split_release(struct split_dir *split, struct sum *summary) {
+    pthread_mutex_lock(&split->mutex);
+    summerge(summary, &split->summary);
+    const int last = !--split->remaining;
+    pthread_mutex_unlock(&split->mutex);
+
+    if (!last) {
+        return;
+    }
+
+    for(size_t i = 0; i < split->chunks; i++) {
+        char name[MAXPATH];
+        shardname(name, split->dbname, i);
+        mergeshard(name, split->db);
+        unlink(name);
+    }
+
+    insertsumdb(split->db, &split->dir, &split->summary);
+    index_entries(split->dbname, split->db, &split->summary);
+
+    if (in.build_in_memory) {
+        write_memdb(split->db, split->dbname, &split->dir.statuso);
+    }
+    closedb(split->db);
+
+    pthread_mutex_destroy(&split->mutex);
+    free(split);
+}
+
+/* insert a range of the entries of a split directory into a shard */
+int processchunk(struct QPTPool *ctx, const size_t id, void *data, void *args) {
+    (void) ctx;
+
+    struct chunk *chunk = (struct chunk *) data;
+    struct split_dir *split = chunk->split;
+    FILE *trace = ((FILE **) args)[id];
+
+    char name[MAXPATH];
+    shardname(name, split->dbname, chunk->index);
+
+    struct sum summary;
+    zeroit(&summary);
+
+    int rc = 1;
+    if (copy_template(templatefd, name, templatesize, split->dir.statuso.st_uid, split->dir.statuso.st_gid) == 0) {
+        sqlite3 *db = opendb(name, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, PRAGMA_BUILD, 0
+                             , NULL, NULL
+                             #if defined(DEBUG) && defined(PER_THREAD_STATS)
+                             , NULL, NULL
+                             , NULL, NULL
+                             #endif
+                             );
+        if (db) {
+            sqlite3_stmt *res = insertdbprep(db);
+
+            startdb(db);
+
+            fseek(trace, chunk->offset, SEEK_SET);
+
+            for(size_t i = 0; i < chunk->count; i++) {
+                char *line = NULL;
+                size_t len = 0;
+                if (getline(&line, &len, trace) == -1) {
+                    free(line);
+                    break;
+                }
+
+                struct work row;
+                memset(&row, 0, sizeof(struct work));
+                linetowork(line, len, in.delim, &row);
+                free(line);
+
+                sumit(&summary, &row);
+
+                /* don't record pinode */
+                row.pinode = 0;
+
+                insertdbgo(&row, db, res);
+            }
+
+            stopdb(db);
+            insertdbfin(res);
+            closedb(db);
+
+            rc = 0;
+        }
+    }
+
+    free(chunk);
+
+    split_release(split, &summary);
+
+    return rc;
+}
+
 #ifdef DEBUG
 
 #ifdef CUMULATIVE_TIMES
@@ -236,7 +390,8 @@ int processdir(struct QPTPool *ctx, const size_t id, void *data, void *args) {
     /* } */
 
     /* copy the template file */
-    if (copy_template(templatefd, dbname, templatesize, dir.statuso.st_uid, dir.statuso.st_gid)) {
+    if (!in.build_in_memory &&
+        copy_template(templatefd, dbname, templatesize, dir.statuso.st_uid, dir.statuso.st_gid)) {
         row_destroy(w);
         return 1;
     }
@@ -245,13 +400,20 @@ int processdir(struct QPTPool *ctx, const size_t id, void *data, void *args) {
 
     /* process the work */
     timestamp_start(opendb);
-    sqlite3 *db = opendb(dbname, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, 1, 0
-                          , NULL, NULL
-                          #if defined(DEBUG) && defined(PER_THREAD_STATS)
-                          , NULL, NULL
-                          , NULL, NULL
-                          #endif
-                          );
+    sqlite3 *db = NULL;
+    if (in.build_in_memory) {
+        /* the database is written to dbname after it has been filled */
+        db = template_to_memdb(templateimage, templatesize);
+    }
+    else {
+        db = opendb(dbname, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, PRAGMA_BUILD, 0
+                    , NULL, NULL
+                    #if defined(DEBUG) && defined(PER_THREAD_STATS)
+                    , NULL, NULL
+                    , NULL, NULL
+                    #endif
+                    );
+    }
     timestamp_set_end(opendb);
 
     if (db) {
@@ -268,6 +430,37 @@ int processdir(struct QPTPool *ctx, const size_t id, void *data, void *args) {
         startdb(db);
         timestamp_set_end(startdb);
 
+        /* hand the entries past the threshold to other threads */
+        size_t own = w->entries;
+        struct split_dir *split = NULL;
+        if (w->chunk_count) {
+            own = in.split_threshold;
+
+            split = calloc(1, sizeof(struct split_dir));
+            pthread_mutex_init(&split->mutex, NULL);
+            split->remaining = w->chunk_count + 1;
+            split->chunks = w->chunk_count;
+            memcpy(&split->dir, &dir, sizeof(struct work));
+            SNFORMAT_S(split->dbname, MAXPATH, 1, dbname, strlen(dbname));
+            split->db = NULL;
+            zeroit(&split->summary);
+
+            for(size_t i = 0; i < w->chunk_count; i++) {
+                const size_t start = (i + 1) * in.split_threshold;
+
+                struct chunk *chunk = malloc(sizeof(struct chunk));
+                chunk->split = split;
+                chunk->index = i;
+                chunk->offset = w->chunks[i];
+                chunk->count = w->entries - start;
+                if (chunk->count > in.split_threshold) {
+                    chunk->count = in.split_threshold;
+                }
+
+                QPTPool_enqueue(ctx, id, processchunk, chunk);
+            }
+        }
+
         /* move the trace file to the offet */
         timestamp_start(fseek);
         fseek(trace, w->offset, SEEK_SET);
@@ -275,7 +468,7 @@ int processdir(struct QPTPool *ctx, const size_t id, void *data, void *args) {
 
         timestamp_start(read_entries);
         size_t row_count = 0;
-        for(size_t i = 0; i < w->entries; i++) {
+        for(size_t i = 0; i < own; i++) {
             timestamp_start(getline);
             char *line = NULL;
             size_t len = 0;
@@ -375,11 +568,24 @@ int processdir(struct QPTPool *ctx, const size_t id, void *data, void *args) {
         timestamp_set_end(insertdbfin);
 
         timestamp_start(insertsumdb);
-        insertsumdb(db, &dir, &summary);
+        if (!split) {
+            insertsumdb(db, &dir, &summary);
+            index_entries(dbname, db, &summary);
+        }
         timestamp_set_end(insertsumdb);
 
         timestamp_start(closedb);
-        closedb(db); /* don't set to nullptr */
+        if (split) {
+            /* the last thread working on this directory writes the database */
+            split->db = db;
+            split_release(split, &summary);
+        }
+        else {
+            if (in.build_in_memory) {
+                write_memdb(db, dbname, &dir.statuso);
+            }
+            closedb(db); /* don't set to nullptr */
+        }
         timestamp_set_end(closedb);
 
         #ifdef DEBUG
@@ -538,10 +744,18 @@ int scout_function(struct QPTPool *ctx, const size_t id, void *data, void *args)
 
     /* don't free line - the pointer is now owned by work */
 
+    /* offset of the line that is about to be read */
+    /* (tracked here to avoid calling ftell for every line) */
+    long offset = ftell(trace);
+
     /* have getline allocate a new buffer */
     line = NULL;
     len = 0;
-    while (getline(&line, &len, trace) != -1) {
+    ssize_t nread;
+    while ((nread = getline(&line, &len, trace)) != -1) {
+        const long line_offset = offset;
+        offset += nread;
+
         first_delim = parsefirst(line, len, in.delim[0]);
 
         /* bad line */
@@ -564,10 +778,16 @@ int scout_function(struct QPTPool *ctx, const size_t id, void *data, void *args)
             target_thread = (target_thread + 1) % ctx->size;
 
             /* put the current line into a new work item */
-            work = row_init(first_delim, line, len, ftell(trace));
+            work = row_init(first_delim, line, len, offset);
         }
         /* ignore non-directories */
         else {
+            /* large directories are split into chunks starting at these lines */
+            if (in.split_threshold && work->entries &&
+                !(work->entries % in.split_threshold)) {
+                row_add_chunk(work, line_offset);
+            }
+
             work->entries++;
             file_count++;
 
@@ -635,7 +855,7 @@ int main(int argc, char *argv[]) {
     clock_gettime(CLOCK_MONOTONIC, &main_func.start);
     epoch = since_epoch(&main_func.start);
 
-    int idx = parse_cmd_line(argc, argv, "hHn:d:", 2, "input_file output_dir", &in);
+    int idx = parse_cmd_line(argc, argv, "hHn:d:Mk:Q:", 2, "input_file output_dir", &in);
     if (in.helped)
         sub_help();
     if (idx < 0)
@@ -655,6 +875,13 @@ int main(int argc, char *argv[]) {
         return -1;
     }
 
+    if (in.build_in_memory) {
+        if (!(templateimage = load_template_image(templatefd, templatesize))) {
+            close(templatefd);
+            return -1;
+        }
+    }
+
     /* open trace files for threads to jump around in */
     /* all have to be passed in at once because there's no way to send one to each thread */
     /* the trace files have to be opened outside of the thread in order to not repeatedly open the files */
@@ -704,7 +931,11 @@ int main(int argc, char *argv[]) {
     /* set top level permissions */
     chmod(in.nameto, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
 
+    /* a catalog from a previous index would be missing any new directories */
+    catalog_remove(in.nameto);
+
     close_per_thread_traces(traces, in.maxthreads);
+    free(templateimage);
     close(templatefd);
 
     /* have to call clock_gettime explicitly to get end time */
@@ -740,5 +971,10 @@ int main(int argc, char *argv[]) {
 
     fprintf(stderr, "main completed in %.2Lf seconds\n", sec(nsec(&main_func)));
 
+    if (write_errors) {
+        fprintf(stderr, "Could not write %zu databases\n", write_errors);
+        return -1;
+    }
+
     return 0;
 }
@@ -0,0 +1,341 @@
+/*
+This file is part of GUFI, which is part of MarFS, which is released
+under the BSD license.
+
+
+Copyright (c) 2017, Los Alamos National Security (LANS), LLC
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+From Los Alamos National Security, LLC:
+LA-CC-15-039
+
+Copyright (c) 2017, Los Alamos National Security, LLC All rights reserved.
+Copyright 2017. Los Alamos National Security, LLC. This software was produced
+under U.S. Government contract DE-AC52-06NA25396 for Los Alamos National
+Laboratory (LANL), which is operated by Los Alamos National Security, LLC for
+the U.S. Department of Energy. The U.S. Government has rights to use,
+reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR LOS
+ALAMOS NATIONAL SECURITY, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR
+ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is
+modified to produce derivative works, such modified software should be
+clearly marked, so as not to confuse it with the version available from
+LANL.
+
+THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+
+
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* O_NOATIME */
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sqlite3.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "gufi_vfs.h"
+
+#ifndef O_NOATIME
+#define O_NOATIME 0
+#endif
+
+extern int errno;
+
+struct gufi_file {
+    sqlite3_file base;      /* must be first */
+    int fd;                 /* -1 after the whole file was read */
+    sqlite3_int64 size;
+    unsigned char *image;   /* NULL if the file is too large */
+    size_t capacity;
+};
+
+/* each thread keeps the buffer of the last file it closed for the next file it opens */
+struct spare {
+    unsigned char *image;
+    size_t capacity;
+};
+
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static pthread_key_t spare_key;
+static sqlite3_vfs gufi_vfs;
+static int init_rc = SQLITE_ERROR;
+
+static void free_spare(void *ptr) {
+    struct spare *spare = (struct spare *) ptr;
+    free(spare->image);
+    free(spare);
+}
+
+static unsigned char *get_image(const size_t size, size_t *capacity) {
+    struct spare *spare = (struct spare *) pthread_getspecific(spare_key);
+    if (spare && spare->image && (spare->capacity >= size)) {
+        unsigned char *image = spare->image;
+        *capacity = spare->capacity;
+        spare->image = NULL;
+        spare->capacity = 0;
+        return image;
+    }
+
+    *capacity = size;
+    return malloc(size);
+}
+
+static void put_image(unsigned char *image, const size_t capacity) {
+    struct spare *spare = (struct spare *) pthread_getspecific(spare_key);
+    if (!spare) {
+        spare = calloc(1, sizeof(*spare));
+        if (!spare || (pthread_setspecific(spare_key, spare) != 0)) {
+            free(spare);
+            free(image);
+            return;
+        }
+    }
+
+    /* keep the larger buffer */
+    if (capacity > spare->capacity) {
+        free(spare->image);
+        spare->image = image;
+        spare->capacity = capacity;
+    }
+    else {
+        free(image);
+    }
+}
+
+static int gufi_close(sqlite3_file *file) {
+    struct gufi_file *gf = (struct gufi_file *) file;
+    if (gf->image) {
+        put_image(gf->image, gf->capacity);
+        gf->image = NULL;
+    }
+    if (gf->fd > -1) {
+        close(gf->fd);
+        gf->fd = -1;
+    }
+    return SQLITE_OK;
+}
+
+static int gufi_read(sqlite3_file *file, void *buf, int amt, sqlite3_int64 offset) {
+    struct gufi_file *gf = (struct gufi_file *) file;
+
+    sqlite3_int64 got = 0;
+    if (offset < gf->size) {
+        got = gf->size - offset;
+        if (got > amt) {
+            got = amt;
+        }
+
+        if (gf->image) {
+            memcpy(buf, gf->image + offset, got);
+        }
+        else {
+            got = pread(gf->fd, buf, got, offset);
+            if (got < 0) {
+                return SQLITE_IOERR_READ;
+            }
+        }
+    }
+
+    if (got < amt) {
+        memset((char *) buf + got, 0, amt - got);
+        return SQLITE_IOERR_SHORT_READ;
+    }
+
+    return SQLITE_OK;
+}
+
+static int gufi_write(sqlite3_file *file, const void *buf, int amt, sqlite3_int64 offset) {
+    (void) file; (void) buf; (void) amt; (void) offset;
+    return SQLITE_READONLY;
+}
+
+static int gufi_truncate(sqlite3_file *file, sqlite3_int64 size) {
+    (void) file; (void) size;
+    return SQLITE_READONLY;
+}
+
+static int gufi_sync(sqlite3_file *file, int flags) {
+    (void) file; (void) flags;
+    return SQLITE_OK;
+}
+
+static int gufi_file_size(sqlite3_file *file, sqlite3_int64 *size) {
+    *size = ((struct gufi_file *) file)->size;
+    return SQLITE_OK;
+}
+
+/* nothing writes to the file, so locking is not needed */
+static int gufi_lock(sqlite3_file *file, int lock) {
+    (void) file; (void) lock;
+    return SQLITE_OK;
+}
+
+static int gufi_check_reserved_lock(sqlite3_file *file, int *out) {
+    (void) file;
+    *out = 0;
+    return SQLITE_OK;
+}
+
+static int gufi_file_control(sqlite3_file *file, int op, void *arg) {
+    (void) file; (void) op; (void) arg;
+    return SQLITE_NOTFOUND;
+}
+
+static int gufi_sector_size(sqlite3_file *file) {
+    (void) file;
+    return 4096;
+}
+
+/* the contents will not change while the file is open, so there is no need to look for journals */
+static int gufi_device_characteristics(sqlite3_file *file) {
+    (void) file;
+    return SQLITE_IOCAP_IMMUTABLE;
+}
+
+static const sqlite3_io_methods gufi_io_methods = {
+    1,
+    gufi_close,
+    gufi_read,
+    gufi_write,
+    gufi_truncate,
+    gufi_sync,
+    gufi_file_size,
+    gufi_lock,
+    gufi_lock,
+    gufi_check_reserved_lock,
+    gufi_file_control,
+    gufi_sector_size,
+    gufi_device_characteristics,
+    NULL, NULL, NULL, NULL, NULL, NULL,
+};
+
+static int gufi_open(sqlite3_vfs *vfs, const char *name, sqlite3_file *file, int flags, int *out_flags) {
+    sqlite3_vfs *base = (sqlite3_vfs *) vfs->pAppData;
+
+    /* only read-only main databases are handled here */
+    if (!name || !(flags & SQLITE_OPEN_MAIN_DB) || !(flags & SQLITE_OPEN_READONLY)) {
+        return base->xOpen(base, name, file, flags, out_flags);
+    }
+
+    struct gufi_file *gf = (struct gufi_file *) file;
+    memset(gf, 0, sizeof(*gf));
+    gf->fd = -1;
+
+    /* O_NOATIME is only allowed for the owner of the file */
+    int fd = open(name, O_RDONLY | O_NOATIME);
+    if ((fd < 0) && (errno == EPERM)) {
+        fd = open(name, O_RDONLY);
+    }
+
+    if (fd < 0) {
+        return SQLITE_CANTOPEN;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return SQLITE_CANTOPEN;
+    }
+
+    gf->size = st.st_size;
+
+    if (gf->size <= GUFI_VFS_MAX_IMAGE) {
+        gf->image = get_image(gf->size?gf->size:1, &gf->capacity);
+        sqlite3_int64 got = 0;
+        while (gf->image && (got < gf->size)) {
+            const ssize_t rc = pread(fd, gf->image + got, gf->size - got, got);
+            if (rc < 1) {
+                break;
+            }
+            got += rc;
+        }
+
+        if (gf->image && (got == gf->size)) {
+            close(fd);
+            fd = -1;
+        }
+        else if (gf->image) {
+            /* fall back to reading on demand */
+            put_image(gf->image, gf->capacity);
+            gf->image = NULL;
+        }
+    }
+
+    gf->fd = fd;
+    gf->base.pMethods = &gufi_io_methods;
+
+    if (out_flags) {
+        *out_flags = flags;
+    }
+
+    return SQLITE_OK;
+}
+
+static void register_vfs(void) {
+    sqlite3_vfs *base = sqlite3_vfs_find(GUFI_SQLITE_BASE_VFS);
+    if (!base) {
+        return;
+    }
+
+    if (pthread_key_create(&spare_key, free_spare) != 0) {
+        return;
+    }
+
+    gufi_vfs = *base;
+    gufi_vfs.pNext = NULL;
+    gufi_vfs.zName = GUFI_SQLITE_RO_VFS;
+    gufi_vfs.pAppData = base;
+    gufi_vfs.xOpen = gufi_open;
+    if ((size_t) gufi_vfs.szOsFile < sizeof(struct gufi_file)) {
+        gufi_vfs.szOsFile = sizeof(struct gufi_file);
+    }
+
+    init_rc = sqlite3_vfs_register(&gufi_vfs, 0);
+}
+
+int gufi_vfs_init(void) {
+    pthread_once(&once, register_vfs);
+    return init_rc;
+}
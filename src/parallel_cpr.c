@@ -0,0 +1,437 @@
+/*
+This file is part of GUFI, which is part of MarFS, which is released
+under the BSD license.
+
+
+Copyright (c) 2017, Los Alamos National Security (LANS), LLC
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+From Los Alamos National Security, LLC:
+LA-CC-15-039
+
+Copyright (c) 2017, Los Alamos National Security, LLC All rights reserved.
+Copyright 2017. Los Alamos National Security, LLC. This software was produced
+under U.S. Government contract DE-AC52-06NA25396 for Los Alamos National
+Laboratory (LANL), which is operated by Los Alamos National Security, LLC for
+the U.S. Department of Energy. The U.S. Government has rights to use,
+reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR LOS
+ALAMOS NATIONAL SECURITY, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR
+ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is
+modified to produce derivative works, such modified software should be
+clearly marked, so as not to confuse it with the version available from
+LANL.
+
+THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bf.h"
+#include "BottomUp.h"
+#include "dbutils.h"
+#include "debug.h"
+#include "template_db.h"
+#include "utils.h"
+
+extern int errno;
+
+/* list of completed directories, kept in the destination root until the copy finishes */
+#define JOURNAL DBNAME ".copy"
+
+struct Copy {
+    const char * src;
+    size_t src_len;
+    const char * dst;
+    size_t dst_len;
+
+    /* directories finished by a previous run, sorted */
+    char ** done;
+    size_t done_count;
+
+    int journal;            /* append-only, one relative path per line */
+};
+
+struct CopyDir {
+    struct BottomUp data;
+    int failed;             /* something in this subtree was not copied */
+};
+
+static int compare_strings(const void * lhs, const void * rhs) {
+    return strcmp(*(char **) lhs, *(char **) rhs);
+}
+
+/* path of a directory relative to the source root, "." for the root */
+static const char * relative(const struct Copy * copy, const struct BottomUp * dir) {
+    if (dir->name_len == copy->src_len) {
+        return ".";
+    }
+    return dir->name + copy->src_len + 1;
+}
+
+/* path in the destination tree */
+static size_t dst_path(const struct Copy * copy, const struct BottomUp * dir, char * path) {
+    return SNFORMAT_S(path, MAXPATH, 2,
+                      copy->dst, copy->dst_len,
+                      dir->name + copy->src_len, dir->name_len - copy->src_len);
+}
+
+static int finished(const struct Copy * copy, const char * rel) {
+    return copy->done_count &&
+        bsearch(&rel, copy->done, copy->done_count, sizeof(char *), compare_strings);
+}
+
+/* read the journal left behind by an interrupted copy */
+static int load_journal(struct Copy * copy, const char * name) {
+    copy->done = NULL;
+    copy->done_count = 0;
+
+    FILE * file = fopen(name, "r");
+    if (!file) {
+        return (errno == ENOENT)?0:-1;
+    }
+
+    size_t capacity = 0;
+    char * line = NULL;
+    size_t len = 0;
+    ssize_t got = 0;
+    while ((got = getline(&line, &len, file)) > 0) {
+        /* a line without a newline was cut off and does not count */
+        if (line[got - 1] != '\n') {
+            break;
+        }
+        line[got - 1] = '\0';
+
+        if (copy->done_count == capacity) {
+            capacity = capacity?(capacity * 2):1024;
+            copy->done = realloc(copy->done, capacity * sizeof(char *));
+        }
+        copy->done[copy->done_count++] = strdup(line);
+    }
+    free(line);
+    fclose(file);
+
+    qsort(copy->done, copy->done_count, sizeof(char *), compare_strings);
+    return 0;
+}
+
+/* copy one file, keeping its permissions, ownership, and times */
+static int copy_file(const char * src, const char * dst, const struct stat * st, const int is_db) {
+    /* anything left behind by an interrupted copy is replaced */
+    unlink(dst);
+
+    if (in.vacuum && is_db) {
+        /*
+         * VACUUM INTO creates the new file with the flags of the
+         * connection, so attach the source to a writable connection
+         */
+        sqlite3 * db = opendb(":memory:", SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, PRAGMA_NONE, 0
+                              , NULL, NULL
+                              #if defined(DEBUG) && defined(PER_THREAD_STATS)
+                              , NULL, NULL
+                              , NULL, NULL
+                              #endif
+            );
+        if (!db) {
+            return -1;
+        }
+
+        if (!attachdb(src, db, "src", SQLITE_OPEN_READONLY)) {
+            closedb(db);
+            return -1;
+        }
+
+        char sql[MAXSQL];
+        sqlite3_snprintf(MAXSQL, sql, "VACUUM src INTO %Q", dst);
+
+        char * err = NULL;
+        const int rc = sqlite3_exec(db, sql, NULL, NULL, &err);
+        closedb(db);
+        if (rc != SQLITE_OK) {
+            fprintf(stderr, "Error: Could not VACUUM \"%s\" into \"%s\": %s\n", src, dst, err);
+            sqlite3_free(err);
+            return -1;
+        }
+    }
+    else {
+        const int src_fd = open(src, O_RDONLY);
+        if (src_fd < 0) {
+            fprintf(stderr, "Error: Could not open \"%s\": %s\n", src, strerror(errno));
+            return -1;
+        }
+
+        const int dst_fd = open(dst, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+        if (dst_fd < 0) {
+            fprintf(stderr, "Error: Could not create \"%s\": %s\n", dst, strerror(errno));
+            close(src_fd);
+            return -1;
+        }
+
+        const ssize_t copied = st->st_size?gufi_copyfd(src_fd, dst_fd, st->st_size):0;
+        close(dst_fd);
+        close(src_fd);
+
+        if (copied != st->st_size) {
+            fprintf(stderr, "Error: Could not copy \"%s\" to \"%s\": %s\n", src, dst, strerror(errno));
+            return -1;
+        }
+    }
+
+    /* same as what was set when the index was built */
+    chmod(dst, st->st_mode & 07777);
+    chown(dst, st->st_uid, st->st_gid);
+
+    /* keep times so that incremental tools see the same history */
+    const struct timespec times[2] = {st->st_atim, st->st_mtim};
+    utimensat(AT_FDCWD, dst, times, AT_SYMLINK_NOFOLLOW);
+
+    return 0;
+}
+
+/* create the destination directory before its children are copied into it */
+void copy_dir(void * args timestamp_sig) {
+    struct BottomUp * dir = (struct BottomUp *) args;
+    struct Copy * copy = (struct Copy *) dir->extra_args;
+
+    char dst[MAXPATH];
+    dst_path(copy, dir, dst);
+
+    /* owner needs to be able to write into the directory until it is done */
+    if ((mkdir(dst, S_IRWXU) != 0) && (errno != EEXIST)) {
+        fprintf(stderr, "Error: Could not create directory \"%s\": %s\n", dst, strerror(errno));
+    }
+}
+
+/* copy the files once all subdirectories are done, then set the directory's metadata */
+void copy_files(void * args timestamp_sig) {
+    struct CopyDir * cd = (struct CopyDir *) args;
+    struct BottomUp * dir = &cd->data;
+    struct Copy * copy = (struct Copy *) dir->extra_args;
+
+    cd->failed = 0;
+
+    const char * rel = relative(copy, dir);
+    if (finished(copy, rel)) {
+        return;
+    }
+
+    sll_loop(&dir->subdirs, node) {
+        struct CopyDir * child = (struct CopyDir *) sll_node_data(node);
+        cd->failed |= child->failed;
+    }
+
+    char dst[MAXPATH];
+    const size_t dst_len = dst_path(copy, dir, dst);
+
+    int rc = 0;
+    BottomUp_nondir_loop(dir, entry) {
+        /* do not copy the journal of an earlier copy of this index */
+        if (!dir->parent && (strcmp(entry, JOURNAL) == 0)) {
+            continue;
+        }
+
+        const size_t entry_len = strlen(entry);
+
+        char src_name[MAXPATH];
+        SNFORMAT_S(src_name, MAXPATH, 3, dir->name, dir->name_len, "/", (size_t) 1, entry, entry_len);
+
+        char dst_name[MAXPATH];
+        SNFORMAT_S(dst_name, MAXPATH, 3, dst, dst_len, "/", (size_t) 1, entry, entry_len);
+
+        struct stat st;
+        if (lstat(src_name, &st) != 0) {
+            fprintf(stderr, "Error: Could not stat \"%s\": %s\n", src_name, strerror(errno));
+            rc = -1;
+            continue;
+        }
+
+        if (!S_ISREG(st.st_mode)) {
+            continue;
+        }
+
+        rc |= copy_file(src_name, dst_name, &st, (strcmp(entry, DBNAME) == 0));
+    }
+
+    struct stat st;
+    if (lstat(dir->name, &st) != 0) {
+        fprintf(stderr, "Error: Could not stat \"%s\": %s\n", dir->name, strerror(errno));
+        cd->failed = 1;
+        return;
+    }
+
+    if (dupdir(dst, &st) != 0) {
+        fprintf(stderr, "Error: Could not set permissions of \"%s\": %s\n", dst, strerror(errno));
+        cd->failed = 1;
+        return;
+    }
+
+    const struct timespec times[2] = {st.st_atim, st.st_mtim};
+    utimensat(AT_FDCWD, dst, times, AT_SYMLINK_NOFOLLOW);
+
+    cd->failed |= (rc != 0);
+
+    /* a directory is only done when everything under it was copied */
+    if (!cd->failed) {
+        char line[MAXPATH + 1];
+        const size_t len = SNPRINTF(line, sizeof(line), "%s\n", rel);
+        if (write(copy->journal, line, len) != (ssize_t) len) {
+            fprintf(stderr, "Warning: Could not record \"%s\" as copied: %s\n", dir->name, strerror(errno));
+        }
+    }
+}
+
+/* remove trailing slashes, keeping "/" */
+static size_t trim(char * path) {
+    size_t len = strlen(path);
+    while ((len > 1) && (path[len - 1] == '/')) {
+        path[--len] = '\0';
+    }
+    return len;
+}
+
+void sub_help() {
+   printf("GUFI_index       index to copy\n");
+   printf("destination      where to copy the index to\n");
+   printf("\n");
+}
+
+int main(int argc, char * argv[]) {
+    int idx = parse_cmd_line(argc, argv, "hHn:l:v", 2, "GUFI_index destination", &in);
+    if (in.helped)
+        sub_help();
+    if (idx < 0)
+        return -1;
+
+    #ifdef DEBUG
+    #ifdef PER_THREAD_STATS
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    epoch = since_epoch(&now);
+    #endif
+
+    timestamp_init(timestamp_buffers, in.maxthreads + 1, 1024 * 1024, NULL);
+    #endif
+
+    struct Copy copy;
+    copy.src_len = trim(argv[idx]);
+    copy.src = argv[idx];
+    copy.dst_len = trim(argv[idx + 1]);
+    copy.dst = argv[idx + 1];
+
+    struct stat st;
+    if ((lstat(copy.src, &st) != 0) || !S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "\"%s\" is not a directory\n", copy.src);
+        return -1;
+    }
+
+    /* the root has to exist for the journal to be placed in it */
+    if ((mkdir(copy.dst, S_IRWXU) != 0) && (errno != EEXIST)) {
+        fprintf(stderr, "Could not create \"%s\": %s\n", copy.dst, strerror(errno));
+        return -1;
+    }
+
+    char journal[MAXPATH];
+    SNPRINTF(journal, MAXPATH, "%s/" JOURNAL, copy.dst);
+
+    if (load_journal(&copy, journal) != 0) {
+        fprintf(stderr, "Could not read \"%s\": %s\n", journal, strerror(errno));
+        return -1;
+    }
+
+    copy.journal = open(journal, O_WRONLY | O_CREAT | O_APPEND, S_IRUSR | S_IWUSR);
+    if (copy.journal < 0) {
+        fprintf(stderr, "Could not open \"%s\": %s\n", journal, strerror(errno));
+        return -1;
+    }
+
+    char * root = (char *) copy.src;
+    const int rc = parallel_bottomup(&root, 1,
+                                     in.maxthreads,
+                                     sizeof(struct CopyDir),
+                                     copy_dir, copy_files,
+                                     1,
+                                     in.memory_limit,
+                                     &copy
+                                     #if defined(DEBUG) && defined(PER_THREAD_STATS)
+                                     , timestamp_buffers
+                                     #endif
+        );
+
+    close(copy.journal);
+
+    /* the journal is only needed to resume an unfinished copy */
+    const char * root_rel = ".";
+    int complete = (rc == 0);
+    if (complete) {
+        struct Copy check;
+        load_journal(&check, journal);
+        complete = finished(&check, root_rel);
+        for(size_t i = 0; i < check.done_count; i++) {
+            free(check.done[i]);
+        }
+        free(check.done);
+    }
+
+    if (complete) {
+        remove(journal);
+
+        /* removing the journal modified the root */
+        const struct timespec times[2] = {st.st_atim, st.st_mtim};
+        utimensat(AT_FDCWD, copy.dst, times, AT_SYMLINK_NOFOLLOW);
+    }
+    else {
+        fprintf(stderr, "Copy incomplete. Run again to resume.\n");
+    }
+
+    for(size_t i = 0; i < copy.done_count; i++) {
+        free(copy.done[i]);
+    }
+    free(copy.done);
+
+    timestamp_destroy(timestamp_buffers);
+
+    return complete?0:-1;
+}
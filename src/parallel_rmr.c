@@ -86,10 +86,11 @@ void rm_dir(void * args timestamp_sig) {
     char db_name[MAXPATH];
     SNPRINTF(db_name, MAXPATH, "%s/" DBNAME, dir->name);
 
-    sll_loop(&dir->subnondirs, node) {
-        struct BottomUp * entry = (struct BottomUp *) sll_node_data(node);
-        if (unlink(entry->name) != 0) {
-            fprintf(stderr, "Warning: Failed to delete \"%s\": %s\n", entry->name, strerror(errno));
+    BottomUp_nondir_loop(dir, entry) {
+        char name[MAXPATH];
+        SNFORMAT_S(name, MAXPATH, 3, dir->name, dir->name_len, "/", (size_t) 1, entry, strlen(entry));
+        if (unlink(name) != 0) {
+            fprintf(stderr, "Warning: Failed to delete \"%s\": %s\n", name, strerror(errno));
         }
     }
 
@@ -104,7 +105,7 @@ void sub_help() {
 }
 
 int main(int argc, char * argv[]) {
-    int idx = parse_cmd_line(argc, argv, "hHn:", 1, "directory ...", &in);
+    int idx = parse_cmd_line(argc, argv, "hHn:l:", 1, "directory ...", &in);
     if (in.helped)
         sub_help();
     if (idx < 0)
@@ -125,6 +126,7 @@ int main(int argc, char * argv[]) {
                                      sizeof(struct BottomUp),
                                      NULL, rm_dir,
                                      1,
+                                     in.memory_limit,
                                      NULL
                                      #if defined(DEBUG) && defined(PER_THREAD_STATS)
                                      , timestamp_buffers
@@ -122,7 +122,7 @@ int main(int argc, char *argv[])
         rsqlstmt = argv[idx++];
     }
 
-    if (!(db = opendb(":memory:", SQLITE_OPEN_CREATE | SQLITE_OPEN_READWRITE, 1, 1,
+    if (!(db = opendb(":memory:", SQLITE_OPEN_CREATE | SQLITE_OPEN_READWRITE, PRAGMA_AGGREGATE, 1,
                       NULL, NULL
                       #if defined(DEBUG) && defined(PER_THREAD_STATS)
                       , NULL, NULL
@@ -63,14 +63,19 @@ OF SUCH DAMAGE.
 
 
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include "bf.h"
 #include "BottomUp.h"
+#include "bloom.h"
+#include "catalog.h"
+#include "columns.h"
 #include "dbutils.h"
 #include "debug.h"
 #include "SinglyLinkedList.h"
@@ -80,6 +85,9 @@ extern int errno;
 
 #define SUBDIR_ATTACH_NAME "subdir"
 
+/* touched in each root after a roll up so that -U can find what changed */
+#define ROLLUP_MARKER DBNAME ".rollup"
+
 /* statistics stored when processing each directory */
 /* this is the type stored in the RollUpStats struct sll variables */
 struct DirStats {
@@ -96,11 +104,56 @@ struct DirStats {
     int success;            /* whether or not the roll up succeeded */
 };
 
+/* a directory whose entire subtree is allowed to be rolled up */
+/* this is the type stored in the RollUpStats candidates sll */
+struct Candidate {
+    char * path;
+    size_t level;
+    size_t dirs;            /* directories in the subtree, including this one */
+    size_t rows;            /* pentries rows copied if the subtree is rolled up */
+    size_t end;             /* index of the first candidate not under this one */
+    int chosen;
+    int covered;            /* an ancestor was chosen */
+};
+
+/* directories chosen to be rolled up when there is a storage budget */
+struct Plan {
+    struct Candidate ** candidates; /* sorted by path */
+    size_t count;
+    size_t chosen;
+    size_t rows;            /* rows used out of the budget */
+    size_t saved;           /* database opens a full tree walk no longer does */
+};
+
+static struct Plan plan;
+
+/* catalogs of the roots being rolled up (see catalog.h) */
+static struct catalog * catalogs = NULL;
+static int catalog_count = 0;
+
+/* copy the rollupscore that was just written into the catalog that has this directory */
+static void update_catalog(const char * name, sqlite3 * db) {
+    for(int i = 0; i < catalog_count; i++) {
+        if (!catalogs[i].records) {
+            continue;
+        }
+
+        const uint64_t record = catalog_find_path(&catalogs[i], name);
+        if (record < catalogs[i].count) {
+            int score = 0;
+            get_rollupscore(name, db, &score);
+            catalogs[i].records[record].rollupscore = score;
+            return;
+        }
+    }
+}
+
 /* per thread stats */
 struct RollUpStats {
     struct sll not_processed;
     struct sll not_rolled_up;
     struct sll rolled_up;
+    struct sll candidates;
 
     size_t remaining;       /* children that remain after rolling up */
 
@@ -308,6 +361,27 @@ void print_stats(char ** paths, const int path_count, struct RollUpStats * stats
     fprintf(stdout, "Directories:    %zu (%zu empty)\n", total_dirs, empty);
     fprintf(stdout, "Total:          %zu\n", total_nondirs + total_dirs);
     fprintf(stdout, "Remaining Dirs: %zu (%.2Lf%%)\n", remaining, (100 * (long double) remaining) / total_dirs);
+
+    if (in.rollup_budget) {
+        fprintf(stdout, "\n");
+        fprintf(stdout, "Plan:\n");
+        fprintf(stdout, "    Budget:     %14zu rows\n", in.rollup_budget);
+        fprintf(stdout, "    Used:       %14zu rows\n", plan.rows);
+        fprintf(stdout, "    Candidates: %14zu\n", plan.count);
+        fprintf(stdout, "    Chosen:     %14zu\n", plan.chosen);
+        fprintf(stdout, "    Opens Saved:%14zu\n", plan.saved);
+
+        /* list the subtrees that were (or would be) rolled up */
+        if (in.dry_run) {
+            for(size_t i = 0; i < plan.count; i++) {
+                const struct Candidate * c = plan.candidates[i];
+                if (c->chosen && !c->covered) {
+                    fprintf(stdout, "    %s (%zu dirs, %zu rows, level %zu)\n", c->path, c->dirs, c->rows, c->level);
+                }
+            }
+        }
+    }
+
     sll_destroy(&rolled_up, free);
     sll_destroy(&not_rolled_up, free);
     sll_destroy(&not_processed, free);
@@ -317,8 +391,123 @@ void print_stats(char ** paths, const int path_count, struct RollUpStats * stats
 struct RollUp {
     struct BottomUp data;
     int rolledup;
+    int changed;            /* parent has to be processed again */
+    struct timespec since;  /* when the root was last rolled up */
+
+    /* filled in by the planner */
+    int legal;              /* the entire subtree can be rolled up */
+    size_t rows;            /* pentries rows if this directory is rolled up */
+    size_t dirs;            /* directories in the subtree, including this one */
+    size_t cost;            /* pentries rows copied if the subtree is rolled up */
+    int planned;            /* this directory is inside of a chosen subtree */
 };
 
+/*
+ * compare paths so that '/' sorts before every other character
+ * in order to keep each subtree contiguous after sorting
+ */
+static int compare_paths(const char * lhs, const char * rhs) {
+    while (*lhs && (*lhs == *rhs)) {
+        lhs++;
+        rhs++;
+    }
+
+    const int l = (*lhs == '/')?1:((unsigned char) *lhs + 1);
+    const int r = (*rhs == '/')?1:((unsigned char) *rhs + 1);
+    return (*lhs?l:0) - (*rhs?r:0);
+}
+
+static int compare_candidates(const void * lhs, const void * rhs) {
+    return compare_paths((*(struct Candidate **) lhs)->path,
+                         (*(struct Candidate **) rhs)->path);
+}
+
+static int compare_key(const void * key, const void * elem) {
+    return compare_paths((const char *) key, (*(struct Candidate **) elem)->path);
+}
+
+/* whether or not the planner chose to roll up this directory */
+static int planned(const char * path) {
+    if (!in.rollup_budget || !plan.count) {
+        return 0;
+    }
+
+    struct Candidate ** found = bsearch(path, plan.candidates, plan.count,
+                                        sizeof(struct Candidate *), compare_key);
+    return found && (*found)->chosen;
+}
+
+/* get the time of the previous roll up from the root and pass it down */
+void rollup_descend(void * args timestamp_sig) {
+    struct RollUp * dir = (struct RollUp *) args;
+    dir->changed = 0;
+
+    struct RollUp * parent = (struct RollUp *) dir->data.parent;
+    dir->planned = (parent && parent->planned) || planned(dir->data.name);
+
+    if (parent) {
+        dir->since = parent->since;
+        return;
+    }
+
+    /* without a marker, every directory is processed */
+    dir->since.tv_sec = 0;
+    dir->since.tv_nsec = 0;
+
+    char marker[MAXPATH];
+    SNPRINTF(marker, MAXPATH, "%s/" ROLLUP_MARKER, dir->data.name);
+
+    struct stat st;
+    if (lstat(marker, &st) == 0) {
+        dir->since = st.st_mtim;
+    }
+}
+
+static int newer(const struct timespec * lhs, const struct timespec * rhs) {
+    return ((lhs->tv_sec > rhs->tv_sec) ||
+            ((lhs->tv_sec == rhs->tv_sec) && (lhs->tv_nsec > rhs->tv_nsec)));
+}
+
+/*
+ * a directory has to be processed again if its database or its
+ * list of subdirectories was modified after the previous roll up,
+ * or if any of its children was processed again
+ */
+static int modified(struct RollUp * dir, const char * dbname) {
+    sll_loop(&dir->data.subdirs, node) {
+        struct RollUp * child = (struct RollUp *) sll_node_data(node);
+        if (child->changed) {
+            return 1;
+        }
+    }
+
+    struct stat st;
+    if ((lstat(dir->data.name, &st) != 0) || newer(&st.st_mtim, &dir->since)) {
+        return 1;
+    }
+
+    if ((lstat(dbname, &st) != 0) || newer(&st.st_mtim, &dir->since)) {
+        return 1;
+    }
+
+    return 0;
+}
+
+/* record when the roll up finished */
+static void touch_marker(const char * root) {
+    char marker[MAXPATH];
+    SNPRINTF(marker, MAXPATH, "%s/" ROLLUP_MARKER, root);
+
+    const int fd = open(marker, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd < 0) {
+        fprintf(stderr, "Warning: Could not create \"%s\": %s\n", marker, strerror(errno));
+        return;
+    }
+
+    futimens(fd, NULL);
+    close(fd);
+}
+
 /* ************************************** */
 /* get permissions from directory entries */
 const char PERM_SQL[] = "SELECT " \
@@ -401,7 +590,7 @@ int check_children(struct RollUp * rollup, struct Permissions * curr,
         SNPRINTF(dbname, MAXPATH, "%s/" DBNAME, child->data.name);
 
         timestamp_start(open_child_db);
-        sqlite3 * db = opendb(dbname, SQLITE_OPEN_READONLY, 1, 0
+        sqlite3 * db = opendb(dbname, SQLITE_OPEN_READONLY, PRAGMA_QUERY_READONLY, 0
                               , NULL, NULL
                               #if defined(DEBUG) && defined(PER_THREAD_STATS)
                               , NULL, NULL
@@ -481,6 +670,224 @@ int check_children(struct RollUp * rollup, struct Permissions * curr,
 }
 /* ************************************** */
 
+/*
+ * first pass when there is a storage budget: find the size and
+ * cost of every subtree and whether or not all of it can be rolled up
+ *
+ * rolling up a directory replaces the pentries view with a table
+ * containing the entries of the entire subtree, so the cost of
+ * rolling up a subtree is the sum of the rows of every pentries
+ * table in it, and the benefit is not having to open the database
+ * of every directory under the top of the subtree
+ */
+void plan_rollup(void * args timestamp_sig) {
+    struct RollUp * dir = (struct RollUp *) args;
+    struct RollUpStats * stats = (struct RollUpStats *) dir->data.extra_args;
+    const size_t id = dir->data.tid.up;
+
+    dir->legal = 1;
+    dir->rows = 0;
+    dir->dirs = 1;
+    dir->cost = 0;
+
+    sll_loop(&dir->data.subdirs, node) {
+        struct RollUp * child = (struct RollUp *) sll_node_data(node);
+        dir->legal &= child->legal;
+        dir->rows  += child->rows;
+        dir->dirs  += child->dirs;
+        dir->cost  += child->cost;
+    }
+
+    char dbname[MAXPATH];
+    SNPRINTF(dbname, MAXPATH, "%s/" DBNAME, dir->data.name);
+
+    sqlite3 * db = opendb(dbname, SQLITE_OPEN_READONLY, PRAGMA_QUERY_READONLY, 0
+                          , NULL, NULL
+                          #if defined(DEBUG) && defined(PER_THREAD_STATS)
+                          , NULL, NULL
+                          , NULL, NULL
+                          #endif
+        );
+    if (!db) {
+        dir->legal = 0;
+        return;
+    }
+
+    /* count entries instead of pentries in case this directory was already rolled up */
+    size_t own = 0;
+    char * err = NULL;
+    if (sqlite3_exec(db, "SELECT COUNT(*) FROM entries", add_entries_count, &own, &err) != SQLITE_OK) {
+        fprintf(stderr, "Warning: Failed to get entries row count from \"%s\": %s\n", dir->data.name, err);
+        dir->legal = 0;
+    }
+    sqlite3_free(err);
+    err = NULL;
+
+    /* packed directories always stay rolled up, so they cost nothing more */
+    if (is_packed(dir->data.name)) {
+        own = 0;
+        get_nondirs(dir->data.name, db, &own);
+        dir->rows += own;
+        closedb(db);
+        return;
+    }
+
+    dir->rows += own;
+    dir->cost += dir->rows;
+
+    if ((own > in.max_in_dir) || (dir->rows > in.max_in_dir)) {
+        dir->legal = 0;
+    }
+
+    if (dir->legal) {
+        struct Permissions perms;
+        if (sqlite3_exec(db, PERM_SQL, get_permissions, &perms, &err) == SQLITE_OK) {
+            size_t total_child_entries = 0;
+            dir->legal = (check_children(dir, &perms, dir->data.subdir_count, &total_child_entries timestamp_args) == 1);
+        }
+        else {
+            fprintf(stderr, "Error: Could not get permissions of current directory \"%s\": %s\n", dir->data.name, err);
+            dir->legal = 0;
+        }
+        sqlite3_free(err);
+    }
+
+    closedb(db);
+
+    /* rolling up a directory without subdirectories does not save any opens */
+    if (dir->legal && dir->data.subdir_count) {
+        struct Candidate * c = malloc(sizeof(struct Candidate));
+        c->path = strndup(dir->data.name, dir->data.name_len);
+        c->level = dir->data.level;
+        c->dirs = dir->dirs;
+        c->rows = dir->cost;
+        c->end = 0;
+        c->chosen = 0;
+        c->covered = 0;
+        sll_push(&stats[id].candidates, c);
+    }
+}
+
+/* more opens saved per row copied goes first */
+static int compare_benefit(const void * lhs, const void * rhs) {
+    const struct Candidate * l = *(struct Candidate **) lhs;
+    const struct Candidate * r = *(struct Candidate **) rhs;
+
+    /* (l->dirs - 1) / l->rows vs. (r->dirs - 1) / r->rows without dividing by 0 */
+    const long double lb = ((long double) (l->dirs - 1)) * (r->rows + 1);
+    const long double rb = ((long double) (r->dirs - 1)) * (l->rows + 1);
+    if (lb != rb) {
+        return (lb < rb)?1:-1;
+    }
+
+    /* prefer larger subtrees */
+    if (l->dirs != r->dirs) {
+        return (l->dirs < r->dirs)?1:-1;
+    }
+
+    return compare_paths(l->path, r->path);
+}
+
+/*
+ * greedily choose the subtrees that save the most database opens per
+ * row copied until the budget runs out
+ *
+ * choosing a subtree that contains already chosen subtrees only costs
+ * the rows that have not been paid for yet, and replaces them in the plan
+ */
+static void make_plan(struct RollUpStats * stats, const size_t threads) {
+    struct sll candidates;
+    sll_init(&candidates);
+    for(size_t i = 0; i < threads; i++) {
+        sll_move_append(&candidates, &stats[i].candidates);
+    }
+
+    plan.count = sll_get_size(&candidates);
+    plan.candidates = malloc(plan.count * sizeof(struct Candidate *));
+
+    size_t idx = 0;
+    sll_loop(&candidates, node) {
+        plan.candidates[idx++] = (struct Candidate *) sll_node_data(node);
+    }
+    sll_destroy(&candidates, 0);
+
+    qsort(plan.candidates, plan.count, sizeof(struct Candidate *), compare_candidates);
+
+    /* find where each subtree ends */
+    size_t * open = malloc(plan.count * sizeof(size_t));
+    size_t depth = 0;
+    for(size_t i = 0; i < plan.count; i++) {
+        const char * path = plan.candidates[i]->path;
+        while (depth) {
+            struct Candidate * top = plan.candidates[open[depth - 1]];
+            const size_t len = strlen(top->path);
+            if ((strncmp(path, top->path, len) == 0) && (path[len] == '/')) {
+                break;
+            }
+            top->end = i;
+            depth--;
+        }
+        open[depth++] = i;
+    }
+    while (depth) {
+        plan.candidates[open[--depth]]->end = plan.count;
+    }
+    free(open);
+
+    struct Candidate ** order = malloc(plan.count * sizeof(struct Candidate *));
+    memcpy(order, plan.candidates, plan.count * sizeof(struct Candidate *));
+    qsort(order, plan.count, sizeof(struct Candidate *), compare_benefit);
+
+    for(size_t i = 0; i < plan.count; i++) {
+        struct Candidate * c = order[i];
+        if (c->covered) {
+            continue;
+        }
+
+        /* location of c in the sorted candidates */
+        struct Candidate ** found = bsearch(c->path, plan.candidates, plan.count,
+                                            sizeof(struct Candidate *), compare_key);
+        const size_t start = found - plan.candidates;
+
+        /* chosen subtrees under c have already been paid for */
+        size_t rows = c->rows;
+        size_t saved = c->dirs - 1;
+        for(size_t j = start + 1; j < c->end; j++) {
+            struct Candidate * sub = plan.candidates[j];
+            if (sub->chosen && !sub->covered) {
+                rows  -= sub->rows;
+                saved -= sub->dirs - 1;
+            }
+        }
+
+        if (plan.rows + rows > in.rollup_budget) {
+            continue;
+        }
+
+        c->chosen = 1;
+        plan.rows += rows;
+        plan.saved += saved;
+
+        for(size_t j = start + 1; j < c->end; j++) {
+            struct Candidate * sub = plan.candidates[j];
+            plan.chosen -= (sub->chosen && !sub->covered);
+            sub->covered = 1;
+        }
+        plan.chosen++;
+    }
+
+    free(order);
+}
+
+static void destroy_plan(void) {
+    for(size_t i = 0; i < plan.count; i++) {
+        free(plan.candidates[i]->path);
+        free(plan.candidates[i]);
+    }
+    free(plan.candidates);
+    memset(&plan, 0, sizeof(plan));
+}
+
 /* check if the current directory can be rolled up */
 /*
 @return   0 - cannot rollup
@@ -508,6 +915,11 @@ int can_rollup(struct RollUp * rollup,
     get_nondirs(rollup->data.name, dst, &ds->subnondir_count);
     timestamp_end(timestamp_buffers, rollup->data.tid.up, "nondir_count", nondir_count);
 
+    /* the planner did not choose this directory */
+    if (in.rollup_budget && !rollup->planned) {
+        goto end_can_rollup;
+    }
+
     /* the current directory has too many immediate files/links, don't roll up */
     if (ds->subnondir_count > in.max_in_dir) {
         ds->too_many_before = ds->subnondir_count;
@@ -618,6 +1030,16 @@ int do_rollup(struct RollUp * rollup,
     char * err = NULL;
     int exec_rc = SQLITE_OK;
 
+    #ifdef NAME_FILTERS
+    /*
+     * the name filter of a rolled up directory is the union of its
+     * own filter and the filters of the children copied into it
+     */
+    struct bloom filter;
+    bloom_init(&filter);
+    int filter_complete = (namefilter_read(dst, "main", NAMEFILTER_DIR, &filter) == 0);
+    #endif
+
     /* set the rollup score in the SQL statement */
     char rollup_current_dir[] = ROLLUP_CURRENT_DIR;
     rollup_current_dir[rollup_score_offset] += ds->score;
@@ -648,11 +1070,19 @@ int do_rollup(struct RollUp * rollup,
 
         /* roll up the subdir into this dir */
         if (!rc) {
+            #ifdef NAME_FILTERS
+            if (filter_complete) {
+                filter_complete = (namefilter_read(dst, SUBDIR_ATTACH_NAME, NAMEFILTER_DIR, &filter) == 0);
+            }
+            #endif
+
             timestamp_start(rollup_subdir);
             exec_rc = sqlite3_exec(dst, rollup_subdir, NULL, NULL, &err);
             timestamp_end(timestamp_buffers, id, "rollup_subdir", rollup_subdir);
             if (exec_rc != SQLITE_OK) {
                 fprintf(stderr, "Error: Failed to copy \"%s\" subdir pentries into pentries table: %s\n", child->name, err);
+                sqlite3_free(err);
+                err = NULL;
             }
         }
 
@@ -671,10 +1101,69 @@ int do_rollup(struct RollUp * rollup,
 end_rollup:
     sqlite3_free(err);
 
+    /* a child without a filter means the names have to be read again */
+    #ifdef NAME_FILTERS
+    if (!rc && filter_complete) {
+        namefilter_write(rollup->data.name, dst, NAMEFILTER_DIR, &filter);
+    }
+    else {
+        create_namefilter(rollup->data.name, dst);
+    }
+    bloom_destroy(&filter);
+    #else
+    update_namefilter(rollup->data.name, dst);
+    #endif
+
+    /* ignore errors */
+    update_columns(rollup->data.name, dst);
+
     timestamp_end(timestamp_buffers, id, "do_rollup", do_roll_up);
     return rc;
 }
 
+/*
+ * only rolled up directories whose parents were not rolled up are
+ * queried, so they are the only ones that get pentries indexes
+ *
+ * this runs after the parent has decided, so the indexes are
+ * built once, after all of the rows have been copied
+ */
+static void index_pentries(const char * name, sqlite3 * db) {
+    size_t rows = 0;
+    if ((get_nondirs(name, db, &rows) == SQLITE_OK) && (rows > in.index_threshold)) {
+        /* ignore errors */
+        create_entries_indexes(name, db, "pentries");
+    }
+}
+
+static void index_rolled_up_children(struct RollUp * dir) {
+    if (!in.index_threshold || in.dry_run) {
+        return;
+    }
+
+    sll_loop(&dir->data.subdirs, node) {
+        struct RollUp * child = (struct RollUp *) sll_node_data(node);
+        if (!child->rolledup) {
+            continue;
+        }
+
+        char dbname[MAXPATH];
+        SNFORMAT_S(dbname, MAXPATH, 3, child->data.name, child->data.name_len, "/", 1, DBNAME, DBNAME_LEN);
+
+        sqlite3 * db = opendb(dbname, SQLITE_OPEN_READWRITE, PRAGMA_ROLLUP, 0
+                              , NULL, NULL
+                              #if defined(DEBUG) && defined(PER_THREAD_STATS)
+                              , NULL, NULL
+                              , NULL, NULL
+                              #endif
+            );
+        if (db) {
+            index_pentries(child->data.name, db);
+        }
+        closedb(db);
+    }
+}
+
 void rollup(void * args timestamp_sig) {
     timestamp_create_buffer(4096);
 
@@ -706,7 +1195,7 @@ void rollup(void * args timestamp_sig) {
 
     /* open the database file here to reduce number of open calls */
     timestamp_start(open_curr_db);
-    sqlite3 * dst = opendb(dbname, SQLITE_OPEN_READWRITE, 1, 0
+    sqlite3 * dst = opendb(dbname, SQLITE_OPEN_READWRITE, PRAGMA_ROLLUP, 0
                            , NULL, NULL
                            #if defined(DEBUG) && defined(PER_THREAD_STATS)
                            , NULL, NULL
@@ -717,13 +1206,43 @@ void rollup(void * args timestamp_sig) {
 
     /* can attempt to roll up */
     if (dst) {
-        /* check if rollup is allowed */
-        ds->score = can_rollup(dir, ds, dst timestamp_args);
+        int changed = 1;
+        int prev_score = 0;
+        const int packed = is_packed(dir->data.name);
+        if (in.incremental) {
+            changed = modified(dir, dbname);
+            get_rollupscore(dbname, dst, &prev_score);
+
+            /* the plan changed for this directory */
+            if (in.rollup_budget && !packed && ((prev_score > 0) != dir->planned)) {
+                changed = 1;
+            }
+        }
+
+        if (packed) {
+            /* the database is the only copy of the subtree, so only unrollup can undo it */
+            get_rollupscore(dbname, dst, &ds->score);
+            get_nondirs(dir->data.name, dst, &ds->subnondir_count);
+        }
+        else if (!changed) {
+            /* nothing under this directory changed, so keep the previous result */
+            ds->score = prev_score;
+            get_nondirs(dir->data.name, dst, &ds->subnondir_count);
+        }
+        else {
+            /* roll up data is stale */
+            if ((prev_score > 0) && !in.dry_run) {
+                unrollupdb(dir->data.name, dst);
+            }
+
+            /* check if rollup is allowed */
+            ds->score = can_rollup(dir, ds, dst timestamp_args);
+        }
 
         /* if can roll up */
         if (ds->score > 0) {
             /* do the roll up */
-            if (in.dry_run) {
+            if (in.dry_run || !changed || packed) {
                 ds->success = 1;
             }
             else {
@@ -736,6 +1255,10 @@ void rollup(void * args timestamp_sig) {
             /* root directory will always remain */
             if (!dir->data.parent) {
                 stats[id].remaining++;
+
+                if (dir->rolledup && in.index_threshold && !in.dry_run) {
+                    index_pentries(dir->data.name, dst);
+                }
             }
         }
         else if (ds->score == 0) {
@@ -753,6 +1276,15 @@ void rollup(void * args timestamp_sig) {
                     stats[id].remaining++;
                 }
             }
+
+            index_rolled_up_children(dir);
+        }
+
+        /* the parent copied from (or could have copied from) this directory */
+        dir->changed = changed && ((prev_score > 0) || dir->rolledup);
+
+        if (!in.dry_run) {
+            update_catalog(dir->data.name, dst);
         }
     }
     else {
@@ -760,6 +1292,10 @@ void rollup(void * args timestamp_sig) {
         sll_push(&stats[id].not_processed, ds);
 
         stats[id].remaining++;
+
+        dir->changed = 1;
+
+        index_rolled_up_children(dir);
     }
 
     closedb(dst);
@@ -775,7 +1311,7 @@ int main(int argc, char * argv[]) {
 
     timestamp_start_raw(runtime);
 
-    int idx = parse_cmd_line(argc, argv, "hHn:L:X", 1, "GUFI_index ...", &in);
+    int idx = parse_cmd_line(argc, argv, "hHn:L:XUC:Q:", 1, "GUFI_index ...", &in);
     if (in.helped)
         sub_help();
     if (idx < 0)
@@ -794,6 +1330,7 @@ int main(int argc, char * argv[]) {
         sll_init(&stats[i].not_processed);
         sll_init(&stats[i].not_rolled_up);
         sll_init(&stats[i].rolled_up);
+        sll_init(&stats[i].candidates);
         stats[i].remaining = 0;
     }
 
@@ -809,10 +1346,37 @@ int main(int argc, char * argv[]) {
     argv += idx;
     argc -= idx;
 
+    /* rollupscores are updated in place */
+    if (!in.dry_run) {
+        catalogs = calloc(argc, sizeof(struct catalog));
+        catalog_count = argc;
+        for(int i = 0; i < argc; i++) {
+            catalog_open(&catalogs[i], argv[i], 1);
+        }
+    }
+
+    /* find the subtrees to roll up before rolling up */
+    if (in.rollup_budget) {
+        parallel_bottomup(argv, argc,
+                          in.maxthreads,
+                          sizeof(struct RollUp),
+                          NULL, plan_rollup,
+                          0,
+                          0,
+                          stats
+                          #if defined(DEBUG) && defined(PER_THREAD_STATS)
+                          , timestamp_buffers
+                          #endif
+            );
+
+        make_plan(stats, in.maxthreads);
+    }
+
     const int rc = parallel_bottomup(argv, argc,
                                      in.maxthreads,
                                      sizeof(struct RollUp),
-                                     NULL, rollup,
+                                     rollup_descend, rollup,
+                                     0,
                                      0,
                                      stats
                                      #if defined(DEBUG) && defined(PER_THREAD_STATS)
@@ -830,6 +1394,17 @@ int main(int argc, char * argv[]) {
 
     #endif
 
+    if (!in.dry_run) {
+        for(int i = 0; i < argc; i++) {
+            touch_marker(argv[i]);
+        }
+    }
+
+    for(int i = 0; i < catalog_count; i++) {
+        catalog_close(&catalogs[i]);
+    }
+    free(catalogs);
+
     print_stats(argv, argc, stats, in.maxthreads);
 
     for(int i = 0; i < in.maxthreads; i++) {
@@ -839,9 +1414,12 @@ int main(int argc, char * argv[]) {
         sll_destroy(&stats[i].rolled_up, 0);
         sll_destroy(&stats[i].not_rolled_up, 0);
         sll_destroy(&stats[i].not_processed, 0);
+        sll_destroy(&stats[i].candidates, 0);
     }
     free(stats);
 
+    destroy_plan();
+
     timestamp_set_end_raw(runtime);
     fprintf(stderr, "Took %.2Lf seconds\n", sec(nsec(&runtime)));
 
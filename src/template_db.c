@@ -66,6 +66,7 @@ OF SUCH DAMAGE.
 #include <fcntl.h>
 #include <sqlite3.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -77,7 +78,7 @@ OF SUCH DAMAGE.
 
 #include <copyfile.h>
 
-static ssize_t gufi_copyfd(int src_fd, int dst_fd, size_t size) {
+ssize_t gufi_copyfd(int src_fd, int dst_fd, size_t size) {
     (void) size;
     lseek(src_fd, 0, SEEK_SET);
     return fcopyfile(src_fd, dst_fd, 0, COPYFILE_DATA);
@@ -85,9 +86,43 @@ static ssize_t gufi_copyfd(int src_fd, int dst_fd, size_t size) {
 
 #else
 
+#include <linux/fs.h>
+#include <sys/ioctl.h>
 #include <sys/sendfile.h>
+#include <sys/syscall.h>
+
+/*
+ * try the cheapest copy first:
+ *     1. reflink (shares extents - no data is copied)
+ *     2. copy_file_range (copy happens in the kernel/filesystem/server)
+ *     3. sendfile
+ */
+ssize_t gufi_copyfd(int src_fd, int dst_fd, size_t size) {
+    #ifdef FICLONE
+    if (ioctl(dst_fd, FICLONE, src_fd) == 0) {
+        return size;
+    }
+    #endif
+
+    #ifdef SYS_copy_file_range
+    loff_t src_off = 0;
+    loff_t dst_off = 0;
+    size_t copied = 0;
+    while (copied < size) {
+        const ssize_t rc = syscall(SYS_copy_file_range, src_fd, &src_off, dst_fd, &dst_off, size - copied, 0);
+        if (rc < 1) {
+            break;
+        }
+        copied += rc;
+    }
+
+    if (copied == size) {
+        return size;
+    }
+
+    /* partial copies are redone from the start with sendfile */
+    #endif
 
-static ssize_t gufi_copyfd(int src_fd, int dst_fd, size_t size) {
     off_t offset = 0;
     return sendfile(dst_fd, src_fd, &offset, size);
 }
@@ -112,7 +147,7 @@ static int create_tables(const char *name, sqlite3 *db, void *args) {
 off_t create_template(int *fd) {
     static const char name[] = "tmp.db";
 
-    sqlite3 *db = opendb(name, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, 0, 0
+    sqlite3 *db = opendb(name, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, PRAGMA_BUILD, 0
                           , create_tables, NULL
                           #if defined(DEBUG) && defined(PER_THREAD_STATS)
                           , NULL, NULL
@@ -138,7 +173,7 @@ off_t create_template(int *fd) {
 int copy_template(const int src_fd, const char *dst, off_t size, uid_t uid, gid_t gid) {
     // ignore errors here
     const int src_db = dup(src_fd);
-    const int dst_db = open(dst, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
+    const int dst_db = open(dst, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
     const ssize_t sf = gufi_copyfd(src_db, dst_db, size);
     fchown(dst_db, uid, gid);
     close(src_db);
@@ -151,3 +186,115 @@ int copy_template(const int src_fd, const char *dst, off_t size, uid_t uid, gid_
 
     return 0;
 }
+
+// read the template file into memory so that databases can be built without touching the filesystem
+void *load_template_image(const int fd, const off_t size) {
+    unsigned char *image = malloc(size);
+    if (!image) {
+        fprintf(stderr, "Could not allocate space for the template image\n");
+        return NULL;
+    }
+
+    off_t got = 0;
+    while (got < size) {
+        const ssize_t rc = pread(fd, image + got, size - got, got);
+        if (rc < 1) {
+            fprintf(stderr, "Could not read template file: %s (%d)\n", strerror(errno), errno);
+            free(image);
+            return NULL;
+        }
+        got += rc;
+    }
+
+    return image;
+}
+
+// create an in-memory database containing a copy of the template image
+sqlite3 *template_to_memdb(const void *image, const off_t size) {
+    sqlite3 *db = opendb(":memory:", SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, PRAGMA_NONE, 0
+                         , NULL, NULL
+                         #if defined(DEBUG) && defined(PER_THREAD_STATS)
+                         , NULL, NULL
+                         , NULL, NULL
+                         #endif
+                         );
+    if (!db) {
+        return NULL;
+    }
+
+    // the database takes ownership of the copy, and is allowed to grow it
+    unsigned char *copy = sqlite3_malloc64(size);
+    if (!copy) {
+        fprintf(stderr, "Could not allocate space for in-memory database\n");
+        sqlite3_close(db);
+        return NULL;
+    }
+
+    memcpy(copy, image, size);
+
+    if (sqlite3_deserialize(db, "main", copy, size, size,
+                            SQLITE_DESERIALIZE_FREEONCLOSE | SQLITE_DESERIALIZE_RESIZEABLE) != SQLITE_OK) {
+        fprintf(stderr, "Could not load template into in-memory database: %s\n", sqlite3_errmsg(db));
+        sqlite3_close(db);
+        return NULL;
+    }
+
+    // ignore errors
+    set_db_pragmas(db, PRAGMA_BUILD);
+
+    return db;
+}
+
+// write an in-memory database to a file with a single write
+// the ownership and permissions are set too
+int memdb_to_file(sqlite3 *db, const char *dst, uid_t uid, gid_t gid) {
+    // the in-memory database is contiguous, so no copy is needed
+    sqlite3_int64 size = 0;
+    unsigned char *image = sqlite3_serialize(db, "main", &size, SQLITE_SERIALIZE_NOCOPY);
+    if (!image) {
+        fprintf(stderr, "Could not serialize database for %s\n", dst);
+        return -1;
+    }
+
+    return write_image(image, size, dst, uid, gid);
+}
+
+// write a serialized database to a file
+// the ownership and permissions are set too
+// if the write fails, the partially written file is removed
+int write_image(const void *image, const size_t size, const char *dst, uid_t uid, gid_t gid) {
+    const int fd = open(dst, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
+    if (fd < 0) {
+        fprintf(stderr, "Could not open %s: %s (%d)\n", dst, strerror(errno), errno);
+        return -1;
+    }
+
+    size_t written = 0;
+    while (written < size) {
+        const ssize_t rc = write(fd, ((const char *) image) + written, size - written);
+        if (rc < 0) {
+            const int err = errno;
+            if (err == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Could not write %s: %s (%d)\n", dst, strerror(err), err);
+            close(fd);
+            unlink(dst);
+            return -1;
+        }
+        written += rc;
+    }
+
+    // ignore errors here
+    fchown(fd, uid, gid);
+
+    // a truncated database is worse than none
+    if (close(fd) != 0) {
+        const int err = errno;
+        fprintf(stderr, "Could not write %s: %s (%d)\n", dst, strerror(err), err);
+        unlink(dst);
+        return -1;
+    }
+
+    return 0;
+}
@@ -63,6 +63,7 @@ OF SUCH DAMAGE.
 
 
 #include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -70,44 +71,197 @@ OF SUCH DAMAGE.
 #include <unistd.h>
 
 #include "bf.h"
+#include "catalog.h"
+#include "columns.h"
 #include "dbutils.h"
 #include "debug.h"
 #include "QueuePerThreadPool.h"
+#include "template_db.h"
 #include "utils.h"
 
 extern int errno;
 
+#define BATCH_ATTACH_NAME "unroll"
+
 struct Unrollup {
     char name[MAXPATH];
-    int rolledup; /* set by parent, can be modified by self */
 };
 
-int get_rolled_up(void * args, int count, char ** data, char ** columns) {
-    if ((count == 1) && (data[0][1] == '\0')) {
-        int * rolledup = (int *) args;
-        *rolledup = (data[0][0] == '1');
+/* rolled up directories under a directory that was rolled up */
+struct Batch {
+    size_t count;
+    char names[][MAXPATH];
+};
+
+/* same as unrollupdb, but for a database attached as %s */
+static const char unrollup_attached[] =
+    "DROP TABLE %s.pentries;"
+    "CREATE VIEW %s.pentries AS SELECT entries.*, summary.inode AS pinode FROM entries, summary WHERE rectype = 0;"
+    "DELETE FROM %s.summary WHERE isroot <> 1;"
+    "UPDATE %s.summary SET rollupscore = 0 WHERE isroot == 1;";
+
+/*
+ * unroll a batch of directories in a single transaction instead
+ * of opening, committing, and closing each database separately
+ */
+int processbatch(struct QPTPool * ctx, const size_t id, void * data, void * args) {
+    struct Batch * batch = (struct Batch *) data;
+    int rc = 0;
+
+    sqlite3 * db = opendb(":memory:", SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, PRAGMA_NONE, 0
+                          , NULL, NULL
+                          #if defined(DEBUG) && defined(PER_THREAD_STATS)
+                          , NULL, NULL
+                          , NULL, NULL
+                          #endif
+        );
+    if (!db) {
+        free(batch);
+        return 1;
+    }
+
+    /* databases cannot be attached inside of a transaction */
+    size_t attached = 0;
+    for(attached = 0; attached < batch->count; attached++) {
+        char dbname[MAXPATH];
+        SNPRINTF(dbname, MAXPATH, "%s/" DBNAME, batch->names[attached]);
+
+        char alias[MAXSQL];
+        SNPRINTF(alias, MAXSQL, BATCH_ATTACH_NAME "%zu", attached);
+
+        if (!attachdb(dbname, db, alias, SQLITE_OPEN_READWRITE)) {
+            rc = 1;
+            break;
+        }
+    }
+
+    /* the attached databases keep their journals - the transaction also */
+    /* modifies summary, and the batch is only atomic with a journal */
+    startdb(db);
+    for(size_t i = 0; i < attached; i++) {
+        char alias[MAXSQL];
+        SNPRINTF(alias, MAXSQL, BATCH_ATTACH_NAME "%zu", i);
+
+        char sql[MAXSQL];
+        SNPRINTF(sql, MAXSQL, unrollup_attached, alias, alias, alias, alias);
+
+        char * err = NULL;
+        if (sqlite3_exec(db, sql, NULL, NULL, &err) != SQLITE_OK) {
+            fprintf(stderr, "Could not remove roll up data from \"%s\": %s\n", batch->names[i], err);
+            rc = 1;
+        }
+        sqlite3_free(err);
+    }
+    stopdb(db);
+
+    for(size_t i = 0; i < attached; i++) {
+        char alias[MAXSQL];
+        SNPRINTF(alias, MAXSQL, BATCH_ATTACH_NAME "%zu", i);
+
+        /* same as unrollupdb */
+        #ifdef COLUMN_SIDECARS
+        columns_write(batch->names[i], db, alias);
+        #else
+        columns_remove(batch->names[i]);
+        #endif
+
+        detachdb(batch->names[i], db, alias);
+    }
+
+    closedb(db);
+    free(batch);
+
+    return rc;
+}
+
+struct Descendants {
+    struct QPTPool * ctx;
+    size_t id;
+    const char * name;
+    size_t batch_size;
+    struct Batch * batch;
+
+    /* packed directories found so far, whose subtrees are not on disk */
+    char ** packed;
+    size_t packed_count;
+};
+
+int processdir(struct QPTPool * ctx, const size_t id, void * data, void * args);
+
+static void enqueue_batch(struct Descendants * desc) {
+    if (desc->batch && desc->batch->count) {
+        QPTPool_enqueue(desc->ctx, desc->id, processbatch, desc->batch);
+    }
+    else {
+        free(desc->batch);
+    }
+    desc->batch = NULL;
+}
+
+/* group the directories listed in a rolled up summary table into batches */
+int add_descendant(void * args, int count, char ** data, char ** columns) {
+    struct Descendants * desc = (struct Descendants *) args;
+
+    char path[MAXPATH];
+    const size_t len = SNPRINTF(path, MAXPATH, "%s/%s", desc->name, data[0]);
+
+    /* only exists in the database of a packed directory, which recreates it */
+    for(size_t i = 0; i < desc->packed_count; i++) {
+        const size_t packed_len = strlen(desc->packed[i]);
+        if ((strncmp(path, desc->packed[i], packed_len) == 0) && (path[packed_len] == '/')) {
+            return 0;
+        }
+    }
+
+    /* packed directories are unpacked on their own */
+    if (is_packed(path)) {
+        desc->packed = realloc(desc->packed, (desc->packed_count + 1) * sizeof(char *));
+        desc->packed[desc->packed_count++] = strdup(path);
+
+        struct Unrollup * subdir = malloc(sizeof(struct Unrollup));
+        memcpy(subdir->name, path, len + 1);
+        QPTPool_enqueue(desc->ctx, desc->id, processdir, subdir);
         return 0;
     }
-    return 1;
+
+    if (!desc->batch) {
+        desc->batch = malloc(sizeof(struct Batch) + desc->batch_size * MAXPATH);
+        desc->batch->count = 0;
+    }
+
+    memcpy(desc->batch->names[desc->batch->count++], path, len + 1);
+
+    if (desc->batch->count == desc->batch_size) {
+        enqueue_batch(desc);
+    }
+
+    return 0;
 }
 
-int processdir(struct QPTPool * ctx, const size_t id, void * data, void * args) {
-    struct Unrollup * work = (struct Unrollup *) data;
-    char * err = NULL;
-    int rc = 0;
+/* databases of unpacked directories are copies of this */
+static pthread_once_t template_once = PTHREAD_ONCE_INIT;
+static int template_fd = -1;
+static off_t template_size = 0;
 
-    DIR * dir = opendir(work->name);
-    if (!dir) {
-        fprintf(stderr, "Error: Could not open directory \"%s\": %s", work->name, strerror(errno));
-        rc = 1;
-        goto free_work;
+static void make_template(void) {
+    template_size = create_template(&template_fd);
+    if (template_size < 0) {
+        template_fd = -1;
     }
+}
 
-    int rolledup = 0;
+/* paths of the rolled up directories relative to this one */
+static const char DESCENDANTS_SQL[] =
+    "SELECT substr(name, length((SELECT name FROM summary WHERE isroot == 1)) + 2) "
+    "FROM summary WHERE isroot <> 1";
+
+int processdir(struct QPTPool * ctx, const size_t id, void * data, void * args) {
+    struct Unrollup * work = (struct Unrollup *) data;
+    int rc = 0;
 
     char dbname[MAXPATH];
     SNPRINTF(dbname, MAXPATH, "%s/" DBNAME, work->name);
-    sqlite3 * db = opendb(dbname, SQLITE_OPEN_READWRITE, 0, 0
+    sqlite3 * db = opendb(dbname, SQLITE_OPEN_READWRITE, PRAGMA_ROLLUP, 0
                 , NULL, NULL
                 #if defined(DEBUG) && defined(PER_THREAD_STATS)
                 , NULL, NULL
@@ -115,30 +269,84 @@ int processdir(struct QPTPool * ctx, const size_t id, void * data, void * args)
                 #endif
         );
 
+    int rollupscore = 0;
     if (!db) {
         rc = 1;
     }
+    else if (get_rollupscore(work->name, db, &rollupscore) != 0) {
+        fprintf(stderr, "Error: Failed to get rollup score from \"%s\"\n", work->name);
+        rc = 1;
+    }
+
+    if (rollupscore && is_packed(work->name)) {
+        /* the subtree only exists in this database, so put it back on disk */
+        pthread_once(&template_once, make_template);
+        if ((template_fd < 0) ||
+            (unpackdb(work->name, db, template_fd, template_size) != 0)) {
+            fprintf(stderr, "Error: Could not unpack \"%s\"\n", work->name);
+            rc = 1;
+        }
+        else {
+            char marker[MAXPATH];
+            SNPRINTF(marker, MAXPATH, "%s/" PACKED_MARKER, work->name);
+            remove(marker);
+
+            if (unrollupdb(work->name, db) != 0) {
+                rc = 1;
+            }
+        }
 
-    /* get roll up status set by parent */
-    rolledup = work->rolledup;
+        closedb(db);
+        goto free_work;
+    }
 
-    /* even if the parent was not rolled up, this directory might be */
-    /* directories known to be rolled up can skip this check */
-    if (db && !work->rolledup) {
-        /* get whether or not the current directory was rolled up */
-        if (sqlite3_exec(db, "SELECT (rollupscore <> 0) FROM summary WHERE isroot == 1", get_rolled_up, &rolledup, &err) != SQLITE_OK) {
-            fprintf(stderr, "Error: Failed to get rollup score from \"%s\": %s\n", work->name, err);
+    if (rollupscore) {
+        /*
+         * every directory under a rolled up directory is also
+         * rolled up and is listed in its summary table, so the
+         * subtree does not need to be walked or checked
+         */
+        struct Descendants desc;
+        desc.ctx = ctx;
+        desc.id = id;
+        desc.name = work->name;
+        desc.batch_size = sqlite3_limit(db, SQLITE_LIMIT_ATTACHED, -1);
+        desc.batch = NULL;
+        desc.packed = NULL;
+        desc.packed_count = 0;
+
+        char * err = NULL;
+        if (sqlite3_exec(db, DESCENDANTS_SQL, add_descendant, &desc, &err) != SQLITE_OK) {
+            fprintf(stderr, "Error: Failed to get rolled up directories from \"%s\": %s\n", work->name, err);
             rc = 1;
         }
         sqlite3_free(err);
-        err = NULL;
+
+        enqueue_batch(&desc);
+
+        for(size_t i = 0; i < desc.packed_count; i++) {
+            free(desc.packed[i]);
+        }
+        free(desc.packed);
+
+        if (unrollupdb(work->name, db) != 0) {
+            rc = 1;
+        }
+
+        closedb(db);
+        goto free_work;
+    }
+
+    closedb(db);
+
+    /* this directory was not rolled up, but its children might have been */
+    DIR * dir = opendir(work->name);
+    if (!dir) {
+        fprintf(stderr, "Error: Could not open directory \"%s\": %s", work->name, strerror(errno));
+        rc = 1;
+        goto free_work;
     }
 
-    /* always descend */
-    /* if not rolled up, children might be */
-    /* if rolled up, all child also need processing */
-    /**/
-    /* descend first to keep working while cleaning up db */
     struct dirent * entry = NULL;
     while ((entry = readdir(dir))) {
         if ((strncmp(entry->d_name, ".",  2) == 0) ||
@@ -154,36 +362,11 @@ int processdir(struct QPTPool * ctx, const size_t id, void * data, void * args)
             if (S_ISDIR(st.st_mode)) {
                 struct Unrollup * subdir = malloc(sizeof(struct Unrollup));
                 memcpy(subdir->name, name, len + 1);
-
-                /* set child rolledup status so that if this dir */
-                /* was rolled up, child can skip roll up check */
-                subdir->rolledup = rolledup;
-
                 QPTPool_enqueue(ctx, id, processdir, subdir);
             }
         }
     }
 
-    /* now that work has been pushed onto the queue, clean up this db */
-    if (db && rolledup) {
-        if (sqlite3_exec(db,
-                         "BEGIN TRANSACTION;"
-                         "DROP TABLE pentries;"
-                         "CREATE VIEW pentries AS SELECT entries.*, summary.inode AS pinode FROM entries, summary WHERE rectype = 0;"
-                         "DELETE FROM summary WHERE isroot <> 1;"
-                         "UPDATE summary SET rollupscore = 0 WHERE isroot == 1;"
-                         "END TRANSACTION;",
-                         NULL,
-                         NULL,
-                         &err) != SQLITE_OK) {
-            fprintf(stderr, "Could not remove roll up data from \"%s\": %s\n", work->name, err);
-            rc = 1;
-        }
-        sqlite3_free(err);
-        err = NULL;
-    }
-
-    closedb(db);
     closedir(dir);
 
   free_work:
@@ -192,6 +375,59 @@ int processdir(struct QPTPool * ctx, const size_t id, void * data, void * args)
     return rc;
 }
 
+/*
+ * a rolled up directory contains the data of the subtree being
+ * unrolled, so unroll every ancestor that was rolled up
+ *
+ * a directory can only be rolled up if all of its children were,
+ * so stop at the first ancestor that was not rolled up
+ */
+void unroll_ancestors(const char * path) {
+    char parent[MAXPATH];
+    if (!realpath(path, parent)) {
+        return;
+    }
+
+    while (1) {
+        char * slash = strrchr(parent, '/');
+        if (!slash || (slash == parent)) {
+            break;
+        }
+        *slash = '\0';
+
+        char dbname[MAXPATH];
+        SNPRINTF(dbname, MAXPATH, "%s/" DBNAME, parent);
+
+        struct stat st;
+        if (lstat(dbname, &st) != 0) {
+            break;
+        }
+
+        sqlite3 * db = opendb(dbname, SQLITE_OPEN_READWRITE, PRAGMA_ROLLUP, 0
+                              , NULL, NULL
+                              #if defined(DEBUG) && defined(PER_THREAD_STATS)
+                              , NULL, NULL
+                              , NULL, NULL
+                              #endif
+            );
+        if (!db) {
+            break;
+        }
+
+        int rollupscore = 0;
+        get_rollupscore(parent, db, &rollupscore);
+        if (rollupscore) {
+            unrollupdb(parent, db);
+        }
+
+        closedb(db);
+
+        if (!rollupscore) {
+            break;
+        }
+    }
+}
+
 void sub_help() {
    printf("GUFI_index        GUFI index to unroll up\n");
    printf("\n");
@@ -230,7 +466,7 @@ int main(int argc, char * argv[]) {
     for(int i = idx; i < argc; i++) {
         /* remove trailing slashes */
         size_t len = strlen(argv[i]);
-        while (len && (argv[i][len] == '/')) {
+        while (len && (argv[i][len - 1] == '/')) {
             len--;
         }
 
@@ -244,9 +480,6 @@ int main(int argc, char * argv[]) {
         /* copy argv[i] into the work item */
         SNFORMAT_S(mywork->name, MAXPATH, 1, argv[i], len);
 
-        /* assume index root was not rolled up */
-        mywork->rolledup = 0;
-
         struct stat st;
         lstat(mywork->name, &st);
         if (!S_ISDIR(st.st_mode) ) {
@@ -255,6 +488,12 @@ int main(int argc, char * argv[]) {
             continue;
         }
 
+        /* the path might be a subtree of a rolled up index */
+        unroll_ancestors(mywork->name);
+
+        /* the rollupscores and directories in any catalog that has this path will change */
+        catalog_remove_all(mywork->name);
+
         /* push the path onto the queue */
         QPTPool_enqueue(pool, i % in.maxthreads, processdir, mywork);
     }
@@ -267,6 +506,10 @@ int main(int argc, char * argv[]) {
 
     QPTPool_destroy(pool);
 
+    if (template_fd > -1) {
+        close(template_fd);
+    }
+
     #ifdef DEBUG
     #ifdef PER_THREAD_STATS
     timestamp_destroy(timestamp_buffers);
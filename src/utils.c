@@ -64,6 +64,7 @@ OF SUCH DAMAGE.
 
 #include <ctype.h>              /* isprint() */
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -71,6 +72,13 @@ OF SUCH DAMAGE.
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#endif
 
 #include "config.h"
 #include "utils.h"
@@ -451,6 +459,63 @@ int tsumit (struct sum *sumin,struct sum *smout) {
   return 0;
 }
 
+/* combine the summaries of two parts of the same directory */
+int summerge (struct sum *sumin,struct sum *smout) {
+
+  /* nothing was summed into sumin */
+  if (sumin->setit == 0) {
+    return 0;
+  }
+
+  /* nothing was summed into smout */
+  if (smout->setit == 0) {
+    *smout = *sumin;
+    return 0;
+  }
+
+  smout->totfiles   += sumin->totfiles;
+  smout->totlinks   += sumin->totlinks;
+  smout->totltk     += sumin->totltk;
+  smout->totmtk     += sumin->totmtk;
+  smout->totltm     += sumin->totltm;
+  smout->totmtm     += sumin->totmtm;
+  smout->totmtg     += sumin->totmtg;
+  smout->totmtt     += sumin->totmtt;
+  smout->totsize    += sumin->totsize;
+  smout->totxattr   += sumin->totxattr;
+  smout->totossint1 += sumin->totossint1;
+  smout->totossint2 += sumin->totossint2;
+  smout->totossint3 += sumin->totossint3;
+  smout->totossint4 += sumin->totossint4;
+
+  if (sumin->minuid < smout->minuid) smout->minuid=sumin->minuid;
+  if (sumin->maxuid > smout->maxuid) smout->maxuid=sumin->maxuid;
+  if (sumin->mingid < smout->mingid) smout->mingid=sumin->mingid;
+  if (sumin->maxgid > smout->maxgid) smout->maxgid=sumin->maxgid;
+  if (sumin->minsize < smout->minsize) smout->minsize=sumin->minsize;
+  if (sumin->maxsize > smout->maxsize) smout->maxsize=sumin->maxsize;
+  if (sumin->minblocks < smout->minblocks) smout->minblocks=sumin->minblocks;
+  if (sumin->maxblocks > smout->maxblocks) smout->maxblocks=sumin->maxblocks;
+  if (sumin->minctime < smout->minctime) smout->minctime=sumin->minctime;
+  if (sumin->maxctime > smout->maxctime) smout->maxctime=sumin->maxctime;
+  if (sumin->minmtime < smout->minmtime) smout->minmtime=sumin->minmtime;
+  if (sumin->maxmtime > smout->maxmtime) smout->maxmtime=sumin->maxmtime;
+  if (sumin->minatime < smout->minatime) smout->minatime=sumin->minatime;
+  if (sumin->maxatime > smout->maxatime) smout->maxatime=sumin->maxatime;
+  if (sumin->mincrtime < smout->mincrtime) smout->mincrtime=sumin->mincrtime;
+  if (sumin->maxcrtime > smout->maxcrtime) smout->maxcrtime=sumin->maxcrtime;
+  if (sumin->minossint1 < smout->minossint1) smout->minossint1=sumin->minossint1;
+  if (sumin->maxossint1 > smout->maxossint1) smout->maxossint1=sumin->maxossint1;
+  if (sumin->minossint2 < smout->minossint2) smout->minossint2=sumin->minossint2;
+  if (sumin->maxossint2 > smout->maxossint2) smout->maxossint2=sumin->maxossint2;
+  if (sumin->minossint3 < smout->minossint3) smout->minossint3=sumin->minossint3;
+  if (sumin->maxossint3 > smout->maxossint3) smout->maxossint3=sumin->maxossint3;
+  if (sumin->minossint4 < smout->minossint4) smout->minossint4=sumin->minossint4;
+  if (sumin->maxossint4 > smout->maxossint4) smout->maxossint4=sumin->maxossint4;
+
+  return 0;
+}
+
 // given a possibly-multi-level path of directories (final component is
 // also a dir), create the parent dirs all the way down.
 //
@@ -499,6 +564,40 @@ int dupdir(char * path, struct stat * stat)
     return 0;
 }
 
+/* remove a directory and everything under it (rm -r) */
+int remove_tree(const char *path) {
+    DIR *dir = opendir(path);
+    if (!dir) {
+        return 1;
+    }
+
+    struct dirent *entry = NULL;
+    while ((entry = readdir(dir))) {
+        const size_t len = strlen(entry->d_name);
+        if (entry->d_name[0] == '.') {
+            if ((len == 1) ||
+                ((len == 2) && (entry->d_name[1] == '.'))) {
+                continue;
+            }
+        }
+
+        char child[MAXPATH];
+        SNFORMAT_S(child, MAXPATH, 3, path, strlen(path), "/", 1, entry->d_name, len);
+
+        struct stat st;
+        if ((lstat(child, &st) == 0) && S_ISDIR(st.st_mode)) {
+            remove_tree(child);
+        }
+        else {
+            unlink(child);
+        }
+    }
+
+    closedir(dir);
+
+    return rmdir(path);
+}
+
 int shortpath(const char *name, char *nameout, char *endname) {
      char prefix[MAXPATH];
      char *pp;
@@ -884,6 +983,51 @@ size_t descend(struct QPTPool *ctx, const size_t id,
     return pushed;
 }
 
+#if defined(SYS_statx) && defined(STATX_BASIC_STATS)
+void statx_to_stat(const struct statx *stx, struct stat *st) {
+    memset(st, 0, sizeof(*st));
+    st->st_dev     = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+    st->st_ino     = stx->stx_ino;
+    st->st_mode    = stx->stx_mode;
+    st->st_nlink   = stx->stx_nlink;
+    st->st_uid     = stx->stx_uid;
+    st->st_gid     = stx->stx_gid;
+    st->st_rdev    = makedev(stx->stx_rdev_major, stx->stx_rdev_minor);
+    st->st_size    = stx->stx_size;
+    st->st_blksize = stx->stx_blksize;
+    st->st_blocks  = stx->stx_blocks;
+    st->st_atim.tv_sec  = stx->stx_atime.tv_sec;
+    st->st_atim.tv_nsec = stx->stx_atime.tv_nsec;
+    st->st_mtim.tv_sec  = stx->stx_mtime.tv_sec;
+    st->st_mtim.tv_nsec = stx->stx_mtime.tv_nsec;
+    st->st_ctim.tv_sec  = stx->stx_ctime.tv_sec;
+    st->st_ctim.tv_nsec = stx->stx_ctime.tv_nsec;
+}
+
+/* set to 0 the first time the kernel says statx is not available */
+static volatile int statx_available = 1;
+#endif
+
+int lstat_at(const int dir_fd, const char *name, struct stat *st) {
+    #if defined(SYS_statx) && defined(STATX_BASIC_STATS)
+    if (statx_available) {
+        struct statx stx;
+        if (syscall(SYS_statx, dir_fd, name, AT_SYMLINK_NOFOLLOW, GUFI_STATX_MASK, &stx) == 0) {
+            statx_to_stat(&stx, st);
+            return 0;
+        }
+
+        if (errno != ENOSYS) {
+            return -1;
+        }
+
+        statx_available = 0;
+    }
+    #endif
+
+    return fstatat(dir_fd, name, st, AT_SYMLINK_NOFOLLOW);
+}
+
 /* convert a mode to a human readable string */
 char * modetostr(char * str, const size_t size, const mode_t mode)
 {
@@ -71,13 +71,15 @@ ROOT="$(dirname ${ROOT})"
 
 GUFI_DIR2INDEX="${ROOT}/src/gufi_dir2index"
 GUFI_QUERY="${ROOT}/src/gufi_query"
+BFTI="${ROOT}/src/bfti"
 
 # output directories
 SRCDIR="prefix"
 INDEXROOT="${SRCDIR}.gufi"
+OTHERROOT="${SRCDIR}.other"
 
 function cleanup {
-    rm -rf "${SRCDIR}" "${INDEXROOT}"
+    rm -rf "${SRCDIR}" "${INDEXROOT}" "${OTHERROOT}"
 }
 
 trap cleanup EXIT
@@ -144,5 +146,109 @@ do
     ) | tee -a "${OUTPUT}"
 done
 
+# update an existing index in place
+(
+    # remove preexisting indicies
+    rm -rf "${INDEXROOT}"
+
+    # generate the index and its treesummary tables
+    ${GUFI_DIR2INDEX} -U -x "${SRCDIR}" "${INDEXROOT}"
+    ${BFTI} -s "${INDEXROOT}" > /dev/null
+
+    # change the source
+    truncate -s 5000 "${SRCDIR}/directory/subdirectory/big_file"
+    rm "${SRCDIR}/directory/readonly"
+
+    # only rebuild the directories that changed
+    ${GUFI_DIR2INDEX} -U -x "${SRCDIR}" "${INDEXROOT}" 2> /dev/null
+
+    src_dirs=$(find "${SRCDIR}" -type d)
+    src_nondirs=$(find "${SRCDIR}" -not -type d)
+    src=$((echo "${src_dirs}"; echo "${src_nondirs}") | sort)
+
+    index_dirs=$(find "${INDEXROOT}" -type d | sed "s/${INDEXROOT}/${SRCDIR}/g; s/[[:space:]]*$//g")
+    index_nondirs=$(${GUFI_QUERY} -d " " -E "SELECT path(summary.name) || '/' || pentries.name FROM summary, pentries WHERE summary.inode == pentries.pinode" "${INDEXROOT}" | sed "s/${INDEXROOT}/${SRCDIR}/g; s/[[:space:]]*$//g")
+    index=$((echo "${index_dirs}"; echo "${index_nondirs}") | sort)
+
+    tsum=$(${GUFI_QUERY} -d " " -S "SELECT path(summary.name) FROM summary, sqlite_master WHERE sqlite_master.name == 'treesummary'" "${INDEXROOT}" | sed "s/${INDEXROOT}/${SRCDIR}/g; s/[[:space:]]*$//g" | sort)
+    large=$(${GUFI_QUERY} -d " " -T "SELECT 1 FROM treesummary WHERE maxsize > 4096" -E "SELECT path(summary.name) || '/' || pentries.name FROM summary, pentries WHERE (summary.inode == pentries.pinode) AND (pentries.size > 4096)" "${INDEXROOT}" | sed "s/${INDEXROOT}/${SRCDIR}/g; s/[[:space:]]*$//g" | sort)
+
+    echo "Update index:"
+    echo "    Source Directory:"
+    echo "${src}" | awk '{ printf "        " $0 "\n" }'
+    echo
+    echo "    GUFI Index:"
+    echo "${index}" | awk '{ printf "        " $0 "\n" }'
+    echo
+    echo "    Directories that still have treesummary tables:"
+    echo "${tsum}" | awk '{ printf "        " $0 "\n" }'
+    echo
+    echo "    Files larger than 4096 bytes found with -T:"
+    echo "${large}" | awk '{ printf "        " $0 "\n" }'
+    echo
+) | tee -a "${OUTPUT}"
+
+# every entry and directory summary of an index, without the index root
+function contents() {
+    ${GUFI_QUERY} -d " " \
+                  -S "SELECT 'd', path(name), mode, uid, gid, totfiles, totlinks, totsize, minsize, maxsize FROM summary" \
+                  -E "SELECT pentries.type, path(summary.name) || '/' || pentries.name, pentries.mode, pentries.uid, pentries.gid, CASE WHEN pentries.type == 'l' THEN 0 ELSE pentries.size END FROM summary, pentries WHERE summary.inode == pentries.pinode" \
+                  "$1" | sed "s/$1/index/g; s/[[:space:]]*$//g" | sort
+}
+
+# split directories with more than 2 entries across threads
+(
+    rm -rf "${INDEXROOT}" "${OTHERROOT}"
+
+    ${GUFI_DIR2INDEX} -x "${SRCDIR}" "${INDEXROOT}"
+    ${GUFI_DIR2INDEX} -n 4 -k 2 -x "${SRCDIR}" "${OTHERROOT}"
+
+    echo "Split directories:"
+    echo "    Entries in the source root: $(ls -A "${SRCDIR}" | wc -l)"
+    echo
+    echo "    GUFI Index:"
+    contents "${OTHERROOT}" | awk '{ printf "        " $0 "\n" }'
+    echo
+    echo "    Differences from an index built without -k:"
+    diff <(contents "${INDEXROOT}") <(contents "${OTHERROOT}") | awk '{ printf "        " $0 "\n" }'
+    echo
+) | tee -a "${OUTPUT}"
+
+# secondary indexes on the entries of directories with more than 2 entries
+(
+    rm -rf "${INDEXROOT}"
+
+    ${GUFI_DIR2INDEX} -Q 2 -x "${SRCDIR}" "${INDEXROOT}"
+
+    echo "Index entries of directories with more than 2 entries:"
+    ${GUFI_QUERY} -d " " -S "SELECT path(name), totfiles + totlinks, (SELECT group_concat(name, ' ') FROM (SELECT name FROM sqlite_master WHERE (type == 'index') AND (name NOT LIKE 'sqlite_%') ORDER BY name)) FROM summary WHERE isroot == 1" "${INDEXROOT}" | sed "s/${INDEXROOT}/${SRCDIR}/g; s/[[:space:]]*$//g" | sort | awk '{ printf "    " $0 "\n" }'
+    echo
+) | tee -a "${OUTPUT}"
+
+# permissions and owners of the directories and databases of an index
+function metadata() {
+    (cd "$1" && find . -exec stat -c "%n %A %u %g" {} \; | sort)
+}
+
+# hand the databases off to separate writer threads
+(
+    rm -rf "${INDEXROOT}" "${OTHERROOT}"
+
+    chown 1001:1002 "${SRCDIR}/leaf_directory"
+    chmod 750 "${SRCDIR}/leaf_directory"
+
+    ${GUFI_DIR2INDEX} -x "${SRCDIR}" "${INDEXROOT}"
+    ${GUFI_DIR2INDEX} -n 2 -q 2 -x "${SRCDIR}" "${OTHERROOT}"
+
+    echo "Writer threads:"
+    echo "    Permissions and owners:"
+    metadata "${OTHERROOT}" | awk '{ printf "        " $0 "\n" }'
+    echo
+    echo "    Differences from an index built without -q:"
+    diff <(metadata "${INDEXROOT}") <(metadata "${OTHERROOT}") | awk '{ printf "        " $0 "\n" }'
+    diff <(contents "${INDEXROOT}") <(contents "${OTHERROOT}") | awk '{ printf "        " $0 "\n" }'
+    echo
+) | tee -a "${OUTPUT}"
+
 diff ${ROOT}/test/regression/gufi_dir2index.expected "${OUTPUT}"
 rm "${OUTPUT}"
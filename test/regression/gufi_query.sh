@@ -122,6 +122,12 @@ output=$(${GUFI_QUERY} -d " " -e 0 -a -I "CREATE TABLE out(name TEXT, size INT64
 replace "${output}"
 echo
 
+echo "# Get relative paths of all directories and non-directories ascending sizes, moving aggregation databases to disk"
+replace "$ ${GUFI_QUERY} -d \" \" -e 0 -a -l 1 -I \"CREATE TABLE out(name TEXT, size INT64)\" -E \"INSERT INTO out SELECT path((SELECT name FROM summary WHERE summary.inode == pentries.pinode)) || '/' || name, size FROM pentries\" -J \"INSERT INTO aggregate.out SELECT * FROM out\" -G \"SELECT name FROM out ORDER BY size ASC, name ASC\" ${INDEXROOT}"
+output=$(TMPDIR="${PWD}" ${GUFI_QUERY} -d " " -e 0 -a -l 1 -I "CREATE TABLE out(name TEXT, size INT64)" -E "INSERT INTO out SELECT path((SELECT name FROM summary WHERE summary.inode == pentries.pinode)) || '/' || name, size FROM pentries" -J "INSERT INTO aggregate.out SELECT * FROM out" -G "SELECT name FROM out ORDER BY size ASC, name ASC" ${INDEXROOT})
+replace "${output}"
+echo
+
 echo "# Get relative paths of all directories and non-directories descending sizes"
 replace "$ ${GUFI_QUERY} -d \" \" -e 0 -a -I \"CREATE TABLE out(name TEXT, size INT64)\" -E \"INSERT INTO out SELECT path((SELECT name FROM summary WHERE summary.inode == pentries.pinode)) || '/' || name, size FROM pentries\" -J \"INSERT INTO aggregate.out SELECT * FROM out\" -G \"SELECT name FROM out ORDER BY size DESC, name DESC\" ${INDEXROOT}"
 output=$(${GUFI_QUERY} -d " " -e 0 -a -I "CREATE TABLE out(name TEXT, size INT64)" -E "INSERT INTO out SELECT path((SELECT name FROM summary WHERE summary.inode == pentries.pinode)) || '/' || name, size FROM pentries" -J "INSERT INTO aggregate.out SELECT * FROM out" -G "SELECT name FROM out ORDER BY size DESC, name DESC" ${INDEXROOT})
@@ -0,0 +1,162 @@
+#!/usr/bin/env bash
+
+# This file is part of GUFI, which is part of MarFS, which is released
+# under the BSD license.
+#
+#
+# Copyright (c) 2017, Los Alamos National Security (LANS), LLC
+# All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without modification,
+# are permitted provided that the following conditions are met:
+#
+# 1. Redistributions of source code must retain the above copyright notice, this
+# list of conditions and the following disclaimer.
+#
+# 2. Redistributions in binary form must reproduce the above copyright notice,
+# this list of conditions and the following disclaimer in the documentation and/or
+# other materials provided with the distribution.
+#
+# 3. Neither the name of the copyright holder nor the names of its contributors
+# may be used to endorse or promote products derived from this software without
+# specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+# IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+# INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+# BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+# DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+# LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+# OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+# ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#
+#
+# From Los Alamos National Security, LLC:
+# LA-CC-15-039
+#
+# Copyright (c) 2017, Los Alamos National Security, LLC All rights reserved.
+# Copyright 2017. Los Alamos National Security, LLC. This software was produced
+# under U.S. Government contract DE-AC52-06NA25396 for Los Alamos National
+# Laboratory (LANL), which is operated by Los Alamos National Security, LLC for
+# the U.S. Department of Energy. The U.S. Government has rights to use,
+# reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR LOS
+# ALAMOS NATIONAL SECURITY, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR
+# ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is
+# modified to produce derivative works, such modified software should be
+# clearly marked, so as not to confuse it with the version available from
+# LANL.
+#
+# THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND CONTRIBUTORS
+# "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+# THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+# ARE DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+# CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+# EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+# OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+# INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+# CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+# IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+# OF SUCH DAMAGE.
+set -e
+
+ROOT="$(realpath ${BASH_SOURCE[0]})"
+ROOT="$(dirname ${ROOT})"
+ROOT="$(dirname ${ROOT})"
+ROOT="$(dirname ${ROOT})"
+
+GUFI_DIR2INDEX="${ROOT}/src/gufi_dir2index"
+GUFI_QUERY="${ROOT}/src/gufi_query"
+PARALLEL_CPR="${ROOT}/src/parallel_cpr"
+
+# output directories
+SRCDIR="prefix"
+INDEXROOT="${SRCDIR}.gufi"
+COPY="${SRCDIR}.copy"
+VACUUMED="${SRCDIR}.vacuumed"
+RESUMED="${SRCDIR}.resumed"
+
+function cleanup {
+    rm -rf "${SRCDIR}" "${INDEXROOT}" "${COPY}" "${VACUUMED}" "${RESUMED}"
+}
+
+trap cleanup EXIT
+
+cleanup
+
+export LC_ALL=C
+
+OUTPUT="parallel_cpr.out"
+
+function replace() {
+    echo "$@" | sed "s/${GUFI_DIR2INDEX//\//\\/}/gufi_dir2index/g; s/${GUFI_QUERY//\//\\/}/gufi_query/g; s/${PARALLEL_CPR//\//\\/}/parallel_cpr/g; s/[[:space:]]*$//g"
+}
+
+# everything in an index tree, relative to its root
+function contents() {
+    (cd "$1" && find . | sort)
+}
+
+# metadata that a copy keeps (sizes change with -v)
+function metadata() {
+    (cd "$1" && find . -exec stat -c "%n %a %u %g %Y" {} \; | sort)
+}
+
+# paths of all entries found by querying an index
+function entries() {
+    ${GUFI_QUERY} -d " " -E "SELECT path(summary.name) || '/' || pentries.name FROM summary, pentries WHERE summary.inode == pentries.pinode" "$1" | sed "s/^$1/index/g; s/[[:space:]]*$//g" | sort
+}
+
+(
+# generate the tree and index it
+replace "$ generatetree ${SRCDIR}"
+${ROOT}/test/regression/generatetree "${SRCDIR}"
+replace "$ ${GUFI_DIR2INDEX} -x ${SRCDIR} ${INDEXROOT}"
+${GUFI_DIR2INDEX} -x "${SRCDIR}" "${INDEXROOT}"
+echo
+
+# copy the index
+replace "$ ${PARALLEL_CPR} ${INDEXROOT} ${COPY}"
+${PARALLEL_CPR} "${INDEXROOT}" "${COPY}"
+echo
+
+echo "Copy:"
+contents "${COPY}" | awk '{ printf "    " $0 "\n" }'
+echo
+
+echo "# differences in contents and metadata from the original"
+diff <(contents "${INDEXROOT}") <(contents "${COPY}") || true
+diff <(metadata "${INDEXROOT}") <(metadata "${COPY}") || true
+echo
+
+echo "# the copy is queried like the original"
+diff <(entries "${INDEXROOT}") <(entries "${COPY}") || true
+entries "${COPY}" | awk '{ printf "    " $0 "\n" }'
+echo
+
+# copy the index, vacuuming each database
+replace "$ ${PARALLEL_CPR} -v ${INDEXROOT} ${VACUUMED}"
+${PARALLEL_CPR} -v "${INDEXROOT}" "${VACUUMED}"
+echo
+
+echo "# differences in contents and query results from the original"
+diff <(contents "${INDEXROOT}") <(contents "${VACUUMED}") || true
+diff <(entries "${INDEXROOT}") <(entries "${VACUUMED}") || true
+echo
+
+# resume a copy that was interrupted after finishing two directories
+replace "$ mkdir ${RESUMED}"
+mkdir "${RESUMED}"
+replace "$ printf \"directory\\ndirectory/subdirectory\\n\" > ${RESUMED}/db.db.copy"
+printf "directory\ndirectory/subdirectory\n" > "${RESUMED}/db.db.copy"
+replace "$ ${PARALLEL_CPR} ${INDEXROOT} ${RESUMED}"
+${PARALLEL_CPR} "${INDEXROOT}" "${RESUMED}"
+echo
+
+echo "# the journaled directories are not copied again, and the journal is removed"
+diff <(contents "${INDEXROOT}") <(contents "${RESUMED}") || true
+) | tee "${OUTPUT}"
+
+diff ${ROOT}/test/regression/parallel_cpr.expected "${OUTPUT}"
+rm "${OUTPUT}"
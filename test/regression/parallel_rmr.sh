@@ -0,0 +1,148 @@
+#!/usr/bin/env bash
+
+# This file is part of GUFI, which is part of MarFS, which is released
+# under the BSD license.
+#
+#
+# Copyright (c) 2017, Los Alamos National Security (LANS), LLC
+# All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without modification,
+# are permitted provided that the following conditions are met:
+#
+# 1. Redistributions of source code must retain the above copyright notice, this
+# list of conditions and the following disclaimer.
+#
+# 2. Redistributions in binary form must reproduce the above copyright notice,
+# this list of conditions and the following disclaimer in the documentation and/or
+# other materials provided with the distribution.
+#
+# 3. Neither the name of the copyright holder nor the names of its contributors
+# may be used to endorse or promote products derived from this software without
+# specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+# IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+# INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+# BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+# DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+# LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+# OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+# ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#
+#
+# From Los Alamos National Security, LLC:
+# LA-CC-15-039
+#
+# Copyright (c) 2017, Los Alamos National Security, LLC All rights reserved.
+# Copyright 2017. Los Alamos National Security, LLC. This software was produced
+# under U.S. Government contract DE-AC52-06NA25396 for Los Alamos National
+# Laboratory (LANL), which is operated by Los Alamos National Security, LLC for
+# the U.S. Department of Energy. The U.S. Government has rights to use,
+# reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR LOS
+# ALAMOS NATIONAL SECURITY, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR
+# ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is
+# modified to produce derivative works, such modified software should be
+# clearly marked, so as not to confuse it with the version available from
+# LANL.
+#
+# THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND CONTRIBUTORS
+# "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+# THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+# ARE DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+# CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+# EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+# OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+# INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+# CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+set -e
+
+ROOT="$(realpath ${BASH_SOURCE[0]})"
+ROOT="$(dirname ${ROOT})"
+ROOT="$(dirname ${ROOT})"
+ROOT="$(dirname ${ROOT})"
+
+GUFI_DIR2INDEX="${ROOT}/src/gufi_dir2index"
+BFTI="${ROOT}/src/bfti"
+PARALLEL_RMR="${ROOT}/src/parallel_rmr"
+
+# output directories
+SRCDIR="prefix"
+INDEXROOT="${SRCDIR}.gufi"
+REMOVE="${SRCDIR}.remove"
+DEEP="deep"
+
+function cleanup {
+    rm -rf "${SRCDIR}" "${INDEXROOT}" "${REMOVE}" "${DEEP}"
+}
+
+trap cleanup EXIT
+
+cleanup
+
+export LC_ALL=C
+
+OUTPUT="parallel_rmr.out"
+
+function replace() {
+    echo "$@" | sed "s/${GUFI_DIR2INDEX//\//\\/}/gufi_dir2index/g; s/${BFTI//\//\\/}/bfti/g; s/${PARALLEL_RMR//\//\\/}/parallel_rmr/g; s/[[:space:]]*$//g"
+}
+
+# a directory tree that is deeper than the regression tree
+function generatedeep() {
+    dir="$1"
+    for level in $(seq 1 100)
+    do
+        mkdir -p "${dir}/sibling"
+        touch "${dir}/file1" "${dir}/file2"
+        dir="${dir}/level"
+    done
+    mkdir "${dir}"
+}
+
+function exists() {
+    if [[ -e "$1" ]]
+    then
+        echo "$1 exists"
+    else
+        echo "$1 does not exist"
+    fi
+}
+
+(
+# generate the tree and index it
+replace "$ generatetree ${SRCDIR}"
+${ROOT}/test/regression/generatetree "${SRCDIR}"
+replace "$ ${GUFI_DIR2INDEX} -x ${SRCDIR} ${INDEXROOT}"
+${GUFI_DIR2INDEX} -x "${SRCDIR}" "${INDEXROOT}"
+echo
+
+# a memory limit of 1 byte walks every directory depth first
+echo "# the tree summary does not depend on the memory limit"
+for threads in 1 4
+do
+    replace "$ ${BFTI} -n ${threads} -l 1 -s ${INDEXROOT}"
+    # run one at a time - both write the tree summary into the same databases
+    unlimited=$(${BFTI} -s "${INDEXROOT}")
+    limited=$(${BFTI} -n "${threads}" -l 1 -s "${INDEXROOT}")
+    diff <(echo "${unlimited}") <(echo "${limited}") || true
+done
+${BFTI} -s "${INDEXROOT}" | grep -E "^(totfiles|totsize|totsubdirs)"
+echo
+
+for threads in 1 4
+do
+    cp -a "${SRCDIR}" "${REMOVE}"
+    generatedeep "${DEEP}"
+    replace "$ ${PARALLEL_RMR} -n ${threads} -l 1 ${REMOVE} ${DEEP}"
+    ${PARALLEL_RMR} -n "${threads}" -l 1 "${REMOVE}" "${DEEP}"
+    exists "${REMOVE}"
+    exists "${DEEP}"
+    echo
+done
+) | tee "${OUTPUT}"
+
+diff ${ROOT}/test/regression/parallel_rmr.expected "${OUTPUT}"
+rm "${OUTPUT}"
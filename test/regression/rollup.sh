@@ -78,13 +78,15 @@ GUFI_STATS="${ROOT}/test/regression/gufi_stats.py"
 TMP="tmp"
 SRCDIR="prefix"
 INDEXROOT="${SRCDIR}.gufi"
+BUDGETROOT="${SRCDIR}.budget"
+INDEXEDROOT="${SRCDIR}.indexed"
 
 source ${ROOT}/test/regression/setup.sh "${ROOT}" "${SRCDIR}" "${INDEXROOT}"
 
 OUTPUT="rollup.out"
 
 function cleanup() {
-    rm -rf "${TMP}" "${SRCDIR}" "${INDEXROOT}"
+    rm -rf "${TMP}" "${SRCDIR}" "${INDEXROOT}" "${BUDGETROOT}" "${INDEXEDROOT}"
 }
 
 # trap cleanup EXIT
@@ -92,7 +94,7 @@ function cleanup() {
 cleanup
 
 function replace() {
-    echo "$@" | sed "s/[[:space:]]*$//g; s/${GUFI_QUERY//\//\\/}/gufi_query/g; s/${GUFI_FIND//\//\\/}/gufi_find/g; s/${GUFI_LS//\//\\/}/gufi_ls/g; s/${GUFI_STATS//\//\\/}/gufi_stats/g; s/${INDEXROOT//\//\\/}\\//prefix.gufi\\//g; s/\\/${SRCDIR//\//\\/}/./g;"
+    echo "$@" | sed "s/[[:space:]]*$//g; s/${GUFI_DIR2INDEX//\//\\/}/gufi_dir2index/g; s/${ROLLUP//\//\\/}/rollup/g; s/${GUFI_QUERY//\//\\/}/gufi_query/g; s/${GUFI_FIND//\//\\/}/gufi_find/g; s/${GUFI_LS//\//\\/}/gufi_ls/g; s/${GUFI_STATS//\//\\/}/gufi_stats/g; s/${INDEXROOT//\//\\/}\\//prefix.gufi\\//g; s/\\/${SRCDIR//\//\\/}/./g;"
 }
 
 function run() {
@@ -252,6 +254,95 @@ run "${GUFI_STATS} -r dircount"
 
 run "${GUFI_STATS}    total-dircount"
 run "${GUFI_STATS} -c total-dircount"
+
+# databases written by the most recent roll up
+function modified_count() {
+    find "${INDEXROOT}" -name "db.db" -newer "${TMP}" | wc -l
+}
+
+echo "# nothing changed, so no databases are written"
+touch "${TMP}"
+replace "$ ${ROLLUP} -U ${INDEXROOT}"
+${ROLLUP} -U ${INDEXROOT} > /dev/null
+modified_count
+echo
+
+# gufi_dir2index -U always rebuilds rolled up directories, unrolling them
+replace "$ touch ${SRCDIR}/ugo/ugo/dir1/file2"
+touch ${SRCDIR}/ugo/ugo/dir1/file2
+replace "$ ${GUFI_DIR2INDEX} -U ${SRCDIR} ${INDEXROOT}"
+${GUFI_DIR2INDEX} -U ${SRCDIR} ${INDEXROOT} 2> /dev/null
+echo
+
+echo "# the rebuilt directories and their parents are rolled up again"
+touch "${TMP}"
+replace "$ ${ROLLUP} -U ${INDEXROOT}"
+${ROLLUP} -U ${INDEXROOT} > /dev/null
+modified_count
+echo
+
+replace "$ ${GUFI_QUERY} -d \" \" -S \"SELECT path(name), rollupscore FROM summary WHERE isroot == 1\" \"${INDEXROOT}\" | sort"
+replace "$(${GUFI_QUERY} -d " " -S "SELECT path(name), rollupscore FROM summary WHERE isroot == 1" "${INDEXROOT}" | sort)"
+echo
+
+echo "# the new file is found through its rolled up ancestors"
+replace "$ ${GUFI_QUERY} -d \" \" -E \"SELECT path(summary.name) || '/' || pentries.name from summary, pentries WHERE summary.inode == pentries.pinode\" \"${INDEXROOT}\" | wc -l"
+${GUFI_QUERY} -d " " -E "SELECT path(summary.name) || '/' || pentries.name from summary, pentries WHERE summary.inode == pentries.pinode" "${INDEXROOT}" | wc -l
+echo
+
+replace "$ ${GUFI_QUERY} -d \" \" -E \"SELECT path(summary.name) || '/' || pentries.name from summary, pentries WHERE summary.inode == pentries.pinode\" \"${INDEXROOT}/ugo/ugo\" | sort"
+replace "$(${GUFI_QUERY} -d " " -E "SELECT path(summary.name) || '/' || pentries.name from summary, pentries WHERE summary.inode == pentries.pinode" "${INDEXROOT}/ugo/ugo" | sort)"
+echo
+
+echo "# running again right away does not write anything"
+touch "${TMP}"
+replace "$ ${ROLLUP} -U ${INDEXROOT}"
+${ROLLUP} -U ${INDEXROOT} > /dev/null
+modified_count
+echo
+
+# roll up a second index with a storage budget
+${GUFI_DIR2INDEX} ${SRCDIR} ${BUDGETROOT}
+
+echo "# the plan lists the highest subtrees that fit in the budget"
+replace "$ ${ROLLUP} -X -C 20 ${BUDGETROOT} | sed -n '/^Plan:/,\$p'"
+${ROLLUP} -X -C 20 ${BUDGETROOT} | sed -n '/^Plan:/,$p'
+echo
+
+replace "$ ${ROLLUP} -C 20 ${BUDGETROOT} | sed -n '/^Plan:/,\$p'"
+${ROLLUP} -C 20 ${BUDGETROOT} | sed -n '/^Plan:/,$p'
+echo
+
+echo "# only the chosen subtrees are rolled up"
+replace "$ ${GUFI_QUERY} -d \" \" -S \"SELECT path(name), rollupscore FROM summary WHERE isroot == 1 AND rollupscore != 0\" \"${BUDGETROOT}\" | sort"
+replace "$(${GUFI_QUERY} -d " " -S "SELECT path(name), rollupscore FROM summary WHERE isroot == 1 AND rollupscore != 0" "${BUDGETROOT}" | sort)"
+echo
+
+echo "# and the same files are found"
+replace "$ ${GUFI_QUERY} -d \" \" -E \"SELECT path(summary.name) || '/' || pentries.name from summary, pentries WHERE summary.inode == pentries.pinode\" \"${BUDGETROOT}\" | wc -l"
+${GUFI_QUERY} -d " " -E "SELECT path(summary.name) || '/' || pentries.name from summary, pentries WHERE summary.inode == pentries.pinode" "${BUDGETROOT}" | wc -l
+echo
+
+# roll up a third index with secondary indexes on tables with more than 2 rows
+replace "$ ${GUFI_DIR2INDEX} -Q 2 ${SRCDIR} ${INDEXEDROOT}"
+${GUFI_DIR2INDEX} -Q 2 ${SRCDIR} ${INDEXEDROOT}
+replace "$ ${ROLLUP} -Q 2 ${INDEXEDROOT}"
+${ROLLUP} -Q 2 ${INDEXEDROOT} > /dev/null
+echo
+
+echo "# pentries are indexed in the highest rolled up directories with more than 2 rows"
+query="SELECT path(name), rollupscore, (SELECT COUNT(*) FROM pentries), (SELECT group_concat(name, ' ') FROM (SELECT name FROM sqlite_master WHERE (type == 'index') AND (tbl_name == 'pentries') ORDER BY name)) FROM summary WHERE isroot == 1"
+replace "$ ${GUFI_QUERY} -d \" \" -S \"${query}\" \"${INDEXEDROOT}\" | sort"
+replace "$(${GUFI_QUERY} -d " " -S "${query}" "${INDEXEDROOT}" | sort)"
+echo
+
+echo "# directories under them keep only the entries indexes from gufi_dir2index"
+query="SELECT path(name), (SELECT COUNT(*) FROM entries), (SELECT group_concat(name, ' ') FROM (SELECT name FROM sqlite_master WHERE (type == 'index') AND (name NOT LIKE 'sqlite_%') ORDER BY name)) FROM summary WHERE isroot == 1"
+for dir in ugo/ugo ugo/ugo/dir1 ugo/ugo/dir3
+do
+    replace "$ ${GUFI_QUERY} -d \" \" -S \"${query}\" \"${INDEXEDROOT}/${dir}\""
+    replace "$(${GUFI_QUERY} -d " " -S "${query}" "${INDEXEDROOT}/${dir}")"
+done
 ) | tee "${OUTPUT}"
 
 diff ${ROOT}/test/regression/rollup.expected "${OUTPUT}"
@@ -71,6 +71,7 @@ ROOT="$(dirname ${ROOT})"
 GUFI_DIR2INDEX="${ROOT}/src/gufi_dir2index"
 ROLLUP="${ROOT}/src/rollup"
 UNROLLUP="${ROOT}/src/unrollup"
+GUFI_PACK="${ROOT}/src/gufi_pack"
 GUFI_QUERY="${ROOT}/src/gufi_query"
 
 TMP="tmp"
@@ -108,7 +109,7 @@ then
 fi
 
 function replace() {
-    echo "$@" | sed "s/[[:space:]]*$//g; s/${GUFI_DIR2INDEX//\//\\/}/gufi_dir2index/g; s/${ROLLUP//\//\\/}/rollup/g; s/${UNROLLUP//\//\\/}/unrollup/g; s/${GUFI_QUERY//\//\\/}/gufi_query/g; s/${INDEXROOT//\//\\/}\\//prefix.gufi\\//g; s/\\/${SRCDIR//\//\\/}/./g;"
+    echo "$@" | sed "s/[[:space:]]*$//g; s/${GUFI_DIR2INDEX//\//\\/}/gufi_dir2index/g; s/${ROLLUP//\//\\/}/rollup/g; s/${UNROLLUP//\//\\/}/unrollup/g; s/${GUFI_PACK//\//\\/}/gufi_pack/g; s/${GUFI_QUERY//\//\\/}/gufi_query/g; s/${INDEXROOT//\//\\/}\\//prefix.gufi\\//g; s/\\/${SRCDIR//\//\\/}/./g;"
 }
 
 function run() {
@@ -217,6 +218,69 @@ replace "$ ${GUFI_QUERY} -d \" \" -S \"SELECT (SELECT COUNT(*) FROM entries), (S
 output=$(${GUFI_QUERY} -d " " -S "SELECT (SELECT COUNT(*) FROM entries), (SELECT COUNT(*) FROM pentries), (SELECT type FROM sqlite_master where name == 'pentries'), path(name) AS fullpath FROM summary ORDER BY fullpath ASC" ${INDEXROOT} | sort -k4 -k3)
 replace "${output}"
 echo
+
+# roll up the index again
+${ROLLUP} ${INDEXROOT} > /dev/null
+
+# unroll up a subtree - its rolled up ancestors contain its entries, so they are unrolled too
+run ${UNROLLUP} ${INDEXROOT}/ugo/ugo
+
+echo "# ugo/ugo, its subdirectories, and its rolled up parent ugo are unrolled - the other subtrees are still rolled up"
+replace "$ ${GUFI_QUERY} -d \" \" -S \"SELECT (SELECT COUNT(*) FROM entries), (SELECT COUNT(*) FROM pentries), (SELECT type FROM sqlite_master where name == 'pentries'), rollupscore, path(name) AS fullpath FROM summary WHERE isroot == 1 ORDER BY fullpath ASC\" ${INDEXROOT} | sort -k5"
+output=$(${GUFI_QUERY} -d " " -S "SELECT (SELECT COUNT(*) FROM entries), (SELECT COUNT(*) FROM pentries), (SELECT type FROM sqlite_master where name == 'pentries'), rollupscore, path(name) AS fullpath FROM summary WHERE isroot == 1 ORDER BY fullpath ASC" ${INDEXROOT} | sort -k5)
+replace "${output}"
+echo
+
+echo "# every file is still found"
+replace "$ ${GUFI_QUERY} -d \" \" -E \"SELECT path(summary.name) || '/' || pentries.name FROM summary, pentries WHERE summary.inode == pentries.pinode\" ${INDEXROOT} | wc -l"
+${GUFI_QUERY} -d " " -E "SELECT path(summary.name) || '/' || pentries.name FROM summary, pentries WHERE summary.inode == pentries.pinode" ${INDEXROOT} | wc -l
+echo
+
+# roll up ugo again and pack the rolled up subtrees
+${ROLLUP} -U ${INDEXROOT} > /dev/null
+run ${GUFI_PACK} ${INDEXROOT}
+
+echo "# the highest rolled up directories are packed and their subdirectories are gone"
+replace "$ find ${INDEXROOT} -name db.db.packed | sort"
+replace "$(find ${INDEXROOT} -name db.db.packed | sort)"
+echo
+replace "$ find ${INDEXROOT} -type d | wc -l"
+find ${INDEXROOT} -type d | wc -l
+echo
+
+echo "# every file is still found"
+replace "$ ${GUFI_QUERY} -d \" \" -E \"SELECT path(summary.name) || '/' || pentries.name FROM summary, pentries WHERE summary.inode == pentries.pinode\" ${INDEXROOT} | wc -l"
+${GUFI_QUERY} -d " " -E "SELECT path(summary.name) || '/' || pentries.name FROM summary, pentries WHERE summary.inode == pentries.pinode" ${INDEXROOT} | wc -l
+echo
+
+# unpack and unroll up the index
+run ${UNROLLUP} ${INDEXROOT}
+
+echo "# the directories and their databases are back and nothing is rolled up"
+replace "$ find ${INDEXROOT} -name db.db.packed | wc -l"
+find ${INDEXROOT} -name db.db.packed | wc -l
+echo
+replace "$ ${GUFI_QUERY} -d \" \" -S \"SELECT (SELECT COUNT(*) FROM entries), (SELECT COUNT(*) FROM pentries), (SELECT type FROM sqlite_master where name == 'pentries'), rollupscore, path(name) AS fullpath FROM summary WHERE isroot == 1 ORDER BY fullpath ASC\" ${INDEXROOT} | sort -k5"
+output=$(${GUFI_QUERY} -d " " -S "SELECT (SELECT COUNT(*) FROM entries), (SELECT COUNT(*) FROM pentries), (SELECT type FROM sqlite_master where name == 'pentries'), rollupscore, path(name) AS fullpath FROM summary WHERE isroot == 1 ORDER BY fullpath ASC" ${INDEXROOT} | sort -k5)
+replace "${output}"
+echo
+
+# packed directories rebuilt from the source tree are not packed anymore
+${ROLLUP} -U ${INDEXROOT} > /dev/null
+${GUFI_PACK} ${INDEXROOT} > /dev/null
+run ${GUFI_DIR2INDEX} -U ${SRCDIR} ${INDEXROOT}
+
+echo "# gufi_dir2index -U rebuilds packed directories with all of their subdirectories"
+replace "$ find ${INDEXROOT} -name db.db.packed | wc -l"
+find ${INDEXROOT} -name db.db.packed | wc -l
+echo
+replace "$ find ${INDEXROOT} -type d | wc -l"
+find ${INDEXROOT} -type d | wc -l
+echo
+
+echo "# so they can be rolled up and packed again"
+${ROLLUP} -U ${INDEXROOT} > /dev/null
+run ${GUFI_PACK} ${INDEXROOT}
 ) | tee "${OUTPUT}"
 
 diff ${ROOT}/test/regression/unrollup.expected "${OUTPUT}"
@@ -0,0 +1,283 @@
+/*
+This file is part of GUFI, which is part of MarFS, which is released
+under the BSD license.
+
+
+Copyright (c) 2017, Los Alamos National Security (LANS), LLC
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+From Los Alamos National Security, LLC:
+LA-CC-15-039
+
+Copyright (c) 2017, Los Alamos National Security, LLC All rights reserved.
+Copyright 2017. Los Alamos National Security, LLC. This software was produced
+under U.S. Government contract DE-AC52-06NA25396 for Los Alamos National
+Laboratory (LANL), which is operated by Los Alamos National Security, LLC for
+the U.S. Department of Energy. The U.S. Government has rights to use,
+reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR LOS
+ALAMOS NATIONAL SECURITY, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR
+ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is
+modified to produce derivative works, such modified software should be
+clearly marked, so as not to confuse it with the version available from
+LANL.
+
+THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+extern "C" {
+
+#include "BottomUp.h"
+#include "bf.h"
+
+}
+
+/* how deep the chain of directories goes */
+static const size_t DEPTH = 200;
+
+struct counts {
+    size_t descended;
+    size_t ascended;
+    size_t nondirs;
+    size_t out_of_order;
+    size_t repeated;
+};
+
+struct Dir {
+    struct BottomUp bu;
+    int ascended;
+};
+
+#if defined(DEBUG) && defined(PER_THREAD_STATS)
+#define PARALLEL_BOTTOMUP(roots, count, threads, descend, ascend, max_memory, extra) \
+    parallel_bottomup(roots, count, threads, sizeof(struct Dir), descend, ascend, 1, max_memory, extra, nullptr)
+#else
+#define PARALLEL_BOTTOMUP(roots, count, threads, descend, ascend, max_memory, extra) \
+    parallel_bottomup(roots, count, threads, sizeof(struct Dir), descend, ascend, 1, max_memory, extra)
+#endif
+
+/*
+ * root/
+ *     file
+ *     gone/
+ *     level/
+ *         file
+ *         sibling/
+ *         level/
+ *             ...
+ */
+static size_t build(const std::string &root) {
+    size_t dirs = 2;
+
+    std::string dir = root;
+    EXPECT_EQ(mkdir((dir + "/gone").c_str(), S_IRWXU), 0);
+    for(size_t i = 0; i < DEPTH; i++) {
+        FILE *file = fopen((dir + "/file").c_str(), "w");
+        EXPECT_NE(file, nullptr);
+        fclose(file);
+
+        EXPECT_EQ(mkdir((dir + "/sibling").c_str(), S_IRWXU), 0);
+        dir += "/level";
+        EXPECT_EQ(mkdir(dir.c_str(), S_IRWXU), 0);
+        dirs += 2;
+    }
+
+    return dirs;
+}
+
+/* remove a subdirectory after it was found, so that it cannot be opened */
+static void remove_gone(void *data timestamp_sig) {
+    struct BottomUp *bu = (struct BottomUp *) data;
+    struct counts *counts = (struct counts *) bu->extra_args;
+
+    __atomic_add_fetch(&counts->descended, 1, __ATOMIC_RELAXED);
+
+    if (bu->level == 0) {
+        rmdir((std::string(bu->name) + "/gone").c_str());
+    }
+}
+
+/* remove a directory the same way parallel_rmr does */
+static void remove_dir(void *data timestamp_sig) {
+    struct Dir *dir = (struct Dir *) data;
+    struct counts *counts = (struct counts *) dir->bu.extra_args;
+
+    /* every subdirectory that could be opened already went up */
+    sll_loop(&dir->bu.subdirs, node) {
+        struct Dir *child = (struct Dir *) sll_node_data(node);
+        if (!child->ascended && (strcmp(child->bu.name + child->bu.name_len - 5, "/gone") != 0)) {
+            __atomic_add_fetch(&counts->out_of_order, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    BottomUp_nondir_loop(&dir->bu, name) {
+        EXPECT_STREQ(name, "file");
+        EXPECT_EQ(unlink((std::string(dir->bu.name) + "/" + name).c_str()), 0);
+        __atomic_add_fetch(&counts->nondirs, 1, __ATOMIC_RELAXED);
+    }
+
+    EXPECT_EQ(rmdir(dir->bu.name), 0);
+
+    if (dir->ascended) {
+        __atomic_add_fetch(&counts->repeated, 1, __ATOMIC_RELAXED);
+    }
+    dir->ascended = 1;
+    __atomic_add_fetch(&counts->ascended, 1, __ATOMIC_RELAXED);
+}
+
+static void remove_tree(const size_t threads, const size_t max_memory) {
+    char root[] = "BottomUpXXXXXX";
+    ASSERT_NE(mkdtemp(root), nullptr);
+
+    const size_t dirs = build(root);
+
+    struct counts counts;
+    memset(&counts, 0, sizeof(counts));
+
+    in.maxthreads = threads;
+    char *roots[] = {root};
+    EXPECT_EQ(PARALLEL_BOTTOMUP(roots, 1, threads, remove_gone, remove_dir, max_memory, &counts), 0);
+
+    /* the directory that could not be opened is skipped, but its parent still went up */
+    EXPECT_EQ(counts.descended, dirs - 1);
+    EXPECT_EQ(counts.ascended,  dirs - 1);
+    EXPECT_EQ(counts.nondirs,   DEPTH);
+    EXPECT_EQ(counts.out_of_order, (size_t) 0);
+    EXPECT_EQ(counts.repeated, (size_t) 0);
+
+    struct stat st;
+    EXPECT_NE(lstat(root, &st), 0);
+}
+
+/*
+ * root/
+ *     file
+ *     0/
+ *         file
+ *         0/
+ *             file
+ *         ...
+ *         15/
+ *     ...
+ *     63/
+ */
+static size_t build_wide(const std::string &root, const size_t width, const size_t fanout) {
+    size_t dirs = 1;
+
+    FILE *file = fopen((root + "/file").c_str(), "w");
+    EXPECT_NE(file, nullptr);
+    fclose(file);
+
+    for(size_t i = 0; i < width; i++) {
+        const std::string child = root + "/" + std::to_string(i);
+        EXPECT_EQ(mkdir(child.c_str(), S_IRWXU), 0);
+        file = fopen((child + "/file").c_str(), "w");
+        EXPECT_NE(file, nullptr);
+        fclose(file);
+        dirs++;
+
+        for(size_t j = 0; j < fanout; j++) {
+            const std::string grandchild = child + "/" + std::to_string(j);
+            EXPECT_EQ(mkdir(grandchild.c_str(), S_IRWXU), 0);
+            file = fopen((grandchild + "/file").c_str(), "w");
+            EXPECT_NE(file, nullptr);
+            fclose(file);
+            dirs++;
+        }
+    }
+
+    return dirs;
+}
+
+/* count directories without touching the filesystem */
+static void count_descent(void *data timestamp_sig) {
+    struct BottomUp *bu = (struct BottomUp *) data;
+    struct counts *counts = (struct counts *) bu->extra_args;
+    __atomic_add_fetch(&counts->descended, 1, __ATOMIC_RELAXED);
+}
+
+/* every directory goes up exactly once, after all of its subdirectories */
+TEST(BottomUp, many_threads_wide_tree) {
+    const size_t width  = 64;
+    const size_t fanout = 16;
+    const size_t threads = 32;
+
+    for(size_t max_memory : {(size_t) 0, (size_t) 1}) {
+        for(int run = 0; run < 5; run++) {
+            char root[] = "BottomUpXXXXXX";
+            ASSERT_NE(mkdtemp(root), nullptr);
+
+            const size_t dirs = build_wide(root, width, fanout);
+
+            struct counts counts;
+            memset(&counts, 0, sizeof(counts));
+
+            in.maxthreads = threads;
+            char *roots[] = {root};
+            EXPECT_EQ(PARALLEL_BOTTOMUP(roots, 1, threads, count_descent, remove_dir, max_memory, &counts), 0);
+
+            EXPECT_EQ(counts.descended, dirs);
+            EXPECT_EQ(counts.ascended,  dirs);
+            EXPECT_EQ(counts.nondirs,   dirs);
+            EXPECT_EQ(counts.out_of_order, (size_t) 0);
+            EXPECT_EQ(counts.repeated, (size_t) 0);
+
+            struct stat st;
+            EXPECT_NE(lstat(root, &st), 0);
+        }
+    }
+}
+
+TEST(BottomUp, unlimited) {
+    remove_tree(1, 0);
+    remove_tree(4, 0);
+}
+
+/* walk depth first in each thread instead of enqueuing subdirectories */
+TEST(BottomUp, memory_limit) {
+    remove_tree(1, 1);
+    remove_tree(4, 1);
+}
@@ -62,6 +62,8 @@ OF SUCH DAMAGE.
 
 
 
+#include <string>
+
 #include <gtest/gtest.h>
 
 
@@ -185,3 +187,94 @@ TEST(OutputBuffers, use) {
     EXPECT_NO_THROW(OutputBuffers_destroy(&obufs));
     EXPECT_EQ(pthread_mutex_destroy(&mutex), 0);
 }
+
+static std::string read_all(FILE *file) {
+    std::string contents;
+    char buf[4096];
+    rewind(file);
+    size_t len = 0;
+    while ((len = fread(buf, sizeof(char), sizeof(buf), file))) {
+        contents.append(buf, len);
+    }
+    return contents;
+}
+
+TEST(OutputWriter, handoff) {
+    const std::size_t buffer_count = 3;
+    struct OutputBuffers obufs;
+    ASSERT_EQ(OutputBuffers_init(&obufs, buffer_count, LEN, nullptr), &obufs);
+    EXPECT_EQ(obufs.writer, nullptr);
+
+    // buffers 0 and 1 share a file
+    FILE *shared = tmpfile();
+    FILE *own = tmpfile();
+    ASSERT_NE(shared, nullptr);
+    ASSERT_NE(own, nullptr);
+    FILE *files[] = {shared, shared, own};
+
+    // already buffered by the FILE
+    fprintf(shared, "first");
+
+    struct OutputWriter writer;
+    ASSERT_EQ(OutputWriter_start(&writer, &obufs, files), &writer);
+    EXPECT_EQ(obufs.writer, &writer);
+
+    const std::size_t rounds = 100;
+    for(std::size_t i = 0; i < rounds; i++) {
+        for(std::size_t j = 0; j < buffer_count; j++) {
+            ASSERT_EQ(OutputBuffer_write(&obufs.buffers[j], STR, LEN, 1), LEN);
+            OutputWriter_handoff(&writer, j);
+
+            // the thread always has an empty buffer of the same size to fill
+            EXPECT_EQ(obufs.buffers[j].filled, (std::size_t) 0);
+            EXPECT_EQ(obufs.buffers[j].capacity, LEN);
+        }
+    }
+
+    // left in the buffers until stopping
+    ASSERT_EQ(OutputBuffer_write(&obufs.buffers[2], STR, LEN, 1), LEN);
+
+    EXPECT_EQ(OutputWriter_stop(&writer), 0);
+    EXPECT_EQ(obufs.writer, nullptr);
+
+    for(std::size_t j = 0; j < buffer_count; j++) {
+        EXPECT_EQ(obufs.buffers[j].filled, (std::size_t) 0);
+    }
+    EXPECT_EQ(obufs.buffers[0].count, rounds);
+    EXPECT_EQ(obufs.buffers[2].count, rounds + 1);
+
+    std::string expected_shared = "first";
+    for(std::size_t i = 0; i < 2 * rounds; i++) {
+        expected_shared += STR;
+    }
+
+    std::string expected_own;
+    for(std::size_t i = 0; i < rounds + 1; i++) {
+        expected_own += STR;
+    }
+
+    EXPECT_EQ(read_all(shared), expected_shared);
+    EXPECT_EQ(read_all(own), expected_own);
+
+    fclose(own);
+    fclose(shared);
+
+    OutputBuffers_destroy(&obufs);
+}
+
+TEST(OutputWriter, bad_file) {
+    struct OutputBuffers obufs;
+    ASSERT_EQ(OutputBuffers_init(&obufs, 1, LEN, nullptr), &obufs);
+
+    // no file descriptor
+    char buf[4096];
+    FILE *file = fmemopen(buf, sizeof(buf), "w");
+    ASSERT_NE(file, nullptr);
+
+    struct OutputWriter writer;
+    EXPECT_EQ(OutputWriter_start(&writer, &obufs, &file), nullptr);
+    EXPECT_EQ(obufs.writer, nullptr);
+
+    fclose(file);
+    OutputBuffers_destroy(&obufs);
+}
@@ -565,3 +565,40 @@ TEST(INSTALL_UINT, too_big) {
     EXPECT_EQ(retval, -1);
     EXPECT_EQ(src, dst);
 }
+
+TEST(parse_cmd_line, write_threads) {
+    const char opts[] = "Mq:";
+    const std::string exec = "exec";
+    const std::string M = "-M";
+    const std::string q = "-q"; const std::string q_arg = "2";
+
+    // -M by itself does not start writer threads
+    {
+        const char *argv[] = {
+            exec.c_str(),
+            M.c_str(),
+        };
+
+        int argc = sizeof(argv) / sizeof(argv[0]);
+
+        struct input in;
+        ASSERT_EQ(parse_cmd_line(argc, (char **) argv, opts, 0, "", &in), argc);
+        EXPECT_EQ(in.build_in_memory, 1);
+        EXPECT_EQ(in.write_threads,   0);
+    }
+
+    // -q implies -M
+    {
+        const char *argv[] = {
+            exec.c_str(),
+            q.c_str(), q_arg.c_str(),
+        };
+
+        int argc = sizeof(argv) / sizeof(argv[0]);
+
+        struct input in;
+        ASSERT_EQ(parse_cmd_line(argc, (char **) argv, opts, 0, "", &in), argc);
+        EXPECT_EQ(in.build_in_memory, 1);
+        EXPECT_EQ(in.write_threads,   2);
+    }
+}
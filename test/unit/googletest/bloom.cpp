@@ -0,0 +1,187 @@
+/*
+This file is part of GUFI, which is part of MarFS, which is released
+under the BSD license.
+
+
+Copyright (c) 2017, Los Alamos National Security (LANS), LLC
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+From Los Alamos National Security, LLC:
+LA-CC-15-039
+
+Copyright (c) 2017, Los Alamos National Security, LLC All rights reserved.
+Copyright 2017. Los Alamos National Security, LLC. This software was produced
+under U.S. Government contract DE-AC52-06NA25396 for Los Alamos National
+Laboratory (LANL), which is operated by Los Alamos National Security, LLC for
+the U.S. Department of Energy. The U.S. Government has rights to use,
+reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR LOS
+ALAMOS NATIONAL SECURITY, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR
+ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is
+modified to produce derivative works, such modified software should be
+clearly marked, so as not to confuse it with the version available from
+LANL.
+
+THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+
+
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "bloom.h"
+
+static bool may_contain(const void *blob, const std::size_t len, const std::string &key) {
+    return bloom_may_contain(blob, len, key.c_str(), key.size());
+}
+
+TEST(bloom, empty) {
+    struct bloom bloom;
+    bloom_init(&bloom);
+
+    std::size_t len = 0;
+    void *blob = bloom_serialize(&bloom, &len);
+    ASSERT_NE(blob, nullptr);
+    EXPECT_EQ(len, (std::size_t) 1);
+
+    EXPECT_FALSE(may_contain(blob, len, "name"));
+
+    free(blob);
+    bloom_destroy(&bloom);
+}
+
+TEST(bloom, names_and_extensions) {
+    struct bloom bloom;
+    bloom_init(&bloom);
+
+    const std::string names[] = {"file.h5", "archive.tar.gz", ".bashrc", "no_extension", "trailing."};
+    for(std::string const &name : names) {
+        bloom_add_name(&bloom, name.c_str(), name.size());
+    }
+
+    std::size_t len = 0;
+    void *blob = bloom_serialize(&bloom, &len);
+    ASSERT_NE(blob, nullptr);
+
+    for(std::string const &name : names) {
+        EXPECT_TRUE(may_contain(blob, len, name));
+    }
+
+    EXPECT_TRUE(may_contain(blob, len, BLOOM_EXT_PREFIX "h5"));
+    EXPECT_TRUE(may_contain(blob, len, BLOOM_EXT_PREFIX "gz"));
+
+    /* a leading dot is not an extension */
+    EXPECT_FALSE(may_contain(blob, len, BLOOM_EXT_PREFIX "bashrc"));
+
+    EXPECT_FALSE(may_contain(blob, len, "file.h6"));
+    EXPECT_FALSE(may_contain(blob, len, BLOOM_EXT_PREFIX "tar"));
+
+    free(blob);
+    bloom_destroy(&bloom);
+}
+
+/* enough names to switch to the bitmap */
+TEST(bloom, dense) {
+    const std::size_t count = BLOOM_BITS / 16;
+
+    struct bloom bloom;
+    bloom_init(&bloom);
+    for(std::size_t i = 0; i < count; i++) {
+        const std::string name = "name" + std::to_string(i);
+        bloom_add(&bloom, name.c_str(), name.size());
+    }
+
+    std::size_t len = 0;
+    void *blob = bloom_serialize(&bloom, &len);
+    ASSERT_NE(blob, nullptr);
+    EXPECT_EQ(len, (std::size_t) BLOOM_BITS / 8 + 1);
+
+    for(std::size_t i = 0; i < count; i++) {
+        EXPECT_TRUE(may_contain(blob, len, "name" + std::to_string(i)));
+    }
+
+    /* ~3 bits per name in 16 bits per name */
+    std::size_t false_positives = 0;
+    for(std::size_t i = 0; i < count; i++) {
+        false_positives += may_contain(blob, len, "other" + std::to_string(i));
+    }
+    EXPECT_LT(false_positives, count / 20);
+
+    free(blob);
+    bloom_destroy(&bloom);
+}
+
+TEST(bloom, merge) {
+    struct bloom lhs;
+    bloom_init(&lhs);
+    bloom_add(&lhs, "lhs", 3);
+
+    struct bloom rhs;
+    bloom_init(&rhs);
+    bloom_add(&rhs, "rhs", 3);
+
+    std::size_t rhs_len = 0;
+    void *rhs_blob = bloom_serialize(&rhs, &rhs_len);
+    EXPECT_EQ(bloom_merge(&lhs, rhs_blob, rhs_len), 0);
+
+    struct bloom copy;
+    bloom_init(&copy);
+    bloom_union(&copy, &lhs);
+
+    std::size_t len = 0;
+    void *blob = bloom_serialize(&copy, &len);
+    EXPECT_TRUE(may_contain(blob, len, "lhs"));
+    EXPECT_TRUE(may_contain(blob, len, "rhs"));
+    EXPECT_FALSE(may_contain(blob, len, "neither"));
+
+    /* bad filters might contain anything */
+    const char bad[] = "x";
+    EXPECT_NE(bloom_merge(&copy, bad, sizeof(bad)), 0);
+    EXPECT_TRUE(may_contain(bad, sizeof(bad), "neither"));
+    EXPECT_TRUE(may_contain(nullptr, 0, "neither"));
+
+    free(blob);
+    free(rhs_blob);
+    bloom_destroy(&copy);
+    bloom_destroy(&rhs);
+    bloom_destroy(&lhs);
+}
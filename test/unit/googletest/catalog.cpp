@@ -0,0 +1,199 @@
+/*
+This file is part of GUFI, which is part of MarFS, which is released
+under the BSD license.
+
+
+Copyright (c) 2017, Los Alamos National Security (LANS), LLC
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+From Los Alamos National Security, LLC:
+LA-CC-15-039
+
+Copyright (c) 2017, Los Alamos National Security, LLC All rights reserved.
+Copyright 2017. Los Alamos National Security, LLC. This software was produced
+under U.S. Government contract DE-AC52-06NA25396 for Los Alamos National
+Laboratory (LANL), which is operated by Los Alamos National Security, LLC for
+the U.S. Department of Energy. The U.S. Government has rights to use,
+reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR LOS
+ALAMOS NATIONAL SECURITY, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR
+ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is
+modified to produce derivative works, such modified software should be
+clearly marked, so as not to confuse it with the version available from
+LANL.
+
+THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+
+
+
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+extern "C" {
+
+#include "catalog.h"
+
+}
+
+static const char *relative[] = {"a/b/c", "z", "a-b", "", "a", "a/b"};
+
+static void build(const std::string &root) {
+    struct catalog_builder builder;
+    catalog_builder_init(&builder, root.c_str());
+
+    for(const char *rel : relative) {
+        const std::string path = std::string(rel).size()?(root + "/" + rel):root;
+
+        struct sum tsum;
+        zeroit(&tsum);
+        tsum.totfiles = std::string(rel).size();
+        tsum.maxsize = 10 * tsum.totfiles;
+
+        /* "z" does not have a treesummary table */
+        EXPECT_EQ(catalog_builder_add(&builder, path.c_str(), (int) std::string(rel).size(),
+                                      strcmp(rel, "z")?&tsum:nullptr), 0);
+    }
+
+    EXPECT_EQ(catalog_builder_write(&builder), 0);
+    catalog_builder_destroy(&builder);
+}
+
+TEST(catalog, build_and_find) {
+    char root[] = "catalogXXXXXX";
+    ASSERT_NE(mkdtemp(root), nullptr);
+
+    build(root);
+
+    struct catalog catalog;
+    ASSERT_EQ(catalog_open(&catalog, root, 0), 0);
+    ASSERT_EQ(catalog.count, (uint64_t) 6);
+
+    /* depth first, with "a-b" after the subtree of "a" */
+    const char *names[] = {"", "a", "b", "c", "a-b", "z"};
+    const uint64_t parents[] = {0, 0, 1, 2, 0, 0};
+    const uint64_t ends[] = {6, 4, 4, 4, 5, 6};
+    for(uint64_t i = 0; i < catalog.count; i++) {
+        const struct catalog_record *record = &catalog.records[i];
+        EXPECT_STREQ(catalog.names + record->name, names[i]);
+        EXPECT_EQ(record->name_len, strlen(names[i]));
+        EXPECT_EQ(record->parent, parents[i]);
+        EXPECT_EQ(record->end, ends[i]);
+    }
+
+    EXPECT_EQ(catalog_find(&catalog, ""), (uint64_t) 0);
+    EXPECT_EQ(catalog_find(&catalog, "a"), (uint64_t) 1);
+    EXPECT_EQ(catalog_find(&catalog, "a/b/c"), (uint64_t) 3);
+    EXPECT_EQ(catalog_find(&catalog, "/a//b/"), (uint64_t) 2);
+    EXPECT_EQ(catalog_find(&catalog, "a-b"), (uint64_t) 4);
+    EXPECT_EQ(catalog_find(&catalog, "b"), catalog.count);
+    EXPECT_EQ(catalog_find(&catalog, "a/c"), catalog.count);
+
+    const std::string full = std::string(root) + "/a/b";
+    EXPECT_EQ(catalog_find_path(&catalog, full.c_str()), (uint64_t) 2);
+    EXPECT_EQ(catalog_find_path(&catalog, root), (uint64_t) 0);
+    EXPECT_EQ(catalog_find_path(&catalog, "elsewhere/a"), catalog.count);
+
+    const struct catalog_record *abc = &catalog.records[3];
+    EXPECT_EQ(abc->rollupscore, 5);
+    EXPECT_EQ(abc->has_tsum, 1);
+    EXPECT_EQ(abc->tsum.totfiles, 5);
+    EXPECT_EQ(abc->tsum.maxsize, 50);
+    EXPECT_EQ(catalog.records[5].has_tsum, 0);
+
+    catalog_close(&catalog);
+
+    EXPECT_EQ(catalog_remove(root), 0);
+    EXPECT_NE(catalog_open(&catalog, root, 0), 0);
+    EXPECT_EQ(rmdir(root), 0);
+}
+
+TEST(catalog, apply_delta) {
+    struct catalog_record record;
+    memset(&record, 0, sizeof(record));
+    record.tsum.totfiles = 10;
+    record.tsum.minsize = 5;
+    record.tsum.maxsize = 50;
+
+    struct sum delta;
+    zeroit(&delta);
+    delta.totfiles = -2;
+    delta.minsize = 1;
+    delta.maxsize = 20;
+
+    catalog_apply_delta(&record, &delta);
+    EXPECT_EQ(record.tsum.totfiles, 8);
+    EXPECT_EQ(record.tsum.minsize, 1);
+    EXPECT_EQ(record.tsum.maxsize, 50);
+}
+
+TEST(catalog, db) {
+    sqlite3 *db = nullptr;
+    ASSERT_EQ(sqlite3_open(":memory:", &db), SQLITE_OK);
+
+    sqlite3_stmt *load = nullptr;
+    ASSERT_EQ(catalog_db_init(db, &load), 0);
+
+    EXPECT_EQ(catalog_db_can_run(db, "SELECT totfiles FROM treesummary WHERE maxsize > 0;"), 1);
+    EXPECT_EQ(catalog_db_can_run(db, "SELECT 1; SELECT maxmtime FROM treesummary;"), 1);
+    EXPECT_EQ(catalog_db_can_run(db, "SELECT totossint1 FROM treesummary;"), 0);
+    EXPECT_EQ(catalog_db_can_run(db, "SELECT * FROM summary;"), 0);
+    EXPECT_EQ(catalog_db_can_run(db, "DELETE FROM treesummary;"), 0);
+
+    struct catalog_record record;
+    memset(&record, 0, sizeof(record));
+    for(int64_t totfiles : {1, 2}) {
+        record.tsum.totfiles = totfiles;
+        EXPECT_EQ(catalog_db_load(load, &record), 0);
+
+        sqlite3_stmt *stmt = nullptr;
+        ASSERT_EQ(sqlite3_prepare_v2(db, "SELECT COUNT(*), SUM(totfiles) FROM treesummary;", -1, &stmt, nullptr), SQLITE_OK);
+        ASSERT_EQ(sqlite3_step(stmt), SQLITE_ROW);
+        EXPECT_EQ(sqlite3_column_int64(stmt, 0), 1);
+        EXPECT_EQ(sqlite3_column_int64(stmt, 1), totfiles);
+        sqlite3_finalize(stmt);
+    }
+
+    sqlite3_finalize(load);
+    sqlite3_close(db);
+}
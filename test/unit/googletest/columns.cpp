@@ -0,0 +1,251 @@
+/*
+This file is part of GUFI, which is part of MarFS, which is released
+under the BSD license.
+
+
+Copyright (c) 2017, Los Alamos National Security (LANS), LLC
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+From Los Alamos National Security, LLC:
+LA-CC-15-039
+
+Copyright (c) 2017, Los Alamos National Security, LLC All rights reserved.
+Copyright 2017. Los Alamos National Security, LLC. This software was produced
+under U.S. Government contract DE-AC52-06NA25396 for Los Alamos National
+Laboratory (LANL), which is operated by Los Alamos National Security, LLC for
+the U.S. Department of Energy. The U.S. Government has rights to use,
+reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR LOS
+ALAMOS NATIONAL SECURITY, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR
+ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is
+modified to produce derivative works, such modified software should be
+clearly marked, so as not to confuse it with the version available from
+LANL.
+
+THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+
+
+
+#include <climits>
+#include <cstdint>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+extern "C" {
+
+#include "columns.h"
+
+}
+
+/* not a multiple of the number of lanes */
+static const uint64_t ROWS = 1003;
+
+static std::vector<int64_t> make_column(const int64_t scale) {
+    std::vector<int64_t> column(ROWS);
+    for(uint64_t i = 0; i < ROWS; i++) {
+        column[i] = (int64_t) ((i * 7919) % 1000) * scale - 500;
+    }
+    return column;
+}
+
+TEST(columns, aggregates) {
+    const std::vector<int64_t> values = make_column(3);
+    const std::vector<int64_t> filter = make_column(1);
+
+    const int64_t ranges[][2] = {
+        {INT64_MIN, INT64_MAX},
+        {-100, 100},
+        {0, 1},
+        {10, 10},
+        {100, -100},
+        {1000, 2000},
+    };
+
+    for(const auto &range : ranges) {
+        const int64_t lo = range[0];
+        const int64_t hi = range[1];
+
+        uint64_t count = 0;
+        int64_t sum = 0;
+        int64_t min = INT64_MAX;
+        int64_t max = INT64_MIN;
+        for(uint64_t i = 0; i < ROWS; i++) {
+            if ((lo <= filter[i]) && (filter[i] < hi)) {
+                count++;
+                sum += values[i];
+                min = std::min(min, values[i]);
+                max = std::max(max, values[i]);
+            }
+        }
+
+        EXPECT_EQ(columns_count(filter.data(), ROWS, lo, hi), count);
+        EXPECT_EQ(columns_sum(values.data(), filter.data(), ROWS, lo, hi), sum);
+
+        int64_t value = 0;
+        EXPECT_EQ(columns_min(values.data(), filter.data(), ROWS, lo, hi, &value), count);
+        if (count) {
+            EXPECT_EQ(value, min);
+        }
+
+        EXPECT_EQ(columns_max(values.data(), filter.data(), ROWS, lo, hi, &value), count);
+        if (count) {
+            EXPECT_EQ(value, max);
+        }
+    }
+
+    /* no filter */
+    int64_t sum = 0;
+    for(const int64_t v : values) {
+        sum += v;
+    }
+    EXPECT_EQ(columns_count(nullptr, ROWS, 0, 0), ROWS);
+    EXPECT_EQ(columns_sum(values.data(), nullptr, ROWS, 0, 0), sum);
+
+    int64_t value = 0;
+    EXPECT_EQ(columns_min(values.data(), nullptr, ROWS, 0, 0, &value), ROWS);
+    EXPECT_EQ(value, -500);
+    EXPECT_EQ(columns_max(values.data(), nullptr, ROWS, 0, 0, &value), ROWS);
+    EXPECT_EQ(value, 2497);
+
+    /* no rows */
+    EXPECT_EQ(columns_sum(values.data(), nullptr, 0, 0, 0), 0);
+    EXPECT_EQ(columns_min(values.data(), nullptr, 0, 0, 0, &value), (uint64_t) 0);
+}
+
+TEST(columns, column_id) {
+    EXPECT_EQ(column_id("size"),   COLUMN_SIZE);
+    EXPECT_EQ(column_id("blocks"), COLUMN_BLOCKS);
+    EXPECT_EQ(column_id("name"),   -1);
+    EXPECT_EQ(column_id(nullptr),  -1);
+}
+
+static int64_t query(sqlite3 *db, const char *sql, int *type) {
+    sqlite3_stmt *stmt = nullptr;
+    EXPECT_EQ(sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr), SQLITE_OK);
+    EXPECT_EQ(sqlite3_step(stmt), SQLITE_ROW);
+    *type = sqlite3_column_type(stmt, 0);
+    const int64_t value = sqlite3_column_int64(stmt, 0);
+    sqlite3_finalize(stmt);
+    return value;
+}
+
+TEST(columns, sidecar) {
+    char dir[] = "columnsXXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+
+    sqlite3 *db = nullptr;
+    ASSERT_EQ(sqlite3_open(":memory:", &db), SQLITE_OK);
+    ASSERT_EQ(sqlite3_exec(db,
+                           "CREATE TABLE pentries(name TEXT, size INT64, uid INT64, gid INT64, mtime INT64, atime INT64, blocks INT64);"
+                           "INSERT INTO pentries VALUES ('a', 10, 1, 2, 100, 200, 1);"
+                           "INSERT INTO pentries VALUES ('b', 20, 1, 3, 300, 400, 2);"
+                           "INSERT INTO pentries VALUES ('c', 30, 2, 3, 500, 600, 3);",
+                           nullptr, nullptr, nullptr), SQLITE_OK);
+    ASSERT_EQ(addcolumnfuncs(db, 0), 0);
+
+    ASSERT_EQ(columns_write(dir, db, "main"), 0);
+
+    struct columns columns;
+    ASSERT_EQ(columns_open(&columns, dir), 0);
+    EXPECT_EQ(columns.rows, (uint64_t) 3);
+    EXPECT_EQ(columns.rollupscore, 0);
+    EXPECT_EQ(columns.values[COLUMN_SIZE][2],  30);
+    EXPECT_EQ(columns.values[COLUMN_GID][1],   3);
+    EXPECT_EQ(columns.values[COLUMN_ATIME][0], 200);
+    columns_close(&columns);
+
+    const char *sql[] = {
+        "SELECT column_count();",
+        "SELECT column_count('uid', 1, 2);",
+        "SELECT column_sum('size');",
+        "SELECT column_sum('size', 'mtime', 200, NULL);",
+        "SELECT column_min('atime', 'gid', 3, 4);",
+        "SELECT column_max('blocks', 'uid', NULL, 2);",
+        "SELECT column_max('blocks', 'uid', 5, 6);",
+    };
+    const int64_t expected[] = {3, 2, 60, 50, 400, 2, 0};
+
+    /* pentries and the sidecar give the same results */
+    for(const bool selected : {false, true}) {
+        if (selected) {
+            ASSERT_EQ(columns_select(0, dir), 0);
+            ASSERT_NE(columns_selected(0), nullptr);
+        }
+
+        for(size_t i = 0; i < sizeof(sql) / sizeof(sql[0]); i++) {
+            int type = SQLITE_NULL;
+            EXPECT_EQ(query(db, sql[i], &type), expected[i]) << sql[i];
+            EXPECT_EQ(type, (i == 6)?SQLITE_NULL:SQLITE_INTEGER) << sql[i];
+        }
+    }
+
+    /* the sidecar is used even without pentries */
+    sqlite3 *empty = nullptr;
+    ASSERT_EQ(sqlite3_open(":memory:", &empty), SQLITE_OK);
+    ASSERT_EQ(addcolumnfuncs(empty, 0), 0);
+    int type = SQLITE_NULL;
+    EXPECT_EQ(query(empty, "SELECT column_sum('size', 'gid', 3, 4);", &type), 50);
+
+    EXPECT_EQ(columns_can_run(empty, "SELECT column_sum('size'); SELECT column_count();"), 1);
+    EXPECT_EQ(columns_can_run(empty, "SELECT SUM(size) FROM pentries;"), 0);
+    EXPECT_EQ(columns_can_run(empty, "SELECT COUNT(*) FROM sqlite_master;"), 0);
+
+    columns_deselect(0);
+    EXPECT_EQ(columns_selected(0), nullptr);
+
+    /* bad arguments */
+    sqlite3_stmt *stmt = nullptr;
+    ASSERT_EQ(sqlite3_prepare_v2(db, "SELECT column_sum('name');", -1, &stmt, nullptr), SQLITE_OK);
+    EXPECT_EQ(sqlite3_step(stmt), SQLITE_ERROR);
+    sqlite3_finalize(stmt);
+
+    ASSERT_EQ(sqlite3_prepare_v2(db, "SELECT column_count('size', 1);", -1, &stmt, nullptr), SQLITE_OK);
+    EXPECT_EQ(sqlite3_step(stmt), SQLITE_ERROR);
+    sqlite3_finalize(stmt);
+
+    sqlite3_close(empty);
+    sqlite3_close(db);
+
+    EXPECT_EQ(columns_remove(dir), 0);
+    EXPECT_NE(columns_open(&columns, dir), 0);
+    EXPECT_EQ(rmdir(dir), 0);
+}
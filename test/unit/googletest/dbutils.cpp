@@ -68,11 +68,13 @@ OF SUCH DAMAGE.
 #include <grp.h>
 #include <pwd.h>
 #include <sqlite3.h>
+#include <string>
 #include <sys/types.h>
 #include <unistd.h>
 
 extern "C" {
 
+#include "bloom.h"
 #include "dbutils.h"
 
 }
@@ -415,3 +417,194 @@ TEST(addqueryfuncs, level) {
 
     sqlite3_close(db);
 }
+
+TEST(addqueryfuncs, may_contain) {
+    const char query[] = "SELECT group_concat(may_contain(name), ' ') FROM (SELECT 'file.h5' AS name UNION ALL SELECT 'file.h6' UNION ALL SELECT 'file.h5');";
+
+    sqlite3 *db = nullptr;
+    ASSERT_EQ(sqlite3_open(":memory:", &db), SQLITE_OK);
+    ASSERT_NE(db, nullptr);
+
+    // without a filter, every name might be there
+    {
+        ASSERT_EQ(addqueryfuncs(db, 0, 0, nullptr), 0);
+
+        char output[MAXPATH] = {};
+        ASSERT_EQ(sqlite3_exec(db, query, str_output, output, nullptr), SQLITE_OK);
+        EXPECT_STREQ(output, "1 1 1");
+    }
+
+    struct bloom bloom;
+    bloom_init(&bloom);
+    bloom_add_name(&bloom, "file.h5", 7);
+    size_t len = 0;
+    void *blob = bloom_serialize(&bloom, &len);
+    ASSERT_NE(blob, nullptr);
+    bloom_destroy(&bloom);
+
+    ASSERT_EQ(sqlite3_exec(db, "CREATE TABLE " NAMEFILTERS "(tree INT64 PRIMARY KEY, filter BLOB);", nullptr, nullptr, nullptr), SQLITE_OK);
+    sqlite3_stmt *stmt = nullptr;
+    ASSERT_EQ(sqlite3_prepare_v2(db, "INSERT INTO " NAMEFILTERS " VALUES (0, ?);", -1, &stmt, nullptr), SQLITE_OK);
+    ASSERT_EQ(sqlite3_bind_blob(stmt, 1, blob, len, free), SQLITE_OK);
+    ASSERT_EQ(sqlite3_step(stmt), SQLITE_DONE);
+    sqlite3_finalize(stmt);
+
+    // the filter is read once per call to addqueryfuncs
+    {
+        ASSERT_EQ(addqueryfuncs(db, 0, 0, nullptr), 0);
+
+        char output[MAXPATH] = {};
+        ASSERT_EQ(sqlite3_exec(db, query, str_output, output, nullptr), SQLITE_OK);
+        EXPECT_STREQ(output, "1 0 1");
+
+        // there is no subtree filter
+        char tree[MAXPATH] = {};
+        ASSERT_EQ(sqlite3_exec(db, "SELECT tree_may_contain('file.h6');", str_output, tree, nullptr), SQLITE_OK);
+        EXPECT_STREQ(tree, "1");
+    }
+
+    ASSERT_EQ(sqlite3_exec(db, "DELETE FROM " NAMEFILTERS ";", nullptr, nullptr, nullptr), SQLITE_OK);
+
+    {
+        char output[MAXPATH] = {};
+        ASSERT_EQ(sqlite3_exec(db, query, str_output, output, nullptr), SQLITE_OK);
+        EXPECT_STREQ(output, "1 0 1");
+    }
+
+    {
+        ASSERT_EQ(addqueryfuncs(db, 0, 0, nullptr), 0);
+
+        char output[MAXPATH] = {};
+        ASSERT_EQ(sqlite3_exec(db, query, str_output, output, nullptr), SQLITE_OK);
+        EXPECT_STREQ(output, "1 1 1");
+    }
+
+    sqlite3_close(db);
+}
+
+static int count_rows(sqlite3 *db, const char *sql) {
+    char output[MAXPATH] = {};
+    if (sqlite3_exec(db, sql, str_output, output, nullptr) != SQLITE_OK) {
+        return -1;
+    }
+    return atoi(output);
+}
+
+// entries and pentries behave the same with and without COMPACT_SCHEMA
+TEST(esql, insert_delete_select) {
+    sqlite3 *db = nullptr;
+    ASSERT_EQ(sqlite3_open(":memory:", &db), SQLITE_OK);
+    ASSERT_NE(db, nullptr);
+
+    ASSERT_EQ(sqlite3_exec(db, esql,  nullptr, nullptr, nullptr), SQLITE_OK);
+    ASSERT_EQ(sqlite3_exec(db, ssql,  nullptr, nullptr, nullptr), SQLITE_OK);
+    ASSERT_EQ(sqlite3_exec(db, vesql, nullptr, nullptr, nullptr), SQLITE_OK);
+
+    ASSERT_EQ(sqlite3_exec(db, "INSERT INTO summary (name, type, inode, rectype, isroot) VALUES ('dir', 'd', 100, 0, 1);", nullptr, nullptr, nullptr), SQLITE_OK);
+
+    // one plain file, and one link with xattrs and an OSS column
+    ASSERT_EQ(sqlite3_exec(db,
+                           "INSERT INTO entries VALUES (NULL, 'file', 'f', 1, 33188, 1, 10, 20, 1024, 4096, 8, 1, 2, 3, '', X'', 4, 0, 0, 0, 0, '', '');"
+                           "INSERT INTO entries VALUES (NULL, 'link', 'l', 2, 41471, 1, 11, 21, 4, 4096, 0, 5, 6, 7, 'file', X'61', 8, 9, 0, 0, 0, 'text', '');",
+                           nullptr, nullptr, nullptr), SQLITE_OK);
+
+    EXPECT_EQ(count_rows(db, "SELECT COUNT(*) FROM entries;"), 2);
+
+    char output[MAXPATH] = {};
+    ASSERT_EQ(sqlite3_exec(db,
+                           "SELECT group_concat(name || ' ' || type || ' ' || inode || ' ' || uid || ' ' || size || ' ' || linkname || ' ' || hex(xattrs) || ' ' || crtime || ' ' || ossint1 || ' ' || osstext1 || ' ' || pinode, ',') "
+                           "FROM (SELECT * FROM pentries ORDER BY name);",
+                           str_output, output, nullptr), SQLITE_OK);
+    EXPECT_STREQ(output, "file f 1 10 1024   4 0  100,link l 2 11 4 file 61 8 9 text 100");
+
+    #ifdef COMPACT_SCHEMA
+    // type is stored as an integer and only the link has extension columns
+    EXPECT_EQ(count_rows(db, "SELECT COUNT(*) FROM entriesc WHERE typeof(type) == 'integer';"), 2);
+    EXPECT_EQ(count_rows(db, "SELECT COUNT(*) FROM entriesext;"), 1);
+    #endif
+
+    ASSERT_EQ(sqlite3_exec(db, "DELETE FROM entries WHERE name == 'link';", nullptr, nullptr, nullptr), SQLITE_OK);
+    EXPECT_EQ(count_rows(db, "SELECT COUNT(*) FROM pentries;"), 1);
+    EXPECT_EQ(count_rows(db, "SELECT COUNT(*) FROM pentries WHERE name == 'file' AND type == 'f';"), 1);
+
+    #ifdef COMPACT_SCHEMA
+    EXPECT_EQ(count_rows(db, "SELECT COUNT(*) FROM entriesc;"), 1);
+    EXPECT_EQ(count_rows(db, "SELECT COUNT(*) FROM entriesext;"), 0);
+    #endif
+
+    sqlite3_close(db);
+}
+
+static std::string pragma(sqlite3 *db, const char *name) {
+    char output[MAXPATH] = {};
+    const std::string sql = std::string("PRAGMA ") + name + ";";
+    EXPECT_EQ(sqlite3_exec(db, sql.c_str(), str_output, output, nullptr), SQLITE_OK);
+    return output;
+}
+
+static int create_entries(const char *name, sqlite3 *db, void *) {
+    return create_table_wrapper(name, db, "esql", esql);
+}
+
+// each profile sets exactly its own PRAGMAs on a freshly opened database
+TEST(opendb, pragma_profiles) {
+    char dir[] = "pragmaXXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+
+    struct Expected {
+        enum pragma_profile profile;
+        const char *synchronous;
+        const char *journal_mode;
+        const char *page_size;
+    };
+
+    // defaults: synchronous = FULL (2), journal_mode = delete, page_size = 4096
+    const Expected expected[] = {
+        {PRAGMA_NONE,      "2", "delete", "4096"},
+        {PRAGMA_BUILD,     "0", "off",    "2048"},
+        {PRAGMA_ROLLUP,    "0", "off",    "4096"},
+        {PRAGMA_AGGREGATE, "0", "off",    "4096"},
+    };
+
+    for(const Expected &e : expected) {
+        const std::string name = std::string(dir) + "/" + std::to_string(e.profile) + ".db";
+
+        sqlite3 *db = opendb(name.c_str(), SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, e.profile, 0,
+                             create_entries, nullptr
+                             #if defined(DEBUG) && defined(PER_THREAD_STATS)
+                             , nullptr, nullptr
+                             , nullptr, nullptr
+                             #endif
+            );
+        ASSERT_NE(db, nullptr);
+
+        EXPECT_EQ(pragma(db, "synchronous"),  e.synchronous)  << e.profile;
+        EXPECT_EQ(pragma(db, "journal_mode"), e.journal_mode) << e.profile;
+        EXPECT_EQ(pragma(db, "page_size"),    e.page_size)    << e.profile;
+        EXPECT_EQ(pragma(db, "cache_size"),   "-2000")        << e.profile;
+
+        sqlite3_close(db);
+    }
+
+    // read-only opens run no PRAGMAs
+    const std::string name = std::string(dir) + "/" + std::to_string(PRAGMA_BUILD) + ".db";
+    sqlite3 *db = opendb(name.c_str(), SQLITE_OPEN_READONLY, PRAGMA_QUERY_READONLY, 0,
+                         nullptr, nullptr
+                         #if defined(DEBUG) && defined(PER_THREAD_STATS)
+                         , nullptr, nullptr
+                         , nullptr, nullptr
+                         #endif
+        );
+    ASSERT_NE(db, nullptr);
+
+    EXPECT_EQ(pragma(db, "synchronous"), "2");
+    EXPECT_EQ(pragma(db, "page_size"),   "2048");
+    EXPECT_EQ(pragma(db, "cache_size"),  "-2000");
+
+    sqlite3_close(db);
+
+    for(const Expected &e : expected) {
+        EXPECT_EQ(remove((std::string(dir) + "/" + std::to_string(e.profile) + ".db").c_str()), 0);
+    }
+    EXPECT_EQ(rmdir(dir), 0);
+}
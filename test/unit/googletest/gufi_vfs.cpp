@@ -0,0 +1,178 @@
+/*
+This file is part of GUFI, which is part of MarFS, which is released
+under the BSD license.
+
+
+Copyright (c) 2017, Los Alamos National Security (LANS), LLC
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+From Los Alamos National Security, LLC:
+LA-CC-15-039
+
+Copyright (c) 2017, Los Alamos National Security, LLC All rights reserved.
+Copyright 2017. Los Alamos National Security, LLC. This software was produced
+under U.S. Government contract DE-AC52-06NA25396 for Los Alamos National
+Laboratory (LANL), which is operated by Los Alamos National Security, LLC for
+the U.S. Department of Energy. The U.S. Government has rights to use,
+reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR LOS
+ALAMOS NATIONAL SECURITY, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR
+ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is
+modified to produce derivative works, such modified software should be
+clearly marked, so as not to confuse it with the version available from
+LANL.
+
+THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+
+
+
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <sqlite3.h>
+#include <unistd.h>
+
+extern "C" {
+
+#include "dbutils.h"
+#include "gufi_vfs.h"
+
+}
+
+static int get_int(void *args, int, char **data, char **) {
+    *static_cast <long long *> (args) = atoll(data[0]);
+    return 0;
+}
+
+/* create a database with the given number of rows of filler */
+static void create_db(const char *name, const int rows) {
+    sqlite3 *db = nullptr;
+    ASSERT_EQ(sqlite3_open(name, &db), SQLITE_OK);
+    ASSERT_EQ(sqlite3_exec(db, "CREATE TABLE t(i INT, s TEXT); BEGIN TRANSACTION;", nullptr, nullptr, nullptr), SQLITE_OK);
+    for(int i = 0; i < rows; i++) {
+        char sql[MAXSQL];
+        snprintf(sql, sizeof(sql), "INSERT INTO t VALUES (%d, printf('%%.100c', 'x'));", i);
+        ASSERT_EQ(sqlite3_exec(db, sql, nullptr, nullptr, nullptr), SQLITE_OK);
+    }
+    ASSERT_EQ(sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr), SQLITE_OK);
+    sqlite3_close(db);
+}
+
+static void check_read(const int rows) {
+    char dbname[] = "XXXXXX";
+    const int tmp = mkstemp(dbname);
+    ASSERT_GE(tmp, 0);
+    close(tmp);
+    remove(dbname);
+
+    create_db(dbname, rows);
+
+    sqlite3 *db = opendb(dbname, SQLITE_OPEN_READONLY, PRAGMA_NONE, 0,
+                         nullptr, nullptr
+                         #if defined(DEBUG) && defined(PER_THREAD_STATS)
+                         , nullptr, nullptr
+                         , nullptr, nullptr
+                         #endif
+                         );
+    ASSERT_NE(db, nullptr);
+
+    /* read-only databases go through the GUFI VFS */
+    sqlite3_vfs *vfs = nullptr;
+    ASSERT_EQ(sqlite3_file_control(db, "main", SQLITE_FCNTL_VFS_POINTER, &vfs), SQLITE_OK);
+    ASSERT_NE(vfs, nullptr);
+    EXPECT_STREQ(vfs->zName, GUFI_SQLITE_RO_VFS);
+
+    long long count = -1;
+    EXPECT_EQ(sqlite3_exec(db, "SELECT COUNT(*) FROM t", get_int, &count, nullptr), SQLITE_OK);
+    EXPECT_EQ(count, rows);
+
+    long long sum = -1;
+    EXPECT_EQ(sqlite3_exec(db, "SELECT SUM(i) FROM t", get_int, &sum, nullptr), SQLITE_OK);
+    EXPECT_EQ(sum, (long long) rows * (rows - 1) / 2);
+
+    /* writes are not allowed */
+    EXPECT_NE(sqlite3_exec(db, "INSERT INTO t VALUES (0, '')", nullptr, nullptr, nullptr), SQLITE_OK);
+
+    closedb(db);
+
+    EXPECT_EQ(remove(dbname), 0);
+}
+
+TEST(gufi_vfs, small) {
+    check_read(10);
+}
+
+TEST(gufi_vfs, larger_than_image) {
+    /* roughly 100 bytes per row */
+    check_read(2 * GUFI_VFS_MAX_IMAGE / 100);
+}
+
+TEST(gufi_vfs, attach) {
+    char dbname[] = "XXXXXX";
+    const int tmp = mkstemp(dbname);
+    ASSERT_GE(tmp, 0);
+    close(tmp);
+    remove(dbname);
+
+    create_db(dbname, 5);
+
+    sqlite3 *db = opendb(":memory:", SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, PRAGMA_NONE, 0,
+                         nullptr, nullptr
+                         #if defined(DEBUG) && defined(PER_THREAD_STATS)
+                         , nullptr, nullptr
+                         , nullptr, nullptr
+                         #endif
+                         );
+    ASSERT_NE(db, nullptr);
+    ASSERT_EQ(attachdb(dbname, db, "ro", SQLITE_OPEN_READONLY), db);
+
+    sqlite3_vfs *vfs = nullptr;
+    ASSERT_EQ(sqlite3_file_control(db, "ro", SQLITE_FCNTL_VFS_POINTER, &vfs), SQLITE_OK);
+    ASSERT_NE(vfs, nullptr);
+    EXPECT_STREQ(vfs->zName, GUFI_SQLITE_RO_VFS);
+
+    long long count = -1;
+    EXPECT_EQ(sqlite3_exec(db, "SELECT COUNT(*) FROM ro.t", get_int, &count, nullptr), SQLITE_OK);
+    EXPECT_EQ(count, 5);
+
+    detachdb(dbname, db, "ro");
+    closedb(db);
+
+    EXPECT_EQ(remove(dbname), 0);
+}
@@ -0,0 +1,151 @@
+/*
+This file is part of GUFI, which is part of MarFS, which is released
+under the BSD license.
+
+
+Copyright (c) 2017, Los Alamos National Security (LANS), LLC
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+From Los Alamos National Security, LLC:
+LA-CC-15-039
+
+Copyright (c) 2017, Los Alamos National Security, LLC All rights reserved.
+Copyright 2017. Los Alamos National Security, LLC. This software was produced
+under U.S. Government contract DE-AC52-06NA25396 for Los Alamos National
+Laboratory (LANL), which is operated by Los Alamos National Security, LLC for
+the U.S. Department of Energy. The U.S. Government has rights to use,
+reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR LOS
+ALAMOS NATIONAL SECURITY, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR
+ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is
+modified to produce derivative works, such modified software should be
+clearly marked, so as not to confuse it with the version available from
+LANL.
+
+THIS SOFTWARE IS PROVIDED BY LOS ALAMOS NATIONAL SECURITY, LLC AND CONTRIBUTORS
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL LOS ALAMOS NATIONAL SECURITY, LLC OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+
+
+
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <fcntl.h>
+#include <sqlite3.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+extern "C" {
+
+#include "dbutils.h"
+#include "template_db.h"
+
+}
+
+static int count_rows(void *args, int, char **data, char **) {
+    *static_cast <int *> (args) = atoi(data[0]);
+    return 0;
+}
+
+TEST(template_db, copy_template) {
+    int fd = -1;
+    const off_t size = create_template(&fd);
+    ASSERT_GT(size, 0);
+    ASSERT_GE(fd, 0);
+
+    char dbname[] = "XXXXXX";
+    const int tmp = mkstemp(dbname);
+    ASSERT_GE(tmp, 0);
+    close(tmp);
+
+    ASSERT_EQ(copy_template(fd, dbname, size, geteuid(), getegid()), 0);
+
+    struct stat st;
+    ASSERT_EQ(stat(dbname, &st), 0);
+    EXPECT_EQ(st.st_size, size);
+
+    sqlite3 *db = nullptr;
+    ASSERT_EQ(sqlite3_open(dbname, &db), SQLITE_OK);
+
+    int rows = -1;
+    EXPECT_EQ(sqlite3_exec(db, "SELECT COUNT(*) FROM entries", count_rows, &rows, nullptr), SQLITE_OK);
+    EXPECT_EQ(rows, 0);
+
+    sqlite3_close(db);
+
+    EXPECT_EQ(remove(dbname), 0);
+    close(fd);
+}
+
+TEST(template_db, memdb) {
+    int fd = -1;
+    const off_t size = create_template(&fd);
+    ASSERT_GT(size, 0);
+    ASSERT_GE(fd, 0);
+
+    void *image = load_template_image(fd, size);
+    ASSERT_NE(image, nullptr);
+
+    sqlite3 *memdb = template_to_memdb(image, size);
+    ASSERT_NE(memdb, nullptr);
+
+    // the in-memory database should have the schema of the template
+    ASSERT_EQ(sqlite3_exec(memdb, "INSERT INTO entries (name) VALUES ('name')", nullptr, nullptr, nullptr), SQLITE_OK);
+
+    char dbname[] = "XXXXXX";
+    const int tmp = mkstemp(dbname);
+    ASSERT_GE(tmp, 0);
+    close(tmp);
+
+    ASSERT_EQ(memdb_to_file(memdb, dbname, geteuid(), getegid()), 0);
+    sqlite3_close(memdb);
+
+    // the written file should contain the inserted row
+    sqlite3 *db = nullptr;
+    ASSERT_EQ(sqlite3_open(dbname, &db), SQLITE_OK);
+
+    int rows = -1;
+    EXPECT_EQ(sqlite3_exec(db, "SELECT COUNT(*) FROM entries WHERE name == 'name'", count_rows, &rows, nullptr), SQLITE_OK);
+    EXPECT_EQ(rows, 1);
+
+    sqlite3_close(db);
+
+    EXPECT_EQ(remove(dbname), 0);
+    free(image);
+    close(fd);
+}
@@ -66,8 +66,11 @@ OF SUCH DAMAGE.
 #include <cstdlib>
 #include <cstring>
 #include <random>
+#include <dirent.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/xattr.h>
+#include <unistd.h>
 
 #include <gtest/gtest.h>
 
@@ -460,6 +463,76 @@ TEST(summary, tsumit) {
     EXPECT_EQ(in.maxossint4, out.maxossint4);
 }
 
+TEST(summary, summerge) {
+    std::random_device rd;
+    std::mt19937 gen(rd());
+    std::uniform_int_distribution <> dist(1, INT_MAX);
+
+    // sum a set of entries all at once and in two parts
+    struct sum whole;
+    struct sum part1;
+    struct sum part2;
+    ASSERT_EQ(zeroit(&whole), 0);
+    ASSERT_EQ(zeroit(&part1), 0);
+    ASSERT_EQ(zeroit(&part2), 0);
+
+    for(int i = 0; i < 10; i++) {
+        struct work pwork;
+        memset(&pwork, 0, sizeof(pwork));
+
+        SNPRINTF(pwork.type, 2, "%s", (i & 1)?"f":"l");
+        pwork.statuso.st_uid    = dist(gen);
+        pwork.statuso.st_gid    = dist(gen);
+        pwork.statuso.st_size   = dist(gen);
+        pwork.statuso.st_ctime  = dist(gen);
+        pwork.statuso.st_mtime  = dist(gen);
+        pwork.statuso.st_atime  = dist(gen);
+        pwork.statuso.st_blocks = dist(gen);
+        pwork.crtime            = dist(gen);
+
+        ASSERT_EQ(sumit(&whole, &pwork), 0);
+        ASSERT_EQ(sumit((i < 5)?&part1:&part2, &pwork), 0);
+    }
+
+    // merging into an empty summary copies the part
+    struct sum merged;
+    ASSERT_EQ(zeroit(&merged), 0);
+    ASSERT_EQ(summerge(&part1, &merged), 0);
+    EXPECT_EQ(memcmp(&merged, &part1, sizeof(struct sum)), 0);
+
+    ASSERT_EQ(summerge(&part2, &merged), 0);
+
+    EXPECT_EQ(merged.totfiles,   whole.totfiles);
+    EXPECT_EQ(merged.totlinks,   whole.totlinks);
+    EXPECT_EQ(merged.totsize,    whole.totsize);
+    EXPECT_EQ(merged.totltk,     whole.totltk);
+    EXPECT_EQ(merged.totmtk,     whole.totmtk);
+    EXPECT_EQ(merged.totltm,     whole.totltm);
+    EXPECT_EQ(merged.totmtm,     whole.totmtm);
+    EXPECT_EQ(merged.minuid,     whole.minuid);
+    EXPECT_EQ(merged.maxuid,     whole.maxuid);
+    EXPECT_EQ(merged.mingid,     whole.mingid);
+    EXPECT_EQ(merged.maxgid,     whole.maxgid);
+    EXPECT_EQ(merged.maxsize,    whole.maxsize);
+    EXPECT_EQ(merged.maxblocks,  whole.maxblocks);
+    EXPECT_EQ(merged.minctime,   whole.minctime);
+    EXPECT_EQ(merged.maxctime,   whole.maxctime);
+    EXPECT_EQ(merged.minmtime,   whole.minmtime);
+    EXPECT_EQ(merged.maxmtime,   whole.maxmtime);
+    EXPECT_EQ(merged.minatime,   whole.minatime);
+    EXPECT_EQ(merged.maxatime,   whole.maxatime);
+    EXPECT_EQ(merged.mincrtime,  whole.mincrtime);
+    EXPECT_EQ(merged.maxcrtime,  whole.maxcrtime);
+    EXPECT_EQ(merged.setit,      1);
+
+    // merging an empty summary does nothing
+    struct sum empty;
+    ASSERT_EQ(zeroit(&empty), 0);
+    const struct sum before = merged;
+    ASSERT_EQ(summerge(&empty, &merged), 0);
+    EXPECT_EQ(memcmp(&merged, &before, sizeof(struct sum)), 0);
+}
+
 #define PATH "a/b/c/d"
 #define LAST "e"
 #define SRC PATH "/" LAST
@@ -752,6 +825,47 @@ TEST(xattrs, pullxattrs) {
     remove(name);
 }
 
+TEST(lstat_at, matches_lstat) {
+    char name[] = "XXXXXX";
+    const int fd = mkstemp(name);
+    ASSERT_NE(fd, -1);
+    ASSERT_EQ(write(fd, name, sizeof(name)), (ssize_t) sizeof(name));
+    close(fd);
+
+    char link[] = "XXXXXX.link";
+    ASSERT_EQ(symlink(name, link), 0);
+
+    DIR *dir = opendir(".");
+    ASSERT_NE(dir, nullptr);
+
+    for(const char *path : {name, link}) {
+        struct stat expected;
+        ASSERT_EQ(lstat(path, &expected), 0);
+
+        struct stat st;
+        ASSERT_EQ(lstat_at(dirfd(dir), path, &st), 0);
+
+        EXPECT_EQ(st.st_ino,    expected.st_ino);
+        EXPECT_EQ(st.st_mode,   expected.st_mode);
+        EXPECT_EQ(st.st_nlink,  expected.st_nlink);
+        EXPECT_EQ(st.st_uid,    expected.st_uid);
+        EXPECT_EQ(st.st_gid,    expected.st_gid);
+        EXPECT_EQ(st.st_size,   expected.st_size);
+        EXPECT_EQ(st.st_blocks, expected.st_blocks);
+        EXPECT_EQ(st.st_atime,  expected.st_atime);
+        EXPECT_EQ(st.st_mtime,  expected.st_mtime);
+        EXPECT_EQ(st.st_ctime,  expected.st_ctime);
+    }
+
+    struct stat st;
+    EXPECT_EQ(lstat_at(dirfd(dir), "", &st), -1);
+
+    closedir(dir);
+
+    remove(link);
+    remove(name);
+}
+
 TEST(remove_trailing, paths) {
     const char expected[] = "/a/b/c";
     const std::size_t expected_len = strlen(expected);